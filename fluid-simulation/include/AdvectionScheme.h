@@ -0,0 +1,8 @@
+#ifndef ADVECTION_SCHEME_H_
+#define ADVECTION_SCHEME_H_
+
+// Used to choose the Runge-Kutta scheme StaggeredGrid integrates particle
+// positions through the grid velocities with
+enum AdvectionScheme { FORWARD_EULER, RK2, RK3 };
+
+#endif  // ADVECTION_SCHEME_H_
@@ -1,16 +1,114 @@
 #ifndef ARRAY3D_H_
 #define ARRAY3D_H_
 
+#include <algorithm>
 #include <cassert>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Array3DArena.h"
+#include "Array3DLayout.h"
+#include "ThreadPool.h"
 
 // To disable assert*() calls, uncomment this line:
 // #define NDEBUG
 
-template <typename T>
+// Width of the cubic bricks of an Array3D with BRICKED_LAYOUT, in cells. Each
+// run of 8 consecutive k in a brick of doubles fills one 64-byte cache line,
+// and the cells a 7-point stencil reads at any cell inside a brick are in
+// that brick's 64 lines.
+const std::size_t kArray3DBrickSize = 8;
+
+// Returns |n| rounded up to a multiple of kArray3DBrickSize.
+inline std::size_t RoundUpToBrickSize(std::size_t n) {
+  return (n + kArray3DBrickSize - 1) / kArray3DBrickSize * kArray3DBrickSize;
+}
+
+// Calls |cell_fn(i, j, k, &slice_sum)| for each cell (i, j, k) of an |nx| x
+// |ny| x |nz| grid that is at least |border| cells away from its faces, with
+// slabs of consecutive i split among the threads of |pool|. |cell_fn| may add
+// to the sum of its i-slice, and the slice sums, added in order of i, are
+// returned, so the result is the same for any number of threads.
+//
+// Cells are visited in the order arrays with layout |L| store them: with
+// BRICKED_LAYOUT, each brick is swept through before the next one and slabs
+// hold whole bricks. Sums may differ between layouts in the last bits.
+template <Array3DLayout L, typename CellFn>
+inline double SweepCells(std::size_t nx, std::size_t ny, std::size_t nz,
+                         std::size_t border, ThreadPool* pool,
+                         const CellFn& cell_fn) {
+  std::vector<double> slice_sums(nx, 0.0);
+
+  if (L == LINEAR_LAYOUT) {
+    pool->ParallelFor(border, nx - border, [&](std::size_t i_begin,
+                                               std::size_t i_end) {
+      for (std::size_t i = i_begin; i < i_end; i++) {
+        double slice_sum = 0.0;
+        for (std::size_t j = border; j < ny - border; j++) {
+          for (std::size_t k = border; k < nz - border; k++) {
+            cell_fn(i, j, k, &slice_sum);
+          }
+        }
+        slice_sums[i] = slice_sum;
+      }
+    });
+  } else {
+    const std::size_t B = kArray3DBrickSize;
+    pool->ParallelFor(0, (nx + B - 1) / B, [&](std::size_t bi_begin,
+                                               std::size_t bi_end) {
+      for (std::size_t bi = bi_begin; bi < bi_end; bi++) {
+        const std::size_t i0 = bi * B;
+        const std::size_t i_begin = std::max(i0, border);
+        const std::size_t i_end = std::min(i0 + B, nx - border);
+        double brick_slice_sums[kArray3DBrickSize] = {};
+        for (std::size_t j0 = 0; j0 < ny; j0 += B) {
+          const std::size_t j_begin = std::max(j0, border);
+          const std::size_t j_end = std::min(j0 + B, ny - border);
+          for (std::size_t k0 = 0; k0 < nz; k0 += B) {
+            const std::size_t k_begin = std::max(k0, border);
+            const std::size_t k_end = std::min(k0 + B, nz - border);
+            for (std::size_t i = i_begin; i < i_end; i++) {
+              for (std::size_t j = j_begin; j < j_end; j++) {
+                for (std::size_t k = k_begin; k < k_end; k++) {
+                  cell_fn(i, j, k, &brick_slice_sums[i - i0]);
+                }
+              }
+            }
+          }
+        }
+        for (std::size_t i = i_begin; i < i_end; i++) {
+          slice_sums[i] = brick_slice_sums[i - i0];
+        }
+      }
+    });
+  }
+
+  double sum = 0.0;
+  for (std::size_t i = 0; i < nx; i++) {
+    sum += slice_sums[i];
+  }
+  return sum;
+}
+
+// A 3D array whose elements are ordered in memory by |L|. Since |L| is known at
+// compile time, the default LINEAR_LAYOUT costs nothing extra.
+template <typename T, Array3DLayout L = LINEAR_LAYOUT>
 class Array3D {
  public:
-  // Allocates a 3D array with |nx| rows, |ny| columns, and depth |nz|.
-  inline Array3D(std::size_t nx, std::size_t ny, std::size_t nz);
+  // Allocates a 3D array with |nx| rows, |ny| columns, and depth |nz|. With
+  // BRICKED_LAYOUT, the storage of each dimension is padded up to a multiple of
+  // kArray3DBrickSize.
+  //
+  // The data starts on a cache line. If |arena| isn't NULL, it is carved from
+  // |arena|, which must outlive this array; otherwise it is allocated on its
+  // own.
+  inline Array3D(std::size_t nx, std::size_t ny, std::size_t nz,
+                 Array3DArena* arena = NULL);
+
+  // Takes the data of |other|, leaving it a 0 x 0 x 0 array.
+  inline Array3D(Array3D&& other);
+  inline Array3D& operator=(Array3D&& other);
 
   // Sets |*this| = |other|.
   // We use this function instead of operator= to prevent any automatic calls to
@@ -18,9 +116,16 @@ class Array3D {
   // assigning the returned Array3D to an already instantiated Array3D object.
   inline void SetEqualTo(const Array3D& other);
 
-  // Deallocates the array.
+  // Deallocates the array, unless it was carved from an arena.
   inline ~Array3D();
 
+  // Returns the number of bytes an Array3DArena must set aside for an |nx| x
+  // |ny| x |nz| array.
+  static std::size_t ArenaBytes(std::size_t nx, std::size_t ny,
+                                std::size_t nz) {
+    return Array3DArena::BytesFor<T>(StorageSize(nx, ny, nz));
+  }
+
   std::size_t nx() const { return nx_; }
   std::size_t ny() const { return ny_; }
   std::size_t nz() const { return nz_; }
@@ -34,12 +139,12 @@ class Array3D {
 
   // Sets all elements of this 3D array equal to |value|.
   // inline const T& operator=(const T& value);
-  inline Array3D<T>& operator=(const T& value);
+  inline Array3D<T, L>& operator=(const T& value);
 
 
   // Adds |scalar| * |arr| to |*this|.
   // |arr| and |*this| must have identical dimensions.
-  inline void PlusEquals(double scalar, const Array3D<T>& arr);
+  inline void PlusEquals(double scalar, const Array3D<T, L>& arr);
 
   // Sets |*this| = |arr1| + |scalar| * |arr2|.
   //
@@ -48,8 +153,15 @@ class Array3D {
   // It's okay if |arr1| and/or |arr2| and/or |*this| are the same array since
   // each element will be modified one at a time, not affecting any other
   // element.
-  inline void EqualsPlusTimes(const Array3D<T>& arr1, double scalar,
-                              const Array3D<T>& arr2);
+  inline void EqualsPlusTimes(const Array3D<T, L>& arr1, double scalar,
+                              const Array3D<T, L>& arr2);
+
+  // Same as the above, with slabs of consecutive i indices split among the
+  // threads of |pool|.
+  inline void PlusEquals(double scalar, const Array3D<T, L>& arr,
+                         ThreadPool* pool);
+  inline void EqualsPlusTimes(const Array3D<T, L>& arr1, double scalar,
+                              const Array3D<T, L>& arr2, ThreadPool* pool);
 
  private:
   // Don't allow copy constructor to be called from outside this class.
@@ -58,99 +170,232 @@ class Array3D {
   // Don't allow copy-assignment operator to be called from outside this class.
   Array3D& operator=(const Array3D& other);
 
+  // Returns the number of elements, padding included, an |nx| x |ny| x |nz|
+  // array stores.
+  static std::size_t StorageSize(std::size_t nx, std::size_t ny,
+                                 std::size_t nz) {
+    if (L == BRICKED_LAYOUT) {
+      return RoundUpToBrickSize(nx) * RoundUpToBrickSize(ny) *
+             RoundUpToBrickSize(nz);
+    }
+    return nx * ny * nz;
+  }
+
   // Number of rows of data this array stores (x or i direction)
-  const std::size_t nx_;
+  std::size_t nx_;
 
   // Number of columns of data this array stores (y or j direction)
-  const std::size_t ny_;
+  std::size_t ny_;
 
   // Depth of data this array stores (z or k direction)
-  const std::size_t nz_;
+  std::size_t nz_;
 
   // Size of a single stack of this array's data, for convenience
-  const std::size_t ny_nz_;
+  std::size_t ny_nz_;
+
+  // Number of elements |data_| holds, padding included
+  std::size_t size_;
+
+  // With BRICKED_LAYOUT, element (i, j, k) is stored at data_[i_offsets_[i] +
+  // j_offsets_[j] + k_offsets_[k]]. Bricks, and the cells within each brick,
+  // are ordered like the cells of a linear array. Empty with LINEAR_LAYOUT.
+  std::vector<std::size_t> i_offsets_;
+  std::vector<std::size_t> j_offsets_;
+  std::vector<std::size_t> k_offsets_;
 
   // The actual 3D data this array stores
   T* data_;
+
+  // Block |data_| was allocated in, or NULL if |data_| is carved from an arena
+  void* storage_;
 };
 
-template <class T>
-inline Array3D<T>::Array3D(std::size_t nx, std::size_t ny, std::size_t nz)
-    : nx_(nx), ny_(ny), nz_(nz), ny_nz_(ny * nz), data_(new T[nx * ny_nz_]) {}
+template <class T, Array3DLayout L>
+inline Array3D<T, L>::Array3D(std::size_t nx, std::size_t ny, std::size_t nz,
+                              Array3DArena* arena)
+    : nx_(nx),
+      ny_(ny),
+      nz_(nz),
+      ny_nz_(ny * nz),
+      size_(StorageSize(nx, ny, nz)),
+      data_(NULL),
+      storage_(NULL) {
+  // The elements are left uninitialized, as new T[size_] would leave them.
+  static_assert(std::is_trivial<T>::value,
+                "Array3D only stores trivial types");
+  if (arena) {
+    data_ = static_cast<T*>(arena->Allocate(ArenaBytes(nx, ny, nz)));
+  } else {
+    data_ = static_cast<T*>(AllocateAligned(size_ * sizeof(T), &storage_));
+  }
 
-template <class T>
-inline void Array3D<T>::SetEqualTo(const Array3D<T>& other) {
+  if (L == BRICKED_LAYOUT) {
+    const std::size_t B = kArray3DBrickSize;
+    const std::size_t brick_volume = B * B * B;
+    const std::size_t j_brick_stride =
+        RoundUpToBrickSize(nz) / B * brick_volume;
+    const std::size_t i_brick_stride =
+        RoundUpToBrickSize(ny) / B * j_brick_stride;
+    for (std::size_t i = 0; i < nx; i++) {
+      i_offsets_.push_back((i / B) * i_brick_stride + (i % B) * B * B);
+    }
+    for (std::size_t j = 0; j < ny; j++) {
+      j_offsets_.push_back((j / B) * j_brick_stride + (j % B) * B);
+    }
+    for (std::size_t k = 0; k < nz; k++) {
+      k_offsets_.push_back((k / B) * brick_volume + k % B);
+    }
+  }
+}
+
+template <class T, Array3DLayout L>
+inline Array3D<T, L>::Array3D(Array3D&& other)
+    : nx_(other.nx_),
+      ny_(other.ny_),
+      nz_(other.nz_),
+      ny_nz_(other.ny_nz_),
+      size_(other.size_),
+      i_offsets_(std::move(other.i_offsets_)),
+      j_offsets_(std::move(other.j_offsets_)),
+      k_offsets_(std::move(other.k_offsets_)),
+      data_(other.data_),
+      storage_(other.storage_) {
+  other.nx_ = other.ny_ = other.nz_ = other.ny_nz_ = other.size_ = 0;
+  other.data_ = NULL;
+  other.storage_ = NULL;
+}
+
+template <class T, Array3DLayout L>
+inline Array3D<T, L>& Array3D<T, L>::operator=(Array3D&& other) {
+  if (this != &other) {
+    ::operator delete(storage_);
+    nx_ = other.nx_;
+    ny_ = other.ny_;
+    nz_ = other.nz_;
+    ny_nz_ = other.ny_nz_;
+    size_ = other.size_;
+    i_offsets_ = std::move(other.i_offsets_);
+    j_offsets_ = std::move(other.j_offsets_);
+    k_offsets_ = std::move(other.k_offsets_);
+    data_ = other.data_;
+    storage_ = other.storage_;
+
+    other.nx_ = other.ny_ = other.nz_ = other.ny_nz_ = other.size_ = 0;
+    other.data_ = NULL;
+    other.storage_ = NULL;
+  }
+  return *this;
+}
+
+template <class T, Array3DLayout L>
+inline void Array3D<T, L>::SetEqualTo(const Array3D<T, L>& other) {
   T* data_pointer = data_;
   const T* other_data_pointer = other.data_;
-  for (std::size_t i = 0; i < nx_ * ny_nz_; i++) {
+  for (std::size_t i = 0; i < size_; i++) {
     (*data_pointer) = (*other_data_pointer);
     data_pointer++;
     other_data_pointer++;
   }
 }
 
-template <class T>
-inline Array3D<T>::~Array3D() {
-  // The only constructor for the class instantiates |data_|, so there is
-  // no need to check if |data_| is NULL before deleting it.
-  delete[] data_;
+template <class T, Array3DLayout L>
+inline Array3D<T, L>::~Array3D() {
+  // |storage_| is NULL if this array was carved from an arena or moved from,
+  // and deleting NULL does nothing.
+  ::operator delete(storage_);
 }
 
-template <class T>
-inline const T& Array3D<T>::operator()(std::size_t i, std::size_t j,
-                                       std::size_t k) const {
+template <class T, Array3DLayout L>
+inline const T& Array3D<T, L>::operator()(std::size_t i, std::size_t j,
+                                          std::size_t k) const {
+  if (L == BRICKED_LAYOUT) {
+    return data_[i_offsets_[i] + j_offsets_[j] + k_offsets_[k]];
+  }
   return data_[i * ny_nz_ + j * nz_ + k];
 }
 
-template <class T>
-inline T& Array3D<T>::operator()(std::size_t i, std::size_t j, std::size_t k) {
+template <class T, Array3DLayout L>
+inline T& Array3D<T, L>::operator()(std::size_t i, std::size_t j,
+                                    std::size_t k) {
+  if (L == BRICKED_LAYOUT) {
+    return data_[i_offsets_[i] + j_offsets_[j] + k_offsets_[k]];
+  }
   return data_[i * ny_nz_ + j * nz_ + k];
 }
 
-template <class T>
-inline Array3D<T>& Array3D<T>::operator=(const T& value) {
+template <class T, Array3DLayout L>
+inline Array3D<T, L>& Array3D<T, L>::operator=(const T& value) {
   T* data_pointer = data_;
-  for (std::size_t i = 0; i < nx_ * ny_nz_; i++) {
+  for (std::size_t i = 0; i < size_; i++) {
     (*data_pointer) = value;
     data_pointer++;
   }
   return *this;
 }
 
-template <class T>
-inline void Array3D<T>::PlusEquals(double scalar, const Array3D<T>& arr) {
+template <class T, Array3DLayout L>
+inline void Array3D<T, L>::PlusEquals(double scalar, const Array3D<T, L>& arr) {
   // |arr| and |*this| must have identical dimensions.
+  const T scalar_t = static_cast<T>(scalar);
   for (std::size_t i = 0; i < nx_; i++) {
     for (std::size_t j = 0; j < ny_; j++) {
       for (std::size_t k = 0; k < nz_; k++) {
-        (*this)(i, j, k) += scalar * arr(i, j, k);
+        (*this)(i, j, k) += scalar_t * arr(i, j, k);
       }
     }
   }
 }
 
-template <class T>
-inline void Array3D<T>::EqualsPlusTimes(const Array3D<T>& arr1, double scalar,
-                                        const Array3D<T>& arr2) {
+template <class T, Array3DLayout L>
+inline void Array3D<T, L>::EqualsPlusTimes(const Array3D<T, L>& arr1,
+                                           double scalar,
+                                           const Array3D<T, L>& arr2) {
   // |arr1|, |arr2|, and |*this| must have identical dimensions.
+  const T scalar_t = static_cast<T>(scalar);
   for (std::size_t i = 0; i < nx_; i++) {
     for (std::size_t j = 0; j < ny_; j++) {
       for (std::size_t k = 0; k < nz_; k++) {
-        (*this)(i, j, k) = arr1(i, j, k) + scalar * arr2(i, j, k);
+        (*this)(i, j, k) = arr1(i, j, k) + scalar_t * arr2(i, j, k);
       }
     }
   }
 }
 
-// Returns the element-wise "dot product" of |a1| and |a2|.
+template <class T, Array3DLayout L>
+inline void Array3D<T, L>::PlusEquals(double scalar, const Array3D<T, L>& arr,
+                                      ThreadPool* pool) {
+  // |arr| and |*this| must have identical dimensions.
+  const T scalar_t = static_cast<T>(scalar);
+  SweepCells<L>(nx_, ny_, nz_, 0, pool,
+                [&](std::size_t i, std::size_t j, std::size_t k, double*) {
+                  (*this)(i, j, k) += scalar_t * arr(i, j, k);
+                });
+}
+
+template <class T, Array3DLayout L>
+inline void Array3D<T, L>::EqualsPlusTimes(const Array3D<T, L>& arr1,
+                                           double scalar,
+                                           const Array3D<T, L>& arr2,
+                                           ThreadPool* pool) {
+  // |arr1|, |arr2|, and |*this| must have identical dimensions.
+  const T scalar_t = static_cast<T>(scalar);
+  SweepCells<L>(nx_, ny_, nz_, 0, pool,
+                [&](std::size_t i, std::size_t j, std::size_t k, double*) {
+                  (*this)(i, j, k) = arr1(i, j, k) + scalar_t * arr2(i, j, k);
+                });
+}
+
+// Returns the element-wise "dot product" of |a1| and |a2|, accumulated in
+// double precision whatever |T| is.
 // |a1| and |a2| must have identical dimensions.
-inline double Dot(const Array3D<double>& a1, const Array3D<double>& a2) {
+template <class T, Array3DLayout L>
+inline double Dot(const Array3D<T, L>& a1, const Array3D<T, L>& a2) {
   double dot = 0.0;
 
   for (std::size_t i = 0; i < a1.nx(); i++) {
     for (std::size_t j = 0; j < a1.ny(); j++) {
       for (std::size_t k = 0; k < a1.nz(); k++) {
-        dot += a1(i, j, k) * a2(i, j, k);
+        dot += static_cast<double>(a1(i, j, k)) * a2(i, j, k);
       }
     }
   }
@@ -158,4 +403,21 @@ inline double Dot(const Array3D<double>& a1, const Array3D<double>& a2) {
   return dot;
 }
 
+// Returns the element-wise "dot product" of |a1| and |a2|, with slabs of
+// consecutive i indices split among the threads of |pool|.
+//
+// Each i-slice is summed on its own, and then the slice sums are added in
+// order of i, so the result is the same bit-for-bit for any number of threads.
+// It may differ in the last bits from the single-threaded Dot above, which
+// sums every element into one running total.
+template <class T, Array3DLayout L>
+inline double Dot(const Array3D<T, L>& a1, const Array3D<T, L>& a2,
+                  ThreadPool* pool) {
+  return SweepCells<L>(
+      a1.nx(), a1.ny(), a1.nz(), 0, pool,
+      [&](std::size_t i, std::size_t j, std::size_t k, double* slice_dot) {
+        *slice_dot += static_cast<double>(a1(i, j, k)) * a2(i, j, k);
+      });
+}
+
 #endif  // ARRAY3D_H_
@@ -0,0 +1,102 @@
+#ifndef ARRAY3D_ARENA_H_
+#define ARRAY3D_ARENA_H_
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+// To disable assert*() calls, uncomment this line:
+// #define NDEBUG
+
+// Alignment of the data of every Array3D, in bytes: one cache line, and a
+// multiple of the width of every SIMD load the kernels use
+const std::size_t kArray3DAlignment = 64;
+
+// Number of different cache-line offsets that consecutive Array3D allocations
+// start at. Arrays of identical size that all start at the same offset within
+// a page map element (i, j, k) of each to the same cache set, so a sweep
+// reading several of them at once evicts its own lines. Staggering their
+// starts by a cache line apiece spreads them over different sets.
+const std::size_t kArray3DStaggers = 16;
+
+// Returns |bytes| rounded up to a multiple of kArray3DAlignment.
+inline std::size_t RoundUpToAlignment(std::size_t bytes) {
+  return (bytes + kArray3DAlignment - 1) / kArray3DAlignment *
+         kArray3DAlignment;
+}
+
+// Returns a block of at least |bytes| bytes starting at a multiple of
+// kArray3DAlignment, staggered from the previous block by a cache line, and
+// sets |*storage| to the pointer that must be passed to ::operator delete to
+// free it.
+inline void* AllocateAligned(std::size_t bytes, void** storage) {
+  static std::atomic<std::size_t> num_allocations(0);
+  const std::size_t stagger =
+      (num_allocations++ % kArray3DStaggers) * kArray3DAlignment;
+
+  *storage = ::operator new(bytes + stagger + kArray3DAlignment);
+  std::uintptr_t address = reinterpret_cast<std::uintptr_t>(*storage);
+  std::uintptr_t aligned_address =
+      (address + kArray3DAlignment - 1) / kArray3DAlignment * kArray3DAlignment;
+  return reinterpret_cast<void*>(aligned_address + stagger);
+}
+
+// A single contiguous block of memory that the Array3Ds of a grid are carved
+// from one after another, so they are allocated, and freed, all at once. Each
+// array starts on a cache line, one cache line after the end of the previous
+// one, which staggers arrays of identical size like AllocateAligned does.
+//
+// The arena must outlive every array carved from it.
+class Array3DArena {
+ public:
+  // Allocates an arena of |capacity| bytes, which may be zero.
+  explicit Array3DArena(std::size_t capacity)
+      : storage_(NULL), data_(NULL), capacity_(capacity), used_(0) {
+    if (capacity > 0) {
+      data_ = static_cast<char*>(AllocateAligned(capacity, &storage_));
+    }
+  }
+
+  // Deallocates the arena.
+  ~Array3DArena() { ::operator delete(storage_); }
+
+  // Returns the number of bytes Allocate(..) takes from an arena for an array
+  // of |num_elements| |T|s.
+  template <typename T>
+  static std::size_t BytesFor(std::size_t num_elements) {
+    return RoundUpToAlignment(num_elements * sizeof(T)) + kArray3DAlignment;
+  }
+
+  std::size_t capacity() const { return capacity_; }
+  std::size_t used() const { return used_; }
+
+  // Returns the next |bytes| bytes of this arena, which must have room for
+  // them, as returned by BytesFor(..).
+  void* Allocate(std::size_t bytes) {
+    assert(used_ + bytes <= capacity_);
+    void* block = data_ + used_;
+    used_ += bytes;
+    return block;
+  }
+
+ private:
+  // Don't allow copy constructor to be called.
+  Array3DArena(const Array3DArena& other);
+
+  // Don't allow copy-assignment operator to be called.
+  Array3DArena& operator=(const Array3DArena& other);
+
+  // Block to pass to ::operator delete
+  void* storage_;
+
+  // Aligned start of the arena within |storage_|
+  char* data_;
+
+  // Size of the arena, and the number of its bytes handed out so far
+  std::size_t capacity_;
+  std::size_t used_;
+};
+
+#endif  // ARRAY3D_ARENA_H_
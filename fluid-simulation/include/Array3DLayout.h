@@ -0,0 +1,9 @@
+#ifndef ARRAY3D_LAYOUT_H_
+#define ARRAY3D_LAYOUT_H_
+
+// Used to choose how an Array3D orders its elements in memory: one k column
+// after another along j and then i, or in small cubic bricks of neighboring
+// (i, j, k) cells
+enum Array3DLayout { LINEAR_LAYOUT, BRICKED_LAYOUT };
+
+#endif  // ARRAY3D_LAYOUT_H_
@@ -0,0 +1,197 @@
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Array3D.h"
+#include "ParticleSet.h"
+
+// Settings controlling how often a simulation saves the state it can resume
+// from
+struct CheckpointOptions {
+  // Number of frames between checkpoints, or zero to never save one
+  std::size_t interval = 0;
+
+  // File each checkpoint replaces the previous one in
+  std::string file_name = "checkpoint.bin";
+};
+
+// Version of the checkpoint format, incremented whenever its layout changes
+const std::uint32_t kCheckpointVersion = 1;
+
+// The complete state of a simulation, built up in memory by appending values
+// one after another, then saved to a file in one go
+//
+// A checkpoint starts with the magic string "FLUIDCK" and kCheckpointVersion.
+// Values follow in the order they were written, in the writer's byte order,
+// and must be read back in the same order by a CheckpointReader.
+class CheckpointWriter {
+ public:
+  // Creates a checkpoint holding only its magic string and version.
+  CheckpointWriter();
+
+  // Destroys this checkpoint.
+  ~CheckpointWriter();
+
+  // Appends the |num_bytes| bytes at |bytes|.
+  void WriteBytes(const void* bytes, std::size_t num_bytes);
+
+  // Appends |value|, a number, bool, or enum.
+  template <typename S>
+  void Write(const S& value) {
+    WriteBytes(&value, sizeof(value));
+  }
+
+  // Appends the length of |text|, then its characters.
+  void WriteString(const std::string& text);
+
+  // Appends the dimensions of |array|, then its elements.
+  template <typename S, Array3DLayout L>
+  void WriteArray(const Array3D<S, L>& array);
+
+  // Appends the number of |particles|, then each of their coordinates in
+  // turn.
+  template <typename T>
+  void WriteParticles(const ParticleSet<T>& particles);
+
+  // Saves the checkpoint to the file named |file_name| atomically: it is
+  // written to a temporary file next to it and flushed to disk, then renamed
+  // over |file_name|, so a crash leaves either the previous checkpoint or this
+  // one, never part of one. Returns whether it was saved.
+  bool Save(const std::string& file_name) const;
+
+ private:
+  // Don't allow copy constructor to be called.
+  CheckpointWriter(const CheckpointWriter& other);
+
+  // Don't allow copy-assignment operator to be called.
+  CheckpointWriter& operator=(const CheckpointWriter& other);
+
+  std::string data_;
+};
+
+// Reads back, in order, the values of a checkpoint saved by a
+// CheckpointWriter
+//
+// Every read reports an error and crashes the program, even with assert*()
+// calls disabled, if the checkpoint doesn't hold what is being read.
+class CheckpointReader {
+ public:
+  // Reads the checkpoint file named |file_name|, which must start with the
+  // magic string and version of a checkpoint.
+  explicit CheckpointReader(const std::string& file_name);
+
+  // Destroys this reader.
+  ~CheckpointReader();
+
+  // Sets the |num_bytes| bytes at |bytes| to the next bytes of the checkpoint.
+  void ReadBytes(void* bytes, std::size_t num_bytes);
+
+  // Returns the next value of the checkpoint, as written by Write(..).
+  template <typename S>
+  S Read() {
+    S value;
+    ReadBytes(&value, sizeof(value));
+    return value;
+  }
+
+  std::string ReadString();
+
+  // Sets |*array|, whose dimensions must be the ones written, to the next
+  // array of the checkpoint.
+  template <typename S, Array3DLayout L>
+  void ReadArray(Array3D<S, L>* array);
+
+  template <typename T>
+  void ReadParticles(ParticleSet<T>* particles);
+
+  // Checks that the whole checkpoint was read.
+  void Finish() const;
+
+ private:
+  // Don't allow copy constructor to be called.
+  CheckpointReader(const CheckpointReader& other);
+
+  // Don't allow copy-assignment operator to be called.
+  CheckpointReader& operator=(const CheckpointReader& other);
+
+  // Reports that the checkpoint can't be read because of |problem|, and
+  // crashes the program.
+  void Fail(const std::string& problem) const;
+
+  const std::string file_name_;
+  std::string data_;
+
+  // Offset of the next value to read in |data_|
+  std::size_t position_;
+};
+
+template <typename S, Array3DLayout L>
+void CheckpointWriter::WriteArray(const Array3D<S, L>& array) {
+  Write<std::uint64_t>(array.nx());
+  Write<std::uint64_t>(array.ny());
+  Write<std::uint64_t>(array.nz());
+  for (std::size_t i = 0; i < array.nx(); i++) {
+    for (std::size_t j = 0; j < array.ny(); j++) {
+      for (std::size_t k = 0; k < array.nz(); k++) {
+        Write(array(i, j, k));
+      }
+    }
+  }
+}
+
+template <typename T>
+void CheckpointWriter::WriteParticles(const ParticleSet<T>& particles) {
+  Write<std::uint64_t>(particles.size());
+  const T* const kCoordinates[] = {particles.x(),  particles.y(),
+                                   particles.z(),  particles.vx(),
+                                   particles.vy(), particles.vz()};
+  for (const T* coordinates : kCoordinates) {
+    WriteBytes(coordinates, particles.size() * sizeof(T));
+  }
+}
+
+template <typename S, Array3DLayout L>
+void CheckpointReader::ReadArray(Array3D<S, L>* array) {
+  std::uint64_t nx = Read<std::uint64_t>();
+  std::uint64_t ny = Read<std::uint64_t>();
+  std::uint64_t nz = Read<std::uint64_t>();
+  if (nx != array->nx() || ny != array->ny() || nz != array->nz()) {
+    Fail("it holds a " + std::to_string(nx) + " x " + std::to_string(ny) +
+         " x " + std::to_string(nz) + " array where a " +
+         std::to_string(array->nx()) + " x " + std::to_string(array->ny()) +
+         " x " + std::to_string(array->nz()) + " one belongs");
+  }
+  for (std::size_t i = 0; i < array->nx(); i++) {
+    for (std::size_t j = 0; j < array->ny(); j++) {
+      for (std::size_t k = 0; k < array->nz(); k++) {
+        (*array)(i, j, k) = Read<S>();
+      }
+    }
+  }
+}
+
+template <typename T>
+void CheckpointReader::ReadParticles(ParticleSet<T>* particles) {
+  const std::size_t num_particles =
+      static_cast<std::size_t>(Read<std::uint64_t>());
+  // x, y, z, vx, vy, vz
+  std::vector<std::vector<T>> coordinates(6, std::vector<T>(num_particles));
+  for (std::vector<T>& block : coordinates) {
+    ReadBytes(block.data(), num_particles * sizeof(T));
+  }
+  particles->resize(num_particles);
+  for (std::size_t n = 0; n < num_particles; n++) {
+    particles->set_position(n, Eigen::Vector3d(coordinates[0][n],
+                                               coordinates[1][n],
+                                               coordinates[2][n]));
+    particles->set_velocity(n, Eigen::Vector3d(coordinates[3][n],
+                                               coordinates[4][n],
+                                               coordinates[5][n]));
+  }
+}
+
+#endif  // CHECKPOINT_H_
@@ -0,0 +1,7 @@
+#ifndef EMITTER_SHAPE_H_
+#define EMITTER_SHAPE_H_
+
+// Used to choose the region of the grid a ParticleEmitter fills with particles
+enum EmitterShape { BOX_EMITTER, SPHERE_EMITTER };
+
+#endif  // EMITTER_SHAPE_H_
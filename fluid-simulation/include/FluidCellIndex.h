@@ -0,0 +1,84 @@
+#ifndef FLUID_CELL_INDEX_H_
+#define FLUID_CELL_INDEX_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Array3D.h"
+#include "MaterialType.h"
+
+// A compact numbering of the interior FLUID cells of a grid, in increasing
+// (i, j, k) order, used to store the vectors of the pressure solve packed
+//
+// Entry c of a packed vector belongs to FLUID cell c. Packed vectors hold one
+// extra trailing entry, at index size(), that always stays 0.0 and stands in
+// for every neighbor that isn't a FLUID cell, so stencils need no branches.
+class FluidCellIndex {
+ public:
+  // Number of neighbors of a cell, one per entry of kNeighborDirections
+  static const std::size_t kNumNeighbors = 6;
+
+  // Creates an empty index for a grid of |nx| x |ny| x |nz| cells.
+  FluidCellIndex(std::size_t nx, std::size_t ny, std::size_t nz);
+
+  // Deallocates the index.
+  ~FluidCellIndex();
+
+  // Renumbers the FLUID cells according to |labels|, and records the stencil
+  // of each one from |neighbors|, as made by MakeNeighborMaterialInfo.
+  void Build(const Array3D<MaterialType>& labels,
+             const Array3D<unsigned short>& neighbors);
+
+  // Number of FLUID cells; also the index of the trailing zero entry of packed
+  // vectors
+  std::size_t size() const { return cells_.size(); }
+
+  // Grid index (|*i|, |*j|, |*k|) of FLUID cell |c|
+  void GetCell(std::size_t c, std::size_t* i, std::size_t* j,
+               std::size_t* k) const {
+    std::size_t cell = cells_[c];
+    *i = cell / ny_nz_;
+    *j = (cell / nz_) % ny_;
+    *k = cell % nz_;
+  }
+
+  // Entry of the neighbors array for FLUID cell |c|
+  unsigned short stencil(std::size_t c) const { return stencils_[c]; }
+
+  // Packed index of the neighbor of FLUID cell |c| in direction
+  // kNeighborDirections[|n|] if that neighbor is a FLUID cell coupled to it in
+  // A, or size() otherwise
+  std::size_t neighbor(std::size_t c, std::size_t n) const {
+    return neighbor_cells_[c * kNumNeighbors + n];
+  }
+
+ private:
+  // Don't allow copy constructor to be called.
+  FluidCellIndex(const FluidCellIndex& other);
+
+  // Don't allow copy-assignment operator to be called.
+  FluidCellIndex& operator=(const FluidCellIndex& other);
+
+  // Number of columns (y or j direction) and depth (z or k direction) of the
+  // grid
+  const std::size_t ny_;
+  const std::size_t nz_;
+
+  // Size of a single stack of the grid's cells, for convenience
+  const std::size_t ny_nz_;
+
+  // Linear index, i * ny * nz + j * nz + k, of each FLUID cell
+  std::vector<std::size_t> cells_;
+
+  // Entry of the neighbors array of each FLUID cell
+  std::vector<unsigned short> stencils_;
+
+  // kNumNeighbors packed neighbor indices per FLUID cell
+  std::vector<std::uint32_t> neighbor_cells_;
+
+  // Packed index of each cell of the grid, valid only for FLUID cells
+  Array3D<std::uint32_t> packed_indices_;
+};
+
+#endif  // FLUID_CELL_INDEX_H_
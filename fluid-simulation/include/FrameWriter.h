@@ -0,0 +1,112 @@
+#ifndef FRAME_WRITER_H_
+#define FRAME_WRITER_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "OutputFormat.h"
+#include "ParticleSet.h"
+
+// Writes the particle frames of a simulation to files, either on the calling
+// thread or on a background thread that overlaps each write with the
+// simulation's next time steps
+//
+// In the background, each frame is first copied into one of a fixed pool of
+// particle buffers, which are recycled once written. When every buffer is
+// still waiting to be written, Write(..) blocks until one is free, so no more
+// than that many frames are ever queued.
+//
+// Only FrameWriter<double> and FrameWriter<float> are instantiated, in
+// FrameWriter.cpp.
+template <typename T>
+class FrameWriter {
+ public:
+  // Creates a writer of frames in |format|, which writes them on a background
+  // thread through |num_buffers| particle buffers if |asynchronous|, or else on
+  // the calling thread.
+  FrameWriter(OutputFormat format, bool asynchronous,
+              std::size_t num_buffers = 2u);
+
+  // Finishes writing every frame and stops the background thread.
+  ~FrameWriter();
+
+  // Writes |particles|, at simulated time |time|, to the file named
+  // |file_name|. In the background, |particles| may change as soon as this
+  // returns.
+  void Write(const std::string& file_name, const ParticleSet<T>& particles,
+             double time);
+
+  // Returns once every frame passed to Write(..) has been written.
+  void Finish();
+
+  // Number of frames written so far
+  std::size_t num_frames() const;
+
+  // Seconds spent writing frames to files, on whichever thread wrote them
+  double write_seconds() const;
+
+  // Seconds the calling thread spent copying frames into buffers, and waiting
+  // for a free buffer or for the last frames to be written
+  double copy_seconds() const;
+  double stall_seconds() const;
+
+ private:
+  // A frame waiting to be written from |buffers_|[|buffer|]
+  struct PendingFrame {
+    std::string file_name;
+    double time;
+    std::size_t buffer;
+  };
+
+  // Don't allow copy constructor to be called.
+  FrameWriter(const FrameWriter& other);
+
+  // Don't allow copy-assignment operator to be called.
+  FrameWriter& operator=(const FrameWriter& other);
+
+  // Writes pending frames until the writer is destroyed.
+  void WorkerLoop();
+
+  // Writes |particles| at simulated time |time| to the file named |file_name|
+  // and returns the seconds it took.
+  double WriteFrame(const std::string& file_name,
+                    const ParticleSet<T>& particles, double time) const;
+
+  const OutputFormat format_;
+
+  // Particle buffers, only used in the background
+  std::vector<ParticleSet<T>> buffers_;
+
+  // Guards every member below
+  mutable std::mutex mutex_;
+
+  // Signaled when a frame is queued or the writer is stopping
+  std::condition_variable frame_queued_;
+
+  // Signaled when a frame has been written and its buffer freed
+  std::condition_variable frame_written_;
+
+  // Indices of the buffers not holding a pending frame
+  std::vector<std::size_t> free_buffers_;
+
+  // Frames waiting to be written, in the order they were passed to Write(..)
+  std::deque<PendingFrame> pending_frames_;
+
+  // Whether the destructor has asked the background thread to exit
+  bool stopping_;
+
+  std::size_t num_frames_;
+  double write_seconds_;
+  double copy_seconds_;
+  double stall_seconds_;
+
+  // Background thread, last so it starts once every other member is ready
+  std::thread worker_;
+};
+
+#endif  // FRAME_WRITER_H_
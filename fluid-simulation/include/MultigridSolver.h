@@ -0,0 +1,88 @@
+#ifndef MULTIGRID_SOLVER_H_
+#define MULTIGRID_SOLVER_H_
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "Array3D.h"
+#include "MaterialType.h"
+
+// A data type that solves the pressure projection equation, Ap = d, with a
+// geometric multigrid V-cycle, either on its own or as a preconditioner for the
+// Conjugate Gradient Algorithm in PressureSolver
+//
+// Each coarser level halves the resolution of the interior of the grid beneath
+// it. A coarse cell is EMPTY if any of its fine cells is EMPTY, otherwise
+// FLUID if any of its fine cells is FLUID, and otherwise SOLID, and its stencil
+// is rebuilt from those labels exactly like the finest level's. Residuals are
+// restricted and corrections prolonged with cell-centered trilinear weights,
+// and each level is smoothed with damped Jacobi iterations, so a V-cycle is a
+// symmetric operator suitable for preconditioning.
+//
+// Values are stored as |T|, which is double or float, like the StaggeredGrid
+// the solver serves. Only MultigridSolver<double> and MultigridSolver<float>
+// are instantiated, in MultigridSolver.cpp.
+template <typename T>
+class MultigridSolver {
+ public:
+  // Allocates the levels of a multigrid hierarchy whose finest level is a grid
+  // of |nx| x |ny| x |nz| cells.
+  MultigridSolver(std::size_t nx, std::size_t ny, std::size_t nz);
+
+  // Deallocates the levels.
+  ~MultigridSolver();
+
+  // Number of levels, including the finest one
+  std::size_t num_levels() const { return levels_.size(); }
+
+  // Coarsens the cell |labels| of the finest level and rebuilds the stencils of
+  // all levels. Must be called whenever the finest level's labels change.
+  void Setup(const Array3D<MaterialType>& labels);
+
+  // Sets |*x| to the result of one V-cycle applied to |b|, starting from a zero
+  // initial guess; i.e., |*x| approximates A^-1 * |b|.
+  void ApplyVCycle(const Array3D<T>& b, Array3D<T>* x);
+
+  // Solves A * |*x| = |b| by repeating V-cycles on the residual until the
+  // squared residual norm drops to |tolerance| or |max_cycles| V-cycles have
+  // been run, starting from the values already in |*x|.
+  //
+  // Returns the number of V-cycles that were run, and sets |*residual_norm| to
+  // the squared residual norm of the final |*x|.
+  std::size_t Solve(const Array3D<T>& b, double tolerance,
+                    std::size_t max_cycles, Array3D<T>* x,
+                    double* residual_norm);
+
+ private:
+  // One level of the multigrid hierarchy
+  struct Level {
+    Level(std::size_t nx, std::size_t ny, std::size_t nz);
+
+    // Material type of each cell on this level
+    Array3D<MaterialType> labels;
+
+    // Stencil of each cell on this level, as made by MakeNeighborMaterialInfo
+    Array3D<unsigned short> neighbors;
+
+    // Solution, right-hand side, and residual on this level
+    Array3D<T> x;
+    Array3D<T> b;
+    Array3D<T> r;
+  };
+
+  // Don't allow copy constructor to be called.
+  MultigridSolver(const MultigridSolver& other);
+
+  // Don't allow copy-assignment operator to be called.
+  MultigridSolver& operator=(const MultigridSolver& other);
+
+  // Runs a V-cycle on levels |level| and coarser, solving for
+  // |levels_[level]->x| given |levels_[level]->b|.
+  void VCycle(std::size_t level);
+
+  // Levels from finest (index 0) to coarsest
+  std::vector<std::unique_ptr<Level>> levels_;
+};
+
+#endif  // MULTIGRID_SOLVER_H_
@@ -0,0 +1,33 @@
+#ifndef NEIGHBOR_MATERIAL_INFO_H_
+#define NEIGHBOR_MATERIAL_INFO_H_
+
+#include "Array3D.h"
+#include "MaterialType.h"
+#include "PressureMatrix.h"
+
+// Sets |*neighbors| to describe the pressure projection matrix stencil of each
+// grid cell labeled in |cell_labels|: for each FLUID cell not on the outer
+// faces of the grid, the lowest three bits count the cell's non-SOLID
+// neighbors, and each NeighborDirection bit is set if the neighbor in that
+// direction is FLUID. All other cells get no bits set.
+void MakeNeighborMaterialInfo(const Array3D<MaterialType>& cell_labels,
+                              Array3D<unsigned short>* neighbors);
+
+// Same as above, and also sets |*matrix| to the coefficients of the same
+// stencils. Instantiated for double and float in NeighborMaterialInfo.cpp.
+template <typename T>
+void MakeNeighborMaterialInfo(const Array3D<MaterialType>& cell_labels,
+                              Array3D<unsigned short>* neighbors,
+                              PressureMatrix<T>* matrix);
+
+// Sets the entry of |*neighbors| for the cell (|i|, |j|, |k|) labeled in
+// |cell_labels|, and its coefficients in |*matrix| unless |matrix| is NULL,
+// exactly as the functions above set them for every cell. Instantiated for
+// double and float in NeighborMaterialInfo.cpp.
+template <typename T>
+void UpdateNeighborMaterialInfo(const Array3D<MaterialType>& cell_labels,
+                                std::size_t i, std::size_t j, std::size_t k,
+                                Array3D<unsigned short>* neighbors,
+                                PressureMatrix<T>* matrix);
+
+#endif  // NEIGHBOR_MATERIAL_INFO_H_
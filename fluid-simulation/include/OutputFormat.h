@@ -0,0 +1,8 @@
+#ifndef OUTPUT_FORMAT_H_
+#define OUTPUT_FORMAT_H_
+
+// Used to choose whether a simulation writes its particle frames as text or
+// in the binary particle frame format
+enum OutputFormat { TEXT_OUTPUT, BINARY_OUTPUT };
+
+#endif  // OUTPUT_FORMAT_H_
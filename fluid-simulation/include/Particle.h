@@ -2,6 +2,7 @@
 #define PARTICLE_H_
 
 #include <Eigen/Dense>
+#include <string>
 #include <vector>
 
 struct Particle {
@@ -9,8 +10,13 @@ struct Particle {
   Eigen::Vector3d vel;
 };
 
-// Returns an array of Particles read from the file with relative path
-// |input_file|.
+// Returns an array of Particles read from the text file with relative path
+// |input_file|: the number of particles, then the three position and three
+// velocity coordinates of each particle, one particle per line.
+//
+// Reports an error and crashes the program, even with assert*() calls
+// disabled, if the file can't be read, is malformed, or holds a different
+// number of particles than it says.
 std::vector<Particle> ReadParticles(const std::string& input_file);
 
 #endif  // PARTICLE_H_
@@ -0,0 +1,56 @@
+#ifndef PARTICLE_EMITTER_H_
+#define PARTICLE_EMITTER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "EmitterShape.h"
+#include "ParticleSet.h"
+#include "ThreadPool.h"
+
+// Settings of one region of the grid filled with fluid particles at the start
+// of a simulation
+struct ParticleEmitter {
+  // Whether the region is a box or a sphere
+  EmitterShape shape = BOX_EMITTER;
+
+  // Lower and upper corners of a BOX_EMITTER's region
+  Eigen::Vector3d lower = Eigen::Vector3d::Zero();
+  Eigen::Vector3d upper = Eigen::Vector3d::Zero();
+
+  // Center and radius of a SPHERE_EMITTER's region
+  Eigen::Vector3d center = Eigen::Vector3d::Zero();
+  double radius = 0.0;
+
+  // Velocity every emitted particle starts with
+  Eigen::Vector3d velocity = Eigen::Vector3d::Zero();
+
+  // Number of particles per grid cell, which must be a cube, 1, 8, 27, ..., as
+  // each cell is split into that many equal subcells with one particle each
+  std::size_t particles_per_cell = 8;
+
+  // How far each particle is moved at random from the center of its subcell,
+  // from 0.0, not at all, to 1.0, anywhere in the subcell
+  double jitter = 1.0;
+};
+
+// Appends to |*particles| the particles of each of |emitters| in turn, in the
+// cells of an |nx| x |ny| x |nz| grid, with lower corner |lc| and cells |dx|
+// wide, that aren't on its SOLID boundary.
+//
+// A particle is emitted for each subcell whose jittered position lies in the
+// emitter's region, so regions are filled to their surface and overlapping
+// regions are filled twice. Subcells are visited in order of their x, y, and
+// then z index, split among the threads of |thread_pool|. The jitter of each
+// subcell only depends on |seed|, the emitter's index, and the subcell, so the
+// same settings always emit the same particles, on any number of threads.
+template <typename T>
+void EmitParticles(const std::vector<ParticleEmitter>& emitters,
+                   std::uint64_t seed, std::size_t nx, std::size_t ny,
+                   std::size_t nz, const Eigen::Vector3d& lc, double dx,
+                   ThreadPool* thread_pool, ParticleSet<T>* particles);
+
+#endif  // PARTICLE_EMITTER_H_
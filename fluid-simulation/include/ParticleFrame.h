@@ -0,0 +1,74 @@
+#ifndef PARTICLE_FRAME_H_
+#define PARTICLE_FRAME_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "ParticleSet.h"
+
+// Version of the binary particle frame format that WriteBinaryParticleFrame
+// writes
+const std::uint32_t kParticleFrameVersion = 1;
+
+// Header at the start of a binary particle frame file
+//
+// It is followed by six blocks of |num_particles| coordinates each, stored as
+// float or double according to |scalar_bytes|: the x, y, and z coordinates of
+// the particles' positions, then of their velocities. Every field is in the
+// byte order of the machine that wrote the file.
+struct ParticleFrameHeader {
+  // "PARTFRM" and a terminating zero
+  char magic[8];
+
+  std::uint32_t version;
+
+  // Size of each stored coordinate: 4 for float or 8 for double
+  std::uint32_t scalar_bytes;
+
+  std::uint64_t num_particles;
+
+  // Simulated time of the frame, in seconds
+  double time;
+
+  // Lower and upper corners of the bounding box of the particles' positions,
+  // which are all zero for a frame without particles
+  double lower[3];
+  double upper[3];
+};
+
+// Returns whether the file named |file_name| starts with the magic string of
+// a binary particle frame.
+bool IsBinaryParticleFrame(const std::string& file_name);
+
+// Writes the particle count of |particles|, then the position and velocity of
+// each particle, one particle per line, to the text file named |file_name|.
+template <typename T>
+void WriteTextParticleFrame(const std::string& file_name,
+                            const ParticleSet<T>& particles);
+
+// Writes |particles|, at simulated time |time|, to the binary particle frame
+// file named |file_name|, storing their coordinates as |T|.
+template <typename T>
+void WriteBinaryParticleFrame(const std::string& file_name,
+                              const ParticleSet<T>& particles, double time);
+
+// Reads the binary particle frame file named |file_name| into |*header| and
+// |*particles|, converting its coordinates to |T|. The file is mapped into
+// memory rather than read through a stream.
+//
+// Reports an error and crashes the program, even with assert*() calls
+// disabled, if the file can't be mapped, isn't a binary particle frame of a
+// supported version, or is shorter or longer than its particle count implies.
+template <typename T>
+void ReadBinaryParticleFrame(const std::string& file_name,
+                             ParticleFrameHeader* header,
+                             ParticleSet<T>* particles);
+
+// Reads the particles of the file named |file_name| into |*particles|, whether
+// it is a binary particle frame or a text file as ReadParticles(..) reads.
+template <typename T>
+void ReadParticleFrame(const std::string& file_name,
+                       ParticleSet<T>* particles);
+
+#endif  // PARTICLE_FRAME_H_
@@ -0,0 +1,116 @@
+#ifndef PARTICLE_SET_H_
+#define PARTICLE_SET_H_
+
+#include <Eigen/Dense>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+#include "Particle.h"
+
+// To disable assert*() calls, uncomment this line:
+// #define NDEBUG
+
+// The particles of a simulation stored as a structure of arrays, one array per
+// coordinate of their positions and velocities, so a batched pass over the
+// particles only streams through the coordinates it needs, and consecutive
+// particles' coordinates are next to each other for vector instructions
+//
+// Coordinates are stored as |T|, which is double or float. Storing them as
+// float halves the memory traffic of every pass over the particles, while
+// interpolation is still computed in double.
+template <typename T>
+class ParticleSet {
+ public:
+  // Creates an empty set of particles.
+  ParticleSet() {}
+
+  // Creates a set holding the positions and velocities of |particles|.
+  explicit ParticleSet(const std::vector<Particle>& particles) {
+    resize(particles.size());
+    for (std::size_t n = 0; n < particles.size(); n++) {
+      Set(n, particles[n]);
+    }
+  }
+
+  std::size_t size() const { return x_.size(); }
+
+  // Resizes the set to |num_particles| particles. Added particles are
+  // uninitialized.
+  void resize(std::size_t num_particles) {
+    x_.resize(num_particles);
+    y_.resize(num_particles);
+    z_.resize(num_particles);
+    vx_.resize(num_particles);
+    vy_.resize(num_particles);
+    vz_.resize(num_particles);
+  }
+
+  const T* x() const { return x_.data(); }
+  const T* y() const { return y_.data(); }
+  const T* z() const { return z_.data(); }
+  const T* vx() const { return vx_.data(); }
+  const T* vy() const { return vy_.data(); }
+  const T* vz() const { return vz_.data(); }
+
+  // Position and velocity of particle |n|
+  Eigen::Vector3d position(std::size_t n) const {
+    return Eigen::Vector3d(x_[n], y_[n], z_[n]);
+  }
+  Eigen::Vector3d velocity(std::size_t n) const {
+    return Eigen::Vector3d(vx_[n], vy_[n], vz_[n]);
+  }
+
+  void set_position(std::size_t n, const Eigen::Vector3d& pos) {
+    x_[n] = static_cast<T>(pos[0]);
+    y_[n] = static_cast<T>(pos[1]);
+    z_[n] = static_cast<T>(pos[2]);
+  }
+  void set_velocity(std::size_t n, const Eigen::Vector3d& vel) {
+    vx_[n] = static_cast<T>(vel[0]);
+    vy_[n] = static_cast<T>(vel[1]);
+    vz_[n] = static_cast<T>(vel[2]);
+  }
+
+  // Returns particle |n| as a Particle.
+  Particle Get(std::size_t n) const {
+    return Particle{.pos = position(n), .vel = velocity(n)};
+  }
+
+  // Sets particle |n| to |particle|.
+  void Set(std::size_t n, const Particle& particle) {
+    set_position(n, particle.pos);
+    set_velocity(n, particle.vel);
+  }
+
+  // Moves each particle |n| to position |destinations|[|n|], which must be a
+  // permutation of the particle indices.
+  void Reorder(const std::vector<std::size_t>& destinations) {
+    assert(destinations.size() == size());
+    std::vector<T>* const kCoordinates[] = {&x_, &y_, &z_, &vx_, &vy_, &vz_};
+    scratch_.resize(size());
+    for (std::vector<T>* coordinate : kCoordinates) {
+      for (std::size_t n = 0; n < destinations.size(); n++) {
+        scratch_[destinations[n]] = (*coordinate)[n];
+      }
+      coordinate->swap(scratch_);
+    }
+  }
+
+ private:
+  // Coordinates of the particles' positions
+  std::vector<T> x_;
+  std::vector<T> y_;
+  std::vector<T> z_;
+
+  // Coordinates of the particles' velocities
+  std::vector<T> vx_;
+  std::vector<T> vy_;
+  std::vector<T> vz_;
+
+  // Reordered coordinates, swapped in for each coordinate array in turn so
+  // that Reorder(..) reuses the storage
+  std::vector<T> scratch_;
+};
+
+#endif  // PARTICLE_SET_H_
@@ -0,0 +1,93 @@
+#ifndef PARTICLE_SORTER_H_
+#define PARTICLE_SORTER_H_
+
+#include <Eigen/Dense>
+#include <cstddef>
+#include <vector>
+
+#include "ParticleSet.h"
+
+// Settings controlling how often a simulation reorders its particles by grid
+// cell
+struct ParticleSortOptions {
+  // Number of time steps between sorts, or zero to never sort on a schedule
+  std::size_t interval = 0;
+
+  // Fraction of consecutive particle pairs out of cell order, as measured by
+  // ParticleSorter::Disorder, above which the particles are sorted before the
+  // next step, or zero to never measure it
+  double disorder_threshold = 0.0;
+};
+
+// A counting sort of particles by the linear index, i * ny * nz + j * nz + k,
+// of the grid cell containing each one, so particles that splat onto and
+// interpolate from the same grid values are next to each other in memory
+//
+// The sort is stable, so particles in the same cell keep their relative order.
+// It also records where each cell's particles start, which stays valid until
+// the particles move or are reordered.
+//
+// Only the member templates for ParticleSet<double> and ParticleSet<float> are
+// instantiated, in ParticleSorter.cpp.
+class ParticleSorter {
+ public:
+  // Creates a sorter for a grid of |nx| x |ny| x |nz| cells of width |dx|
+  // whose lower corner is at |lc|.
+  ParticleSorter(std::size_t nx, std::size_t ny, std::size_t nz,
+                 const Eigen::Vector3d& lc, double dx);
+
+  // Deallocates the sorter.
+  ~ParticleSorter();
+
+  // Reorders |*particles| by grid cell and records the start of each cell's
+  // particles.
+  template <typename T>
+  void Sort(ParticleSet<T>* particles);
+
+  // Returns the fraction of consecutive pairs of |particles| whose second
+  // particle is in an earlier grid cell than the first: zero right after a
+  // sort, and about one half for particles in random order.
+  template <typename T>
+  double Disorder(const ParticleSet<T>& particles) const;
+
+  // Returns whether |particles| should be sorted before time step |step|
+  // according to |options|.
+  template <typename T>
+  bool ShouldSort(const ParticleSortOptions& options, std::size_t step,
+                  const ParticleSet<T>& particles) const;
+
+  // Index of the first particle, after the last sort, in the grid cell with
+  // linear index |cell|. The particles of |cell| end at cell_start(|cell| + 1).
+  std::size_t cell_start(std::size_t cell) const { return cell_starts_[cell]; }
+
+  // Linear index of the grid cell containing |pos|, clamped to the grid
+  std::size_t CellIndex(const Eigen::Vector3d& pos) const;
+
+ private:
+  // Don't allow copy constructor to be called.
+  ParticleSorter(const ParticleSorter& other);
+
+  // Don't allow copy-assignment operator to be called.
+  ParticleSorter& operator=(const ParticleSorter& other);
+
+  // Number of grid cells in each direction
+  const std::size_t nx_;
+  const std::size_t ny_;
+  const std::size_t nz_;
+
+  // Lower corner position (min x, y, z) of the grid
+  const Eigen::Vector3d lc_;
+
+  // Grid cell width (side length)
+  const double dx_;
+
+  // Start of each cell's particles after the last sort, plus a final entry
+  // holding the number of particles
+  std::vector<std::size_t> cell_starts_;
+
+  // Cell index of each particle being sorted, then its position in sorted
+  // order
+  std::vector<std::size_t> cells_;
+};
+
+#endif  // PARTICLE_SORTER_H_
@@ -0,0 +1,121 @@
+#ifndef PHASE_PROFILER_H_
+#define PHASE_PROFILER_H_
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "SimulationPhase.h"
+
+// Phase timers are built in unless NO_PHASE_TIMERS is defined, which the
+// Makefile does with "make PHASE_TIMERS=0". Compiled out, a ScopedPhaseTimer
+// is an empty object, so timed code is exactly as fast as untimed code.
+#ifdef NO_PHASE_TIMERS
+const bool kPhaseTimersEnabled = false;
+#else
+const bool kPhaseTimersEnabled = true;
+#endif
+
+// The wall time a simulation spends in each phase of each time step, as
+// recorded by ScopedPhaseTimers, along with the wall time of each whole step
+class PhaseProfiler {
+ public:
+  // Creates a profiler whose first time step starts now.
+  PhaseProfiler();
+
+  // Destroys this profiler.
+  ~PhaseProfiler();
+
+  // Adds |seconds| to the time spent in |phase| during the current time step.
+  void Add(SimulationPhase phase, double seconds) {
+    current_seconds_[phase] += seconds;
+  }
+
+  // Ends the current time step, which started at simulated time |time|, and
+  // starts the next one.
+  void EndStep(double time);
+
+  // Number of time steps ended so far
+  std::size_t num_steps() const { return step_times_.size(); }
+
+  // Total seconds spent in |phase| over every ended time step
+  double TotalSeconds(SimulationPhase phase) const;
+
+  // Prints the total, share of the run, and mean and largest time per step of
+  // each phase, and of the rest of each step, to std::cout.
+  void PrintSummary() const;
+
+  // Writes one comma-separated line per ended time step, holding its
+  // simulated time, the seconds spent in each phase, and its wall time, under
+  // a line of column names, to the file named |file_name|. Returns whether
+  // the file was written.
+  bool WriteCsv(const std::string& file_name) const;
+
+ private:
+  // Don't allow copy constructor to be called.
+  PhaseProfiler(const PhaseProfiler& other);
+
+  // Don't allow copy-assignment operator to be called.
+  PhaseProfiler& operator=(const PhaseProfiler& other);
+
+  // Simulated time each ended step started at, and its wall time in seconds
+  std::vector<double> step_times_;
+  std::vector<double> step_seconds_;
+
+  // Seconds spent in each phase of each ended step, one step's
+  // NUM_SIMULATION_PHASES values after another
+  std::vector<double> phase_seconds_;
+
+  // Seconds spent in each phase of the current step so far, and when it
+  // started
+  double current_seconds_[NUM_SIMULATION_PHASES];
+  std::chrono::steady_clock::time_point step_start_;
+};
+
+#ifndef NO_PHASE_TIMERS
+
+// Adds the wall time from its creation to its destruction to one phase of the
+// current time step of a PhaseProfiler
+class ScopedPhaseTimer {
+ public:
+  // Starts timing |phase| for |profiler|, which may be NULL to time nothing.
+  ScopedPhaseTimer(SimulationPhase phase, PhaseProfiler* profiler)
+      : phase_(phase), profiler_(profiler) {
+    if (profiler_) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  // Stops timing and records the time.
+  ~ScopedPhaseTimer() {
+    if (profiler_) {
+      profiler_->Add(phase_, std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start_)
+                                 .count());
+    }
+  }
+
+ private:
+  // Don't allow copy constructor to be called.
+  ScopedPhaseTimer(const ScopedPhaseTimer& other);
+
+  // Don't allow copy-assignment operator to be called.
+  ScopedPhaseTimer& operator=(const ScopedPhaseTimer& other);
+
+  const SimulationPhase phase_;
+  PhaseProfiler* const profiler_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#else
+
+// Compiled-out timer that records nothing
+class ScopedPhaseTimer {
+ public:
+  ScopedPhaseTimer(SimulationPhase, PhaseProfiler*) {}
+};
+
+#endif  // NO_PHASE_TIMERS
+
+#endif  // PHASE_PROFILER_H_
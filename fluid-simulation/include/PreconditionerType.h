@@ -0,0 +1,8 @@
+#ifndef PRECONDITIONER_TYPE_H_
+#define PRECONDITIONER_TYPE_H_
+
+// Used to choose how the Conjugate Gradient Algorithm in PressureSolver is
+// preconditioned
+enum PreconditionerType { NO_PRECONDITIONER, MIC0, MULTIGRID };
+
+#endif  // PRECONDITIONER_TYPE_H_
@@ -0,0 +1,130 @@
+#ifndef PRESSURE_KERNELS_H_
+#define PRESSURE_KERNELS_H_
+
+#include <vector>
+
+#include "Array3D.h"
+#include "FluidCellIndex.h"
+#include "MaterialType.h"
+#include "PressureMatrix.h"
+#include "SimdInstructionSet.h"
+#include "ThreadPool.h"
+
+// Grid sweeps of the Conjugate Gradient Algorithm in PressureSolver
+//
+// Every kernel only touches the interior cells of its arrays, i.e., all but the
+// outer layer of cells, and splits slabs of consecutive i indices among the
+// threads of |pool|. Reductions sum one partial per i-slice and then add the
+// slice sums in order of i, so their results don't depend on the number of
+// threads.
+//
+// Vectors are stored as |T|, double or float, but every kernel computes and
+// accumulates in double, so only the stored values are rounded to |T|. The
+// kernels are instantiated for both types in PressureKernels.cpp.
+
+// Sets |*r| to 0.0 in each cell that isn't FLUID according to |labels|, and to
+// the negation of the divergence of the fluid velocity (|u|, |v|, |w|) across
+// the cell otherwise.
+template <typename T>
+void MakeResidualFromVelocityDivergence(const Array3D<MaterialType>& labels,
+                                        const Array3D<T>& u,
+                                        const Array3D<T>& v,
+                                        const Array3D<T>& w, ThreadPool* pool,
+                                        Array3D<T>* r);
+
+// Computes |*q| = A * |d| where A is the pressure projection matrix described
+// by |neighbors|, as made by MakeNeighborMaterialInfo.
+//
+// This kernel and the next two are also instantiated for arrays with
+// BRICKED_LAYOUT, which PressureKernelBenchmark compares against the linear
+// layout the simulation uses.
+template <typename T, Array3DLayout L>
+void ATimes(const Array3D<T, L>& d,
+            const Array3D<unsigned short, L>& neighbors, ThreadPool* pool,
+            Array3D<T, L>* q);
+
+// Same as ATimes, and also returns the dot product of |d| and |*q| computed in
+// the same sweep.
+template <typename T, Array3DLayout L>
+double ATimesAndDot(const Array3D<T, L>& d,
+                    const Array3D<unsigned short, L>& neighbors,
+                    ThreadPool* pool, Array3D<T, L>* q);
+
+// Sets |*p| += |alpha| * |d| and |*r| -= |alpha| * |q| in a single sweep, and
+// returns the dot product of the updated |*r| with itself.
+template <typename T, Array3DLayout L>
+double UpdatePressureAndResidual(double alpha, const Array3D<T, L>& d,
+                                 const Array3D<T, L>& q, ThreadPool* pool,
+                                 Array3D<T, L>* p, Array3D<T, L>* r);
+
+// Versions of ATimes and ATimesAndDot that multiply by the coefficient form of
+// A in |matrix|, as made by MakeNeighborMaterialInfo. Each k-row of the grid is
+// swept without branches, several cells at a time with the vector instructions
+// |simd|, which the CPU must support. |*q| doesn't depend on |simd|, but the
+// dot product of each row is summed in a different order with each.
+template <typename T>
+void ATimes(const PressureMatrix<T>& matrix, const Array3D<T>& d,
+            SimdInstructionSet simd, ThreadPool* pool, Array3D<T>* q);
+template <typename T>
+double ATimesAndDot(const PressureMatrix<T>& matrix, const Array3D<T>& d,
+                    SimdInstructionSet simd, ThreadPool* pool, Array3D<T>* q);
+
+// Returns the widest vector instructions the CPU running this program supports.
+SimdInstructionSet BestSimdInstructionSet();
+
+// Packed versions of the kernels above, which only visit the FLUID cells of
+// |cells| and store vectors as described in FluidCellIndex. Packed vectors must
+// have cells.size() + 1 entries, and the kernels never write the trailing one.
+//
+// The FLUID cells are split into blocks of a fixed size that are handed out to
+// the threads of |pool|. Reductions sum one partial per block and then add the
+// block sums in order, so their results don't depend on the number of threads.
+
+// Sets |*r| to the negation of the divergence of the fluid velocity (|u|, |v|,
+// |w|) across each FLUID cell.
+template <typename T>
+void MakePackedResidualFromVelocityDivergence(const FluidCellIndex& cells,
+                                              const Array3D<T>& u,
+                                              const Array3D<T>& v,
+                                              const Array3D<T>& w,
+                                              ThreadPool* pool,
+                                              std::vector<T>* r);
+
+// Computes |*q| = A * |d| and returns the dot product of |d| and |*q|.
+template <typename T>
+double PackedATimesAndDot(const FluidCellIndex& cells, const std::vector<T>& d,
+                          ThreadPool* pool, std::vector<T>* q);
+
+// Sets |*p| += |alpha| * |d| and |*r| -= |alpha| * |q|, and returns the dot
+// product of the updated |*r| with itself.
+template <typename T>
+double PackedUpdatePressureAndResidual(const FluidCellIndex& cells,
+                                       double alpha, const std::vector<T>& d,
+                                       const std::vector<T>& q,
+                                       ThreadPool* pool, std::vector<T>* p,
+                                       std::vector<T>* r);
+
+// Returns the dot product of |a1| and |a2|.
+template <typename T>
+double PackedDot(const FluidCellIndex& cells, const std::vector<T>& a1,
+                 const std::vector<T>& a2, ThreadPool* pool);
+
+// Sets |*out| = |a1| + |scalar| * |a2|. |*out| may be |a1| or |a2|.
+template <typename T>
+void PackedEqualsPlusTimes(const FluidCellIndex& cells,
+                           const std::vector<T>& a1, double scalar,
+                           const std::vector<T>& a2, ThreadPool* pool,
+                           std::vector<T>* out);
+
+// Sets |*packed| to the values of |dense| in the FLUID cells.
+template <typename T>
+void Pack(const FluidCellIndex& cells, const Array3D<T>& dense,
+          std::vector<T>* packed);
+
+// Sets the FLUID cells of |*dense| to the values of |packed|, leaving all other
+// cells untouched.
+template <typename T>
+void Unpack(const FluidCellIndex& cells, const std::vector<T>& packed,
+            Array3D<T>* dense);
+
+#endif  // PRESSURE_KERNELS_H_
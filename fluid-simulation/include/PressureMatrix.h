@@ -0,0 +1,50 @@
+#ifndef PRESSURE_MATRIX_H_
+#define PRESSURE_MATRIX_H_
+
+#include <cstddef>
+
+#include "Array3D.h"
+
+// The pressure projection matrix A stored as coefficient arrays, one entry per
+// grid cell, instead of as the neighbors bitmask made by
+// MakeNeighborMaterialInfo
+//
+// A is symmetric, so each coupling is stored once, by the cell on its lower
+// side: row (i, j, k) of A * d is
+//
+//   diag(i, j, k) * d(i, j, k)
+//     + plus_i(i, j, k) * d(i + 1, j, k) + plus_i(i - 1, j, k) * d(i - 1, j, k)
+//     + plus_j(i, j, k) * d(i, j + 1, k) + plus_j(i, j - 1, k) * d(i, j - 1, k)
+//     + plus_k(i, j, k) * d(i, j, k + 1) + plus_k(i, j, k - 1) * d(i, j, k - 1)
+//
+// Every term is present for every cell, so a sweep over A needs no branches and
+// can run on several consecutive k at once.
+template <typename T>
+struct PressureMatrix {
+  // Allocates coefficient arrays for a grid of |nx| x |ny| x |nz| cells,
+  // carved from |arena| if it isn't NULL.
+  PressureMatrix(std::size_t nx, std::size_t ny, std::size_t nz,
+                 Array3DArena* arena = NULL)
+      : diag(nx, ny, nz, arena),
+        plus_i(nx, ny, nz, arena),
+        plus_j(nx, ny, nz, arena),
+        plus_k(nx, ny, nz, arena) {}
+
+  // Returns the number of bytes an Array3DArena must set aside for the
+  // coefficient arrays of an |nx| x |ny| x |nz| grid.
+  static std::size_t ArenaBytes(std::size_t nx, std::size_t ny,
+                                std::size_t nz) {
+    return 4 * Array3D<T>::ArenaBytes(nx, ny, nz);
+  }
+
+  // Number of non-SOLID neighbors of each FLUID cell, and 0.0 elsewhere
+  Array3D<T> diag;
+
+  // -1.0 where the cell and its neighbor in the positive i, j, or k direction
+  // are both FLUID, and 0.0 elsewhere
+  Array3D<T> plus_i;
+  Array3D<T> plus_j;
+  Array3D<T> plus_k;
+};
+
+#endif  // PRESSURE_MATRIX_H_
@@ -0,0 +1,54 @@
+#ifndef PRESSURE_SOLVE_LOG_H_
+#define PRESSURE_SOLVE_LOG_H_
+
+#include <cstddef>
+#include <fstream>
+#include <string>
+
+#include "PressureSolver.h"
+
+// A record of how well the pressure solve of each time step converged, kept as
+// running totals and, optionally, written to a CSV file one line per solve as
+// the simulation goes
+class PressureSolveLog {
+ public:
+  // Creates a log that writes to the file named |file_name|, or to no file if
+  // it is empty. The file starts over with a line of column names, unless
+  // |append| is set, as it is when a simulation resumes from a checkpoint, in
+  // which case the lines already in it are kept.
+  PressureSolveLog(const std::string& file_name, bool append);
+
+  // Closes the file, if any.
+  ~PressureSolveLog();
+
+  // Records |stats| of the pressure solve of time step |step|, which started
+  // at simulated time |time|. Its line is flushed to the file at once, so the
+  // file covers every finished solve even if the simulation dies. A solve that
+  // didn't converge is also reported on std::cout.
+  void Add(std::size_t step, double time, const PressureSolveStats& stats);
+
+  // Number of solves recorded, and how many of them didn't converge
+  std::size_t num_solves() const { return num_solves_; }
+  std::size_t num_unconverged() const { return num_unconverged_; }
+
+  // Prints the number of solves, their mean and largest number of iterations,
+  // and how many didn't converge, to std::cout.
+  void PrintSummary() const;
+
+ private:
+  // Don't allow copy constructor to be called.
+  PressureSolveLog(const PressureSolveLog& other);
+
+  // Don't allow copy-assignment operator to be called.
+  PressureSolveLog& operator=(const PressureSolveLog& other);
+
+  const std::string file_name_;
+  std::ofstream file_;
+
+  std::size_t num_solves_;
+  std::size_t num_unconverged_;
+  std::size_t total_iterations_;
+  std::size_t max_iterations_;
+};
+
+#endif  // PRESSURE_SOLVE_LOG_H_
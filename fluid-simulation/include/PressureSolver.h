@@ -1,15 +1,92 @@
 #ifndef PRESSURE_SOLVER_H_
 #define PRESSURE_SOLVER_H_
 
+#include <cstddef>
+#include <memory>
+#include <vector>
+
 #include "Array3D.h"
+#include "FluidCellIndex.h"
 #include "MaterialType.h"
+#include "MultigridSolver.h"
+#include "PreconditionerType.h"
+#include "PressureMatrix.h"
+#include "PressureSolverMethod.h"
+#include "SimdInstructionSet.h"
+#include "ThreadPool.h"
+
+class CheckpointReader;
+class CheckpointWriter;
+
+// Settings controlling how a PressureSolver solves the pressure projection
+// equation
+struct PressureSolverOptions {
+  // Iterative method used to solve the equation
+  PressureSolverMethod method = CONJUGATE_GRADIENT;
+
+  // Preconditioner applied to the residual in each Conjugate Gradient step
+  PreconditionerType preconditioner = NO_PRECONDITIONER;
+
+  // Whether the Conjugate Gradient Algorithm stores its vectors packed over
+  // just the FLUID cells, as numbered by a FluidCellIndex, instead of over the
+  // whole grid. Multigrid V-cycles always run on the whole grid.
+  bool compact_fluid_cells = false;
+
+  // Whether each solve starts from the previous solve's pressures instead of
+  // from zero
+  bool warm_start = false;
+
+  // Whether the Conjugate Gradient Algorithm multiplies by A using the
+  // coefficient arrays of a PressureMatrix, swept with the widest vector
+  // instructions the CPU supports, instead of decoding the neighbors bitmask
+  // of each cell. The packed vectors of compact_fluid_cells have stencils of
+  // their own and ignore this.
+  bool vectorized_stencil = false;
+};
+
+// What one pressure solve did, and how close it got to the solution
+//
+// Residual norms are squared norms, r . r, of the residual vector of the
+// pressure projection equation: the quantity the Conjugate Gradient Algorithm
+// calls sigma when it has no preconditioner, and the one convergence is judged
+// by with any solver.
+struct PressureSolveStats {
+  // Number of Conjugate Gradient iterations or multigrid V-cycles run
+  std::size_t iterations = 0;
+
+  // Whether the final residual norm dropped to |tolerance|, rather than the
+  // solve giving up after its largest allowed number of iterations
+  bool converged = true;
+
+  // Squared norm of the right-hand side of the equation, which is the residual
+  // of a zero initial guess
+  double rhs_norm = 0.0;
+
+  // Squared residual norms of the initial guess and of the final pressures
+  double initial_residual_norm = 0.0;
+  double final_residual_norm = 0.0;
+
+  // Squared residual norm the solve stops at, relative to |rhs_norm|
+  double tolerance = 0.0;
+
+  // Number of FLUID cells, the unknowns of the equation
+  std::size_t num_fluid_cells = 0;
+
+  // Wall time of the solve
+  double seconds = 0.0;
+};
 
 // A data type that computes a 3D array of fluid pressure values that minimize
 // the divergence of the velocity field of a fluid in the next time step using
-// the Conjugate Gradient Algorithm and encapsulates (stores) auxiliary (helper)
+// the (preconditioned) Conjugate Gradient Algorithm, or multigrid V-cycles, and
+// encapsulates (stores) auxiliary (helper)
 // 3D arrays to perform this calculation
 //
-// Exactly one instance of this class shall be owned by a StaggeredGrid.
+// Exactly one instance of this class shall be owned by a StaggeredGrid, and it
+// stores its vectors as the same |T|, double or float, as that grid. Its dot
+// products are always accumulated in double. Only PressureSolver<double> and
+// PressureSolver<float> are instantiated, in PressureSolver.cpp.
+template <typename T>
 class PressureSolver {
  public:
   // Creates auxiliary (helper) 3D arrays for the Conjugate Gradient Algorithm
@@ -20,17 +97,56 @@ class PressureSolver {
   // pressure values of a StaggeredGrid's cells, and d is the "vector" of
   // scaled, flipped velocity divergence values for each cell. All arrays are
   // the same size as the StaggeredGrid that owns |this|: |nx| x |ny| x |nz|.
-  PressureSolver(std::size_t nx, std::size_t ny, std::size_t nz);
+  //
+  // The Conjugate Gradient kernels run on the threads of |thread_pool|, which
+  // must outlive |this|. If |arena| isn't NULL, the arrays are carved from it,
+  // and it must outlive |this| too.
+  PressureSolver(std::size_t nx, std::size_t ny, std::size_t nz,
+                 const PressureSolverOptions& options, ThreadPool* thread_pool,
+                 Array3DArena* arena = NULL);
+
+  // Returns the number of bytes an Array3DArena must set aside for the arrays
+  // of a PressureSolver created with these arguments.
+  static std::size_t ArenaBytes(std::size_t nx, std::size_t ny, std::size_t nz,
+                                const PressureSolverOptions& options);
 
   // Deallocates the data this grid stores.
   ~PressureSolver();
 
+  const PressureSolverOptions& options() const { return options_; }
+
+  // Norm of the residual of the last solve's initial guess, relative to the
+  // norm of the residual of a zero initial guess. Always 1.0 without a warm
+  // start.
+  double warm_start_residual_ratio() const {
+    return warm_start_residual_ratio_;
+  }
+
   // Computes pressure values for the grid cells to update grid velocities at
   // the next time step that are as divergence-free as possible.
-  void ProjectPressure(const Array3D<MaterialType>& labels,
-                       const Array3D<unsigned short>& neighbors,
-                       const Array3D<double>& u, const Array3D<double>& v,
-                       const Array3D<double>& w, Array3D<double>* p);
+  //
+  // With options().warm_start, |*p| must still hold the pressures of the
+  // previous call, as they are used as the initial guess.
+  //
+  // |fluid_cells| must have been built from |labels| and |neighbors| if
+  // options().compact_fluid_cells is set, and is ignored otherwise. Likewise,
+  // |matrix| must have been made along with |neighbors| if
+  // options().vectorized_stencil is set, and may be NULL otherwise.
+  //
+  // Returns the number of Conjugate Gradient iterations or multigrid V-cycles
+  // that were needed, along with how well the solve converged.
+  PressureSolveStats ProjectPressure(const Array3D<MaterialType>& labels,
+                                     const Array3D<unsigned short>& neighbors,
+                                     const FluidCellIndex& fluid_cells,
+                                     const PressureMatrix<T>* matrix,
+                                     const Array3D<T>& u, const Array3D<T>& v,
+                                     const Array3D<T>& w, Array3D<T>* p);
+
+  // Writes the state a warm start carries over to the next solve, apart from
+  // the pressures, to |*writer|, and restores it from |*reader|, on a solver
+  // created with the same arguments.
+  void WriteCheckpoint(CheckpointWriter* writer) const;
+  void ReadCheckpoint(CheckpointReader* reader);
 
  private:
   // Don't allow copy constructor to be called.
@@ -39,6 +155,69 @@ class PressureSolver {
   // Don't allow copy-assignment operator to be called.
   PressureSolver& operator=(const PressureSolver& other);
 
+  // Sets |*p| to the initial guess of the solve for the cells labeled in
+  // |labels|: zero, or, with a warm start, the previous pressures |*p| carried
+  // over to the current FLUID cells.
+  void MakeInitialGuess(const Array3D<MaterialType>& labels,
+                        Array3D<T>* p);
+
+  // Sets |*q| = A * |d| and returns the dot product of |d| and |*q|, using
+  // |matrix| or |neighbors| to describe A as chosen in |options_|.
+  double MultiplyByA(const Array3D<unsigned short>& neighbors,
+                     const PressureMatrix<T>* matrix, const Array3D<T>& d,
+                     Array3D<T>* q);
+
+  // Same as ProjectPressure, apart from timing the solve, on vectors over the
+  // whole grid, setting |*stats|.
+  void ProjectGridPressure(const Array3D<MaterialType>& labels,
+                           const Array3D<unsigned short>& neighbors,
+                           const PressureMatrix<T>* matrix,
+                           const Array3D<T>& u, const Array3D<T>& v,
+                           const Array3D<T>& w, Array3D<T>* p,
+                           PressureSolveStats* stats);
+
+  // Same as ProjectGridPressure, with the Conjugate Gradient vectors packed
+  // over the FLUID cells of |cells|.
+  void ProjectPackedPressure(const Array3D<MaterialType>& labels,
+                             const FluidCellIndex& cells, const Array3D<T>& u,
+                             const Array3D<T>& v, const Array3D<T>& w,
+                             Array3D<T>* p, PressureSolveStats* stats);
+
+  // Prepares the preconditioner chosen in |options_| for the pressure
+  // projection matrix A described by |labels| and |neighbors|.
+  void MakePreconditioner(const Array3D<MaterialType>& labels,
+                          const Array3D<unsigned short>& neighbors);
+
+  // Sets |z_| = M^-1 * |r_|, where M is the preconditioner chosen in
+  // |options_|.
+  void ApplyPreconditioner(const Array3D<unsigned short>& neighbors);
+
+  // Computes the modified incomplete Cholesky factor, MIC(0), of the pressure
+  // projection matrix A described by |neighbors| and stores the inverse of its
+  // diagonal in |precon_|.
+  void MakeMICPreconditioner(const Array3D<unsigned short>& neighbors);
+
+  // Sets |z_| = M^-1 * |r_|, where M = L * L^T is the MIC(0) approximation of
+  // A, by solving L * y = |r_| and then L^T * |z_| = y.
+  void ApplyMICPreconditioner(const Array3D<unsigned short>& neighbors);
+
+  // Packed versions of the four functions above, working on |packed_r_|,
+  // |packed_z_|, and |packed_precon_| over the FLUID cells of |cells|
+  void MakePackedPreconditioner(const Array3D<MaterialType>& labels,
+                                const FluidCellIndex& cells);
+  void ApplyPackedPreconditioner(const FluidCellIndex& cells);
+  void MakePackedMICPreconditioner(const FluidCellIndex& cells);
+  void ApplyPackedMICPreconditioner(const FluidCellIndex& cells);
+
+  // How the pressure projection equation is solved
+  const PressureSolverOptions options_;
+
+  // Threads the Conjugate Gradient kernels run on
+  ThreadPool* const thread_pool_;
+
+  // Vector instructions the PressureMatrix sweeps run on
+  const SimdInstructionSet simd_;
+
   // Number of rows of data this array stores (x or i direction)
   const std::size_t nx_;
 
@@ -49,15 +228,45 @@ class PressureSolver {
   const std::size_t nz_;
 
   // Residual values for pressure projection
-  Array3D<double> r_;
+  Array3D<T> r_;
 
   // Direction vectors used to "take steps" toward the minimum point of the
   // quadratic form for the pressure projection matrix equation
-  Array3D<double> d_;
+  Array3D<T> d_;
 
   // Matrix-mapped direction vector used to update the residual values in each
   // step of the Conjugate Gradient Algorithm
-  Array3D<double> q_;
+  Array3D<T> q_;
+
+  // Preconditioned residual values, M^-1 * r, where M approximates A
+  Array3D<T> z_;
+
+  // Reciprocal of the diagonal of the incomplete Cholesky factor of A
+  Array3D<T> precon_;
+
+  // Packed counterparts of |*p|, |r_|, |d_|, |q_|, |z_|, and |precon_|, used
+  // instead of them when options_.compact_fluid_cells is set
+  std::vector<T> packed_p_;
+  std::vector<T> packed_r_;
+  std::vector<T> packed_d_;
+  std::vector<T> packed_q_;
+  std::vector<T> packed_z_;
+  std::vector<T> packed_precon_;
+
+  // Copy of the previous solve's pressures, and the cell labels it was solved
+  // for, only allocated for a warm start
+  std::unique_ptr<Array3D<T>> previous_p_;
+  std::unique_ptr<Array3D<MaterialType>> previous_labels_;
+
+  // Whether |previous_labels_| holds the labels of a previous solve
+  bool has_previous_pressure_;
+
+  // See warm_start_residual_ratio().
+  double warm_start_residual_ratio_;
+
+  // Multigrid hierarchy, only allocated when multigrid is used as the solver or
+  // the preconditioner
+  std::unique_ptr<MultigridSolver<T>> multigrid_;
 };
 
 #endif  // PRESSURE_SOLVER_H_
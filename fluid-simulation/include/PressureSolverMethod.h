@@ -0,0 +1,8 @@
+#ifndef PRESSURE_SOLVER_METHOD_H_
+#define PRESSURE_SOLVER_METHOD_H_
+
+// Used to choose the iterative method PressureSolver uses to solve the
+// pressure projection equation
+enum PressureSolverMethod { CONJUGATE_GRADIENT, MULTIGRID_V_CYCLES };
+
+#endif  // PRESSURE_SOLVER_METHOD_H_
@@ -0,0 +1,8 @@
+#ifndef SCALAR_PRECISION_H_
+#define SCALAR_PRECISION_H_
+
+// Used to choose whether a simulation stores its grid quantities, and the
+// vectors of its pressure solve, as double or float
+enum ScalarPrecision { DOUBLE_PRECISION, SINGLE_PRECISION };
+
+#endif  // SCALAR_PRECISION_H_
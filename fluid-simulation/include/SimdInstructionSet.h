@@ -0,0 +1,8 @@
+#ifndef SIMD_INSTRUCTION_SET_H_
+#define SIMD_INSTRUCTION_SET_H_
+
+// Used to choose which vector instructions the stencil sweeps over a
+// PressureMatrix run on
+enum SimdInstructionSet { NO_SIMD, SSE2_SIMD, AVX2_SIMD };
+
+#endif  // SIMD_INSTRUCTION_SET_H_
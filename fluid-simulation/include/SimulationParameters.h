@@ -2,7 +2,18 @@
 #define SIMULATION_PARAMETERS_H_
 
 #include <Eigen/Dense>
+#include <cstdint>
 #include <string>
+#include <vector>
+
+#include "Checkpoint.h"
+#include "OutputFormat.h"
+#include "ParticleEmitter.h"
+#include "ParticleSorter.h"
+#include "PressureSolver.h"
+#include "ScalarPrecision.h"
+#include "StaggeredGrid.h"
+#include "TimeStepper.h"
 
 // A data type holding configuration settings for a FLIP/PIC simulation
 class SimulationParameters {
@@ -13,7 +24,22 @@ class SimulationParameters {
                        const Eigen::Matrix<std::size_t, 3, 1>& dimensions,
                        double dx, const Eigen::Vector3d& lc, double flip_ratio,
                        const std::string& input_file,
-                       const std::string& output_file_name_pattern);
+                       const std::vector<ParticleEmitter>& emitters,
+                       std::uint64_t emitter_seed,
+                       const std::string& output_file_name_pattern,
+                       const PressureSolverOptions& pressure_solver_options,
+                       std::size_t num_threads, ScalarPrecision precision,
+                       bool contiguous_grid_arrays,
+                       bool incremental_cell_labels,
+                       bool active_region_sweeps,
+                       const ParticleSortOptions& particle_sort_options,
+                       const AdvectionOptions& advection_options,
+                       const TimeStepOptions& time_step_options,
+                       OutputFormat output_format, bool async_output,
+                       const CheckpointOptions& checkpoint_options,
+                       const std::string& timing_file_name,
+                       const std::string& solver_stats_file_name,
+                       const std::string& json_text);
 
   // Copy constructor
   // The C++ compiler should NOT invoke this copy constructor when doing this:
@@ -54,9 +80,16 @@ class SimulationParameters {
   SimulationParameters(const SimulationParameters& other);
 
   // Returns a new set of configuration settings for a simulation read from a
-  // .json file.
+  // .json file. If |precision_name| isn't empty, it replaces the precision
+  // named in the file.
   static SimulationParameters CreateFromJsonFile(
-      const std::string& input_file_path);
+      const std::string& input_file_path,
+      const std::string& precision_name = std::string());
+
+  // Same as above, with the settings read from the .json text |json_text|
+  static SimulationParameters CreateFromJson(
+      const std::string& json_text,
+      const std::string& precision_name = std::string());
 
   // Destroys this set of configuration settings.
   ~SimulationParameters();
@@ -71,9 +104,38 @@ class SimulationParameters {
   const Eigen::Vector3d& lc() const { return lc_; }
   double flip_ratio() const { return flip_ratio_; }
   const std::string& input_file() const { return input_file_; }
+  const std::vector<ParticleEmitter>& emitters() const { return emitters_; }
+  std::uint64_t emitter_seed() const { return emitter_seed_; }
   const std::string& output_file_name_pattern() const {
     return output_file_name_pattern_;
   }
+  const PressureSolverOptions& pressure_solver_options() const {
+    return pressure_solver_options_;
+  }
+  std::size_t num_threads() const { return num_threads_; }
+  ScalarPrecision precision() const { return precision_; }
+  bool contiguous_grid_arrays() const { return contiguous_grid_arrays_; }
+  bool incremental_cell_labels() const { return incremental_cell_labels_; }
+  bool active_region_sweeps() const { return active_region_sweeps_; }
+  const ParticleSortOptions& particle_sort_options() const {
+    return particle_sort_options_;
+  }
+  const AdvectionOptions& advection_options() const {
+    return advection_options_;
+  }
+  const TimeStepOptions& time_step_options() const {
+    return time_step_options_;
+  }
+  OutputFormat output_format() const { return output_format_; }
+  bool async_output() const { return async_output_; }
+  const CheckpointOptions& checkpoint_options() const {
+    return checkpoint_options_;
+  }
+  const std::string& timing_file_name() const { return timing_file_name_; }
+  const std::string& solver_stats_file_name() const {
+    return solver_stats_file_name_;
+  }
+  const std::string& json_text() const { return json_text_; }
 
  private:
   // Don't allow |this| to be assigned to another instance.
@@ -102,17 +164,78 @@ class SimulationParameters {
   // via viscosity, but more proneness to noise
   const double flip_ratio_;
 
-  // Input .json file containing initial particle positions and velocities
+  // Input file containing initial particle positions and velocities, or
+  // empty to start from the emitted particles alone
   const std::string input_file_;
 
+  // Regions filled with particles, after those of |input_file_|, at the start
+  // of the simulation
+  const std::vector<ParticleEmitter> emitters_;
+
+  // Seed of the random jitter of the emitted particles
+  const std::uint64_t emitter_seed_;
+
   // Naming pattern for particle position data files output from the
   // simulation; e.g., "fluid%03d.txt" will lead to output files named
   // "fluid_001.txt", "fluid_002.txt", etc.
   const std::string output_file_name_pattern_;
+
+  // How the pressure projection equation is solved in each time step
+  const PressureSolverOptions pressure_solver_options_;
+
+  // Number of threads that run grid sweeps, or zero to use every hardware
+  // thread
+  const std::size_t num_threads_;
+
+  // Whether grid quantities are stored as double or float
+  const ScalarPrecision precision_;
+
+  // Whether the grid's arrays are carved from one contiguous arena
+  const bool contiguous_grid_arrays_;
+
+  // Whether the grid only relabels cells whose particle occupancy changed
+  const bool incremental_cell_labels_;
+
+  // Whether grid velocity sweeps only visit the box around the FLUID cells
+  const bool active_region_sweeps_;
+
+  // How often particles are reordered by grid cell
+  const ParticleSortOptions particle_sort_options_;
+
+  // How particles are advected through the grid velocities
+  const AdvectionOptions advection_options_;
+
+  // Whether time steps adapt to the grid velocities instead of lasting
+  // |dt_seconds_|
+  const TimeStepOptions time_step_options_;
+
+  // Whether particle frames are written as text or in the binary particle
+  // frame format
+  const OutputFormat output_format_;
+
+  // Whether particle frames are written on a background thread while the
+  // simulation continues
+  const bool async_output_;
+
+  // How often the simulation saves a checkpoint to resume from, and where
+  const CheckpointOptions checkpoint_options_;
+
+  // File the time spent in each phase of each time step is written to, or
+  // empty to only print a summary
+  const std::string timing_file_name_;
+
+  // File the convergence of each time step's pressure solve is written to as
+  // it happens, or empty to write none
+  const std::string solver_stats_file_name_;
+
+  // The .json text these settings were read from, which checkpoints store so
+  // a resumed simulation runs with the same settings
+  const std::string json_text_;
 };
 
 // Reads a set of configuration settings from a file specified in a command-line
-// argument.
+// argument. An optional second argument, "double" or "float", overrides the
+// precision set in the file.
 SimulationParameters ReadSimulationParameters(int argc, char** argv);
 
 #endif  // SIMULATION_PARAMETERS_H_
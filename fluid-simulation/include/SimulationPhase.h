@@ -0,0 +1,20 @@
+#ifndef SIMULATION_PHASE_H_
+#define SIMULATION_PHASE_H_
+
+// Used to name the phases of a simulation's time steps that a PhaseProfiler
+// times. NUM_SIMULATION_PHASES counts them.
+enum SimulationPhase {
+  ADVECTION_PHASE,
+  PARTICLE_SORT_PHASE,
+  PARTICLES_TO_GRID_PHASE,
+  GRAVITY_PHASE,
+  NEIGHBOR_INFO_PHASE,
+  PRESSURE_SOLVE_PHASE,
+  PRESSURE_GRADIENT_PHASE,
+  GRID_TO_PARTICLES_PHASE,
+  FRAME_OUTPUT_PHASE,
+  CHECKPOINT_PHASE,
+  NUM_SIMULATION_PHASES
+};
+
+#endif  // SIMULATION_PHASE_H_
@@ -3,16 +3,55 @@
 
 #include <Eigen/Dense>
 #include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <vector>
 
+#include "AdvectionScheme.h"
 #include "Array3D.h"
+#include "FluidCellIndex.h"
 #include "MaterialType.h"
 #include "Particle.h"
+#include "ParticleSet.h"
+#include "PhaseProfiler.h"
+#include "PressureMatrix.h"
 #include "PressureSolver.h"
+#include "ThreadPool.h"
+
+class CheckpointReader;
+class CheckpointWriter;
+
+// Settings controlling how a StaggeredGrid advects particles
+struct AdvectionOptions {
+  // Scheme that integrates each advection substep: forward Euler, the
+  // midpoint method, or Ralston's third-order method
+  AdvectionScheme scheme = FORWARD_EULER;
+
+  // Largest number of grid cells a particle moving at the grid's top speed may
+  // cross in one substep. Each time step is split into as many equal substeps
+  // as that takes. Zero always advects in a single step.
+  double max_cfl = 0.0;
+};
+
+// A box of grid cells: those whose index along each axis a is in
+// [begin[a], end[a])
+struct CellBox {
+  std::size_t begin[3];
+  std::size_t end[3];
+};
 
 // A data type representing a grid with velocity components defined at grid cell
 // boundaries and cell-specific values, including pressure, defined at grid cell
 // centers
+//
+// Grid quantities are stored as |T|, which is double or float. Storing them as
+// float halves the memory traffic of grid sweeps, while interpolation and the
+// reductions of the pressure solve are still computed in double.
+//
+// Only StaggeredGrid<double> and StaggeredGrid<float> are instantiated, in
+// StaggeredGrid.cpp, along with their batched particle transfers for
+// ParticleSet<double> and ParticleSet<float>.
+template <typename T>
 class StaggeredGrid {
  public:
   // Allocates a 3D staggered grid storing the following quantities as
@@ -23,31 +62,86 @@ class StaggeredGrid {
   // - |nx| x |ny| x |nz + 1| array of depth fluid velocities
   // - |lc| is the lower corner (min x, y, z) position of the grid
   // - |dx| is the grid cell width (side length)
+  // - |solver_options| configures the grid's PressureSolver
+  // - |num_threads| is the number of threads that run grid sweeps, or zero to
+  //   use every hardware thread
+  // - |contiguous_arrays| carves the grid's arrays, and its PressureSolver's,
+  //   from one contiguous arena instead of allocating each on its own
+  // - |advection_options| configures how particles are advected
+  // - |incremental_cell_labels| makes ParticlesToGrid(..) relabel only the
+  //   cells whose particle occupancy changed, and ProjectPressure() update
+  //   the neighbors info only around them, instead of redoing every cell
+  // - |active_region_sweeps| makes the grid velocity sweeps only visit a box
+  //   around the FLUID cells, outside of which every velocity stays zero
   StaggeredGrid(std::size_t nx, std::size_t ny, std::size_t nz,
-                const Eigen::Vector3d& lc, double dx);
+                const Eigen::Vector3d& lc, double dx,
+                const PressureSolverOptions& solver_options =
+                    PressureSolverOptions(),
+                std::size_t num_threads = 1u, bool contiguous_arrays = false,
+                const AdvectionOptions& advection_options =
+                    AdvectionOptions(),
+                bool incremental_cell_labels = false,
+                bool active_region_sweeps = false);
 
   // Deallocates the data this grid stores.
   ~StaggeredGrid();
 
-  const Array3D<double>& p() const { return p_; }
-  const Array3D<double>& u() const { return u_; }
-  const Array3D<double>& v() const { return v_; }
-  const Array3D<double>& w() const { return w_; }
+  const Array3D<T>& p() const { return p_; }
+  const Array3D<T>& u() const { return u_; }
+  const Array3D<T>& v() const { return v_; }
+  const Array3D<T>& w() const { return w_; }
   const Array3D<MaterialType>& cell_labels() const { return cell_labels_; }
+  const PressureSolver<T>& pressure_solver() const { return pressure_solver_; }
+
+  // Makes ProjectPressure() record the time of its phases in |*profiler|, or
+  // in no profiler if |profiler| is NULL, as it is to begin with.
+  void set_phase_profiler(PhaseProfiler* profiler) {
+    phase_profiler_ = profiler;
+  }
 
   // Advects velocity for a particle located at |pos|.
+  //
+  // The scheme and substeps follow the grid's AdvectionOptions. Choosing the
+  // number of substeps scans the grid velocities for their top speed, on every
+  // call, so advecting many particles is best left to AdvectParticles(..),
+  // which scans them once.
   Eigen::Vector3d Advect(const Eigen::Vector3d& pos, double dt) const;
 
+  // Returns an upper bound on the speed of any velocity interpolated from the
+  // current grid velocities.
+  double MaxSpeed() const;
+
   // Transfers particle velocities to this grid.
+  //
+  // On more than one thread, each thread splats onto its own slab of grid
+  // points along x, so the grid velocities are bit-identical for any number of
+  // threads.
   void ParticlesToGrid(const std::vector<Particle>& particles);
+  template <typename P>
+  void ParticlesToGrid(const ParticleSet<P>& particles);
+
+  // Moves every particle of |*particles| to where Advect(..) takes it, with the
+  // particles split among the grid's threads.
+  template <typename P>
+  void AdvectParticles(double dt, ParticleSet<P>* particles);
 
   // Subtracts |dt| times acceleration due to gravity to all vertical velocities
-  // in this grid.
+  // in this grid, or in its active region with active region sweeps.
   void ApplyGravity(double dt);
 
   // Computes pressure values for the grid cells to update grid velocities at
   // the next time step that are as divergence-free as possible.
-  void ProjectPressure();
+  //
+  // Returns the number of Conjugate Gradient iterations or multigrid V-cycles
+  // that were needed, along with how well the solve converged.
+  PressureSolveStats ProjectPressure();
+
+  // Writes the grid quantities that carry over from one time step to the
+  // next--the velocities, pressures, velocities saved for FLIP, cell labels,
+  // and the pressure solver's warm start--to |*writer|, and restores them from
+  // |*reader|, on a grid created with the same arguments.
+  void WriteCheckpoint(CheckpointWriter* writer) const;
+  void ReadCheckpoint(CheckpointReader* reader);
 
   // Returns the velocity for a |particle| resulting from transferring grid
   // velocities back to the particle using the provided |flip_ratio| to combine
@@ -55,6 +149,26 @@ class StaggeredGrid {
   Eigen::Vector3d GridToParticle(double flip_ratio,
                                  const Particle& particle) const;
 
+  // Sets the velocity of every particle of |*particles| to what
+  // GridToParticle(..) returns for it, with the particles split among the
+  // grid's threads.
+  template <typename P>
+  void GridToParticles(double flip_ratio, ParticleSet<P>* particles);
+
+  // Does GridToParticles(|flip_ratio|, |particles|) and then
+  // AdvectParticles(|dt|, |particles|) in one pass, with the same results.
+  // The grid cell and interpolation weights of each particle in each
+  // staggered grid are computed once and shared by the old, current, and
+  // advecting interpolations, instead of three times.
+  //
+  // Since advection interpolates the current grid velocities, which don't
+  // change between the end of one time step and the start of the next, this
+  // can advect particles for the next time step as soon as the current one
+  // has projected pressure.
+  template <typename P>
+  void GridToParticlesAndAdvect(double flip_ratio, double dt,
+                                ParticleSet<P>* particles);
+
  private:
   // Don't allow copy constructor to be called.
   StaggeredGrid(const StaggeredGrid& other);
@@ -62,6 +176,11 @@ class StaggeredGrid {
   // Don't allow copy-assignment operator to be called.
   StaggeredGrid& operator=(const StaggeredGrid& other);
 
+  // Returns the number of bytes the arena of a grid created with these
+  // arguments must hold.
+  static std::size_t ArenaBytes(std::size_t nx, std::size_t ny, std::size_t nz,
+                                const PressureSolverOptions& solver_options);
+
   // Returns the result of interpolating grid velocities stored in |u_|, |v_|,
   // and |w_| at the point |pos|. These are the "current" grid velocities, which
   // change during a single time step of the simulation as boundary conditions
@@ -72,8 +191,24 @@ class StaggeredGrid {
   // Returns the result of interpolating the grid velocities stored in |u|, |v|,
   // and |w| at the point |pos|.
   Eigen::Vector3d InterpolateTheseGridVelocities(
-      const Eigen::Vector3d& pos, const Array3D<double>& u,
-      const Array3D<double>& v, const Array3D<double>& w) const;
+      const Eigen::Vector3d& pos, const Array3D<T>& u, const Array3D<T>& v,
+      const Array3D<T>& w) const;
+
+  // Returns the number of equal substeps that advecting particles by |dt|
+  // splits into, so that none crosses more than max_cfl grid cells in one.
+  std::size_t NumAdvectionSubsteps(double dt) const;
+
+  // Returns where |num_substeps| substeps, |dt| in all, take a particle at
+  // |pos|, where the current grid velocity is |velocity|.
+  Eigen::Vector3d AdvectSubsteps(const Eigen::Vector3d& pos,
+                                 const Eigen::Vector3d& velocity, double dt,
+                                 std::size_t num_substeps) const;
+
+  // Returns where one step of the advection scheme, of length |h|, takes a
+  // particle at |pos|, where the current grid velocity is |velocity|. Every
+  // intermediate position is clamped like the result.
+  Eigen::Vector3d AdvectStep(const Eigen::Vector3d& pos,
+                             const Eigen::Vector3d& velocity, double h) const;
 
   // Returns the result of clamping |pos| to stay within the non-SOLID cells
   // with a small floating-point buffer.
@@ -86,8 +221,53 @@ class StaggeredGrid {
   void SetInnerCellLabelsToEmpty();
 
   // Sets the label of the cell containing the particle with position |p_lc|
-  // relative to the grid's lower corner to |FLUID|.
-  void SetParticlesCellToFluid(const Eigen::Vector3d& p_lc);
+  // relative to the grid's lower corner to |FLUID|, if that cell is in the
+  // slab |i_begin| <= i < |i_end|.
+  void SetParticlesCellToFluid(const Eigen::Vector3d& p_lc,
+                               std::size_t i_begin, std::size_t i_end);
+
+  // Returns the label cell (|i|, |j|, |k|) has without particles: SOLID on
+  // the outer faces of the grid, and EMPTY inside.
+  MaterialType StaticCellLabel(std::size_t i, std::size_t j,
+                               std::size_t k) const;
+
+  // With incremental cell labels, restores the labels of the FLUID cells that
+  // no particle reached in the current ParticlesToGrid(..) call, and makes
+  // |fluid_cell_list_| the FLUID cells of this call.
+  void UpdateFluidCellList();
+
+  // With incremental cell labels, numbers the current FLUID cells as reached
+  // in the latest ParticlesToGrid(..) call, as after a checkpoint is read, and
+  // makes the next ProjectPressure() rebuild |neighbors_| for every cell.
+  void ResetIncrementalCellLabels();
+
+  // With active region sweeps, makes |active_region_| the box around the
+  // FLUID cells of the current ParticlesToGrid(..) call.
+  void UpdateActiveRegion();
+
+  // Transfers the velocities of |particles|, a std::vector<Particle> or a
+  // ParticleSet, to this grid.
+  template <typename Particles>
+  void TransferParticlesToGrid(const Particles& particles);
+
+  // Splats the velocity |vel| of the particle at |pos| onto the grid
+  // velocities, and marks its cell FLUID, within the slab
+  // |i_begin| <= i < |i_end|.
+  void SplatParticle(const Eigen::Vector3d& pos, const Eigen::Vector3d& vel,
+                     std::size_t i_begin, std::size_t i_end);
+
+  // Sets |*first_slab| and |*last_slab| to the first and last of the slabs
+  // of |splat_slab_width_| grid points along x that SplatParticle reaches for
+  // a particle at |pos|.
+  void GetSplatSlabs(const Eigen::Vector3d& pos, std::size_t* first_slab,
+                     std::size_t* last_slab) const;
+
+  // Lists, in |slab_particles_|, the indices of the |particles| reaching each
+  // slab of |splat_slab_width_| grid points along x, in increasing order.
+  //
+  // Returns the number of slabs.
+  template <typename Particles>
+  std::size_t BinParticlesBySlab(const Particles& particles);
 
   void NormalizeHorizontalVelocities();
   void NormalizeVerticalVelocities();
@@ -143,17 +323,21 @@ class StaggeredGrid {
   const Eigen::Vector3d half_shift_xz_;  // (dx_/2, 0, dx_/2)
   const Eigen::Vector3d half_shift_xy_;  // (dx_/2, dx_/2, 0)
 
+  // Block of memory the arrays below are carved from, only allocated if they
+  // are allocated contiguously
+  std::unique_ptr<Array3DArena> arena_;
+
   // 3D array of fluid pressures
-  Array3D<double> p_;
+  Array3D<T> p_;
 
   // 3D array of horizontal velocity components
-  Array3D<double> u_;
+  Array3D<T> u_;
 
   // 3D array of vertical velocity components
-  Array3D<double> v_;
+  Array3D<T> v_;
 
   // 3D array of depth (z direction) velocity components
-  Array3D<double> w_;
+  Array3D<T> w_;
 
   // Accumulated particle velocity-weights for each grid velocity component when
   // splatting is completed in the ParticlesToGrid function
@@ -163,21 +347,91 @@ class StaggeredGrid {
   // "old" velocities when transferring velocities from particles back to the
   // grid after the "current" velocities have become modified by boundary
   // condition enforcement, gravity application, and pressure projection.
-  Array3D<double> fu_;  // horizontal
-  Array3D<double> fv_;  // vertical
-  Array3D<double> fw_;  // depth
+  Array3D<T> fu_;  // horizontal
+  Array3D<T> fv_;  // vertical
+  Array3D<T> fw_;  // depth
 
   // Material type of each grid cell
   Array3D<MaterialType> cell_labels_;
 
+  // How particles are advected through the grid velocities
+  const AdvectionOptions advection_options_;
+
+  // Threads that grid sweeps are split among
+  ThreadPool thread_pool_;
+
+  // The next four variables are only used by ParticlesToGrid() on more than
+  // one thread.
+  //
+  // Width, in grid points along x, of the slabs that threads splat onto
+  const std::size_t splat_slab_width_;
+
+  // Indices of the particles reaching each slab, one slab's list after
+  // another, and the start of each slab's list within them
+  std::vector<std::size_t> slab_particles_;
+  std::vector<std::size_t> slab_starts_;
+
+  // Number of particles of each thread's chunk of particles reaching each
+  // slab, then the next position to fill in each slab's list
+  std::vector<std::size_t> chunk_slab_counts_;
+
   // The next four variables are only used by ProjectPressure().
   //
   // Indicator of fluid neighbors and counter of non-solid neighbors of grid
   // cells
   Array3D<unsigned short> neighbors_;
 
+  // Compact numbering of the FLUID cells, only rebuilt if the pressure solver
+  // packs its vectors over them
+  FluidCellIndex fluid_cells_;
+
+  // Coefficient arrays of the pressure projection matrix, only allocated if
+  // the pressure solver sweeps them with vector instructions
+  std::unique_ptr<PressureMatrix<T>> pressure_matrix_;
+
   // Updater of pressure in each time step
-  PressureSolver pressure_solver_;
+  PressureSolver<T> pressure_solver_;
+
+  // The next six variables are only used with incremental cell labels.
+  //
+  // Whether cell labels, and |neighbors_|, are only updated where particle
+  // occupancy changed
+  const bool incremental_cell_labels_;
+
+  // Number of the current ParticlesToGrid(..) call, and of the latest call
+  // each cell was reached by a particle in, only allocated for incremental
+  // cell labels
+  std::uint32_t label_pass_;
+  std::unique_ptr<Array3D<std::uint32_t>> cell_label_passes_;
+
+  // Cells, as indices (i * ny + j) * nz + k, that turned FLUID in the current
+  // ParticlesToGrid(..) call, one list per slab of |splat_slab_width_| grid
+  // points along x
+  std::vector<std::vector<std::size_t>> slab_new_fluid_cells_;
+
+  // Indices of the FLUID cells
+  std::vector<std::size_t> fluid_cell_list_;
+
+  // Indices of the cells relabeled since |neighbors_| was last updated, and
+  // whether every cell must be updated instead
+  std::vector<std::size_t> relabeled_cells_;
+  bool relabel_all_cells_;
+
+  // Whether grid velocity sweeps only visit |active_region_|
+  const bool active_region_sweeps_;
+
+  // Cells whose velocities the grid velocity sweeps visit: the whole grid,
+  // unless active region sweeps limit them to the FLUID cells' bounding box,
+  // grown by kActiveRegionMargin cells. Every velocity outside it is zero.
+  CellBox active_region_;
+
+  // Bounding box of the cells each slab of |splat_slab_width_| grid points
+  // along x marked FLUID in the current ParticlesToGrid(..) call, only used
+  // with active region sweeps
+  std::vector<CellBox> slab_fluid_boxes_;
+
+  // Where ProjectPressure() records the time of its phases, if anywhere
+  PhaseProfiler* phase_profiler_;
 };
 
 #endif  // STAGGERED_GRID_H_
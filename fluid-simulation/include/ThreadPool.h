@@ -0,0 +1,79 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that run loops over a range of indices split
+// into contiguous slabs, one slab per thread
+//
+// The calling thread always works on the first slab itself, so a ThreadPool
+// with one thread starts no workers and runs every loop inline.
+class ThreadPool {
+ public:
+  // Starts |num_threads| - 1 worker threads. If |num_threads| is zero, one
+  // thread per hardware thread is used.
+  explicit ThreadPool(std::size_t num_threads);
+
+  // Stops and joins the worker threads.
+  ~ThreadPool();
+
+  std::size_t num_threads() const { return num_threads_; }
+
+  // Splits [|begin|, |end|) into num_threads() contiguous slabs of nearly equal
+  // size and calls |fn|(slab_begin, slab_end) for each slab on its own thread.
+  // Returns once every slab is done.
+  //
+  // Slab boundaries only depend on |begin|, |end|, and num_threads(). |fn| must
+  // not call ParallelFor on this same pool.
+  void ParallelFor(std::size_t begin, std::size_t end,
+                   const std::function<void(std::size_t, std::size_t)>& fn);
+
+ private:
+  // Don't allow copy constructor to be called.
+  ThreadPool(const ThreadPool& other);
+
+  // Don't allow copy-assignment operator to be called.
+  ThreadPool& operator=(const ThreadPool& other);
+
+  // Waits for loops and runs slab |thread_index| of each one until the pool is
+  // destroyed.
+  void WorkerLoop(std::size_t thread_index);
+
+  // Runs slab |thread_index| of the current loop.
+  void RunSlab(std::size_t thread_index);
+
+  // Number of threads, including the calling thread
+  const std::size_t num_threads_;
+
+  std::vector<std::thread> workers_;
+
+  // Guards every member below
+  std::mutex mutex_;
+
+  // Signaled when a new loop is posted or the pool is stopping
+  std::condition_variable loop_posted_;
+
+  // Signaled when the last worker finishes its slab of the current loop
+  std::condition_variable loop_finished_;
+
+  // The current loop body and index range
+  const std::function<void(std::size_t, std::size_t)>* fn_;
+  std::size_t begin_;
+  std::size_t end_;
+
+  // Incremented each time a loop is posted so workers can tell loops apart
+  std::size_t generation_;
+
+  // Number of workers that haven't finished their slab of the current loop
+  std::size_t num_busy_workers_;
+
+  // Whether the destructor has asked the workers to exit
+  bool stopping_;
+};
+
+#endif  // THREAD_POOL_H_
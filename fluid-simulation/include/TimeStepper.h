@@ -0,0 +1,117 @@
+#ifndef TIME_STEPPER_H_
+#define TIME_STEPPER_H_
+
+#include <cstddef>
+#include <map>
+
+class CheckpointReader;
+class CheckpointWriter;
+
+// Settings controlling how a simulation sizes its time steps
+struct TimeStepOptions {
+  // Largest number of grid cells the grid's top speed may carry a particle in
+  // one time step, or zero to always step by the fixed time step
+  double cfl = 0.0;
+
+  // Bounds on adaptive time steps, in seconds, before they are shortened to
+  // fit a whole number of them into the rest of the frame
+  double min_dt = 0.0;
+  double max_dt = 1.0 / 30.0;
+};
+
+// Advances the time of a simulation that writes a frame every
+// |frame_seconds|, by fixed time steps or by time steps adapted to the speed
+// of its grid velocities, and counts the time steps in each frame
+//
+// With a fixed time step, frames are written once at least a frame's worth of
+// time steps has passed, as the simulator always has. Adaptive time steps are
+// evened out over the rest of each frame so that they land exactly on its
+// boundary.
+class TimeStepper {
+ public:
+  // Creates a stepper for a simulation lasting |duration| seconds on a grid of
+  // cell width |dx|, starting at time zero, that steps by |fixed_dt| seconds
+  // unless |options| sets a CFL number.
+  TimeStepper(double fixed_dt, double duration, double dx,
+              const TimeStepOptions& options, double frame_seconds);
+
+  // Destroys this stepper.
+  ~TimeStepper();
+
+  double time() const { return time_; }
+
+  // Size of the current time step, in seconds, as last set by ChooseStep(..)
+  double dt() const { return dt_; }
+
+  // Number of time steps taken so far
+  std::size_t step() const { return step_; }
+
+  // Number of frames written so far
+  std::size_t frame() const { return frame_; }
+
+  // Number of completed frames that took each number of time steps
+  const std::map<std::size_t, std::size_t>& steps_per_frame() const {
+    return steps_per_frame_;
+  }
+
+  // Returns whether the simulation has run for its whole duration.
+  bool Done() const { return !(time_ < duration_); }
+
+  // Returns whether a frame is due before the current time step.
+  bool FrameDue() const;
+
+  // Records that the frame due before the current time step was written.
+  void FrameWritten();
+
+  // Sets the size of the current time step for a grid whose velocities move
+  // no particle faster than |max_speed|.
+  void ChooseStep(double max_speed);
+
+  // Advances the time by the current time step.
+  void Advance();
+
+  // Writes the time, current time step, and frame counters to |*writer|, and
+  // restores them from |*reader|, on a stepper created with the same
+  // arguments.
+  void WriteCheckpoint(CheckpointWriter* writer) const;
+  void ReadCheckpoint(CheckpointReader* reader);
+
+ private:
+  // Don't allow copy constructor to be called.
+  TimeStepper(const TimeStepper& other);
+
+  // Don't allow copy-assignment operator to be called.
+  TimeStepper& operator=(const TimeStepper& other);
+
+  // Returns whether time steps adapt to the grid velocities.
+  bool adaptive() const { return options_.cfl > 0.0; }
+
+  const double fixed_dt_;
+  const double duration_;
+  const double dx_;
+  const TimeStepOptions options_;
+  const double frame_seconds_;
+
+  double time_;
+  double dt_;
+  std::size_t step_;
+  std::size_t frame_;
+
+  // With a fixed time step, the time left until the next frame is due, which
+  // falls below zero once it is
+  double frame_time_;
+
+  // With adaptive time steps, the index of the next frame boundary, whether
+  // the current time step ends exactly on it, and whether the time is on a
+  // frame boundary whose frame hasn't been written yet
+  std::size_t next_frame_;
+  bool lands_on_frame_;
+  bool frame_due_;
+
+  // Step at which the last frame was written
+  std::size_t frame_start_step_;
+
+  std::map<std::size_t, std::size_t> steps_per_frame_;
+};
+
+#endif  // TIME_STEPPER_H_
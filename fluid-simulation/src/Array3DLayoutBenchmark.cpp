@@ -0,0 +1,216 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "Array3D.h"
+#include "MaterialType.h"
+#include "NeighborMaterialInfo.h"
+#include "PressureKernels.h"
+#include "ThreadPool.h"
+
+namespace {
+
+// Particles seeded per grid cell
+const std::size_t kParticlesPerCell = 8;
+
+// Seconds spent per Conjugate Gradient iteration and per particle transfer
+// pass, and their results, for one Array3D layout
+struct LayoutStats {
+  double cg_seconds;
+  double residual_norm;
+  double splat_seconds;
+  double gather_seconds;
+  double gathered_sum;
+};
+
+// Sets |*labels| to a cube of FLUID cells inside one layer of SOLID cells.
+void MakeFluidCube(Array3D<MaterialType>* labels) {
+  const std::size_t n = labels->nx();
+  for (std::size_t i = 0; i < n; i++) {
+    for (std::size_t j = 0; j < n; j++) {
+      for (std::size_t k = 0; k < n; k++) {
+        bool border = i == 0 || j == 0 || k == 0 || i == n - 1 ||
+                      j == n - 1 || k == n - 1;
+        (*labels)(i, j, k) = border ? SOLID : FLUID;
+      }
+    }
+  }
+}
+
+// Returns |num_particles| particle positions in grid cell units, spread
+// uniformly over the FLUID cells of a fluid cube of width |n| and stored in
+// random order, as they end up after particles have moved for a while.
+std::vector<double> MakeParticlePositions(std::size_t n,
+                                          std::size_t num_particles) {
+  std::mt19937 generator(1u);
+  std::uniform_real_distribution<double> position(1.0, n - 2.0);
+  std::vector<double> positions(3 * num_particles);
+  for (std::size_t n = 0; n < positions.size(); n++) {
+    positions[n] = position(generator);
+  }
+  return positions;
+}
+
+// Adds the trilinear weights of the point |x| (in grid cell units) times
+// |value| to |*grid|, and the weights themselves to |*weights|, like
+// StaggeredGrid's Splat.
+template <Array3DLayout L>
+inline void Splat(const double* x, double value, Array3D<double, L>* grid,
+                  Array3D<double, L>* weights) {
+  std::size_t i = static_cast<std::size_t>(x[0]);
+  std::size_t j = static_cast<std::size_t>(x[1]);
+  std::size_t k = static_cast<std::size_t>(x[2]);
+  double w[3][2];
+  w[0][1] = x[0] - i;
+  w[1][1] = x[1] - j;
+  w[2][1] = x[2] - k;
+  for (std::size_t d = 0; d < 3; d++) {
+    w[d][0] = 1.0 - w[d][1];
+  }
+
+  for (std::size_t a = 0; a < 2; a++) {
+    for (std::size_t b = 0; b < 2; b++) {
+      for (std::size_t c = 0; c < 2; c++) {
+        double weight = w[0][a] * w[1][b] * w[2][c];
+        (*grid)(i + a, j + b, k + c) += weight * value;
+        (*weights)(i + a, j + b, k + c) += weight;
+      }
+    }
+  }
+}
+
+// Returns the trilinear interpolation of |grid| at the point |x| (in grid cell
+// units), like StaggeredGrid's InterpolateGridVelocities.
+template <Array3DLayout L>
+inline double Gather(const double* x, const Array3D<double, L>& grid) {
+  std::size_t i = static_cast<std::size_t>(x[0]);
+  std::size_t j = static_cast<std::size_t>(x[1]);
+  std::size_t k = static_cast<std::size_t>(x[2]);
+  double w[3][2];
+  w[0][1] = x[0] - i;
+  w[1][1] = x[1] - j;
+  w[2][1] = x[2] - k;
+  for (std::size_t d = 0; d < 3; d++) {
+    w[d][0] = 1.0 - w[d][1];
+  }
+
+  double value = 0.0;
+  for (std::size_t a = 0; a < 2; a++) {
+    for (std::size_t b = 0; b < 2; b++) {
+      for (std::size_t c = 0; c < 2; c++) {
+        value += w[0][a] * w[1][b] * w[2][c] * grid(i + a, j + b, k + c);
+      }
+    }
+  }
+  return value;
+}
+
+// Runs |num_iters| Conjugate Gradient iterations with the fused kernels
+// PressureSolver uses, and one particle-to-grid and one grid-to-particle pass
+// over the particles at |positions|, on arrays with layout |L|.
+template <Array3DLayout L>
+LayoutStats RunLayout(const Array3D<unsigned short>& linear_neighbors,
+                      const std::vector<double>& positions,
+                      std::size_t num_iters, ThreadPool* pool) {
+  const std::size_t n = linear_neighbors.nx();
+  Array3D<unsigned short, L> neighbors(n, n, n);
+  Array3D<double, L> p(n, n, n);
+  Array3D<double, L> r(n, n, n);
+  Array3D<double, L> d(n, n, n);
+  Array3D<double, L> q(n, n, n);
+  p = 0.0;
+  q = 0.0;
+  r = 0.0;
+  for (std::size_t i = 0; i < n; i++) {
+    for (std::size_t j = 0; j < n; j++) {
+      for (std::size_t k = 0; k < n; k++) {
+        neighbors(i, j, k) = linear_neighbors(i, j, k);
+        if (neighbors(i, j, k)) {
+          r(i, j, k) = static_cast<double>((i * 7 + j * 3 + k) % 11) - 5;
+        }
+      }
+    }
+  }
+  d.SetEqualTo(r);
+
+  LayoutStats stats;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  double sigma = Dot(r, r, pool);
+  for (std::size_t iter = 0; iter < num_iters; iter++) {
+    double alpha = sigma / ATimesAndDot(d, neighbors, pool, &q);
+    double sigma_old = sigma;
+    sigma = UpdatePressureAndResidual(alpha, d, q, pool, &p, &r);
+    d.EqualsPlusTimes(r, sigma / sigma_old, d, pool);
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  stats.cg_seconds = elapsed.count() / num_iters;
+  stats.residual_norm = sigma;
+
+  // The pressure arrays double as the splatted quantity and its weights.
+  const std::size_t num_particles = positions.size() / 3;
+  p = 0.0;
+  q = 0.0;
+  start = std::chrono::steady_clock::now();
+  for (std::size_t n = 0; n < num_particles; n++) {
+    Splat(&positions[3 * n], positions[3 * n + 2], &p, &q);
+  }
+  elapsed = std::chrono::steady_clock::now() - start;
+  stats.splat_seconds = elapsed.count();
+
+  stats.gathered_sum = 0.0;
+  start = std::chrono::steady_clock::now();
+  for (std::size_t n = 0; n < num_particles; n++) {
+    stats.gathered_sum += Gather(&positions[3 * n], p);
+  }
+  elapsed = std::chrono::steady_clock::now() - start;
+  stats.gather_seconds = elapsed.count();
+
+  return stats;
+}
+
+void PrintStats(const char* name, const LayoutStats& stats) {
+  std::cout << name << ": " << 1000.0 * stats.cg_seconds
+            << " ms per CG iteration (final r.r " << stats.residual_norm
+            << "), " << 1000.0 * stats.splat_seconds << " ms per splat, "
+            << 1000.0 * stats.gather_seconds << " ms per gather (sum "
+            << stats.gathered_sum << ")" << std::endl;
+}
+
+}  // namespace
+
+// Compares Array3D's linear and bricked layouts on the Conjugate Gradient
+// kernels of the pressure solve and on trilinear particle-to-grid and
+// grid-to-particle transfers, on a cube of FLUID cells holding randomly ordered
+// particles.
+//
+// Usage: ./Array3DLayoutBenchmark [n] [num_iters] [num_threads]
+int main(int argc, char** argv) {
+  std::size_t n = argc >= 2 ? std::strtoul(argv[1], NULL, 10) : 128u;
+  std::size_t num_iters = argc >= 3 ? std::strtoul(argv[2], NULL, 10) : 20u;
+  std::size_t num_threads = argc >= 4 ? std::strtoul(argv[3], NULL, 10) : 1u;
+
+  ThreadPool pool(num_threads);
+  const std::size_t num_particles = kParticlesPerCell * (n - 2) * (n - 2) *
+                                    (n - 2);
+  std::cout << "Layouts on a " << n << " x " << n << " x " << n << " grid, "
+            << num_iters << " CG iterations, " << num_particles
+            << " particles, " << pool.num_threads() << " threads, "
+            << kArray3DBrickSize << "^3 bricks" << std::endl;
+
+  Array3D<MaterialType> labels(n, n, n);
+  MakeFluidCube(&labels);
+  Array3D<unsigned short> neighbors(n, n, n);
+  MakeNeighborMaterialInfo(labels, &neighbors);
+  std::vector<double> positions = MakeParticlePositions(n, num_particles);
+
+  PrintStats("Linear ",
+             RunLayout<LINEAR_LAYOUT>(neighbors, positions, num_iters, &pool));
+  PrintStats("Bricked",
+             RunLayout<BRICKED_LAYOUT>(neighbors, positions, num_iters, &pool));
+
+  return EXIT_SUCCESS;
+}
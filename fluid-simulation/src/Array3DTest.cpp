@@ -1,4 +1,6 @@
+#include <cstdint>
 #include <iostream>
+#include <utility>
 
 #include "Array3D.h"
 
@@ -67,6 +69,172 @@ void CheckEqualsPlusTimes(const Array3D<int>* table_ptr) {
   std::cout << "All elements were -380, as expected." << std::endl;
 }
 
+// Fills |*table_ptr| with values that vary with each element's indices.
+void FillWithPattern(Array3D<double>* table_ptr, double scale) {
+  for (std::size_t i = 0; i < table_ptr->nx(); i++) {
+    for (std::size_t j = 0; j < table_ptr->ny(); j++) {
+      for (std::size_t k = 0; k < table_ptr->nz(); k++) {
+        (*table_ptr)(i, j, k) = scale * (0.1 * i - 0.37 * j + 1.0 / (k + 1));
+      }
+    }
+  }
+}
+
+// Reports whether |table1| and |table2|, the result of |operation|, are exactly
+// equal.
+void CheckEqual(const Array3D<double>& table1, const Array3D<double>& table2,
+                const char* operation) {
+  for (std::size_t i = 0; i < table1.nx(); i++) {
+    for (std::size_t j = 0; j < table1.ny(); j++) {
+      for (std::size_t k = 0; k < table1.nz(); k++) {
+        if (table1(i, j, k) != table2(i, j, k)) {
+          std::cout << "ERROR: " << operation
+                    << " differs at element (" << i << ", " << j << ", " << k
+                    << ")!" << std::endl;
+          return;
+        }
+      }
+    }
+  }
+
+  std::cout << operation << " is correct!" << std::endl;
+}
+
+// Checks the multithreaded kernels against the single-threaded ones.
+void TestMultithreadedKernels() {
+  ThreadPool pool(3);
+
+  Array3D<double> a(11, 6, 7);
+  Array3D<double> b(11, 6, 7);
+  Array3D<double> serial(11, 6, 7);
+  Array3D<double> parallel(11, 6, 7);
+  FillWithPattern(&a, 1.0);
+  FillWithPattern(&b, -2.5);
+
+  serial.SetEqualTo(a);
+  serial.PlusEquals(0.3, b);
+  parallel.SetEqualTo(a);
+  parallel.PlusEquals(0.3, b, &pool);
+  CheckEqual(serial, parallel, "Multithreaded PlusEquals");
+
+  serial.EqualsPlusTimes(a, -1.7, b);
+  parallel.EqualsPlusTimes(a, -1.7, b, &pool);
+  CheckEqual(serial, parallel, "Multithreaded EqualsPlusTimes");
+
+  // The multithreaded dot product must not depend on the number of threads.
+  double single_thread_dot = 0.0;
+  for (std::size_t num_threads = 1; num_threads <= 5; num_threads++) {
+    ThreadPool dot_pool(num_threads);
+    double dot = Dot(a, b, &dot_pool);
+    if (num_threads == 1) {
+      single_thread_dot = dot;
+    } else if (dot != single_thread_dot) {
+      std::cout << "ERROR: Dot product with " << num_threads
+                << " threads differs from Dot product with 1 thread!"
+                << std::endl;
+      return;
+    }
+  }
+  std::cout << "Multithreaded Dot product is deterministic!" << std::endl;
+}
+
+// Checks that a bricked array, whose dimensions aren't multiples of the brick
+// size, stores each element apart from the others and computes the same
+// results as a linear array.
+void TestBrickedLayout() {
+  const std::size_t nx = 19, ny = 11, nz = 10;
+  ThreadPool pool(3);
+
+  Array3D<double> a(nx, ny, nz);
+  Array3D<double> b(nx, ny, nz);
+  Array3D<double, BRICKED_LAYOUT> bricked_a(nx, ny, nz);
+  Array3D<double, BRICKED_LAYOUT> bricked_b(nx, ny, nz);
+  for (std::size_t i = 0; i < nx; i++) {
+    for (std::size_t j = 0; j < ny; j++) {
+      for (std::size_t k = 0; k < nz; k++) {
+        // A different small integer per element, so any two elements stored
+        // in the same place would show, and so sums are exact in any order
+        a(i, j, k) = static_cast<double>((i * ny + j) * nz + k);
+        bricked_a(i, j, k) = a(i, j, k);
+        b(i, j, k) = static_cast<double>(k % 5) - 2.0;
+        bricked_b(i, j, k) = b(i, j, k);
+      }
+    }
+  }
+
+  a.PlusEquals(2.0, b, &pool);
+  bricked_a.PlusEquals(2.0, bricked_b, &pool);
+  b.EqualsPlusTimes(a, -3.0, b, &pool);
+  bricked_b.EqualsPlusTimes(bricked_a, -3.0, bricked_b, &pool);
+
+  for (std::size_t i = 0; i < nx; i++) {
+    for (std::size_t j = 0; j < ny; j++) {
+      for (std::size_t k = 0; k < nz; k++) {
+        if (bricked_a(i, j, k) != a(i, j, k) ||
+            bricked_b(i, j, k) != b(i, j, k)) {
+          std::cout << "ERROR: bricked array differs at element (" << i
+                    << ", " << j << ", " << k << ")!" << std::endl;
+          return;
+        }
+      }
+    }
+  }
+
+  double dot = Dot(a, b, &pool);
+  for (std::size_t num_threads = 1; num_threads <= 4; num_threads++) {
+    ThreadPool dot_pool(num_threads);
+    if (Dot(bricked_a, bricked_b, &dot_pool) != dot ||
+        Dot(bricked_a, bricked_b) != dot) {
+      std::cout << "ERROR: bricked Dot product is wrong with " << num_threads
+                << " threads!" << std::endl;
+      return;
+    }
+  }
+  std::cout << "Bricked layout is correct!" << std::endl;
+}
+
+// Checks that arrays start on a cache line, whether allocated on their own or
+// carved from an arena, and that moving an array keeps its elements.
+void TestAlignedAndMovableArrays() {
+  Array3D<double> a(5, 6, 7);
+  Array3D<unsigned short> b(5, 6, 7);
+  if (reinterpret_cast<std::uintptr_t>(&a(0, 0, 0)) % kArray3DAlignment != 0 ||
+      reinterpret_cast<std::uintptr_t>(&b(0, 0, 0)) % kArray3DAlignment != 0) {
+    std::cout << "ERROR: array isn't aligned!" << std::endl;
+    return;
+  }
+  FillWithPattern(&a, 1.0);
+  Array3D<double> expected(5, 6, 7);
+  expected.SetEqualTo(a);
+
+  Array3D<double> moved(std::move(a));
+  if (a.nx() != 0 || moved.nx() != 5 || moved.ny() != 6 || moved.nz() != 7) {
+    std::cout << "ERROR: move constructor is wrong!" << std::endl;
+    return;
+  }
+  CheckEqual(expected, moved, "Moved array");
+
+  Array3D<double> assigned(1, 1, 1);
+  assigned = std::move(moved);
+  CheckEqual(expected, assigned, "Move-assigned array");
+
+  Array3DArena arena(Array3D<double>::ArenaBytes(5, 6, 7) +
+                     Array3D<unsigned short>::ArenaBytes(3, 3, 3));
+  Array3D<unsigned short> small(3, 3, 3, &arena);
+  Array3D<double> carved(5, 6, 7, &arena);
+  if (arena.used() != arena.capacity() ||
+      reinterpret_cast<std::uintptr_t>(&small(0, 0, 0)) % kArray3DAlignment !=
+          0 ||
+      reinterpret_cast<std::uintptr_t>(&carved(0, 0, 0)) % kArray3DAlignment !=
+          0) {
+    std::cout << "ERROR: arena is laid out wrong!" << std::endl;
+    return;
+  }
+  small = 7;
+  carved.SetEqualTo(expected);
+  CheckEqual(expected, carved, "Arena array");
+}
+
 int main(int argc, char** argv) {
   // Create a 3 x 4 x 5 array of integers.
   Array3D<int> table(3, 4, 5);
@@ -117,5 +285,9 @@ int main(int argc, char** argv) {
     std::cout << "ERROR: Dot product is wrong!" << std::endl;
   }
 
+  TestMultithreadedKernels();
+  TestBrickedLayout();
+  TestAlignedAndMovableArrays();
+
   return 0;
 }
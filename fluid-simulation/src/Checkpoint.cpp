@@ -0,0 +1,125 @@
+#include "Checkpoint.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+const char kCheckpointMagic[8] = "FLUIDCK";
+
+// Writes the |num_bytes| bytes at |bytes| to the file named |file_name| and
+// flushes them to disk, returning whether that succeeded.
+bool WriteFileToDisk(const std::string& file_name, const char* bytes,
+                     std::size_t num_bytes) {
+  int fd = open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool written = true;
+  while (written && num_bytes > 0) {
+    ssize_t count = write(fd, bytes, num_bytes);
+    written = count > 0;
+    if (written) {
+      bytes += count;
+      num_bytes -= static_cast<std::size_t>(count);
+    }
+  }
+  written = written && fsync(fd) == 0;
+  return close(fd) == 0 && written;
+}
+
+}  // namespace
+
+CheckpointWriter::CheckpointWriter() {
+  WriteBytes(kCheckpointMagic, sizeof(kCheckpointMagic));
+  Write(kCheckpointVersion);
+}
+
+CheckpointWriter::~CheckpointWriter() {}
+
+void CheckpointWriter::WriteBytes(const void* bytes, std::size_t num_bytes) {
+  data_.append(static_cast<const char*>(bytes), num_bytes);
+}
+
+void CheckpointWriter::WriteString(const std::string& text) {
+  Write<std::uint64_t>(text.size());
+  WriteBytes(text.data(), text.size());
+}
+
+bool CheckpointWriter::Save(const std::string& file_name) const {
+  const std::string temporary_file_name = file_name + ".tmp";
+  if (!WriteFileToDisk(temporary_file_name, data_.data(), data_.size())) {
+    std::remove(temporary_file_name.c_str());
+    return false;
+  }
+  return std::rename(temporary_file_name.c_str(), file_name.c_str()) == 0;
+}
+
+CheckpointReader::CheckpointReader(const std::string& file_name)
+    : file_name_(file_name), position_(0) {
+  std::ifstream in(file_name.c_str(), std::ios::in | std::ios::binary);
+  if (!in) {
+    Fail("the file can't be opened");
+  }
+  in.seekg(0, std::ios::end);
+  std::streamoff size = in.tellg();
+  in.seekg(0, std::ios::beg);
+  data_.resize(size > 0 ? static_cast<std::size_t>(size) : 0);
+  if (!data_.empty()) {
+    in.read(&data_[0], data_.size());
+  }
+  if (!in) {
+    Fail("the file can't be read");
+  }
+
+  char magic[sizeof(kCheckpointMagic)];
+  ReadBytes(magic, sizeof(magic));
+  if (std::memcmp(magic, kCheckpointMagic, sizeof(magic)) != 0) {
+    Fail("it isn't a checkpoint");
+  }
+  std::uint32_t version = Read<std::uint32_t>();
+  if (version != kCheckpointVersion) {
+    Fail("it has unsupported version " + std::to_string(version));
+  }
+}
+
+CheckpointReader::~CheckpointReader() {}
+
+void CheckpointReader::ReadBytes(void* bytes, std::size_t num_bytes) {
+  if (num_bytes > data_.size() - position_) {
+    Fail("it ends early");
+  }
+  if (num_bytes > 0) {
+    std::memcpy(bytes, data_.data() + position_, num_bytes);
+  }
+  position_ += num_bytes;
+}
+
+std::string CheckpointReader::ReadString() {
+  std::uint64_t length = Read<std::uint64_t>();
+  if (length > data_.size() - position_) {
+    Fail("it ends early");
+  }
+  std::string text(data_, position_, static_cast<std::size_t>(length));
+  position_ += text.size();
+  return text;
+}
+
+void CheckpointReader::Finish() const {
+  if (position_ != data_.size()) {
+    Fail("it has " + std::to_string(data_.size() - position_) +
+         " bytes left over");
+  }
+}
+
+void CheckpointReader::Fail(const std::string& problem) const {
+  std::cout << "ERROR: can't read checkpoint " << file_name_ << ": " << problem
+            << "!" << std::endl;
+  std::abort();  // crash the program
+}
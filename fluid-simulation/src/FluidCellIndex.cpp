@@ -0,0 +1,65 @@
+#include "FluidCellIndex.h"
+
+#include <cassert>
+
+#include "NeighborDirection.h"
+
+// To disable assert*() calls, uncomment this line:
+// #define NDEBUG
+
+namespace {
+
+// Offsets from a cell to its neighbor in each of kNeighborDirections
+const int kNeighborOffsets[FluidCellIndex::kNumNeighbors][3] = {
+    {-1, 0, 0}, {0, -1, 0}, {0, 0, -1}, {1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+
+}  // namespace
+
+const std::size_t FluidCellIndex::kNumNeighbors;
+
+FluidCellIndex::FluidCellIndex(std::size_t nx, std::size_t ny, std::size_t nz)
+    : ny_(ny), nz_(nz), ny_nz_(ny * nz), packed_indices_(nx, ny, nz) {}
+
+FluidCellIndex::~FluidCellIndex() {}
+
+void FluidCellIndex::Build(const Array3D<MaterialType>& labels,
+                           const Array3D<unsigned short>& neighbors) {
+  const std::size_t nx = labels.nx();
+
+  // Number the FLUID cells in increasing (i, j, k) order.
+  cells_.clear();
+  stencils_.clear();
+  for (std::size_t i = 1; i < nx - 1; i++) {
+    for (std::size_t j = 1; j < ny_ - 1; j++) {
+      for (std::size_t k = 1; k < nz_ - 1; k++) {
+        if (labels(i, j, k) != FLUID) {
+          continue;
+        }
+        packed_indices_(i, j, k) = static_cast<std::uint32_t>(cells_.size());
+        cells_.push_back(i * ny_nz_ + j * nz_ + k);
+        stencils_.push_back(neighbors(i, j, k));
+      }
+    }
+  }
+
+  // The trailing zero entry must be addressable by a 32-bit neighbor index.
+  assert(cells_.size() < UINT32_MAX);
+  const std::uint32_t none = static_cast<std::uint32_t>(cells_.size());
+
+  // Look up the packed index of each FLUID neighbor. A neighbor direction bit
+  // is only ever set for a FLUID neighbor, which has been numbered above.
+  neighbor_cells_.resize(cells_.size() * kNumNeighbors);
+  for (std::size_t c = 0; c < cells_.size(); c++) {
+    std::size_t i, j, k;
+    GetCell(c, &i, &j, &k);
+    for (std::size_t n = 0; n < kNumNeighbors; n++) {
+      std::uint32_t neighbor = none;
+      if (stencils_[c] & kNeighborDirections[n]) {
+        neighbor = packed_indices_(i + kNeighborOffsets[n][0],
+                                   j + kNeighborOffsets[n][1],
+                                   k + kNeighborOffsets[n][2]);
+      }
+      neighbor_cells_[c * kNumNeighbors + n] = neighbor;
+    }
+  }
+}
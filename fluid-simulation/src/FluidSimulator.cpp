@@ -1,78 +1,253 @@
-#include <fstream>
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
+#include <string>
 #include <vector>
 
-#include "Particle.h"
+#include "Checkpoint.h"
+#include "FrameWriter.h"
+#include "ParticleEmitter.h"
+#include "ParticleFrame.h"
+#include "ParticleSet.h"
+#include "ParticleSorter.h"
+#include "PhaseProfiler.h"
+#include "PressureSolveLog.h"
 #include "SimulationParameters.h"
 #include "StaggeredGrid.h"
+#include "ThreadPool.h"
+#include "TimeStepper.h"
 
 namespace {
 
-void Write3d(const Eigen::Vector3d& vec, std::ofstream* out) {
-  (*out) << vec[0] << " " << vec[1] << " " << vec[2];
+// Saves everything a simulation configured by |params| needs to resume from
+// where it is now to its checkpoint file: the settings, then |stepper|,
+// |grid|, and |particles|.
+template <typename T>
+void SaveCheckpoint(const SimulationParameters& params,
+                    const TimeStepper& stepper, const StaggeredGrid<T>& grid,
+                    const ParticleSet<T>& particles) {
+  CheckpointWriter writer;
+  writer.Write<std::uint32_t>(sizeof(T));
+  writer.WriteString(params.json_text());
+  stepper.WriteCheckpoint(&writer);
+  grid.WriteCheckpoint(&writer);
+  writer.WriteParticles(particles);
+  if (!writer.Save(params.checkpoint_options().file_name)) {
+    std::cout << "ERROR: can't save checkpoint "
+              << params.checkpoint_options().file_name << "!" << std::endl;
+    return;
+  }
+  std::cout << "Saved checkpoint " << params.checkpoint_options().file_name
+            << " at frame " << stepper.frame() << ", " << stepper.time()
+            << " s" << std::endl;
 }
 
-// Writes the position and velocity of each particle to the file with the
-// specified |output_file_name|.
-void WriteParticles(const char* output_file_name,
-                    const std::vector<Particle>& particles) {
-  std::ofstream out(output_file_name, std::ios::out);
-  out << particles.size() << std::endl;
-  for (std::vector<Particle>::const_iterator p = particles.begin();
-       p != particles.end(); p++) {
-    Write3d(p->pos, &out);
-    out << " ";
-    Write3d(p->vel, &out);
-    out << std::endl;
+// Runs the simulation configured by |params| on a grid, and particles, storing
+// their quantities as |T| and writes the fluid particles of each frame to a
+// file.
+//
+// The simulation starts from the particles in the input file, or, if
+// |checkpoint| isn't NULL, from the rest of the checkpoint it reads, just
+// past the settings.
+template <typename T>
+void RunSimulation(const SimulationParameters& params,
+                   CheckpointReader* checkpoint) {
+  StaggeredGrid<T> grid(params.nx(), params.ny(), params.nz(), params.lc(),
+                        params.dx(), params.pressure_solver_options(),
+                        params.num_threads(),
+                        params.contiguous_grid_arrays(),
+                        params.advection_options(),
+                        params.incremental_cell_labels(),
+                        params.active_region_sweeps());
+
+  ParticleSet<T> particles;
+  ParticleSorter sorter(params.nx(), params.ny(), params.nz(), params.lc(),
+                        params.dx());
+
+  // Frames are written every 1/30 s, starting before the first time step.
+  TimeStepper stepper(params.dt_seconds(), params.duration_seconds(),
+                      params.dx(), params.time_step_options(), 1.0 / 30.0);
+
+  if (checkpoint) {
+    // Checkpoints are saved just before a frame is written, so the resumed
+    // simulation rewrites that frame and carries on as the original did.
+    stepper.ReadCheckpoint(checkpoint);
+    grid.ReadCheckpoint(checkpoint);
+    checkpoint->ReadParticles(&particles);
+    checkpoint->Finish();
+    std::cout << "Resumed from frame " << stepper.frame() << ", "
+              << stepper.time() << " s, with " << particles.size()
+              << " particles." << std::endl;
+  } else {
+    if (!params.input_file().empty()) {
+      ReadParticleFrame(params.input_file(), &particles);
+    }
+    {
+      ThreadPool thread_pool(params.num_threads());
+      EmitParticles(params.emitters(), params.emitter_seed(), params.nx(),
+                    params.ny(), params.nz(), params.lc(), params.dx(),
+                    &thread_pool, &particles);
+    }
+    grid.ParticlesToGrid(particles);
+    stepper.ChooseStep(grid.MaxSpeed());
   }
-  out.close();
-  std::cout << "Output file " << output_file_name << " saved." << std::endl;
-}
+  const std::size_t first_step = stepper.step();
+  const std::size_t checkpoint_interval =
+      params.checkpoint_options().interval;
 
-}  // namespace
+  PhaseProfiler profiler;
+  grid.set_phase_profiler(&profiler);
+  PressureSolveLog solve_log(params.solver_stats_file_name(),
+                             checkpoint != NULL);
 
-// Run a physics-based fluid simulation and print the resulting fluid particle
-// positions at each time step to files.
-int main(int argc, char** argv) {
-  SimulationParameters params = ReadSimulationParameters(argc, argv);
+  FrameWriter<T> writer(params.output_format(), params.async_output());
+  char output_file_name[100];
+  bool advected = false;
+  while (!stepper.Done()) {
+    const double step_time = stepper.time();
+    if (stepper.FrameDue()) {
+      if (checkpoint_interval > 0 && stepper.step() > first_step &&
+          stepper.frame() % checkpoint_interval == 0) {
+        ScopedPhaseTimer timer(CHECKPOINT_PHASE, &profiler);
+        SaveCheckpoint(params, stepper, grid, particles);
+      }
+
+      ScopedPhaseTimer timer(FRAME_OUTPUT_PHASE, &profiler);
+      sprintf(output_file_name, params.output_file_name_pattern().c_str(),
+              static_cast<int>(stepper.frame()));
+      writer.Write(output_file_name, particles, stepper.time());
+      stepper.FrameWritten();
+    }
 
-  StaggeredGrid grid(params.nx(), params.ny(), params.nz(), params.lc(),
-                     params.dx());
+    // Advect particles, unless the previous step already did.
+    if (!advected) {
+      ScopedPhaseTimer timer(ADVECTION_PHASE, &profiler);
+      grid.AdvectParticles(stepper.dt(), &particles);
+    }
 
-  std::vector<Particle> particles = ReadParticles(params.input_file());
+    // Keep particles that share grid cells next to each other in memory.
+    {
+      ScopedPhaseTimer timer(PARTICLE_SORT_PHASE, &profiler);
+      if (sorter.ShouldSort(params.particle_sort_options(), stepper.step(),
+                            particles)) {
+        sorter.Sort(&particles);
+      }
+    }
 
-  grid.ParticlesToGrid(particles);
+    {
+      ScopedPhaseTimer timer(PARTICLES_TO_GRID_PHASE, &profiler);
+      grid.ParticlesToGrid(particles);
+    }
 
-  char output_file_name[100];
-  int frame = 0;
-  const double kFirstPositiveFrameTime = 1.0 / 30.0 - 0.0001;
-  for (double time = 0.0, frame_time = -1.0; time < params.duration_seconds();
-       time += params.dt_seconds(), frame_time -= params.dt_seconds()) {
-    if (frame_time < 0.0) {
-      sprintf(output_file_name, params.output_file_name_pattern().c_str(),
-              frame);
-      WriteParticles(output_file_name, particles);
-      frame_time = kFirstPositiveFrameTime;
-      frame++;
+    {
+      ScopedPhaseTimer timer(GRAVITY_PHASE, &profiler);
+      grid.ApplyGravity(stepper.dt());
     }
 
-    // Advect particles
-    for (std::vector<Particle>::iterator p = particles.begin();
-         p != particles.end(); p++) {
-      p->pos = grid.Advect(p->pos, params.dt_seconds());
+    PressureSolveStats solve_stats = grid.ProjectPressure();
+    solve_log.Add(stepper.step(), step_time, solve_stats);
+    if (params.pressure_solver_options().warm_start) {
+      std::cout << "Step " << stepper.step() << ": " << solve_stats.iterations
+                << " pressure iterations, warm start residual "
+                << 100.0 * grid.pressure_solver().warm_start_residual_ratio()
+                << "% of cold start" << std::endl;
     }
 
-    grid.ParticlesToGrid(particles);
+    // The next step advects through the velocities just projected, so its
+    // size is known now.
+    stepper.Advance();
+    stepper.ChooseStep(grid.MaxSpeed());
+
+    // Advect particles for the next step along with transferring grid
+    // velocities to them, which shares the interpolation weights, unless the
+    // next step first writes out their current positions.
+    // The fused pass counts as GridToParticles time.
+    advected = !stepper.Done() && !stepper.FrameDue();
+    {
+      ScopedPhaseTimer timer(GRID_TO_PARTICLES_PHASE, &profiler);
+      if (advected) {
+        grid.GridToParticlesAndAdvect(params.flip_ratio(), stepper.dt(),
+                                      &particles);
+      } else {
+        grid.GridToParticles(params.flip_ratio(), &particles);
+      }
+    }
+    profiler.EndStep(step_time);
+  }
+
+  // Writing overlapped the simulation except while it waited on the writer.
+  writer.Finish();
+  double overlap_seconds =
+      params.async_output()
+          ? std::max(0.0, writer.write_seconds() - writer.stall_seconds())
+          : 0.0;
+  std::cout << "Wrote " << writer.num_frames() << " frames in "
+            << writer.write_seconds() << " s, " << overlap_seconds
+            << " s of it overlapped with the simulation; copying frames took "
+            << writer.copy_seconds() << " s and waiting for the writer "
+            << writer.stall_seconds() << " s" << std::endl;
+
+  std::cout << "Time steps per frame:" << std::endl;
+  for (const std::pair<const std::size_t, std::size_t>& bin :
+       stepper.steps_per_frame()) {
+    std::cout << "  " << bin.first << " steps: " << bin.second << " frames"
+              << std::endl;
+  }
+
+  solve_log.PrintSummary();
+  profiler.PrintSummary();
+  if (!params.timing_file_name().empty() && kPhaseTimersEnabled) {
+    if (profiler.WriteCsv(params.timing_file_name())) {
+      std::cout << "Timing file " << params.timing_file_name() << " saved."
+                << std::endl;
+    } else {
+      std::cout << "ERROR: can't write timing file "
+                << params.timing_file_name() << "!" << std::endl;
+    }
+  }
+}
 
-    grid.ApplyGravity(params.dt_seconds());
+// Runs the simulation configured by |params| in the precision it names.
+void RunSimulation(const SimulationParameters& params,
+                   CheckpointReader* checkpoint) {
+  switch (params.precision()) {
+    case DOUBLE_PRECISION:
+      RunSimulation<double>(params, checkpoint);
+      break;
+    case SINGLE_PRECISION:
+      RunSimulation<float>(params, checkpoint);
+      break;
+  }
+}
 
-    grid.ProjectPressure();
+}  // namespace
 
-    for (std::vector<Particle>::iterator p = particles.begin();
-         p != particles.end(); p++) {
-      p->vel = grid.GridToParticle(params.flip_ratio(), *p);
+// Run a physics-based fluid simulation and print the resulting fluid particle
+// positions at each time step to files.
+//
+// Usage: ./FluidSimulator [.json file path] [double|float]
+//        ./FluidSimulator --resume [checkpoint file path]
+int main(int argc, char** argv) {
+  if (argc >= 2 && std::string(argv[1]) == "--resume") {
+    if (argc < 3) {
+      std::cout << "ERROR: checkpoint file argument not found!" << std::endl;
+      std::cout << "Usage: ./FluidSimulator --resume [checkpoint file path]"
+                << std::endl;
+      return EXIT_FAILURE;
     }
+
+    // The checkpoint holds the settings of the simulation it was saved from.
+    CheckpointReader checkpoint(argv[2]);
+    const std::uint32_t scalar_bytes = checkpoint.Read<std::uint32_t>();
+    const std::string json_text = checkpoint.ReadString();
+    SimulationParameters params = SimulationParameters::CreateFromJson(
+        json_text, scalar_bytes == sizeof(float) ? "float" : "double");
+    RunSimulation(params, &checkpoint);
+    return EXIT_SUCCESS;
   }
 
+  SimulationParameters params = ReadSimulationParameters(argc, argv);
+  RunSimulation(params, NULL);
+
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,178 @@
+#include "FrameWriter.h"
+
+#include <cassert>
+#include <chrono>
+#include <iostream>
+
+#include "ParticleFrame.h"
+
+// To disable assert*() calls, uncomment this line:
+// #define NDEBUG
+
+namespace {
+
+// Returns the seconds elapsed since |start|.
+double SecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+}  // namespace
+
+template <typename T>
+FrameWriter<T>::FrameWriter(OutputFormat format, bool asynchronous,
+                            std::size_t num_buffers)
+    : format_(format),
+      buffers_(asynchronous ? num_buffers : 0u),
+      stopping_(false),
+      num_frames_(0),
+      write_seconds_(0.0),
+      copy_seconds_(0.0),
+      stall_seconds_(0.0) {
+  assert(!asynchronous || num_buffers > 0);
+  for (std::size_t buffer = 0; buffer < buffers_.size(); buffer++) {
+    free_buffers_.push_back(buffer);
+  }
+  if (asynchronous) {
+    worker_ = std::thread(&FrameWriter::WorkerLoop, this);
+  }
+}
+
+template <typename T>
+FrameWriter<T>::~FrameWriter() {
+  if (!worker_.joinable()) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  frame_queued_.notify_one();
+  worker_.join();
+}
+
+template <typename T>
+void FrameWriter<T>::Write(const std::string& file_name,
+                           const ParticleSet<T>& particles, double time) {
+  if (!worker_.joinable()) {
+    double seconds = WriteFrame(file_name, particles, time);
+    std::lock_guard<std::mutex> lock(mutex_);
+    num_frames_++;
+    write_seconds_ += seconds;
+    return;
+  }
+
+  // Wait for a free buffer, which keeps the queue from growing without bound.
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  std::size_t buffer;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    frame_written_.wait(lock, [this] { return !free_buffers_.empty(); });
+    buffer = free_buffers_.back();
+    free_buffers_.pop_back();
+  }
+  std::chrono::steady_clock::time_point copy_start =
+      std::chrono::steady_clock::now();
+
+  // Only this thread touches a buffer between taking it from the free list and
+  // queuing it.
+  buffers_[buffer] = particles;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stall_seconds_ +=
+        std::chrono::duration<double>(copy_start - start).count();
+    copy_seconds_ += SecondsSince(copy_start);
+    pending_frames_.push_back(PendingFrame{file_name, time, buffer});
+  }
+  frame_queued_.notify_one();
+}
+
+template <typename T>
+void FrameWriter<T>::Finish() {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lock(mutex_);
+  frame_written_.wait(lock, [this] {
+    return free_buffers_.size() == buffers_.size();
+  });
+  stall_seconds_ += SecondsSince(start);
+}
+
+template <typename T>
+std::size_t FrameWriter<T>::num_frames() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_frames_;
+}
+
+template <typename T>
+double FrameWriter<T>::write_seconds() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return write_seconds_;
+}
+
+template <typename T>
+double FrameWriter<T>::copy_seconds() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return copy_seconds_;
+}
+
+template <typename T>
+double FrameWriter<T>::stall_seconds() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stall_seconds_;
+}
+
+template <typename T>
+void FrameWriter<T>::WorkerLoop() {
+  while (true) {
+    PendingFrame frame;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      frame_queued_.wait(
+          lock, [this] { return stopping_ || !pending_frames_.empty(); });
+      // Once stopping, write whatever is still queued before exiting.
+      if (pending_frames_.empty()) {
+        return;
+      }
+      frame = pending_frames_.front();
+      pending_frames_.pop_front();
+    }
+
+    double seconds = WriteFrame(frame.file_name, buffers_[frame.buffer],
+                                frame.time);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      num_frames_++;
+      write_seconds_ += seconds;
+      free_buffers_.push_back(frame.buffer);
+    }
+    frame_written_.notify_one();
+  }
+}
+
+template <typename T>
+double FrameWriter<T>::WriteFrame(const std::string& file_name,
+                                  const ParticleSet<T>& particles,
+                                  double time) const {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  if (format_ == BINARY_OUTPUT) {
+    WriteBinaryParticleFrame(file_name, particles, time);
+  } else {
+    WriteTextParticleFrame(file_name, particles);
+  }
+  double seconds = SecondsSince(start);
+
+  // One insertion, so lines from the background thread don't interleave with
+  // the simulation's.
+  std::cout << "Output file " + file_name + " saved.\n" << std::flush;
+  return seconds;
+}
+
+template class FrameWriter<double>;
+template class FrameWriter<float>;
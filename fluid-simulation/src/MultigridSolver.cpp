@@ -0,0 +1,319 @@
+#include "MultigridSolver.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "NeighborDirection.h"
+#include "NeighborMaterialInfo.h"
+
+// To disable assert*() calls, uncomment this line:
+// #define NDEBUG
+
+namespace {
+
+// A coarser level is only added beneath a level whose smallest interior
+// dimension has at least this many cells.
+const std::size_t kMinInteriorToCoarsen = 4u;
+
+// Damped Jacobi weight and number of sweeps before and after the coarse grid
+// correction, and on the coarsest level in place of an exact solve
+const double kJacobiWeight = 2.0 / 3.0;
+const std::size_t kPreSmoothingSweeps = 2u;
+const std::size_t kPostSmoothingSweeps = 2u;
+const std::size_t kCoarsestSweeps = 30u;
+
+// Returns the number of cells along one dimension of the level coarser than
+// one with |n| cells along that dimension. Only the interior cells are
+// coarsened; each level keeps a single layer of SOLID cells on its outer faces.
+//
+// Coarse cell I > 0 covers fine cells 2I - 1 and 2I.
+std::size_t CoarseSize(std::size_t n) { return (n - 1) / 2 + 2; }
+
+// Returns the smallest number of interior cells along any dimension of |arr|.
+template <typename T>
+std::size_t MinInterior(const Array3D<T>& arr) {
+  return std::min(std::min(arr.nx(), arr.ny()), arr.nz()) - 2;
+}
+
+// Cell-centered trilinear interpolation weights along one dimension: fine cell
+// |i| lies a quarter of a coarse cell away from the center of coarse cell
+// |near|, and three quarters away from the center of coarse cell |far|.
+struct AxisWeights {
+  explicit AxisWeights(std::size_t i)
+      : near((i + 1) / 2), far((i & 1u) ? near - 1 : near + 1) {}
+
+  const std::size_t near;
+  const std::size_t far;
+};
+
+const double kNearWeight = 0.75;
+const double kFarWeight = 0.25;
+
+// Sets |*coarse_labels| from the |fine_labels| of the level beneath it.
+void Coarsen(const Array3D<MaterialType>& fine_labels,
+             Array3D<MaterialType>* coarse_labels) {
+  (*coarse_labels) = SOLID;
+
+  for (std::size_t ci = 1; ci < coarse_labels->nx() - 1; ci++) {
+    for (std::size_t cj = 1; cj < coarse_labels->ny() - 1; cj++) {
+      for (std::size_t ck = 1; ck < coarse_labels->nz() - 1; ck++) {
+        bool has_empty = false;
+        bool has_fluid = false;
+        for (std::size_t i = 2 * ci - 1; i <= 2 * ci; i++) {
+          for (std::size_t j = 2 * cj - 1; j <= 2 * cj; j++) {
+            for (std::size_t k = 2 * ck - 1; k <= 2 * ck; k++) {
+              MaterialType label = fine_labels(i, j, k);
+              has_empty = has_empty || label == EMPTY;
+              has_fluid = has_fluid || label == FLUID;
+            }
+          }
+        }
+
+        if (has_empty) {
+          (*coarse_labels)(ci, cj, ck) = EMPTY;
+        } else if (has_fluid) {
+          (*coarse_labels)(ci, cj, ck) = FLUID;
+        }
+      }
+    }
+  }
+}
+
+// Sets |*r| = |b| - A * |x| for the cells with a stencil in |neighbors|, and
+// zero elsewhere.
+template <typename T>
+void Residual(const Array3D<unsigned short>& neighbors, const Array3D<T>& x,
+              const Array3D<T>& b, Array3D<T>* r) {
+  const unsigned short CENTER = 7;
+
+  for (std::size_t i = 1; i < x.nx() - 1; i++) {
+    for (std::size_t j = 1; j < x.ny() - 1; j++) {
+      for (std::size_t k = 1; k < x.nz() - 1; k++) {
+        unsigned short nbrs = neighbors(i, j, k);
+
+        if (!nbrs) {
+          (*r)(i, j, k) = 0.0;
+          continue;
+        }
+
+        double ax = ((nbrs & CENTER) * x(i, j, k)) -
+                    ((nbrs & NeighborDirection::LEFT) ? x(i - 1, j, k) : 0) -
+                    ((nbrs & NeighborDirection::DOWN) ? x(i, j - 1, k) : 0) -
+                    ((nbrs & NeighborDirection::BACK) ? x(i, j, k - 1) : 0) -
+                    ((nbrs & NeighborDirection::RIGHT) ? x(i + 1, j, k) : 0) -
+                    ((nbrs & NeighborDirection::UP) ? x(i, j + 1, k) : 0) -
+                    ((nbrs & NeighborDirection::FORWARD) ? x(i, j, k + 1) : 0);
+        (*r)(i, j, k) = b(i, j, k) - ax;
+      }
+    }
+  }
+}
+
+// Runs |sweeps| damped Jacobi iterations on A * |*x| = |b|, using |*r| as
+// scratch space.
+template <typename T>
+void Smooth(const Array3D<unsigned short>& neighbors, const Array3D<T>& b,
+            std::size_t sweeps, Array3D<T>* x, Array3D<T>* r) {
+  const unsigned short CENTER = 7;
+
+  for (std::size_t sweep = 0; sweep < sweeps; sweep++) {
+    Residual(neighbors, *x, b, r);
+
+    for (std::size_t i = 1; i < x->nx() - 1; i++) {
+      for (std::size_t j = 1; j < x->ny() - 1; j++) {
+        for (std::size_t k = 1; k < x->nz() - 1; k++) {
+          unsigned short nbrs = neighbors(i, j, k);
+          if (!nbrs) {
+            continue;
+          }
+          (*x)(i, j, k) += kJacobiWeight * (*r)(i, j, k) / (nbrs & CENTER);
+        }
+      }
+    }
+  }
+}
+
+// Sets |*coarse_b| to the fine residual |fine_r| restricted to the coarse
+// level.
+//
+// Restriction is the transpose of prolongation, scaled by one half: the
+// transpose sums 64 fine values with weights adding up to 8, and the pressure
+// matrix of a level with twice the cell width is 4 times larger than the fine
+// one, so the result is 4 times the weighted average of the fine residual.
+template <typename T>
+void Restrict(const Array3D<unsigned short>& fine_neighbors,
+              const Array3D<T>& fine_r,
+              const Array3D<unsigned short>& coarse_neighbors,
+              Array3D<T>* coarse_b) {
+  (*coarse_b) = 0.0;
+
+  for (std::size_t i = 1; i < fine_r.nx() - 1; i++) {
+    AxisWeights wi(i);
+    for (std::size_t j = 1; j < fine_r.ny() - 1; j++) {
+      AxisWeights wj(j);
+      for (std::size_t k = 1; k < fine_r.nz() - 1; k++) {
+        if (!fine_neighbors(i, j, k)) {
+          continue;
+        }
+
+        AxisWeights wk(k);
+        double r = 0.5 * fine_r(i, j, k);
+        double r_n = kNearWeight * r;
+        double r_f = kFarWeight * r;
+        double r_nn = kNearWeight * r_n;
+        double r_nf = kFarWeight * r_n;
+        double r_fn = kNearWeight * r_f;
+        double r_ff = kFarWeight * r_f;
+        (*coarse_b)(wi.near, wj.near, wk.near) += kNearWeight * r_nn;
+        (*coarse_b)(wi.near, wj.near, wk.far) += kFarWeight * r_nn;
+        (*coarse_b)(wi.near, wj.far, wk.near) += kNearWeight * r_nf;
+        (*coarse_b)(wi.near, wj.far, wk.far) += kFarWeight * r_nf;
+        (*coarse_b)(wi.far, wj.near, wk.near) += kNearWeight * r_fn;
+        (*coarse_b)(wi.far, wj.near, wk.far) += kFarWeight * r_fn;
+        (*coarse_b)(wi.far, wj.far, wk.near) += kNearWeight * r_ff;
+        (*coarse_b)(wi.far, wj.far, wk.far) += kFarWeight * r_ff;
+      }
+    }
+  }
+
+  // Only coarse cells with a stencil take part in the coarse solve.
+  for (std::size_t i = 0; i < coarse_b->nx(); i++) {
+    for (std::size_t j = 0; j < coarse_b->ny(); j++) {
+      for (std::size_t k = 0; k < coarse_b->nz(); k++) {
+        if (!coarse_neighbors(i, j, k)) {
+          (*coarse_b)(i, j, k) = 0.0;
+        }
+      }
+    }
+  }
+}
+
+// Adds the coarse correction |coarse_x|, trilinearly interpolated, to |*fine_x|
+// in the fine cells with a stencil.
+template <typename T>
+void ProlongAndAdd(const Array3D<T>& coarse_x,
+                   const Array3D<unsigned short>& fine_neighbors,
+                   Array3D<T>* fine_x) {
+  for (std::size_t i = 1; i < fine_x->nx() - 1; i++) {
+    AxisWeights wi(i);
+    for (std::size_t j = 1; j < fine_x->ny() - 1; j++) {
+      AxisWeights wj(j);
+      for (std::size_t k = 1; k < fine_x->nz() - 1; k++) {
+        if (!fine_neighbors(i, j, k)) {
+          continue;
+        }
+
+        AxisWeights wk(k);
+        double x_nn = kNearWeight * coarse_x(wi.near, wj.near, wk.near) +
+                      kFarWeight * coarse_x(wi.near, wj.near, wk.far);
+        double x_nf = kNearWeight * coarse_x(wi.near, wj.far, wk.near) +
+                      kFarWeight * coarse_x(wi.near, wj.far, wk.far);
+        double x_fn = kNearWeight * coarse_x(wi.far, wj.near, wk.near) +
+                      kFarWeight * coarse_x(wi.far, wj.near, wk.far);
+        double x_ff = kNearWeight * coarse_x(wi.far, wj.far, wk.near) +
+                      kFarWeight * coarse_x(wi.far, wj.far, wk.far);
+        double x_n = kNearWeight * x_nn + kFarWeight * x_nf;
+        double x_f = kNearWeight * x_fn + kFarWeight * x_ff;
+        (*fine_x)(i, j, k) += kNearWeight * x_n + kFarWeight * x_f;
+      }
+    }
+  }
+}
+
+}  // namespace
+
+template <typename T>
+MultigridSolver<T>::Level::Level(std::size_t nx, std::size_t ny,
+                                 std::size_t nz)
+    : labels(nx, ny, nz),
+      neighbors(nx, ny, nz),
+      x(nx, ny, nz),
+      b(nx, ny, nz),
+      r(nx, ny, nz) {
+  // The kernels only ever write the interior cells of these arrays, but Dot
+  // sums over every cell, so the outer cells must start (and stay) zero.
+  x = 0.0;
+  b = 0.0;
+  r = 0.0;
+}
+
+template <typename T>
+MultigridSolver<T>::MultigridSolver(std::size_t nx, std::size_t ny,
+                                    std::size_t nz) {
+  levels_.push_back(std::unique_ptr<Level>(new Level(nx, ny, nz)));
+  while (MinInterior(levels_.back()->labels) >= kMinInteriorToCoarsen) {
+    const Array3D<MaterialType>& fine = levels_.back()->labels;
+    levels_.push_back(std::unique_ptr<Level>(new Level(
+        CoarseSize(fine.nx()), CoarseSize(fine.ny()), CoarseSize(fine.nz()))));
+  }
+}
+
+template <typename T>
+MultigridSolver<T>::~MultigridSolver() {}
+
+template <typename T>
+void MultigridSolver<T>::Setup(const Array3D<MaterialType>& labels) {
+  levels_[0]->labels.SetEqualTo(labels);
+  MakeNeighborMaterialInfo(levels_[0]->labels, &levels_[0]->neighbors);
+
+  for (std::size_t level = 1; level < levels_.size(); level++) {
+    Coarsen(levels_[level - 1]->labels, &levels_[level]->labels);
+    MakeNeighborMaterialInfo(levels_[level]->labels,
+                             &levels_[level]->neighbors);
+  }
+}
+
+template <typename T>
+void MultigridSolver<T>::ApplyVCycle(const Array3D<T>& b, Array3D<T>* x) {
+  levels_[0]->b.SetEqualTo(b);
+  VCycle(0);
+  x->SetEqualTo(levels_[0]->x);
+}
+
+template <typename T>
+std::size_t MultigridSolver<T>::Solve(const Array3D<T>& b, double tolerance,
+                                      std::size_t max_cycles, Array3D<T>* x,
+                                      double* residual_norm) {
+  Level& finest = *levels_[0];
+
+  std::size_t cycle = 0;
+  for (;; cycle++) {
+    // The residual of the current solution is the right-hand side of the
+    // equation for its correction.
+    Residual(finest.neighbors, *x, b, &finest.b);
+    *residual_norm = Dot(finest.b, finest.b);
+    if (*residual_norm <= tolerance || cycle == max_cycles) {
+      break;
+    }
+
+    VCycle(0);
+    x->PlusEquals(1.0, finest.x);
+  }
+
+  return cycle;
+}
+
+template <typename T>
+void MultigridSolver<T>::VCycle(std::size_t level) {
+  Level& fine = *levels_[level];
+  fine.x = 0.0;
+
+  if (level + 1 == levels_.size()) {
+    Smooth(fine.neighbors, fine.b, kCoarsestSweeps, &fine.x, &fine.r);
+    return;
+  }
+
+  Smooth(fine.neighbors, fine.b, kPreSmoothingSweeps, &fine.x, &fine.r);
+
+  Level& coarse = *levels_[level + 1];
+  Residual(fine.neighbors, fine.x, fine.b, &fine.r);
+  Restrict(fine.neighbors, fine.r, coarse.neighbors, &coarse.b);
+
+  VCycle(level + 1);
+
+  ProlongAndAdd(coarse.x, fine.neighbors, &fine.x);
+  Smooth(fine.neighbors, fine.b, kPostSmoothingSweeps, &fine.x, &fine.r);
+}
+
+template class MultigridSolver<float>;
+template class MultigridSolver<double>;
@@ -0,0 +1,143 @@
+#include "NeighborMaterialInfo.h"
+
+#include <cassert>
+
+#include "NeighborDirection.h"
+
+// To disable assert*() calls, uncomment this line:
+// #define NDEBUG
+
+namespace {
+
+MaterialType GetNeighborMaterial(const Array3D<MaterialType>& cell_labels,
+                                 std::size_t i, std::size_t j, std::size_t k,
+                                 NeighborDirection dir) {
+  switch (dir) {
+    case LEFT:
+      return cell_labels(i - 1, j, k);
+    case DOWN:
+      return cell_labels(i, j - 1, k);
+    case BACK:
+      return cell_labels(i, j, k - 1);
+    case RIGHT:
+      return cell_labels(i + 1, j, k);
+    case UP:
+      return cell_labels(i, j + 1, k);
+    case FORWARD:
+      return cell_labels(i, j, k + 1);
+  }
+  // No default case: switch cases should cover all possibilities
+  assert(false);
+  return SOLID;  // for compiler happiness, should never get executed
+}
+
+unsigned short UpdateFromNeighbor(unsigned short nbr_info,
+                                  MaterialType nbr_material,
+                                  NeighborDirection dir) {
+  unsigned short new_nbr_info = nbr_info;
+
+  if (nbr_material != SOLID) {
+    new_nbr_info++;
+  }
+
+  if (nbr_material != FLUID) {
+    return new_nbr_info;
+  }
+
+  return new_nbr_info | dir;
+}
+
+// Returns the neighbors info of the FLUID cell (|i|, |j|, |k|), which isn't on
+// the outer faces of the grid.
+unsigned short FluidCellNeighborInfo(const Array3D<MaterialType>& cell_labels,
+                                     std::size_t i, std::size_t j,
+                                     std::size_t k) {
+  unsigned short nbr_info = 0u;
+  for (NeighborDirection dir : kNeighborDirections) {
+    MaterialType nbr_material = GetNeighborMaterial(cell_labels, i, j, k, dir);
+    nbr_info = UpdateFromNeighbor(nbr_info, nbr_material, dir);
+  }
+  return nbr_info;
+}
+
+// Sets the coefficients of cell (|i|, |j|, |k|) in |*matrix| from its
+// neighbors info |nbrs|.
+//
+// A cell only has a stencil if it is FLUID, and its RIGHT, UP, and FORWARD
+// bits are only set if that neighbor is FLUID too, so the couplings come out
+// the same from either side.
+template <typename T>
+void SetStencil(unsigned short nbrs, std::size_t i, std::size_t j,
+                std::size_t k, PressureMatrix<T>* matrix) {
+  const unsigned short CENTER = 7;
+  matrix->diag(i, j, k) = nbrs & CENTER;
+  matrix->plus_i(i, j, k) = (nbrs & RIGHT) ? -1 : 0;
+  matrix->plus_j(i, j, k) = (nbrs & UP) ? -1 : 0;
+  matrix->plus_k(i, j, k) = (nbrs & FORWARD) ? -1 : 0;
+}
+
+}  // namespace
+
+void MakeNeighborMaterialInfo(const Array3D<MaterialType>& cell_labels,
+                              Array3D<unsigned short>* neighbors) {
+  (*neighbors) = 0u;
+
+  for (std::size_t i = 1; i < cell_labels.nx() - 1; i++) {
+    for (std::size_t j = 1; j < cell_labels.ny() - 1; j++) {
+      for (std::size_t k = 1; k < cell_labels.nz() - 1; k++) {
+        if (cell_labels(i, j, k) != FLUID) {
+          continue;
+        }
+
+        (*neighbors)(i, j, k) = FluidCellNeighborInfo(cell_labels, i, j, k);
+      }
+    }
+  }
+}
+
+template <typename T>
+void MakeNeighborMaterialInfo(const Array3D<MaterialType>& cell_labels,
+                              Array3D<unsigned short>* neighbors,
+                              PressureMatrix<T>* matrix) {
+  MakeNeighborMaterialInfo(cell_labels, neighbors);
+
+  for (std::size_t i = 0; i < cell_labels.nx(); i++) {
+    for (std::size_t j = 0; j < cell_labels.ny(); j++) {
+      for (std::size_t k = 0; k < cell_labels.nz(); k++) {
+        SetStencil((*neighbors)(i, j, k), i, j, k, matrix);
+      }
+    }
+  }
+}
+
+template <typename T>
+void UpdateNeighborMaterialInfo(const Array3D<MaterialType>& cell_labels,
+                                std::size_t i, std::size_t j, std::size_t k,
+                                Array3D<unsigned short>* neighbors,
+                                PressureMatrix<T>* matrix) {
+  unsigned short nbrs = 0u;
+  if (i > 0 && i < cell_labels.nx() - 1 && j > 0 &&
+      j < cell_labels.ny() - 1 && k > 0 && k < cell_labels.nz() - 1 &&
+      cell_labels(i, j, k) == FLUID) {
+    nbrs = FluidCellNeighborInfo(cell_labels, i, j, k);
+  }
+  (*neighbors)(i, j, k) = nbrs;
+  if (matrix) {
+    SetStencil(nbrs, i, j, k, matrix);
+  }
+}
+
+template void MakeNeighborMaterialInfo(
+    const Array3D<MaterialType>& cell_labels,
+    Array3D<unsigned short>* neighbors, PressureMatrix<float>* matrix);
+template void MakeNeighborMaterialInfo(
+    const Array3D<MaterialType>& cell_labels,
+    Array3D<unsigned short>* neighbors, PressureMatrix<double>* matrix);
+template void UpdateNeighborMaterialInfo(
+    const Array3D<MaterialType>& cell_labels, std::size_t i, std::size_t j,
+    std::size_t k, Array3D<unsigned short>* neighbors,
+    PressureMatrix<float>* matrix);
+template void UpdateNeighborMaterialInfo(
+    const Array3D<MaterialType>& cell_labels, std::size_t i, std::size_t j,
+    std::size_t k, Array3D<unsigned short>* neighbors,
+    PressureMatrix<double>* matrix);
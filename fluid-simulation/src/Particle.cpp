@@ -1,57 +1,109 @@
 #include "Particle.h"
 
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
-#include <sstream>
+#include <string>
 
 namespace {
 
-std::string ReadLine(std::ifstream* in) {
-  std::string line;
-  std::getline(*in, line);
-  return line;
+// Reports that the particles in |input_file| can't be read because of
+// |problem|, and crashes the program, even with assert*() calls disabled.
+void FailToReadParticles(const std::string& input_file,
+                         const std::string& problem) {
+  std::cout << "ERROR: can't read particles from " << input_file << ": "
+            << problem << "!" << std::endl;
+  std::abort();  // crash the program
 }
 
-int ReadNumParticles(std::ifstream* in) {
-  int num_particles = -1;
-
-  std::string line = ReadLine(in);
-  std::istringstream ss(line);
-  if (!(ss >> num_particles)) {
-    return -1;
+// Reads the whole file |input_file| into |*contents|, returning whether it
+// could be read.
+bool ReadFile(const std::string& input_file, std::string* contents) {
+  std::ifstream in(input_file.c_str(), std::ios::in | std::ios::binary);
+  if (!in) {
+    return false;
   }
-
-  return num_particles;
-}
-
-Eigen::Vector3d ReadVector3d(std::istringstream* line_ss) {
-  Eigen::Vector3d vec;
-  (*line_ss) >> vec[0] >> vec[1] >> vec[2];
-  return vec;
+  in.seekg(0, std::ios::end);
+  std::streamoff size = in.tellg();
+  in.seekg(0, std::ios::beg);
+  if (size < 0) {
+    return false;
+  }
+  contents->resize(static_cast<std::size_t>(size));
+  if (size > 0) {
+    in.read(&(*contents)[0], size);
+  }
+  return static_cast<bool>(in);
 }
 
-Particle ReadParticle(const std::string& line) {
-  std::istringstream ss(line);
-  return Particle{.pos = ReadVector3d(&ss), .vel = ReadVector3d(&ss)};
+// Returns whether only whitespace is left at |text|.
+bool OnlyWhitespace(const char* text) {
+  while (*text == ' ' || *text == '\t' || *text == '\n' || *text == '\r') {
+    text++;
+  }
+  return *text == '\0';
 }
 
 }  // namespace
 
 std::vector<Particle> ReadParticles(const std::string& input_file) {
-  std::ifstream in(input_file.c_str(), std::ios::in);
+  std::string contents;
+  if (!ReadFile(input_file, &contents)) {
+    FailToReadParticles(input_file, "the file can't be opened");
+  }
 
-  int alleged_num_particles = ReadNumParticles(&in);
+  // Numbers are parsed in place with strtod, which rounds exactly as
+  // reading them through a stream does, instead of through a stream per line.
+  const char* cursor = contents.c_str();
+  char* end;
+  long long alleged_num_particles = std::strtoll(cursor, &end, 10);
+  if (end == cursor || alleged_num_particles < 0) {
+    FailToReadParticles(input_file,
+                        "it doesn't start with the number of particles");
+  }
+  cursor = end;
 
   std::vector<Particle> particles;
+  particles.reserve(static_cast<std::size_t>(alleged_num_particles));
+  while (true) {
+    // Position, then velocity
+    double coordinates[6];
+    std::size_t num_coordinates = 0;
+    for (; num_coordinates < 6; num_coordinates++) {
+      coordinates[num_coordinates] = std::strtod(cursor, &end);
+      if (end == cursor) {
+        break;
+      }
+      cursor = end;
+    }
+    if (num_coordinates == 0) {
+      break;
+    }
+    if (num_coordinates < 6) {
+      FailToReadParticles(input_file,
+                          "particle " + std::to_string(particles.size()) +
+                              " has only " + std::to_string(num_coordinates) +
+                              " of its 6 coordinates");
+    }
 
-  std::string line;
-  while (std::getline(in, line)) {
-    particles.push_back(ReadParticle(line));
+    Particle particle;
+    particle.pos << coordinates[0], coordinates[1], coordinates[2];
+    particle.vel << coordinates[3], coordinates[4], coordinates[5];
+    particles.push_back(particle);
   }
-  assert(particles.size() == alleged_num_particles);
-  std::cout << "Read " << particles.size() << " particles." << std::endl;
 
-  in.close();
+  if (!OnlyWhitespace(cursor)) {
+    FailToReadParticles(input_file,
+                        "it has text that isn't a number after particle " +
+                            std::to_string(particles.size()));
+  }
+  if (particles.size() != static_cast<std::size_t>(alleged_num_particles)) {
+    FailToReadParticles(
+        input_file, "it holds " + std::to_string(particles.size()) +
+                        " particles, but says it holds " +
+                        std::to_string(alleged_num_particles));
+  }
+  std::cout << "Read " << particles.size() << " particles." << std::endl;
 
   return particles;
 }
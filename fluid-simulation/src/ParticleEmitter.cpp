@@ -0,0 +1,179 @@
+#include "ParticleEmitter.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+// To disable assert*() calls, uncomment this line:
+// #define NDEBUG
+
+namespace {
+
+// Returns |x| scrambled by the SplitMix64 finalizer, so that consecutive
+// inputs give unrelated outputs.
+inline std::uint64_t Mix(std::uint64_t x) {
+  x += 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+// Returns a number in [-0.5, 0.5) drawn from |key|.
+inline double UniformOffset(std::uint64_t key) {
+  return static_cast<double>(Mix(key) >> 11) / 9007199254740992.0 - 0.5;
+}
+
+// The subcells one emitter may fill: those whose index along each axis a is
+// in [begin[a], end[a]), in a grid split into |side| subcells per cell along
+// each axis
+struct SubcellLattice {
+  const ParticleEmitter* emitter;
+  Eigen::Vector3d lc;
+  double spacing;
+  std::size_t side;
+  std::size_t begin[3];
+  std::size_t end[3];
+
+  // Number of subcells of the whole grid along y and z
+  std::size_t ny;
+  std::size_t nz;
+
+  // Key of the random numbers drawn for the emitter's first subcell
+  std::uint64_t key;
+};
+
+// Returns whether |pos| lies in the region of |emitter|.
+bool Contains(const ParticleEmitter& emitter, const Eigen::Vector3d& pos) {
+  if (emitter.shape == SPHERE_EMITTER) {
+    return (pos - emitter.center).squaredNorm() <
+           emitter.radius * emitter.radius;
+  }
+  return (pos.array() >= emitter.lower.array()).all() &&
+         (pos.array() < emitter.upper.array()).all();
+}
+
+// Sets |*pos| to the jittered position of subcell (|i|, |j|, |k|) of
+// |lattice|, and returns whether its emitter emits a particle there.
+bool SubcellParticle(const SubcellLattice& lattice, std::size_t i,
+                     std::size_t j, std::size_t k, Eigen::Vector3d* pos) {
+  const std::uint64_t key =
+      lattice.key + 3 * ((i * lattice.ny + j) * lattice.nz + k);
+  const double jitter = lattice.emitter->jitter;
+  Eigen::Vector3d offset(0.5, 0.5, 0.5);
+  if (jitter > 0.0) {
+    offset += jitter * Eigen::Vector3d(UniformOffset(key),
+                                       UniformOffset(key + 1),
+                                       UniformOffset(key + 2));
+  }
+  *pos = lattice.lc +
+         lattice.spacing * (Eigen::Vector3d(i, j, k) + offset);
+  return Contains(*lattice.emitter, *pos);
+}
+
+// Returns the lattice of subcells of an |n[0]| x |n[1]| x |n[2]| grid, with
+// lower corner |lc| and cells |dx| wide, that overlap the region of |emitter|
+// and aren't in its SOLID boundary cells. |key| seeds the random numbers.
+SubcellLattice MakeSubcellLattice(const ParticleEmitter& emitter,
+                                  const std::size_t n[3],
+                                  const Eigen::Vector3d& lc, double dx,
+                                  std::uint64_t key) {
+  SubcellLattice lattice;
+  lattice.emitter = &emitter;
+  lattice.lc = lc;
+  lattice.side = static_cast<std::size_t>(
+      std::round(std::cbrt(static_cast<double>(emitter.particles_per_cell))));
+  assert(lattice.side > 0 && lattice.side * lattice.side * lattice.side ==
+                                 emitter.particles_per_cell);
+  lattice.spacing = dx / lattice.side;
+  lattice.ny = n[1] * lattice.side;
+  lattice.nz = n[2] * lattice.side;
+  lattice.key = key;
+
+  Eigen::Vector3d lower = emitter.lower, upper = emitter.upper;
+  if (emitter.shape == SPHERE_EMITTER) {
+    lower = emitter.center.array() - emitter.radius;
+    upper = emitter.center.array() + emitter.radius;
+  }
+  for (std::size_t a = 0; a < 3; a++) {
+    // Subcells of the first and last cells are outside the SOLID boundary.
+    const double first = static_cast<double>(lattice.side);
+    const double last = static_cast<double>((n[a] - 1) * lattice.side);
+    double begin = std::floor((lower[a] - lc[a]) / lattice.spacing);
+    double end = std::ceil((upper[a] - lc[a]) / lattice.spacing);
+    lattice.begin[a] =
+        static_cast<std::size_t>(std::max(first, std::min(begin, last)));
+    lattice.end[a] = static_cast<std::size_t>(
+        std::max(static_cast<double>(lattice.begin[a]), std::min(end, last)));
+  }
+  return lattice;
+}
+
+}  // namespace
+
+template <typename T>
+void EmitParticles(const std::vector<ParticleEmitter>& emitters,
+                   std::uint64_t seed, std::size_t nx, std::size_t ny,
+                   std::size_t nz, const Eigen::Vector3d& lc, double dx,
+                   ThreadPool* thread_pool, ParticleSet<T>* particles) {
+  const std::size_t n[3] = {nx, ny, nz};
+  for (std::size_t e = 0; e < emitters.size(); e++) {
+    const ParticleEmitter& emitter = emitters[e];
+    const SubcellLattice lattice =
+        MakeSubcellLattice(emitter, n, lc, dx, Mix(seed + Mix(e)));
+    const std::size_t i_begin = lattice.begin[0];
+    const std::size_t num_layers = lattice.end[0] - i_begin;
+
+    // Count the particles of each layer of subcells along x, then fill each
+    // layer's range of the new particles, so every thread writes its own
+    // particles in place.
+    std::vector<std::size_t> layer_starts(num_layers + 1, 0);
+    thread_pool->ParallelFor(0, num_layers, [&](std::size_t layer_begin,
+                                                std::size_t layer_end) {
+      Eigen::Vector3d pos;
+      for (std::size_t layer = layer_begin; layer < layer_end; layer++) {
+        std::size_t count = 0;
+        for (std::size_t j = lattice.begin[1]; j < lattice.end[1]; j++) {
+          for (std::size_t k = lattice.begin[2]; k < lattice.end[2]; k++) {
+            count += SubcellParticle(lattice, i_begin + layer, j, k, &pos);
+          }
+        }
+        layer_starts[layer + 1] = count;
+      }
+    });
+    layer_starts[0] = particles->size();
+    for (std::size_t layer = 0; layer < num_layers; layer++) {
+      layer_starts[layer + 1] += layer_starts[layer];
+    }
+
+    particles->resize(layer_starts[num_layers]);
+    thread_pool->ParallelFor(0, num_layers, [&](std::size_t layer_begin,
+                                                std::size_t layer_end) {
+      Eigen::Vector3d pos;
+      for (std::size_t layer = layer_begin; layer < layer_end; layer++) {
+        std::size_t p = layer_starts[layer];
+        for (std::size_t j = lattice.begin[1]; j < lattice.end[1]; j++) {
+          for (std::size_t k = lattice.begin[2]; k < lattice.end[2]; k++) {
+            if (SubcellParticle(lattice, i_begin + layer, j, k, &pos)) {
+              particles->set_position(p, pos);
+              particles->set_velocity(p, emitter.velocity);
+              p++;
+            }
+          }
+        }
+      }
+    });
+  }
+}
+
+template void EmitParticles(const std::vector<ParticleEmitter>& emitters,
+                            std::uint64_t seed, std::size_t nx,
+                            std::size_t ny, std::size_t nz,
+                            const Eigen::Vector3d& lc, double dx,
+                            ThreadPool* thread_pool,
+                            ParticleSet<float>* particles);
+template void EmitParticles(const std::vector<ParticleEmitter>& emitters,
+                            std::uint64_t seed, std::size_t nx,
+                            std::size_t ny, std::size_t nz,
+                            const Eigen::Vector3d& lc, double dx,
+                            ThreadPool* thread_pool,
+                            ParticleSet<double>* particles);
@@ -0,0 +1,236 @@
+#include "ParticleFrame.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "Particle.h"
+
+namespace {
+
+const char kParticleFrameMagic[8] = "PARTFRM";
+
+static_assert(sizeof(ParticleFrameHeader) == 80,
+              "ParticleFrameHeader must not be padded");
+
+void Write3d(const Eigen::Vector3d& vec, std::ofstream* out) {
+  (*out) << vec[0] << " " << vec[1] << " " << vec[2];
+}
+
+// Writes the |num_particles| coordinates at |coordinates| to |*out|.
+template <typename T>
+void WriteBlock(const T* coordinates, std::size_t num_particles,
+                std::ofstream* out) {
+  out->write(reinterpret_cast<const char*>(coordinates),
+             num_particles * sizeof(T));
+}
+
+// Reports that the particle frame |file_name| can't be read because of
+// |problem|, and crashes the program, even with assert*() calls disabled.
+void FailToReadFrame(const std::string& file_name, const std::string& problem) {
+  std::cout << "ERROR: can't read particle frame " << file_name << ": "
+            << problem << "!" << std::endl;
+  std::abort();  // crash the program
+}
+
+// A whole file mapped read-only into memory, and unmapped when destroyed
+class MappedFile {
+ public:
+  // Maps the file named |file_name|. data() is NULL if it can't be mapped.
+  explicit MappedFile(const std::string& file_name) : data_(NULL), size_(0) {
+    int fd = open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+      size_ = static_cast<std::size_t>(file_stat.st_size);
+      void* data = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        data_ = static_cast<const char*>(data);
+      }
+    }
+    close(fd);
+  }
+
+  ~MappedFile() {
+    if (data_) {
+      munmap(const_cast<char*>(data_), size_);
+    }
+  }
+
+  const char* data() const { return data_; }
+  std::size_t size() const { return size_; }
+
+ private:
+  // Don't allow copy constructor to be called.
+  MappedFile(const MappedFile& other);
+
+  // Don't allow copy-assignment operator to be called.
+  MappedFile& operator=(const MappedFile& other);
+
+  const char* data_;
+  std::size_t size_;
+};
+
+// Copies the six coordinate blocks at |blocks|, stored as |S|, into
+// |*particles|, which has as many particles as each block has coordinates.
+template <typename S, typename T>
+void CopyBlocks(const char* const blocks[6], ParticleSet<T>* particles) {
+  // The blocks are only aligned for |S| if the header is, so they are copied
+  // out rather than read in place.
+  const std::size_t num_particles = particles->size();
+  std::vector<S> coordinates(6 * num_particles);
+  for (std::size_t b = 0; b < 6; b++) {
+    std::memcpy(&coordinates[b * num_particles], blocks[b],
+                num_particles * sizeof(S));
+  }
+  const S* x = coordinates.data();
+  const S* y = x + num_particles;
+  const S* z = y + num_particles;
+  const S* vx = z + num_particles;
+  const S* vy = vx + num_particles;
+  const S* vz = vy + num_particles;
+  for (std::size_t n = 0; n < num_particles; n++) {
+    particles->set_position(n, Eigen::Vector3d(x[n], y[n], z[n]));
+    particles->set_velocity(n, Eigen::Vector3d(vx[n], vy[n], vz[n]));
+  }
+}
+
+}  // namespace
+
+bool IsBinaryParticleFrame(const std::string& file_name) {
+  std::ifstream in(file_name.c_str(), std::ios::in | std::ios::binary);
+  char magic[sizeof(kParticleFrameMagic)];
+  in.read(magic, sizeof(magic));
+  return in.good() &&
+         std::memcmp(magic, kParticleFrameMagic, sizeof(magic)) == 0;
+}
+
+template <typename T>
+void WriteTextParticleFrame(const std::string& file_name,
+                            const ParticleSet<T>& particles) {
+  // Lines end with '\n' rather than std::endl, which would flush the stream
+  // after every particle.
+  std::ofstream out(file_name.c_str(), std::ios::out);
+  out << particles.size() << '\n';
+  for (std::size_t n = 0; n < particles.size(); n++) {
+    Write3d(particles.position(n), &out);
+    out << " ";
+    Write3d(particles.velocity(n), &out);
+    out << '\n';
+  }
+  out.close();
+}
+
+template <typename T>
+void WriteBinaryParticleFrame(const std::string& file_name,
+                              const ParticleSet<T>& particles, double time) {
+  ParticleFrameHeader header;
+  std::memcpy(header.magic, kParticleFrameMagic, sizeof(header.magic));
+  header.version = kParticleFrameVersion;
+  header.scalar_bytes = sizeof(T);
+  header.num_particles = particles.size();
+  header.time = time;
+  const T* const kPositions[] = {particles.x(), particles.y(), particles.z()};
+  for (std::size_t d = 0; d < 3; d++) {
+    header.lower[d] = 0.0;
+    header.upper[d] = 0.0;
+    if (particles.size() > 0) {
+      const T* coordinates = kPositions[d];
+      header.lower[d] =
+          *std::min_element(coordinates, coordinates + particles.size());
+      header.upper[d] =
+          *std::max_element(coordinates, coordinates + particles.size());
+    }
+  }
+
+  std::ofstream out(file_name.c_str(), std::ios::out | std::ios::binary);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  WriteBlock(particles.x(), particles.size(), &out);
+  WriteBlock(particles.y(), particles.size(), &out);
+  WriteBlock(particles.z(), particles.size(), &out);
+  WriteBlock(particles.vx(), particles.size(), &out);
+  WriteBlock(particles.vy(), particles.size(), &out);
+  WriteBlock(particles.vz(), particles.size(), &out);
+  out.close();
+}
+
+template <typename T>
+void ReadBinaryParticleFrame(const std::string& file_name,
+                             ParticleFrameHeader* header,
+                             ParticleSet<T>* particles) {
+  MappedFile file(file_name);
+  if (!file.data()) {
+    FailToReadFrame(file_name, "the file can't be mapped");
+  }
+  if (file.size() < sizeof(*header)) {
+    FailToReadFrame(file_name, "it is too short for a header");
+  }
+  std::memcpy(header, file.data(), sizeof(*header));
+  if (std::memcmp(header->magic, kParticleFrameMagic,
+                  sizeof(header->magic)) != 0) {
+    FailToReadFrame(file_name, "it isn't a binary particle frame");
+  }
+  if (header->version != kParticleFrameVersion ||
+      (header->scalar_bytes != sizeof(float) &&
+       header->scalar_bytes != sizeof(double))) {
+    FailToReadFrame(file_name, "it has unsupported version " +
+                                   std::to_string(header->version) + " with " +
+                                   std::to_string(header->scalar_bytes) +
+                                   "-byte coordinates");
+  }
+  const std::size_t block_bytes = header->num_particles * header->scalar_bytes;
+  if (file.size() != sizeof(*header) + 6 * block_bytes) {
+    FailToReadFrame(file_name, "its size doesn't match its " +
+                                   std::to_string(header->num_particles) +
+                                   " particles");
+  }
+
+  // x, y, z, vx, vy, vz
+  const char* blocks[6];
+  for (std::size_t b = 0; b < 6; b++) {
+    blocks[b] = file.data() + sizeof(*header) + b * block_bytes;
+  }
+  particles->resize(header->num_particles);
+  if (header->scalar_bytes == sizeof(float)) {
+    CopyBlocks<float>(blocks, particles);
+  } else {
+    CopyBlocks<double>(blocks, particles);
+  }
+}
+
+template <typename T>
+void ReadParticleFrame(const std::string& file_name,
+                       ParticleSet<T>* particles) {
+  if (IsBinaryParticleFrame(file_name)) {
+    ParticleFrameHeader header;
+    ReadBinaryParticleFrame(file_name, &header, particles);
+    std::cout << "Read " << particles->size() << " particles." << std::endl;
+    return;
+  }
+  *particles = ParticleSet<T>(ReadParticles(file_name));
+}
+
+#define INSTANTIATE_PARTICLE_FRAME(T)                                          \
+  template void WriteTextParticleFrame(const std::string& file_name,           \
+                                       const ParticleSet<T>& particles);       \
+  template void WriteBinaryParticleFrame(const std::string& file_name,         \
+                                         const ParticleSet<T>& particles,      \
+                                         double time);                         \
+  template void ReadBinaryParticleFrame(const std::string& file_name,          \
+                                        ParticleFrameHeader* header,           \
+                                        ParticleSet<T>* particles);            \
+  template void ReadParticleFrame(const std::string& file_name,                \
+                                  ParticleSet<T>* particles);
+
+INSTANTIATE_PARTICLE_FRAME(float)
+INSTANTIATE_PARTICLE_FRAME(double)
@@ -0,0 +1,56 @@
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "Particle.h"
+#include "ParticleFrame.h"
+#include "ParticleSet.h"
+
+// Converts a particle frame from the binary particle frame format to text, or
+// from text to the binary format with coordinates stored as float or double
+// and the given simulated time.
+//
+// Usage: ./ParticleFrameConverter [input file] [output file] [double|float]
+//                                 [time]
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cout << "ERROR: input and output file arguments not found!"
+              << std::endl;
+    std::cout << "Usage: ./ParticleFrameConverter [input file] [output file] "
+                 "[double|float] [time]"
+              << std::endl;
+    assert(false);  // crash the program
+    return EXIT_FAILURE;
+  }
+  const std::string input_file = argv[1];
+  const std::string output_file = argv[2];
+  const std::string precision_name = argc >= 4 ? argv[3] : "double";
+  const double time = argc >= 5 ? std::strtod(argv[4], NULL) : 0.0;
+
+  if (IsBinaryParticleFrame(input_file)) {
+    ParticleFrameHeader header;
+    ParticleSet<double> particles;
+    ReadBinaryParticleFrame(input_file, &header, &particles);
+    WriteTextParticleFrame(output_file, particles);
+    std::cout << "Converted " << particles.size() << " particles at time "
+              << header.time << " s to text." << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  std::vector<Particle> particles = ReadParticles(input_file);
+  if (precision_name == "float") {
+    WriteBinaryParticleFrame(output_file, ParticleSet<float>(particles), time);
+  } else if (precision_name == "double") {
+    WriteBinaryParticleFrame(output_file, ParticleSet<double>(particles), time);
+  } else {
+    std::cout << "ERROR: unknown precision \"" << precision_name << "\"!"
+              << std::endl;
+    std::cout << "Valid precisions: \"double\", \"float\"" << std::endl;
+    assert(false);  // crash the program
+    return EXIT_FAILURE;
+  }
+  std::cout << "Converted " << particles.size() << " particles to binary."
+            << std::endl;
+  return EXIT_SUCCESS;
+}
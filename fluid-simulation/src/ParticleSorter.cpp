@@ -0,0 +1,113 @@
+#include "ParticleSorter.h"
+
+#include <algorithm>
+#include <cassert>
+
+// To disable assert*() calls, uncomment this line:
+// #define NDEBUG
+
+namespace {
+
+// Returns the index of the grid cell containing the coordinate |x_lc_over_dx|,
+// in grid cell units, along a direction with |n| cells, clamped to the grid.
+inline std::size_t ClampedCell(double x_lc_over_dx, std::size_t n) {
+  if (!(x_lc_over_dx > 0.0)) {
+    return 0;
+  }
+  return std::min(static_cast<std::size_t>(x_lc_over_dx), n - 1);
+}
+
+}  // namespace
+
+ParticleSorter::ParticleSorter(std::size_t nx, std::size_t ny, std::size_t nz,
+                               const Eigen::Vector3d& lc, double dx)
+    : nx_(nx),
+      ny_(ny),
+      nz_(nz),
+      lc_(lc),
+      dx_(dx),
+      cell_starts_(nx * ny * nz + 1, 0u) {
+  assert(dx > 0.0);
+}
+
+ParticleSorter::~ParticleSorter() {}
+
+std::size_t ParticleSorter::CellIndex(const Eigen::Vector3d& pos) const {
+  Eigen::Vector3d p_lc_over_dx = (pos - lc_) / dx_;
+  return (ClampedCell(p_lc_over_dx[0], nx_) * ny_ +
+          ClampedCell(p_lc_over_dx[1], ny_)) *
+             nz_ +
+         ClampedCell(p_lc_over_dx[2], nz_);
+}
+
+template <typename T>
+void ParticleSorter::Sort(ParticleSet<T>* particles) {
+  const std::size_t num_cells = nx_ * ny_ * nz_;
+  const std::size_t num_particles = particles->size();
+
+  // Count the particles in each cell, one entry past the cell's own.
+  std::fill(cell_starts_.begin(), cell_starts_.end(), 0u);
+  cells_.resize(num_particles);
+  for (std::size_t n = 0; n < num_particles; n++) {
+    cells_[n] = CellIndex(particles->position(n));
+    cell_starts_[cells_[n] + 1]++;
+  }
+
+  // Sum the counts into the start of each cell's particles.
+  for (std::size_t cell = 0; cell < num_cells; cell++) {
+    cell_starts_[cell + 1] += cell_starts_[cell];
+  }
+
+  // Replace each particle's cell with its position in sorted order. Each
+  // cell's entry advances to the start of the next cell's particles along the
+  // way, so shift the entries back afterwards.
+  for (std::size_t n = 0; n < num_particles; n++) {
+    cells_[n] = cell_starts_[cells_[n]]++;
+  }
+  for (std::size_t cell = num_cells; cell > 0; cell--) {
+    cell_starts_[cell] = cell_starts_[cell - 1];
+  }
+  cell_starts_[0] = 0;
+
+  particles->Reorder(cells_);
+}
+
+template <typename T>
+double ParticleSorter::Disorder(const ParticleSet<T>& particles) const {
+  if (particles.size() < 2) {
+    return 0.0;
+  }
+
+  std::size_t num_descents = 0;
+  std::size_t previous_cell = CellIndex(particles.position(0));
+  for (std::size_t n = 1; n < particles.size(); n++) {
+    std::size_t cell = CellIndex(particles.position(n));
+    if (cell < previous_cell) {
+      num_descents++;
+    }
+    previous_cell = cell;
+  }
+  return static_cast<double>(num_descents) / (particles.size() - 1);
+}
+
+template <typename T>
+bool ParticleSorter::ShouldSort(const ParticleSortOptions& options,
+                                std::size_t step,
+                                const ParticleSet<T>& particles) const {
+  if (options.interval > 0 && step % options.interval == 0) {
+    return true;
+  }
+  return options.disorder_threshold > 0.0 &&
+         Disorder(particles) > options.disorder_threshold;
+}
+
+#define INSTANTIATE_PARTICLE_SORTER(T)                                         \
+  template void ParticleSorter::Sort(ParticleSet<T>* particles);               \
+  template double ParticleSorter::Disorder(const ParticleSet<T>& particles)    \
+      const;                                                                   \
+  template bool ParticleSorter::ShouldSort(                                    \
+      const ParticleSortOptions& options, std::size_t step,                    \
+      const ParticleSet<T>& particles) const;
+
+INSTANTIATE_PARTICLE_SORTER(float)
+INSTANTIATE_PARTICLE_SORTER(double)
@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "Array3D.h"
+#include "Particle.h"
+#include "ParticleSet.h"
+#include "ParticleSorter.h"
+#include "PressureSolver.h"
+#include "StaggeredGrid.h"
+
+namespace {
+
+// Physical width of the simulated tank, in meters, as in
+// PressureSolverBenchmark
+const double kTankWidth = 0.25;
+
+// Returns the particles of a dam break on an |n| x |n| x |n| grid with cell
+// width |dx|: a block of fluid filling the lower half of the tank in x and z
+// and the whole tank in y, seeded with 2 x 2 x 2 randomly jittered particles
+// per grid cell, with random velocities.
+std::vector<Particle> MakeDamBreak(std::size_t n, double dx) {
+  std::mt19937 generator(1u);
+  std::uniform_real_distribution<double> jitter(0.0, 0.5);
+  std::uniform_real_distribution<double> velocity(-1.0, 1.0);
+  std::vector<Particle> particles;
+  for (std::size_t i = 1; i < n / 2; i++) {
+    for (std::size_t j = 1; j < n - 1; j++) {
+      for (std::size_t k = 1; k < n / 2; k++) {
+        for (std::size_t s = 0; s < 8; s++) {
+          Particle particle;
+          particle.pos << (i + 0.5 * (s & 1) + jitter(generator)) * dx,
+              (j + 0.5 * ((s >> 1) & 1) + jitter(generator)) * dx,
+              (k + 0.5 * (s >> 2) + jitter(generator)) * dx;
+          particle.vel << velocity(generator), velocity(generator),
+              velocity(generator);
+          particles.push_back(particle);
+        }
+      }
+    }
+  }
+  return particles;
+}
+
+// Returns whether |a1| and |a2| hold exactly the same elements.
+bool ExactlyEqual(const Array3D<double>& a1, const Array3D<double>& a2) {
+  for (std::size_t i = 0; i < a1.nx(); i++) {
+    for (std::size_t j = 0; j < a1.ny(); j++) {
+      for (std::size_t k = 0; k < a1.nz(); k++) {
+        if (!(a1(i, j, k) == a2(i, j, k))) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// Seconds spent per particle-to-grid transfer, grid-to-particle transfer, and
+// advection pass over one ordering and storage of the particles, and per fused
+// grid-to-particle transfer and advection pass where there is one
+struct TransferStats {
+  double splat_seconds;
+  double gather_seconds;
+  double advect_seconds;
+  double fused_seconds;
+};
+
+// Transfers grid velocities back to every particle and advects it, one
+// Particle at a time, as the simulator did before ParticleSet.
+void GridToParticles(double flip_ratio, StaggeredGrid<double>* grid,
+                     std::vector<Particle>* particles) {
+  for (Particle& particle : *particles) {
+    particle.vel = grid->GridToParticle(flip_ratio, particle);
+  }
+}
+void AdvectParticles(double dt, StaggeredGrid<double>* grid,
+                     std::vector<Particle>* particles) {
+  for (Particle& particle : *particles) {
+    particle.pos = grid->Advect(particle.pos, dt);
+  }
+}
+
+// Same as above, with the batched transfers of a ParticleSet
+template <typename P>
+void GridToParticles(double flip_ratio, StaggeredGrid<double>* grid,
+                     ParticleSet<P>* particles) {
+  grid->GridToParticles(flip_ratio, particles);
+}
+template <typename P>
+void AdvectParticles(double dt, StaggeredGrid<double>* grid,
+                     ParticleSet<P>* particles) {
+  grid->AdvectParticles(dt, particles);
+}
+
+// Transfers grid velocities back to every particle and advects it in one
+// pass, returning whether |particles| has such a pass.
+bool GridToParticlesAndAdvect(double, double, StaggeredGrid<double>*,
+                              std::vector<Particle>*) {
+  return false;
+}
+template <typename P>
+bool GridToParticlesAndAdvect(double flip_ratio, double dt,
+                              StaggeredGrid<double>* grid,
+                              ParticleSet<P>* particles) {
+  grid->GridToParticlesAndAdvect(flip_ratio, dt, particles);
+  return true;
+}
+
+// Times |num_reps| repetitions of each particle transfer of a time step over
+// |particles|, a std::vector<Particle> or a ParticleSet, on |grid|. Every
+// repetition starts from a fresh copy of |particles|.
+template <typename Particles>
+TransferStats TimeTransfers(const Particles& particles, std::size_t num_reps,
+                            StaggeredGrid<double>* grid) {
+  const double kDt = 0.001111112;
+  const double kFlipRatio = 0.95;
+  TransferStats stats = {0.0, 0.0, 0.0, 0.0};
+
+  for (std::size_t rep = 0; rep < num_reps; rep++) {
+    Particles moved = particles;
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    grid->ParticlesToGrid(moved);
+    std::chrono::steady_clock::time_point splatted =
+        std::chrono::steady_clock::now();
+    GridToParticles(kFlipRatio, grid, &moved);
+    std::chrono::steady_clock::time_point gathered =
+        std::chrono::steady_clock::now();
+    AdvectParticles(kDt, grid, &moved);
+    std::chrono::steady_clock::time_point advected =
+        std::chrono::steady_clock::now();
+
+    stats.splat_seconds +=
+        std::chrono::duration<double>(splatted - start).count() / num_reps;
+    stats.gather_seconds +=
+        std::chrono::duration<double>(gathered - splatted).count() / num_reps;
+    stats.advect_seconds +=
+        std::chrono::duration<double>(advected - gathered).count() / num_reps;
+
+    // The grid velocities are unchanged, so the fused pass starts over from
+    // the particles' velocities before the gather.
+    moved = particles;
+    start = std::chrono::steady_clock::now();
+    if (GridToParticlesAndAdvect(kFlipRatio, kDt, grid, &moved)) {
+      stats.fused_seconds +=
+          std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                        start).count() / num_reps;
+    }
+  }
+  return stats;
+}
+
+void PrintStats(const char* name, const TransferStats& stats) {
+  std::cout << name << ": " << 1000.0 * stats.splat_seconds
+            << " ms per ParticlesToGrid, " << 1000.0 * stats.gather_seconds
+            << " ms per GridToParticle pass, "
+            << 1000.0 * stats.advect_seconds << " ms per Advect pass";
+  if (stats.fused_seconds > 0.0) {
+    std::cout << ", " << 1000.0 * stats.fused_seconds
+              << " ms per fused pass";
+  }
+  std::cout << std::endl;
+}
+
+}  // namespace
+
+// Measures how particle-to-grid transfers scale from one thread up to
+// |max_threads| threads on a dam break, and checks that every thread count
+// gives bit-identical grid velocities. Then compares the particle transfers of
+// a time step on shuffled particles with the same particles sorted by grid
+// cell, on a ParticleSet of double or float coordinates with a
+// std::vector<Particle>, and a separate grid-to-particle transfer and advection
+// with the fused pass.
+//
+// Usage: ./ParticleTransferBenchmark [n] [num_reps] [max_threads]
+int main(int argc, char** argv) {
+  std::size_t n = argc >= 2 ? std::strtoul(argv[1], NULL, 10) : 64u;
+  std::size_t num_reps = argc >= 3 ? std::strtoul(argv[2], NULL, 10) : 10u;
+  std::size_t max_threads = argc >= 4 ? std::strtoul(argv[3], NULL, 10)
+                                      : std::thread::hardware_concurrency();
+  if (max_threads == 0) {
+    max_threads = 1;
+  }
+
+  const double dx = kTankWidth / n;
+  std::vector<Particle> particles = MakeDamBreak(n, dx);
+  ParticleSet<double> particle_set(particles);
+  std::cout << "ParticlesToGrid on a " << n << " x " << n << " x " << n
+            << " grid, " << particles.size() << " particles, " << num_reps
+            << " repetitions" << std::endl;
+
+  // Powers of two up to |max_threads|, then |max_threads| itself
+  std::vector<std::size_t> thread_counts;
+  for (std::size_t num_threads = 1; num_threads < max_threads;
+       num_threads *= 2) {
+    thread_counts.push_back(num_threads);
+  }
+  thread_counts.push_back(max_threads);
+
+  StaggeredGrid<double> one_thread_grid(n, n, n, Eigen::Vector3d::Zero(), dx);
+  double one_thread_seconds = 0.0;
+  for (std::size_t num_threads : thread_counts) {
+    StaggeredGrid<double> grid(n, n, n, Eigen::Vector3d::Zero(), dx,
+                               PressureSolverOptions(), num_threads);
+    StaggeredGrid<double>& transferred =
+        num_threads == 1 ? one_thread_grid : grid;
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    for (std::size_t rep = 0; rep < num_reps; rep++) {
+      transferred.ParticlesToGrid(particle_set);
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    double seconds = elapsed.count() / num_reps;
+    if (num_threads == 1) {
+      one_thread_seconds = seconds;
+    }
+
+    bool identical = ExactlyEqual(transferred.u(), one_thread_grid.u()) &&
+                     ExactlyEqual(transferred.v(), one_thread_grid.v()) &&
+                     ExactlyEqual(transferred.w(), one_thread_grid.w());
+    std::cout << num_threads << " threads: " << 1000.0 * seconds
+              << " ms per transfer, " << one_thread_seconds / seconds
+              << "x speedup, "
+              << (identical ? "identical to" : "DIFFERENT from")
+              << " one thread" << std::endl;
+  }
+
+  // Particle order, on one thread: particles shuffled as if they had mixed
+  // for a long time, then sorted by grid cell.
+  std::shuffle(particles.begin(), particles.end(), std::mt19937(2u));
+  particle_set = ParticleSet<double>(particles);
+  PrintStats("Shuffled    ",
+             TimeTransfers(particle_set, num_reps, &one_thread_grid));
+
+  ParticleSorter sorter(n, n, n, Eigen::Vector3d::Zero(), dx);
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  sorter.Sort(&particle_set);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << "Sorting by cell: " << 1000.0 * elapsed.count() << " ms"
+            << std::endl;
+  PrintStats("Sorted      ",
+             TimeTransfers(particle_set, num_reps, &one_thread_grid));
+
+  // Particle storage, on one thread, in sorted order: one Particle struct at a
+  // time, then a ParticleSet of float coordinates.
+  for (std::size_t n = 0; n < particle_set.size(); n++) {
+    particles[n] = particle_set.Get(n);
+  }
+  PrintStats("Structs     ",
+             TimeTransfers(particles, num_reps, &one_thread_grid));
+  PrintStats("Float set   ", TimeTransfers(ParticleSet<float>(particles),
+                                           num_reps, &one_thread_grid));
+
+  return EXIT_SUCCESS;
+}
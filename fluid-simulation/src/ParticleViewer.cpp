@@ -25,6 +25,9 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+#include "ParticleFrame.h"
+#include "ParticleSet.h"
+
 #include <sstream>
 
 #ifndef M_PI
@@ -73,6 +76,18 @@ void readFrame(const char *fname, std::vector<Eigen::Vector3d> &particles) {
   int nparts;
   double foo;
   
+  // Frames written in the binary particle frame format
+  if (IsBinaryParticleFrame(fname)) {
+    std::cout<<"reading binary "<<fname<<std::endl;
+    ParticleFrameHeader header;
+    ParticleSet<double> frame;
+    ReadBinaryParticleFrame(fname, &header, &frame);
+    for (std::size_t n = 0; n < frame.size(); n++) {
+      particles.push_back(frame.position(n));
+    }
+    return;
+  }
+
   std::ifstream in(fname, std::ios::in);
   std::cout<<"reading "<<fname<<std::endl;
   if (!in.good()) return;
@@ -0,0 +1,128 @@
+#include "PhaseProfiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+// Names of the phases in the summary and CSV columns, in SimulationPhase
+// order
+const char* const kPhaseNames[NUM_SIMULATION_PHASES] = {
+    "Advection",
+    "ParticleSort",
+    "ParticlesToGrid",
+    "ApplyGravity",
+    "MakeNeighborMaterialInfo",
+    "PressureSolve",
+    "SubtractPressureGradient",
+    "GridToParticles",
+    "FrameOutput",
+    "Checkpoint"};
+
+// Prints one row of the summary table: |name|, |total_seconds| and its share
+// of |run_seconds|, and the mean and largest time per step.
+void PrintRow(const char* name, double total_seconds, double run_seconds,
+              std::size_t num_steps, double max_seconds) {
+  char row[160];
+  std::snprintf(row, sizeof(row), "  %-26s %10.3f %7.1f%% %12.3f %12.3f",
+                name, total_seconds,
+                run_seconds > 0.0 ? 100.0 * total_seconds / run_seconds : 0.0,
+                1000.0 * total_seconds / num_steps, 1000.0 * max_seconds);
+  std::cout << row << std::endl;
+}
+
+}  // namespace
+
+PhaseProfiler::PhaseProfiler()
+    : step_start_(std::chrono::steady_clock::now()) {
+  std::fill(current_seconds_, current_seconds_ + NUM_SIMULATION_PHASES, 0.0);
+}
+
+PhaseProfiler::~PhaseProfiler() {}
+
+void PhaseProfiler::EndStep(double time) {
+  if (!kPhaseTimersEnabled) {
+    return;
+  }
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  step_times_.push_back(time);
+  step_seconds_.push_back(
+      std::chrono::duration<double>(now - step_start_).count());
+  phase_seconds_.insert(phase_seconds_.end(), current_seconds_,
+                        current_seconds_ + NUM_SIMULATION_PHASES);
+  std::fill(current_seconds_, current_seconds_ + NUM_SIMULATION_PHASES, 0.0);
+  step_start_ = now;
+}
+
+double PhaseProfiler::TotalSeconds(SimulationPhase phase) const {
+  double total = 0.0;
+  for (std::size_t step = 0; step < num_steps(); step++) {
+    total += phase_seconds_[step * NUM_SIMULATION_PHASES + phase];
+  }
+  return total;
+}
+
+void PhaseProfiler::PrintSummary() const {
+  if (!kPhaseTimersEnabled) {
+    std::cout << "Phase timers were compiled out." << std::endl;
+    return;
+  }
+  if (num_steps() == 0) {
+    return;
+  }
+
+  double run_seconds = 0.0;
+  for (double seconds : step_seconds_) {
+    run_seconds += seconds;
+  }
+  std::cout << "Time per phase over " << num_steps() << " steps:" << std::endl;
+  std::cout << "  Phase                      Total (s)   Share   Mean (ms)"
+               "    Max (ms)"
+            << std::endl;
+  double timed_seconds = 0.0;
+  for (std::size_t phase = 0; phase < NUM_SIMULATION_PHASES; phase++) {
+    double total = 0.0, max_seconds = 0.0;
+    for (std::size_t step = 0; step < num_steps(); step++) {
+      double seconds = phase_seconds_[step * NUM_SIMULATION_PHASES + phase];
+      total += seconds;
+      max_seconds = std::max(max_seconds, seconds);
+    }
+    timed_seconds += total;
+    PrintRow(kPhaseNames[phase], total, run_seconds, num_steps(), max_seconds);
+  }
+
+  // Whatever the timers don't cover: time step bookkeeping, logging, and the
+  // like
+  double max_other_seconds = 0.0;
+  for (std::size_t step = 0; step < num_steps(); step++) {
+    double other = step_seconds_[step];
+    for (std::size_t phase = 0; phase < NUM_SIMULATION_PHASES; phase++) {
+      other -= phase_seconds_[step * NUM_SIMULATION_PHASES + phase];
+    }
+    max_other_seconds = std::max(max_other_seconds, other);
+  }
+  PrintRow("Other", run_seconds - timed_seconds, run_seconds, num_steps(),
+           max_other_seconds);
+  PrintRow("Total", run_seconds, run_seconds, num_steps(),
+           *std::max_element(step_seconds_.begin(), step_seconds_.end()));
+}
+
+bool PhaseProfiler::WriteCsv(const std::string& file_name) const {
+  std::ofstream out(file_name.c_str(), std::ios::out);
+  out << "step,time";
+  for (const char* name : kPhaseNames) {
+    out << "," << name;
+  }
+  out << ",StepTotal\n";
+  for (std::size_t step = 0; step < num_steps(); step++) {
+    out << step << "," << step_times_[step];
+    for (std::size_t phase = 0; phase < NUM_SIMULATION_PHASES; phase++) {
+      out << "," << phase_seconds_[step * NUM_SIMULATION_PHASES + phase];
+    }
+    out << "," << step_seconds_[step] << '\n';
+  }
+  out.close();
+  return static_cast<bool>(out);
+}
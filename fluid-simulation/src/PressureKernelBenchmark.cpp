@@ -0,0 +1,212 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#include "Array3D.h"
+#include "MaterialType.h"
+#include "NeighborMaterialInfo.h"
+#include "PressureKernels.h"
+#include "ThreadPool.h"
+
+namespace {
+
+// Vector values each sweep of a Conjugate Gradient iteration reads and writes
+// per grid cell. ATimes also reads a 2-byte neighbors entry per cell.
+// Neighboring values of the stencil are assumed to come from cache.
+const std::size_t kATimesValues = 1 + 1;  // d -> q
+const std::size_t kDotValues = 1 + 1;  // a1, a2
+const std::size_t kSelfDotValues = 1;  // r
+const std::size_t kPlusEqualsValues = 1 + 1 + 1;  // this, arr -> this
+const std::size_t kEqualsPlusTimesValues = 1 + 1 + 1;  // arr1, arr2 -> this
+const std::size_t kUpdateValues = 4 + 2;  // d, q, p, r -> p, r
+const std::size_t kNeighborsBytes = 2;
+
+// The PressureMatrix sweep reads four coefficient arrays instead of the
+// neighbors bitmask.
+const std::size_t kMatrixATimesValues = 4 + 1 + 1;  // A, d -> q
+
+// Conjugate Gradient state for one run of iterations, with vectors stored as
+// |T|
+template <typename T>
+struct CGState {
+  CGState(std::size_t nx, std::size_t ny, std::size_t nz)
+      : p(nx, ny, nz), r(nx, ny, nz), d(nx, ny, nz), q(nx, ny, nz) {}
+
+  Array3D<T> p;
+  Array3D<T> r;
+  Array3D<T> d;
+  Array3D<T> q;
+};
+
+// Sets |*state| to the start of a Conjugate Gradient solve whose right-hand
+// side is a smooth pattern over the FLUID cells described by |neighbors|.
+template <typename T>
+void ResetCG(const Array3D<unsigned short>& neighbors, CGState<T>* state) {
+  state->p = 0.0;
+  state->q = 0.0;
+  state->r = 0.0;
+  for (std::size_t i = 0; i < neighbors.nx(); i++) {
+    for (std::size_t j = 0; j < neighbors.ny(); j++) {
+      for (std::size_t k = 0; k < neighbors.nz(); k++) {
+        if (neighbors(i, j, k)) {
+          state->r(i, j, k) = static_cast<T>((i * 7 + j * 3 + k) % 11) - 5;
+        }
+      }
+    }
+  }
+  state->d.SetEqualTo(state->r);
+}
+
+// Runs |num_iters| unpreconditioned Conjugate Gradient iterations with one
+// sweep per vector operation, as PressureSolver did before its kernels were
+// fused. Returns the final squared residual norm.
+template <typename T>
+double RunUnfused(const Array3D<unsigned short>& neighbors,
+                  std::size_t num_iters, ThreadPool* pool, CGState<T>* state) {
+  double sigma = Dot(state->r, state->r, pool);
+  for (std::size_t iter = 0; iter < num_iters; iter++) {
+    ATimes(state->d, neighbors, pool, &state->q);
+    double alpha = sigma / Dot(state->d, state->q, pool);
+    state->p.PlusEquals(alpha, state->d, pool);
+    state->r.PlusEquals(-alpha, state->q, pool);
+    double sigma_old = sigma;
+    sigma = Dot(state->r, state->r, pool);
+    state->d.EqualsPlusTimes(state->r, sigma / sigma_old, state->d, pool);
+  }
+  return sigma;
+}
+
+// Same as RunUnfused, with the fused kernels PressureSolver uses.
+template <typename T>
+double RunFused(const Array3D<unsigned short>& neighbors,
+                std::size_t num_iters, ThreadPool* pool, CGState<T>* state) {
+  double sigma = Dot(state->r, state->r, pool);
+  for (std::size_t iter = 0; iter < num_iters; iter++) {
+    double alpha = sigma / ATimesAndDot(state->d, neighbors, pool, &state->q);
+    double sigma_old = sigma;
+    sigma = UpdatePressureAndResidual(alpha, state->d, state->q, pool,
+                                      &state->p, &state->r);
+    state->d.EqualsPlusTimes(state->r, sigma / sigma_old, state->d, pool);
+  }
+  return sigma;
+}
+
+// Same as RunFused, multiplying by the coefficient arrays of |matrix| with the
+// instructions |simd|.
+template <typename T>
+double RunFusedMatrix(const PressureMatrix<T>& matrix, SimdInstructionSet simd,
+                      std::size_t num_iters, ThreadPool* pool,
+                      CGState<T>* state) {
+  double sigma = Dot(state->r, state->r, pool);
+  for (std::size_t iter = 0; iter < num_iters; iter++) {
+    double alpha =
+        sigma / ATimesAndDot(matrix, state->d, simd, pool, &state->q);
+    double sigma_old = sigma;
+    sigma = UpdatePressureAndResidual(alpha, state->d, state->q, pool,
+                                      &state->p, &state->r);
+    state->d.EqualsPlusTimes(state->r, sigma / sigma_old, state->d, pool);
+  }
+  return sigma;
+}
+
+void PrintStats(const char* name, std::size_t num_sweeps,
+                std::size_t bytes_per_cell, std::size_t num_cells,
+                double seconds, std::size_t num_iters, double residual_norm) {
+  double bytes_per_iter = static_cast<double>(bytes_per_cell) * num_cells;
+  double seconds_per_iter = seconds / num_iters;
+  std::cout << name << ": " << num_sweeps << " sweeps, " << bytes_per_cell
+            << " bytes per cell, " << bytes_per_iter / 1.0e6
+            << " MB per iteration, " << 1000.0 * seconds_per_iter
+            << " ms per iteration, " << bytes_per_iter / seconds_per_iter / 1.0e9
+            << " GB/s, final r.r " << residual_norm << std::endl;
+}
+
+}  // namespace
+
+// Measures the memory traffic of one Conjugate Gradient iteration of the
+// pressure solve, with and without fused kernels, with the fused kernels on
+// float vectors, and with the coefficient array stencil on each instruction set
+// the CPU supports, on a cube of FLUID cells.
+//
+// Usage: ./PressureKernelBenchmark [n] [num_iters] [num_threads]
+int main(int argc, char** argv) {
+  std::size_t n = argc >= 2 ? std::strtoul(argv[1], NULL, 10) : 128u;
+  std::size_t num_iters = argc >= 3 ? std::strtoul(argv[2], NULL, 10) : 50u;
+  std::size_t num_threads = argc >= 4 ? std::strtoul(argv[3], NULL, 10) : 1u;
+
+  ThreadPool pool(num_threads);
+  std::cout << "CG iterations on a " << n << " x " << n << " x " << n
+            << " grid, " << num_iters << " iterations, "
+            << pool.num_threads() << " threads" << std::endl;
+
+  Array3D<MaterialType> labels(n, n, n);
+  for (std::size_t i = 0; i < n; i++) {
+    for (std::size_t j = 0; j < n; j++) {
+      for (std::size_t k = 0; k < n; k++) {
+        bool border = i == 0 || j == 0 || k == 0 || i == n - 1 ||
+                      j == n - 1 || k == n - 1;
+        labels(i, j, k) = border ? SOLID : FLUID;
+      }
+    }
+  }
+  Array3D<unsigned short> neighbors(n, n, n);
+  PressureMatrix<double> matrix(n, n, n);
+  MakeNeighborMaterialInfo(labels, &neighbors, &matrix);
+
+  CGState<double> state(n, n, n);
+  const std::size_t num_cells = n * n * n;
+  const std::size_t kDoubleBytes = sizeof(double);
+
+  ResetCG(neighbors, &state);
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  double residual_norm = RunUnfused(neighbors, num_iters, &pool, &state);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  PrintStats("Unfused", 6,
+             kNeighborsBytes +
+                 kDoubleBytes * (kATimesValues + kDotValues +
+                                 2 * kPlusEqualsValues + kSelfDotValues +
+                                 kEqualsPlusTimesValues),
+             num_cells, elapsed.count(), num_iters, residual_norm);
+
+  ResetCG(neighbors, &state);
+  start = std::chrono::steady_clock::now();
+  residual_norm = RunFused(neighbors, num_iters, &pool, &state);
+  elapsed = std::chrono::steady_clock::now() - start;
+  const std::size_t kFusedValues =
+      kATimesValues + kUpdateValues + kEqualsPlusTimesValues;
+  PrintStats("Fused  ", 3, kNeighborsBytes + kDoubleBytes * kFusedValues,
+             num_cells, elapsed.count(), num_iters, residual_norm);
+
+  // Float vectors halve the bytes of every sweep, while the dot products are
+  // still accumulated in double.
+  CGState<float> float_state(n, n, n);
+  ResetCG(neighbors, &float_state);
+  start = std::chrono::steady_clock::now();
+  residual_norm = RunFused(neighbors, num_iters, &pool, &float_state);
+  elapsed = std::chrono::steady_clock::now() - start;
+  PrintStats("Float  ", 3, kNeighborsBytes + sizeof(float) * kFusedValues,
+             num_cells, elapsed.count(), num_iters, residual_norm);
+
+  const SimdInstructionSet kInstructionSets[] = {NO_SIMD, SSE2_SIMD,
+                                                 AVX2_SIMD};
+  const char* const kInstructionSetNames[] = {"Scalar ", "SSE2   ",
+                                              "AVX2   "};
+  for (std::size_t n = 0; n < 3; n++) {
+    if (kInstructionSets[n] > BestSimdInstructionSet()) {
+      continue;
+    }
+    ResetCG(neighbors, &state);
+    start = std::chrono::steady_clock::now();
+    residual_norm = RunFusedMatrix(matrix, kInstructionSets[n], num_iters,
+                                   &pool, &state);
+    elapsed = std::chrono::steady_clock::now() - start;
+    PrintStats(kInstructionSetNames[n], 3,
+               kDoubleBytes * (kMatrixATimesValues + kUpdateValues +
+                               kEqualsPlusTimesValues),
+               num_cells, elapsed.count(), num_iters, residual_norm);
+  }
+
+  return EXIT_SUCCESS;
+}
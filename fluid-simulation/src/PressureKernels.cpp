@@ -0,0 +1,572 @@
+#include "PressureKernels.h"
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "NeighborDirection.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+namespace {
+
+// Returns the row of A * |d| for cell (|i|, |j|, |k|), whose entry in the
+// neighbors array is |nbrs|. A is very large and sparse: we can simply select
+// the few entries in the row that are nonzero and multiply just the appropriate
+// values from |d| matching with those nonzero entries of A.
+template <typename T, Array3DLayout L>
+inline T StencilTimes(const Array3D<T, L>& d, unsigned short nbrs,
+                      std::size_t i, std::size_t j, std::size_t k) {
+  const unsigned short CENTER = 7;
+
+  return ((nbrs & CENTER) * d(i, j, k)) -
+         ((nbrs & NeighborDirection::LEFT) ? d(i - 1, j, k) : 0) -
+         ((nbrs & NeighborDirection::DOWN) ? d(i, j - 1, k) : 0) -
+         ((nbrs & NeighborDirection::BACK) ? d(i, j, k - 1) : 0) -
+         ((nbrs & NeighborDirection::RIGHT) ? d(i + 1, j, k) : 0) -
+         ((nbrs & NeighborDirection::UP) ? d(i, j + 1, k) : 0) -
+         ((nbrs & NeighborDirection::FORWARD) ? d(i, j, k + 1) : 0);
+}
+
+// Returns the sum of the partial sums in |slice_sums|, per i-slice or per
+// block, added in order.
+inline double SumSlices(const std::vector<double>& slice_sums) {
+  double sum = 0.0;
+  for (std::size_t i = 0; i < slice_sums.size(); i++) {
+    sum += slice_sums[i];
+  }
+  return sum;
+}
+
+// Pointers to the rows of consecutive k of a PressureMatrix and of the vectors
+// that one row of A * d reads and writes, all indexed by k
+template <typename T>
+struct StencilRow {
+  const T* diag;
+  const T* plus_i;
+  const T* minus_i;  // plus_i of the row at i - 1
+  const T* plus_j;
+  const T* minus_j;  // plus_j of the row at j - 1
+  const T* plus_k;
+  const T* d;
+  const T* d_left;
+  const T* d_right;
+  const T* d_down;
+  const T* d_up;
+  T* q;
+};
+
+// Sets q[k] to row k of A * d for each k in [|k_begin|, |k_end|) of |row|, and
+// returns the dot product of those entries of d and q.
+//
+// The vectorized versions below add the terms of each q[k] in this same order
+// and without fused multiply-adds, so every version gives the same q.
+template <typename T>
+double StencilRowScalar(const StencilRow<T>& row, std::size_t k_begin,
+                        std::size_t k_end) {
+  double dot = 0.0;
+  for (std::size_t k = k_begin; k < k_end; k++) {
+    T q_k = row.diag[k] * row.d[k];
+    q_k += row.plus_i[k] * row.d_right[k];
+    q_k += row.minus_i[k] * row.d_left[k];
+    q_k += row.plus_j[k] * row.d_up[k];
+    q_k += row.minus_j[k] * row.d_down[k];
+    q_k += row.plus_k[k] * row.d[k + 1];
+    q_k += row.plus_k[k - 1] * row.d[k - 1];
+    row.q[k] = q_k;
+    dot += static_cast<double>(row.d[k]) * q_k;
+  }
+  return dot;
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("avx2"))) double StencilRowAvx2(
+    const StencilRow<double>& row, std::size_t k_begin, std::size_t k_end) {
+  __m256d dot = _mm256_setzero_pd();
+  std::size_t k = k_begin;
+  for (; k + 4 <= k_end; k += 4) {
+    __m256d d = _mm256_loadu_pd(row.d + k);
+    __m256d q = _mm256_mul_pd(_mm256_loadu_pd(row.diag + k), d);
+    q = _mm256_add_pd(q, _mm256_mul_pd(_mm256_loadu_pd(row.plus_i + k),
+                                       _mm256_loadu_pd(row.d_right + k)));
+    q = _mm256_add_pd(q, _mm256_mul_pd(_mm256_loadu_pd(row.minus_i + k),
+                                       _mm256_loadu_pd(row.d_left + k)));
+    q = _mm256_add_pd(q, _mm256_mul_pd(_mm256_loadu_pd(row.plus_j + k),
+                                       _mm256_loadu_pd(row.d_up + k)));
+    q = _mm256_add_pd(q, _mm256_mul_pd(_mm256_loadu_pd(row.minus_j + k),
+                                       _mm256_loadu_pd(row.d_down + k)));
+    q = _mm256_add_pd(q, _mm256_mul_pd(_mm256_loadu_pd(row.plus_k + k),
+                                       _mm256_loadu_pd(row.d + k + 1)));
+    q = _mm256_add_pd(q, _mm256_mul_pd(_mm256_loadu_pd(row.plus_k + k - 1),
+                                       _mm256_loadu_pd(row.d + k - 1)));
+    _mm256_storeu_pd(row.q + k, q);
+    dot = _mm256_add_pd(dot, _mm256_mul_pd(d, q));
+  }
+
+  double lanes[4];
+  _mm256_storeu_pd(lanes, dot);
+
+  // Clears the upper halves of the AVX registers before running code compiled
+  // for SSE, which otherwise stalls on every SSE instruction that follows.
+  _mm256_zeroupper();
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) +
+         StencilRowScalar(row, k, k_end);
+}
+
+__attribute__((target("avx2"))) double StencilRowAvx2(
+    const StencilRow<float>& row, std::size_t k_begin, std::size_t k_end) {
+  __m256d dot = _mm256_setzero_pd();
+  std::size_t k = k_begin;
+  for (; k + 8 <= k_end; k += 8) {
+    __m256 d = _mm256_loadu_ps(row.d + k);
+    __m256 q = _mm256_mul_ps(_mm256_loadu_ps(row.diag + k), d);
+    q = _mm256_add_ps(q, _mm256_mul_ps(_mm256_loadu_ps(row.plus_i + k),
+                                       _mm256_loadu_ps(row.d_right + k)));
+    q = _mm256_add_ps(q, _mm256_mul_ps(_mm256_loadu_ps(row.minus_i + k),
+                                       _mm256_loadu_ps(row.d_left + k)));
+    q = _mm256_add_ps(q, _mm256_mul_ps(_mm256_loadu_ps(row.plus_j + k),
+                                       _mm256_loadu_ps(row.d_up + k)));
+    q = _mm256_add_ps(q, _mm256_mul_ps(_mm256_loadu_ps(row.minus_j + k),
+                                       _mm256_loadu_ps(row.d_down + k)));
+    q = _mm256_add_ps(q, _mm256_mul_ps(_mm256_loadu_ps(row.plus_k + k),
+                                       _mm256_loadu_ps(row.d + k + 1)));
+    q = _mm256_add_ps(q, _mm256_mul_ps(_mm256_loadu_ps(row.plus_k + k - 1),
+                                       _mm256_loadu_ps(row.d + k - 1)));
+    _mm256_storeu_ps(row.q + k, q);
+
+    // The dot product is accumulated in double, four cells at a time.
+    __m256d d_low = _mm256_cvtps_pd(_mm256_castps256_ps128(d));
+    __m256d d_high = _mm256_cvtps_pd(_mm256_extractf128_ps(d, 1));
+    __m256d q_low = _mm256_cvtps_pd(_mm256_castps256_ps128(q));
+    __m256d q_high = _mm256_cvtps_pd(_mm256_extractf128_ps(q, 1));
+    dot = _mm256_add_pd(dot, _mm256_mul_pd(d_low, q_low));
+    dot = _mm256_add_pd(dot, _mm256_mul_pd(d_high, q_high));
+  }
+
+  double lanes[4];
+  _mm256_storeu_pd(lanes, dot);
+
+  // Clears the upper halves of the AVX registers before running code compiled
+  // for SSE, which otherwise stalls on every SSE instruction that follows.
+  _mm256_zeroupper();
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) +
+         StencilRowScalar(row, k, k_end);
+}
+
+double StencilRowSse2(const StencilRow<double>& row, std::size_t k_begin,
+                      std::size_t k_end) {
+  __m128d dot = _mm_setzero_pd();
+  std::size_t k = k_begin;
+  for (; k + 2 <= k_end; k += 2) {
+    __m128d d = _mm_loadu_pd(row.d + k);
+    __m128d q = _mm_mul_pd(_mm_loadu_pd(row.diag + k), d);
+    q = _mm_add_pd(q, _mm_mul_pd(_mm_loadu_pd(row.plus_i + k),
+                                 _mm_loadu_pd(row.d_right + k)));
+    q = _mm_add_pd(q, _mm_mul_pd(_mm_loadu_pd(row.minus_i + k),
+                                 _mm_loadu_pd(row.d_left + k)));
+    q = _mm_add_pd(q, _mm_mul_pd(_mm_loadu_pd(row.plus_j + k),
+                                 _mm_loadu_pd(row.d_up + k)));
+    q = _mm_add_pd(q, _mm_mul_pd(_mm_loadu_pd(row.minus_j + k),
+                                 _mm_loadu_pd(row.d_down + k)));
+    q = _mm_add_pd(q, _mm_mul_pd(_mm_loadu_pd(row.plus_k + k),
+                                 _mm_loadu_pd(row.d + k + 1)));
+    q = _mm_add_pd(q, _mm_mul_pd(_mm_loadu_pd(row.plus_k + k - 1),
+                                 _mm_loadu_pd(row.d + k - 1)));
+    _mm_storeu_pd(row.q + k, q);
+    dot = _mm_add_pd(dot, _mm_mul_pd(d, q));
+  }
+
+  double lanes[2];
+  _mm_storeu_pd(lanes, dot);
+  return (lanes[0] + lanes[1]) + StencilRowScalar(row, k, k_end);
+}
+
+double StencilRowSse2(const StencilRow<float>& row, std::size_t k_begin,
+                      std::size_t k_end) {
+  __m128d dot = _mm_setzero_pd();
+  std::size_t k = k_begin;
+  for (; k + 4 <= k_end; k += 4) {
+    __m128 d = _mm_loadu_ps(row.d + k);
+    __m128 q = _mm_mul_ps(_mm_loadu_ps(row.diag + k), d);
+    q = _mm_add_ps(q, _mm_mul_ps(_mm_loadu_ps(row.plus_i + k),
+                                 _mm_loadu_ps(row.d_right + k)));
+    q = _mm_add_ps(q, _mm_mul_ps(_mm_loadu_ps(row.minus_i + k),
+                                 _mm_loadu_ps(row.d_left + k)));
+    q = _mm_add_ps(q, _mm_mul_ps(_mm_loadu_ps(row.plus_j + k),
+                                 _mm_loadu_ps(row.d_up + k)));
+    q = _mm_add_ps(q, _mm_mul_ps(_mm_loadu_ps(row.minus_j + k),
+                                 _mm_loadu_ps(row.d_down + k)));
+    q = _mm_add_ps(q, _mm_mul_ps(_mm_loadu_ps(row.plus_k + k),
+                                 _mm_loadu_ps(row.d + k + 1)));
+    q = _mm_add_ps(q, _mm_mul_ps(_mm_loadu_ps(row.plus_k + k - 1),
+                                 _mm_loadu_ps(row.d + k - 1)));
+    _mm_storeu_ps(row.q + k, q);
+
+    // The dot product is accumulated in double, two cells at a time.
+    dot = _mm_add_pd(dot, _mm_mul_pd(_mm_cvtps_pd(d), _mm_cvtps_pd(q)));
+    dot = _mm_add_pd(dot, _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(d, d)),
+                                     _mm_cvtps_pd(_mm_movehl_ps(q, q))));
+  }
+
+  double lanes[2];
+  _mm_storeu_pd(lanes, dot);
+  return (lanes[0] + lanes[1]) + StencilRowScalar(row, k, k_end);
+}
+
+#endif  // HAVE_X86_SIMD
+
+// Sweeps |row| over k in [|k_begin|, |k_end|) with the instructions |simd|.
+template <typename T>
+double StencilRowTimes(const StencilRow<T>& row, std::size_t k_begin,
+                       std::size_t k_end, SimdInstructionSet simd) {
+#ifdef HAVE_X86_SIMD
+  switch (simd) {
+    case AVX2_SIMD:
+      return StencilRowAvx2(row, k_begin, k_end);
+    case SSE2_SIMD:
+      return StencilRowSse2(row, k_begin, k_end);
+    case NO_SIMD:
+      break;
+  }
+#endif  // HAVE_X86_SIMD
+  (void)simd;
+  return StencilRowScalar(row, k_begin, k_end);
+}
+
+// Sets |*q| = |matrix| * |d| in the interior cells, and returns the dot
+// product of |d| and |*q| summed per i-slice.
+template <typename T>
+double SweepMatrixRows(const PressureMatrix<T>& matrix, const Array3D<T>& d,
+                       SimdInstructionSet simd, ThreadPool* pool,
+                       Array3D<T>* q) {
+  const std::size_t ny = d.ny();
+  const std::size_t nz = d.nz();
+  std::vector<double> slice_dots(d.nx(), 0.0);
+
+  pool->ParallelFor(1, d.nx() - 1, [&](std::size_t i_begin,
+                                       std::size_t i_end) {
+    for (std::size_t i = i_begin; i < i_end; i++) {
+      double slice_dot = 0.0;
+      for (std::size_t j = 1; j < ny - 1; j++) {
+        StencilRow<T> row;
+        row.diag = &matrix.diag(i, j, 0);
+        row.plus_i = &matrix.plus_i(i, j, 0);
+        row.minus_i = &matrix.plus_i(i - 1, j, 0);
+        row.plus_j = &matrix.plus_j(i, j, 0);
+        row.minus_j = &matrix.plus_j(i, j - 1, 0);
+        row.plus_k = &matrix.plus_k(i, j, 0);
+        row.d = &d(i, j, 0);
+        row.d_left = &d(i - 1, j, 0);
+        row.d_right = &d(i + 1, j, 0);
+        row.d_down = &d(i, j - 1, 0);
+        row.d_up = &d(i, j + 1, 0);
+        row.q = &(*q)(i, j, 0);
+        slice_dot += StencilRowTimes(row, 1, nz - 1, simd);
+      }
+      slice_dots[i] = slice_dot;
+    }
+  });
+
+  return SumSlices(slice_dots);
+}
+
+// Number of FLUID cells in each block of the packed kernels. Blocks are large
+// enough to amortize handing them out, and their size is fixed so packed
+// reductions don't depend on the number of threads.
+const std::size_t kBlockSize = 4096;
+
+// Returns the number of blocks ForEachBlock splits the FLUID cells of |cells|
+// into.
+inline std::size_t NumBlocks(const FluidCellIndex& cells) {
+  return (cells.size() + kBlockSize - 1) / kBlockSize;
+}
+
+// Calls |fn|(c_begin, c_end, block) for each block of the FLUID cells of
+// |cells|, split among the threads of |pool|.
+void ForEachBlock(
+    const FluidCellIndex& cells, ThreadPool* pool,
+    const std::function<void(std::size_t, std::size_t, std::size_t)>& fn) {
+  const std::size_t num_cells = cells.size();
+  pool->ParallelFor(0, NumBlocks(cells), [&](std::size_t block_begin,
+                                              std::size_t block_end) {
+    for (std::size_t block = block_begin; block < block_end; block++) {
+      std::size_t c_begin = block * kBlockSize;
+      std::size_t c_end = std::min(c_begin + kBlockSize, num_cells);
+      fn(c_begin, c_end, block);
+    }
+  });
+}
+
+}  // namespace
+
+template <typename T>
+void MakeResidualFromVelocityDivergence(const Array3D<MaterialType>& labels,
+                                        const Array3D<T>& u,
+                                        const Array3D<T>& v,
+                                        const Array3D<T>& w, ThreadPool* pool,
+                                        Array3D<T>* r) {
+  const std::size_t ny = r->ny();
+  const std::size_t nz = r->nz();
+
+  pool->ParallelFor(1, r->nx() - 1, [&](std::size_t i_begin,
+                                        std::size_t i_end) {
+    for (std::size_t i = i_begin; i < i_end; i++) {
+      for (std::size_t j = 1; j < ny - 1; j++) {
+        for (std::size_t k = 1; k < nz - 1; k++) {
+          if (labels(i, j, k) != FLUID) {
+            (*r)(i, j, k) = 0.0;
+            continue;
+          }
+
+          double du_dx = static_cast<double>(u(i + 1, j, k)) - u(i, j, k);
+          double dv_dy = static_cast<double>(v(i, j + 1, k)) - v(i, j, k);
+          double dw_dz = static_cast<double>(w(i, j, k + 1)) - w(i, j, k);
+          double velocity_divergence_of_cell_ijk = du_dx + dv_dy + dw_dz;
+          (*r)(i, j, k) = -velocity_divergence_of_cell_ijk;
+        }
+      }
+    }
+  });
+}
+
+template <typename T, Array3DLayout L>
+void ATimes(const Array3D<T, L>& d,
+            const Array3D<unsigned short, L>& neighbors, ThreadPool* pool,
+            Array3D<T, L>* q) {
+  SweepCells<L>(
+      d.nx(), d.ny(), d.nz(), 1, pool,
+      [&](std::size_t i, std::size_t j, std::size_t k, double*) {
+        unsigned short nbrs = neighbors(i, j, k);
+        (*q)(i, j, k) = nbrs ? StencilTimes(d, nbrs, i, j, k) : 0.0;
+      });
+}
+
+template <typename T, Array3DLayout L>
+double ATimesAndDot(const Array3D<T, L>& d,
+                    const Array3D<unsigned short, L>& neighbors,
+                    ThreadPool* pool, Array3D<T, L>* q) {
+  return SweepCells<L>(
+      d.nx(), d.ny(), d.nz(), 1, pool,
+      [&](std::size_t i, std::size_t j, std::size_t k, double* slice_dot) {
+        unsigned short nbrs = neighbors(i, j, k);
+        T q_ijk = nbrs ? StencilTimes(d, nbrs, i, j, k) : 0;
+        (*q)(i, j, k) = q_ijk;
+        *slice_dot += static_cast<double>(d(i, j, k)) * q_ijk;
+      });
+}
+
+template <typename T, Array3DLayout L>
+double UpdatePressureAndResidual(double alpha, const Array3D<T, L>& d,
+                                 const Array3D<T, L>& q, ThreadPool* pool,
+                                 Array3D<T, L>* p, Array3D<T, L>* r) {
+  const T alpha_t = static_cast<T>(alpha);
+  return SweepCells<L>(
+      d.nx(), d.ny(), d.nz(), 1, pool,
+      [&](std::size_t i, std::size_t j, std::size_t k, double* slice_dot) {
+        (*p)(i, j, k) += alpha_t * d(i, j, k);
+        T r_ijk = (*r)(i, j, k) - alpha_t * q(i, j, k);
+        (*r)(i, j, k) = r_ijk;
+        *slice_dot += static_cast<double>(r_ijk) * r_ijk;
+      });
+}
+
+template <typename T>
+void ATimes(const PressureMatrix<T>& matrix, const Array3D<T>& d,
+            SimdInstructionSet simd, ThreadPool* pool, Array3D<T>* q) {
+  // The dot product costs little next to the loads of the sweep.
+  SweepMatrixRows(matrix, d, simd, pool, q);
+}
+
+template <typename T>
+double ATimesAndDot(const PressureMatrix<T>& matrix, const Array3D<T>& d,
+                    SimdInstructionSet simd, ThreadPool* pool, Array3D<T>* q) {
+  return SweepMatrixRows(matrix, d, simd, pool, q);
+}
+
+SimdInstructionSet BestSimdInstructionSet() {
+#ifdef HAVE_X86_SIMD
+  if (__builtin_cpu_supports("avx2")) {
+    return AVX2_SIMD;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return SSE2_SIMD;
+  }
+#endif  // HAVE_X86_SIMD
+  return NO_SIMD;
+}
+
+template <typename T>
+void MakePackedResidualFromVelocityDivergence(const FluidCellIndex& cells,
+                                              const Array3D<T>& u,
+                                              const Array3D<T>& v,
+                                              const Array3D<T>& w,
+                                              ThreadPool* pool,
+                                              std::vector<T>* r) {
+  ForEachBlock(cells, pool, [&](std::size_t c_begin, std::size_t c_end,
+                                std::size_t) {
+    for (std::size_t c = c_begin; c < c_end; c++) {
+      std::size_t i, j, k;
+      cells.GetCell(c, &i, &j, &k);
+      double du_dx = static_cast<double>(u(i + 1, j, k)) - u(i, j, k);
+      double dv_dy = static_cast<double>(v(i, j + 1, k)) - v(i, j, k);
+      double dw_dz = static_cast<double>(w(i, j, k + 1)) - w(i, j, k);
+      (*r)[c] = -(du_dx + dv_dy + dw_dz);
+    }
+  });
+}
+
+template <typename T>
+double PackedATimesAndDot(const FluidCellIndex& cells, const std::vector<T>& d,
+                          ThreadPool* pool, std::vector<T>* q) {
+  const unsigned short CENTER = 7;
+  std::vector<double> block_dots(NumBlocks(cells), 0.0);
+
+  ForEachBlock(cells, pool, [&](std::size_t c_begin, std::size_t c_end,
+                                std::size_t block) {
+    double block_dot = 0.0;
+    for (std::size_t c = c_begin; c < c_end; c++) {
+      // Neighbors that aren't FLUID read the trailing zero entry of |d|.
+      T q_c = (cells.stencil(c) & CENTER) * d[c] - d[cells.neighbor(c, 0)] -
+              d[cells.neighbor(c, 1)] - d[cells.neighbor(c, 2)] -
+              d[cells.neighbor(c, 3)] - d[cells.neighbor(c, 4)] -
+              d[cells.neighbor(c, 5)];
+      (*q)[c] = q_c;
+      block_dot += static_cast<double>(d[c]) * q_c;
+    }
+    block_dots[block] = block_dot;
+  });
+
+  return SumSlices(block_dots);
+}
+
+template <typename T>
+double PackedUpdatePressureAndResidual(const FluidCellIndex& cells,
+                                       double alpha, const std::vector<T>& d,
+                                       const std::vector<T>& q,
+                                       ThreadPool* pool, std::vector<T>* p,
+                                       std::vector<T>* r) {
+  const T alpha_t = static_cast<T>(alpha);
+  std::vector<double> block_dots(NumBlocks(cells), 0.0);
+
+  ForEachBlock(cells, pool, [&](std::size_t c_begin, std::size_t c_end,
+                                std::size_t block) {
+    double block_dot = 0.0;
+    for (std::size_t c = c_begin; c < c_end; c++) {
+      (*p)[c] += alpha_t * d[c];
+      T r_c = (*r)[c] - alpha_t * q[c];
+      (*r)[c] = r_c;
+      block_dot += static_cast<double>(r_c) * r_c;
+    }
+    block_dots[block] = block_dot;
+  });
+
+  return SumSlices(block_dots);
+}
+
+template <typename T>
+double PackedDot(const FluidCellIndex& cells, const std::vector<T>& a1,
+                 const std::vector<T>& a2, ThreadPool* pool) {
+  std::vector<double> block_dots(NumBlocks(cells), 0.0);
+
+  ForEachBlock(cells, pool, [&](std::size_t c_begin, std::size_t c_end,
+                                std::size_t block) {
+    double block_dot = 0.0;
+    for (std::size_t c = c_begin; c < c_end; c++) {
+      block_dot += static_cast<double>(a1[c]) * a2[c];
+    }
+    block_dots[block] = block_dot;
+  });
+
+  return SumSlices(block_dots);
+}
+
+template <typename T>
+void PackedEqualsPlusTimes(const FluidCellIndex& cells,
+                           const std::vector<T>& a1, double scalar,
+                           const std::vector<T>& a2, ThreadPool* pool,
+                           std::vector<T>* out) {
+  const T scalar_t = static_cast<T>(scalar);
+  ForEachBlock(cells, pool, [&](std::size_t c_begin, std::size_t c_end,
+                                std::size_t) {
+    for (std::size_t c = c_begin; c < c_end; c++) {
+      (*out)[c] = a1[c] + scalar_t * a2[c];
+    }
+  });
+}
+
+template <typename T>
+void Pack(const FluidCellIndex& cells, const Array3D<T>& dense,
+          std::vector<T>* packed) {
+  for (std::size_t c = 0; c < cells.size(); c++) {
+    std::size_t i, j, k;
+    cells.GetCell(c, &i, &j, &k);
+    (*packed)[c] = dense(i, j, k);
+  }
+}
+
+template <typename T>
+void Unpack(const FluidCellIndex& cells, const std::vector<T>& packed,
+            Array3D<T>* dense) {
+  for (std::size_t c = 0; c < cells.size(); c++) {
+    std::size_t i, j, k;
+    cells.GetCell(c, &i, &j, &k);
+    (*dense)(i, j, k) = packed[c];
+  }
+}
+
+// Instantiates every kernel above for vectors stored as |T|.
+#define INSTANTIATE_PRESSURE_KERNELS(T)                                        \
+  template void MakeResidualFromVelocityDivergence(                            \
+      const Array3D<MaterialType>& labels, const Array3D<T>& u,                \
+      const Array3D<T>& v, const Array3D<T>& w, ThreadPool* pool,              \
+      Array3D<T>* r);                                                          \
+  template void ATimes(const PressureMatrix<T>& matrix, const Array3D<T>& d,   \
+                       SimdInstructionSet simd, ThreadPool* pool,              \
+                       Array3D<T>* q);                                         \
+  template double ATimesAndDot(const PressureMatrix<T>& matrix,                \
+                               const Array3D<T>& d, SimdInstructionSet simd,   \
+                               ThreadPool* pool, Array3D<T>* q);               \
+  template void MakePackedResidualFromVelocityDivergence(                      \
+      const FluidCellIndex& cells, const Array3D<T>& u, const Array3D<T>& v,   \
+      const Array3D<T>& w, ThreadPool* pool, std::vector<T>* r);               \
+  template double PackedATimesAndDot(const FluidCellIndex& cells,              \
+                                     const std::vector<T>& d,                  \
+                                     ThreadPool* pool, std::vector<T>* q);     \
+  template double PackedUpdatePressureAndResidual(                             \
+      const FluidCellIndex& cells, double alpha, const std::vector<T>& d,      \
+      const std::vector<T>& q, ThreadPool* pool, std::vector<T>* p,            \
+      std::vector<T>* r);                                                      \
+  template double PackedDot(const FluidCellIndex& cells,                       \
+                            const std::vector<T>& a1,                          \
+                            const std::vector<T>& a2, ThreadPool* pool);       \
+  template void PackedEqualsPlusTimes(                                         \
+      const FluidCellIndex& cells, const std::vector<T>& a1, double scalar,    \
+      const std::vector<T>& a2, ThreadPool* pool, std::vector<T>* out);        \
+  template void Pack(const FluidCellIndex& cells, const Array3D<T>& dense,     \
+                     std::vector<T>* packed);                                  \
+  template void Unpack(const FluidCellIndex& cells,                            \
+                       const std::vector<T>& packed, Array3D<T>* dense);
+
+#define INSTANTIATE_LAYOUT_KERNELS(T, L)                                       \
+  template void ATimes(const Array3D<T, L>& d,                                 \
+                       const Array3D<unsigned short, L>& neighbors,            \
+                       ThreadPool* pool, Array3D<T, L>* q);                    \
+  template double ATimesAndDot(const Array3D<T, L>& d,                         \
+                               const Array3D<unsigned short, L>& neighbors,    \
+                               ThreadPool* pool, Array3D<T, L>* q);            \
+  template double UpdatePressureAndResidual(                                   \
+      double alpha, const Array3D<T, L>& d, const Array3D<T, L>& q,            \
+      ThreadPool* pool, Array3D<T, L>* p, Array3D<T, L>* r);
+
+INSTANTIATE_PRESSURE_KERNELS(float)
+INSTANTIATE_PRESSURE_KERNELS(double)
+INSTANTIATE_LAYOUT_KERNELS(float, LINEAR_LAYOUT)
+INSTANTIATE_LAYOUT_KERNELS(double, LINEAR_LAYOUT)
+INSTANTIATE_LAYOUT_KERNELS(double, BRICKED_LAYOUT)
+
+#undef INSTANTIATE_PRESSURE_KERNELS
+#undef INSTANTIATE_LAYOUT_KERNELS
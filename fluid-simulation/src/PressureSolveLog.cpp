@@ -0,0 +1,78 @@
+#include "PressureSolveLog.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+// Returns |norm| relative to the squared norm of the right-hand side of the
+// equation in |stats|, which is what the solve's tolerance is set against.
+double RelativeToRhs(const PressureSolveStats& stats, double norm) {
+  return stats.rhs_norm > 0.0 ? norm / stats.rhs_norm : 0.0;
+}
+
+}  // namespace
+
+PressureSolveLog::PressureSolveLog(const std::string& file_name, bool append)
+    : file_name_(file_name),
+      num_solves_(0),
+      num_unconverged_(0),
+      total_iterations_(0),
+      max_iterations_(0) {
+  if (file_name_.empty()) {
+    return;
+  }
+  file_.open(file_name_.c_str(),
+             append ? std::ios::out | std::ios::app : std::ios::out);
+  if (!file_) {
+    std::cout << "ERROR: can't write solver stats file " << file_name_ << "!"
+              << std::endl;
+    return;
+  }
+  if (!append) {
+    file_ << "step,time,iterations,converged,rhs_norm,initial_residual_norm,"
+             "final_residual_norm,relative_residual_norm,relative_tolerance,"
+             "fluid_cells,seconds"
+          << std::endl;
+  }
+}
+
+PressureSolveLog::~PressureSolveLog() {}
+
+void PressureSolveLog::Add(std::size_t step, double time,
+                           const PressureSolveStats& stats) {
+  num_solves_++;
+  total_iterations_ += stats.iterations;
+  max_iterations_ = std::max(max_iterations_, stats.iterations);
+  if (!stats.converged) {
+    num_unconverged_++;
+    std::cout << "WARNING: the pressure solve of step " << step
+              << " didn't converge: after " << stats.iterations
+              << " iterations its residual norm is "
+              << RelativeToRhs(stats, stats.final_residual_norm)
+              << " of the right-hand side's, above the tolerance of "
+              << RelativeToRhs(stats, stats.tolerance) << std::endl;
+  }
+
+  if (file_.is_open()) {
+    file_ << step << "," << time << "," << stats.iterations << ","
+          << (stats.converged ? 1 : 0) << "," << stats.rhs_norm << ","
+          << stats.initial_residual_norm << "," << stats.final_residual_norm
+          << "," << RelativeToRhs(stats, stats.final_residual_norm) << ","
+          << RelativeToRhs(stats, stats.tolerance) << ","
+          << stats.num_fluid_cells << "," << stats.seconds << std::endl;
+  }
+}
+
+void PressureSolveLog::PrintSummary() const {
+  if (num_solves_ == 0) {
+    return;
+  }
+  std::cout << "Pressure solves: " << num_solves_ << ", "
+            << static_cast<double>(total_iterations_) / num_solves_
+            << " iterations on average, " << max_iterations_ << " at most; "
+            << num_unconverged_ << " didn't converge" << std::endl;
+  if (file_.is_open()) {
+    std::cout << "Solver stats file " << file_name_ << " saved." << std::endl;
+  }
+}
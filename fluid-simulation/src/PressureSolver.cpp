@@ -1,119 +1,623 @@
 #include "PressureSolver.h"
 
 #include <cassert>
+#include <chrono>
+#include <cmath>
 
+#include "Checkpoint.h"
 #include "MaterialType.h"
 #include "NeighborDirection.h"
+#include "PressureKernels.h"
 
 // To disable assert*() calls, uncomment this line:
 // #define NDEBUG
 
 namespace {
 
-// Sets a 3D array, |*r|, the same size as the StaggeredGrid from which the
-// 3D velocity arrays |u|, |v|, and |w| originate, containing 0.0 if the
-// corresponding grid cell is SOLID or EMPTY, or the negation of the divergence
-// of the fluid velocity across the grid cell if the cell is FLUID.
-void MakeResidualFromVelocityDivergence(const Array3D<MaterialType>& labels,
-                                        const Array3D<double>& u,
-                                        const Array3D<double>& v,
-                                        const Array3D<double>& w,
-                                        std::size_t nx, std::size_t ny,
-                                        std::size_t nz, Array3D<double>* r) {
-  for (std::size_t i = 1; i < nx - 1; i++) {
-    for (std::size_t j = 1; j < ny - 1; j++) {
-      for (std::size_t k = 1; k < nz - 1; k++) {
+// Fraction of the initial squared residual norm at which the pressure solve is
+// considered converged
+const double kFloatZero = 1.0e-6;
+
+// Most Conjugate Gradient iterations or multigrid V-cycles run per solve
+const std::size_t kMaxIters = 1000u;
+
+// Tuning constant blending incomplete Cholesky (0.0) with modified incomplete
+// Cholesky (1.0), which preserves row sums of A
+const double kMICTuning = 0.97;
+
+// Fraction of a diagonal entry of A below which a diagonal entry of the MIC(0)
+// factor is considered too small and is replaced with the entry of A
+const double kMICSafety = 0.25;
+
+// Returns -1.0 if the neighbor of a cell in direction |dir| is a FLUID cell
+// coupled to it in A, according to the cell's |nbrs| info, or 0.0 otherwise.
+// These are the off-diagonal entries of A.
+inline double Coupling(unsigned short nbrs, NeighborDirection dir) {
+  return (nbrs & dir) ? -1.0 : 0.0;
+}
+
+}  // namespace
+
+template <typename T>
+PressureSolver<T>::PressureSolver(std::size_t nx, std::size_t ny,
+                                  std::size_t nz,
+                                  const PressureSolverOptions& options,
+                                  ThreadPool* thread_pool,
+                                  Array3DArena* arena)
+    : options_(options),
+      thread_pool_(thread_pool),
+      simd_(BestSimdInstructionSet()),
+      nx_(nx),
+      ny_(ny),
+      nz_(nz),
+      r_(nx, ny, nz, arena),
+      d_(nx, ny, nz, arena),
+      q_(nx, ny, nz, arena),
+      z_(nx, ny, nz, arena),
+      precon_(nx, ny, nz, arena),
+      has_previous_pressure_(false),
+      warm_start_residual_ratio_(1.0) {
+  // The kernels only ever write the interior cells of these arrays, but Dot
+  // sums over every cell, so the outer cells must start (and stay) zero.
+  r_ = 0.0;
+  d_ = 0.0;
+  q_ = 0.0;
+  z_ = 0.0;
+
+  // The previous solution is only kept if it will be used.
+  if (options.warm_start) {
+    previous_p_.reset(new Array3D<T>(nx, ny, nz, arena));
+    previous_labels_.reset(new Array3D<MaterialType>(nx, ny, nz, arena));
+  }
+
+  // The multigrid hierarchy is only allocated if it will be used.
+  if (options.method == MULTIGRID_V_CYCLES ||
+      options.preconditioner == MULTIGRID) {
+    multigrid_.reset(new MultigridSolver<T>(nx, ny, nz));
+  }
+}
+
+template <typename T>
+PressureSolver<T>::~PressureSolver() {}
+
+template <typename T>
+std::size_t PressureSolver<T>::ArenaBytes(
+    std::size_t nx, std::size_t ny, std::size_t nz,
+    const PressureSolverOptions& options) {
+  // r_, d_, q_, z_, and precon_
+  std::size_t bytes = 5 * Array3D<T>::ArenaBytes(nx, ny, nz);
+  if (options.warm_start) {
+    bytes += Array3D<T>::ArenaBytes(nx, ny, nz) +
+             Array3D<MaterialType>::ArenaBytes(nx, ny, nz);
+  }
+  return bytes;
+}
+
+template <typename T>
+PressureSolveStats PressureSolver<T>::ProjectPressure(
+    const Array3D<MaterialType>& labels,
+    const Array3D<unsigned short>& neighbors,
+    const FluidCellIndex& fluid_cells, const PressureMatrix<T>* matrix,
+    const Array3D<T>& u, const Array3D<T>& v, const Array3D<T>& w,
+    Array3D<T>* p) {
+  const std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+
+  PressureSolveStats stats;
+  if (options_.compact_fluid_cells && options_.method == CONJUGATE_GRADIENT) {
+    ProjectPackedPressure(labels, fluid_cells, u, v, w, p, &stats);
+  } else {
+    ProjectGridPressure(labels, neighbors, matrix, u, v, w, p, &stats);
+  }
+
+  // A residual norm that isn't a number fails this test too.
+  stats.converged = stats.final_residual_norm <= stats.tolerance;
+  stats.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  return stats;
+}
+
+template <typename T>
+void PressureSolver<T>::ProjectGridPressure(
+    const Array3D<MaterialType>& labels,
+    const Array3D<unsigned short>& neighbors, const PressureMatrix<T>* matrix,
+    const Array3D<T>& u, const Array3D<T>& v, const Array3D<T>& w,
+    Array3D<T>* p, PressureSolveStats* stats) {
+  stats->num_fluid_cells = 0;
+  for (std::size_t i = 0; i < nx_; i++) {
+    for (std::size_t j = 0; j < ny_; j++) {
+      for (std::size_t k = 0; k < nz_; k++) {
+        if (labels(i, j, k) == FLUID) {
+          stats->num_fluid_cells++;
+        }
+      }
+    }
+  }
+
+  MakeInitialGuess(labels, p);
+
+  // The residual of the zero initial guess is the right-hand side of the
+  // pressure projection equation. The tolerance is always relative to it, so a
+  // warm start converges to the same accuracy as a cold one.
+  MakeResidualFromVelocityDivergence(labels, u, v, w, thread_pool_, &r_);
+  double rhs_norm = Dot(r_, r_, thread_pool_);
+  double tolerance = kFloatZero * rhs_norm;
+  double residual_norm = rhs_norm;
+  if (options_.warm_start) {
+    MultiplyByA(neighbors, matrix, *p, &q_);
+    d_.EqualsPlusTimes(r_, -1.0, q_, thread_pool_);  // d_ = r_ - A * *p
+    residual_norm = Dot(d_, d_, thread_pool_);
+  }
+  warm_start_residual_ratio_ =
+      rhs_norm > 0.0 ? std::sqrt(residual_norm / rhs_norm) : 1.0;
+  stats->rhs_norm = rhs_norm;
+  stats->initial_residual_norm = residual_norm;
+  stats->tolerance = tolerance;
+
+  if (options_.method == MULTIGRID_V_CYCLES) {
+    multigrid_->Setup(labels);
+    stats->iterations = multigrid_->Solve(r_, tolerance, kMaxIters, p,
+                                          &stats->final_residual_norm);
+    return;
+  }
+
+  if (options_.warm_start) {
+    r_.SetEqualTo(d_);
+  }
+
+  // (Preconditioned) Conjugate Gradient Algorithm
+  //
+  // Update |r_|, |d_|, |q_|, and |z_| as we iterate to compute pressures |*p|
+  // that minimize velocity divergence. Without a preconditioner, |z_| is just
+  // |r_|, and |sigma| and |residual_norm| are the same value.
+  const bool preconditioned = options_.preconditioner != NO_PRECONDITIONER;
+  double sigma = residual_norm;
+  if (preconditioned) {
+    MakePreconditioner(labels, neighbors);
+    ApplyPreconditioner(neighbors);
+    d_.SetEqualTo(z_);
+    sigma = Dot(r_, z_, thread_pool_);
+  } else {
+    d_.SetEqualTo(r_);
+  }
+
+  std::size_t iter = 0;
+  for (; iter < kMaxIters && residual_norm > tolerance; iter++) {
+    // q_ = A * d_, along with d_ . q_
+    double alpha = sigma / MultiplyByA(neighbors, matrix, d_, &q_);
+    // *p += alpha * d_ and r_ -= alpha * q_, along with r_ . r_
+    residual_norm =
+        UpdatePressureAndResidual(alpha, d_, q_, thread_pool_, p, &r_);
+    double sigma_old = sigma;
+    if (preconditioned) {
+      ApplyPreconditioner(neighbors);
+      sigma = Dot(r_, z_, thread_pool_);
+      double beta = sigma / sigma_old;
+      d_.EqualsPlusTimes(z_, beta, d_, thread_pool_);  // d_ = z_ + beta * d_
+    } else {
+      sigma = residual_norm;
+      double beta = sigma / sigma_old;
+      d_.EqualsPlusTimes(r_, beta, d_, thread_pool_);  // d_ = r_ + beta * d_
+    }
+  }
+
+  stats->iterations = iter;
+  stats->final_residual_norm = residual_norm;
+}
+
+template <typename T>
+double PressureSolver<T>::MultiplyByA(const Array3D<unsigned short>& neighbors,
+                                      const PressureMatrix<T>* matrix,
+                                      const Array3D<T>& d, Array3D<T>* q) {
+  if (options_.vectorized_stencil) {
+    return ATimesAndDot(*matrix, d, simd_, thread_pool_, q);
+  }
+  return ATimesAndDot(d, neighbors, thread_pool_, q);
+}
+
+template <typename T>
+void PressureSolver<T>::ProjectPackedPressure(
+    const Array3D<MaterialType>& labels, const FluidCellIndex& cells,
+    const Array3D<T>& u, const Array3D<T>& v, const Array3D<T>& w,
+    Array3D<T>* p, PressureSolveStats* stats) {
+  stats->num_fluid_cells = cells.size();
+
+  // Each packed vector gets one trailing entry, which stays 0.0.
+  const std::size_t num_entries = cells.size() + 1;
+  packed_p_.assign(num_entries, 0.0);
+  packed_r_.assign(num_entries, 0.0);
+  packed_d_.assign(num_entries, 0.0);
+  packed_q_.assign(num_entries, 0.0);
+  packed_z_.assign(num_entries, 0.0);
+
+  MakeInitialGuess(labels, p);
+  Pack(cells, *p, &packed_p_);
+
+  MakePackedResidualFromVelocityDivergence(cells, u, v, w, thread_pool_,
+                                           &packed_r_);
+  double rhs_norm = PackedDot(cells, packed_r_, packed_r_, thread_pool_);
+  double tolerance = kFloatZero * rhs_norm;
+  double residual_norm = rhs_norm;
+  if (options_.warm_start) {
+    PackedATimesAndDot(cells, packed_p_, thread_pool_, &packed_q_);
+    // r = r - A * p
+    PackedEqualsPlusTimes(cells, packed_r_, -1.0, packed_q_, thread_pool_,
+                          &packed_r_);
+    residual_norm = PackedDot(cells, packed_r_, packed_r_, thread_pool_);
+  }
+  warm_start_residual_ratio_ =
+      rhs_norm > 0.0 ? std::sqrt(residual_norm / rhs_norm) : 1.0;
+  stats->rhs_norm = rhs_norm;
+  stats->initial_residual_norm = residual_norm;
+  stats->tolerance = tolerance;
+
+  // (Preconditioned) Conjugate Gradient Algorithm, exactly as in
+  // ProjectGridPressure
+  const bool preconditioned = options_.preconditioner != NO_PRECONDITIONER;
+  double sigma = residual_norm;
+  if (preconditioned) {
+    MakePackedPreconditioner(labels, cells);
+    ApplyPackedPreconditioner(cells);
+    packed_d_ = packed_z_;
+    sigma = PackedDot(cells, packed_r_, packed_z_, thread_pool_);
+  } else {
+    packed_d_ = packed_r_;
+  }
+
+  std::size_t iter = 0;
+  for (; iter < kMaxIters && residual_norm > tolerance; iter++) {
+    double alpha =
+        sigma / PackedATimesAndDot(cells, packed_d_, thread_pool_, &packed_q_);
+    residual_norm = PackedUpdatePressureAndResidual(
+        cells, alpha, packed_d_, packed_q_, thread_pool_, &packed_p_,
+        &packed_r_);
+    double sigma_old = sigma;
+    const std::vector<T>* z = &packed_r_;
+    if (preconditioned) {
+      ApplyPackedPreconditioner(cells);
+      sigma = PackedDot(cells, packed_r_, packed_z_, thread_pool_);
+      z = &packed_z_;
+    } else {
+      sigma = residual_norm;
+    }
+    double beta = sigma / sigma_old;
+    // d = z + beta * d
+    PackedEqualsPlusTimes(cells, *z, beta, packed_d_, thread_pool_,
+                          &packed_d_);
+  }
+
+  (*p) = 0.0;
+  Unpack(cells, packed_p_, p);
+
+  stats->iterations = iter;
+  stats->final_residual_norm = residual_norm;
+}
+
+template <typename T>
+void PressureSolver<T>::MakeInitialGuess(const Array3D<MaterialType>& labels,
+                                         Array3D<T>* p) {
+  if (!options_.warm_start) {
+    (*p) = 0.0;
+    return;
+  }
+
+  if (!has_previous_pressure_) {
+    (*p) = 0.0;
+    previous_labels_->SetEqualTo(labels);
+    has_previous_pressure_ = true;
+    return;
+  }
+
+  // Keep the previous pressure of cells that stay FLUID, and start cells that
+  // just became FLUID at the average previous pressure of their neighbors that
+  // were FLUID. Every other cell starts at 0.0.
+  previous_p_->SetEqualTo(*p);
+  (*p) = 0.0;
+  const Array3D<T>& previous_p = *previous_p_;
+  const Array3D<MaterialType>& previous_labels = *previous_labels_;
+  for (std::size_t i = 1; i < nx_ - 1; i++) {
+    for (std::size_t j = 1; j < ny_ - 1; j++) {
+      for (std::size_t k = 1; k < nz_ - 1; k++) {
         if (labels(i, j, k) != FLUID) {
-          (*r)(i, j, k) = 0.0;
+          continue;
+        }
+        if (previous_labels(i, j, k) == FLUID) {
+          (*p)(i, j, k) = previous_p(i, j, k);
           continue;
         }
 
-        double du_dx = u(i + 1, j, k) - u(i, j, k);
-        double dv_dy = v(i, j + 1, k) - v(i, j, k);
-        double dw_dz = w(i, j, k + 1) - w(i, j, k);
-        double velocity_divergence_of_cell_ijk = du_dx + dv_dy + dw_dz;
-        (*r)(i, j, k) = -velocity_divergence_of_cell_ijk;
+        const std::size_t neighbor_cells[6][3] = {
+            {i - 1, j, k}, {i + 1, j, k}, {i, j - 1, k},
+            {i, j + 1, k}, {i, j, k - 1}, {i, j, k + 1}};
+        double pressure_sum = 0.0;
+        std::size_t num_fluid_neighbors = 0;
+        for (const std::size_t* n : neighbor_cells) {
+          if (previous_labels(n[0], n[1], n[2]) == FLUID) {
+            pressure_sum += previous_p(n[0], n[1], n[2]);
+            num_fluid_neighbors++;
+          }
+        }
+        if (num_fluid_neighbors > 0) {
+          (*p)(i, j, k) = pressure_sum / num_fluid_neighbors;
+        }
       }
     }
   }
+  previous_labels_->SetEqualTo(labels);
+}
+
+template <typename T>
+void PressureSolver<T>::MakePreconditioner(
+    const Array3D<MaterialType>& labels,
+    const Array3D<unsigned short>& neighbors) {
+  switch (options_.preconditioner) {
+    case MIC0:
+      MakeMICPreconditioner(neighbors);
+      return;
+    case MULTIGRID:
+      multigrid_->Setup(labels);
+      return;
+    case NO_PRECONDITIONER:
+      return;
+  }
 }
 
-// Computes q = A * d where A is the matrix from the pressure projection
-// equation, Ap = d, relating fluid pressures to the resulting fluid velocity
-// divergence. This is done without directly multiplying any matrices since A is
-// large and sparse: we can simply select the few entries in each row that are
-// nonzero and multiply just the appropriate values from |d| matching with those
-// nonzero entries of A.
-void ATimes(const Array3D<double>& d, const Array3D<unsigned short>& neighbors,
-            std::size_t nx, std::size_t ny, std::size_t nz,
-            Array3D<double>* q) {
+template <typename T>
+void PressureSolver<T>::ApplyPreconditioner(
+    const Array3D<unsigned short>& neighbors) {
+  switch (options_.preconditioner) {
+    case MIC0:
+      ApplyMICPreconditioner(neighbors);
+      return;
+    case MULTIGRID:
+      multigrid_->ApplyVCycle(r_, &z_);
+      return;
+    case NO_PRECONDITIONER:
+      z_.SetEqualTo(r_);
+      return;
+  }
+}
+
+template <typename T>
+void PressureSolver<T>::MakeMICPreconditioner(
+    const Array3D<unsigned short>& neighbors) {
   const unsigned short CENTER = 7;
 
-  for (std::size_t i = 1; i < nx - 1; i++) {
-    for (std::size_t j = 1; j < ny - 1; j++) {
-      for (std::size_t k = 1; k < nz - 1; k++) {
+  precon_ = 0.0;
+
+  // Cells are visited in increasing (i, j, k) order, so the factor entries of
+  // each cell's LEFT, DOWN, and BACK neighbors are already available.
+  for (std::size_t i = 1; i < nx_ - 1; i++) {
+    for (std::size_t j = 1; j < ny_ - 1; j++) {
+      for (std::size_t k = 1; k < nz_ - 1; k++) {
+        unsigned short nbrs = neighbors(i, j, k);
+        double diagonal = nbrs & CENTER;
+        if (diagonal == 0.0) {
+          continue;
+        }
+
+        // Couplings between this cell and its LEFT, DOWN, and BACK neighbors,
+        // and the factor entries of those neighbors
+        double a_left = Coupling(nbrs, LEFT);
+        double a_down = Coupling(nbrs, DOWN);
+        double a_back = Coupling(nbrs, BACK);
+        double e_left = precon_(i - 1, j, k);
+        double e_down = precon_(i, j - 1, k);
+        double e_back = precon_(i, j, k - 1);
+
+        // Couplings of each of those neighbors to *its* other forward
+        // neighbors, whose fill-in MIC(0) adds back onto the diagonal
+        unsigned short left_nbrs = neighbors(i - 1, j, k);
+        unsigned short down_nbrs = neighbors(i, j - 1, k);
+        unsigned short back_nbrs = neighbors(i, j, k - 1);
+        double left_fill =
+            Coupling(left_nbrs, UP) + Coupling(left_nbrs, FORWARD);
+        double down_fill =
+            Coupling(down_nbrs, RIGHT) + Coupling(down_nbrs, FORWARD);
+        double back_fill = Coupling(back_nbrs, RIGHT) + Coupling(back_nbrs, UP);
+
+        double e = diagonal - (a_left * e_left) * (a_left * e_left) -
+                   (a_down * e_down) * (a_down * e_down) -
+                   (a_back * e_back) * (a_back * e_back) -
+                   kMICTuning * (a_left * left_fill * e_left * e_left +
+                                 a_down * down_fill * e_down * e_down +
+                                 a_back * back_fill * e_back * e_back);
+
+        if (e < kMICSafety * diagonal) {
+          e = diagonal;
+        }
+        precon_(i, j, k) = 1.0 / std::sqrt(e);
+      }
+    }
+  }
+}
+
+template <typename T>
+void PressureSolver<T>::ApplyMICPreconditioner(
+    const Array3D<unsigned short>& neighbors) {
+  // Solve L * y = r_, storing y in |q_|, which is free at this point of each
+  // Conjugate Gradient iteration.
+  q_ = 0.0;
+  for (std::size_t i = 1; i < nx_ - 1; i++) {
+    for (std::size_t j = 1; j < ny_ - 1; j++) {
+      for (std::size_t k = 1; k < nz_ - 1; k++) {
         unsigned short nbrs = neighbors(i, j, k);
+        if (!nbrs) {
+          continue;
+        }
+
+        double t =
+            r_(i, j, k) -
+            Coupling(nbrs, LEFT) * precon_(i - 1, j, k) * q_(i - 1, j, k) -
+            Coupling(nbrs, DOWN) * precon_(i, j - 1, k) * q_(i, j - 1, k) -
+            Coupling(nbrs, BACK) * precon_(i, j, k - 1) * q_(i, j, k - 1);
+        q_(i, j, k) = t * precon_(i, j, k);
+      }
+    }
+  }
 
+  // Solve L^T * z_ = y in reverse order.
+  z_ = 0.0;
+  for (std::size_t i = nx_ - 2; i >= 1; i--) {
+    for (std::size_t j = ny_ - 2; j >= 1; j--) {
+      for (std::size_t k = nz_ - 2; k >= 1; k--) {
+        unsigned short nbrs = neighbors(i, j, k);
         if (!nbrs) {
-          (*q)(i, j, k) = 0.0;
           continue;
         }
 
-        // Multiply A * d for the row of A corresponding to cell (i, j, k).
-        // Store the result in q(i, j, k).
-        (*q)(i, j, k) =
-            ((nbrs & CENTER) * d(i, j, k)) -
-            ((nbrs & NeighborDirection::LEFT) ? d(i - 1, j, k) : 0) -
-            ((nbrs & NeighborDirection::DOWN) ? d(i, j - 1, k) : 0) -
-            ((nbrs & NeighborDirection::BACK) ? d(i, j, k - 1) : 0) -
-            ((nbrs & NeighborDirection::RIGHT) ? d(i + 1, j, k) : 0) -
-            ((nbrs & NeighborDirection::UP) ? d(i, j + 1, k) : 0) -
-            ((nbrs & NeighborDirection::FORWARD) ? d(i, j, k + 1) : 0);
+        double e = precon_(i, j, k);
+        double t = q_(i, j, k) -
+                   Coupling(nbrs, RIGHT) * e * z_(i + 1, j, k) -
+                   Coupling(nbrs, UP) * e * z_(i, j + 1, k) -
+                   Coupling(nbrs, FORWARD) * e * z_(i, j, k + 1);
+        z_(i, j, k) = t * e;
       }
     }
   }
 }
 
-}  // namespace
+template <typename T>
+void PressureSolver<T>::MakePackedPreconditioner(
+    const Array3D<MaterialType>& labels, const FluidCellIndex& cells) {
+  switch (options_.preconditioner) {
+    case MIC0:
+      MakePackedMICPreconditioner(cells);
+      return;
+    case MULTIGRID:
+      multigrid_->Setup(labels);
+      // V-cycles run on |r_| and |z_|, and only the FLUID cells of |r_| are
+      // written from now on.
+      r_ = 0.0;
+      return;
+    case NO_PRECONDITIONER:
+      return;
+  }
+}
 
-PressureSolver::PressureSolver(std::size_t nx, std::size_t ny, std::size_t nz)
-    : nx_(nx),
-      ny_(ny),
-      nz_(nz),
-      r_(nx, ny, nz),
-      d_(nx, ny, nz),
-      q_(nx, ny, nz) {}
-
-PressureSolver::~PressureSolver() {}
-
-void PressureSolver::ProjectPressure(const Array3D<MaterialType>& labels,
-                                     const Array3D<unsigned short>& neighbors,
-                                     const Array3D<double>& u,
-                                     const Array3D<double>& v,
-                                     const Array3D<double>& w,
-                                     Array3D<double>* p) {
-  // Conjugate Gradient Algorithm
-  //
-  // Update |r_|, |d_|, and |q_| as we iterate to compute pressures |*p| that
-  // minimize velocity divergence.
-  (*p) = 0.0;
+template <typename T>
+void PressureSolver<T>::ApplyPackedPreconditioner(
+    const FluidCellIndex& cells) {
+  switch (options_.preconditioner) {
+    case MIC0:
+      ApplyPackedMICPreconditioner(cells);
+      return;
+    case MULTIGRID:
+      Unpack(cells, packed_r_, &r_);
+      multigrid_->ApplyVCycle(r_, &z_);
+      Pack(cells, z_, &packed_z_);
+      return;
+    case NO_PRECONDITIONER:
+      packed_z_ = packed_r_;
+      return;
+  }
+}
 
-  MakeResidualFromVelocityDivergence(labels, u, v, w, nx_, ny_, nz_, &r_);
-  d_.SetEqualTo(r_);
+template <typename T>
+void PressureSolver<T>::MakePackedMICPreconditioner(
+    const FluidCellIndex& cells) {
+  const unsigned short CENTER = 7;
+  const std::size_t num_cells = cells.size();
 
-  double sigma = Dot(r_, r_);
-  const double kFloatZero = 1.0e-6;
-  double tolerance = kFloatZero * sigma;
-  const std::size_t kMaxIters = 1000u;
+  packed_precon_.assign(num_cells + 1, 0.0);
 
-  for (std::size_t iter = 0; iter < kMaxIters && sigma > tolerance; iter++) {
-    ATimes(d_, neighbors, nx_, ny_, nz_, &q_);
-    double alpha = sigma / Dot(d_, q_);
-    p->PlusEquals(alpha, d_);   // *p += alpha * d_
-    r_.PlusEquals(-alpha, q_);  // r_ -= alpha * q_
-    double sigma_old = sigma;
-    sigma = Dot(r_, r_);
-    double beta = sigma / sigma_old;
-    d_.EqualsPlusTimes(r_, beta, d_);  // d_ = r_ + beta * d_
+  // Returns the stencil of packed cell |c|, or no bits for the trailing entry.
+  auto stencil = [&](std::size_t c) -> unsigned short {
+    return c < num_cells ? cells.stencil(c) : 0;
+  };
+
+  // Packed cells are in increasing (i, j, k) order, so the factor entries of
+  // each cell's LEFT, DOWN, and BACK neighbors are already available.
+  for (std::size_t c = 0; c < num_cells; c++) {
+    unsigned short nbrs = cells.stencil(c);
+    double diagonal = nbrs & CENTER;
+    if (diagonal == 0.0) {
+      continue;
+    }
+
+    std::size_t left = cells.neighbor(c, 0);
+    std::size_t down = cells.neighbor(c, 1);
+    std::size_t back = cells.neighbor(c, 2);
+
+    // See MakeMICPreconditioner.
+    double a_left = Coupling(nbrs, LEFT);
+    double a_down = Coupling(nbrs, DOWN);
+    double a_back = Coupling(nbrs, BACK);
+    double e_left = packed_precon_[left];
+    double e_down = packed_precon_[down];
+    double e_back = packed_precon_[back];
+
+    double left_fill =
+        Coupling(stencil(left), UP) + Coupling(stencil(left), FORWARD);
+    double down_fill =
+        Coupling(stencil(down), RIGHT) + Coupling(stencil(down), FORWARD);
+    double back_fill =
+        Coupling(stencil(back), RIGHT) + Coupling(stencil(back), UP);
+
+    double e = diagonal - (a_left * e_left) * (a_left * e_left) -
+               (a_down * e_down) * (a_down * e_down) -
+               (a_back * e_back) * (a_back * e_back) -
+               kMICTuning * (a_left * left_fill * e_left * e_left +
+                             a_down * down_fill * e_down * e_down +
+                             a_back * back_fill * e_back * e_back);
+
+    if (e < kMICSafety * diagonal) {
+      e = diagonal;
+    }
+    packed_precon_[c] = 1.0 / std::sqrt(e);
   }
 }
+
+template <typename T>
+void PressureSolver<T>::ApplyPackedMICPreconditioner(
+    const FluidCellIndex& cells) {
+  const std::size_t num_cells = cells.size();
+
+  // The off-diagonal entries of L are -1.0 times the factor entry of a coupled
+  // neighbor. Neighbors that aren't coupled read the trailing zero entries of
+  // |packed_precon_|, |packed_q_|, and |packed_z_| instead, as do cells whose
+  // factor entry is zero.
+
+  // Solve L * y = r, storing y in |packed_q_|, which is free at this point of
+  // each Conjugate Gradient iteration.
+  for (std::size_t c = 0; c < num_cells; c++) {
+    std::size_t left = cells.neighbor(c, 0);
+    std::size_t down = cells.neighbor(c, 1);
+    std::size_t back = cells.neighbor(c, 2);
+    double t = packed_r_[c] + packed_precon_[left] * packed_q_[left] +
+               packed_precon_[down] * packed_q_[down] +
+               packed_precon_[back] * packed_q_[back];
+    packed_q_[c] = t * packed_precon_[c];
+  }
+
+  // Solve L^T * z = y in reverse order.
+  for (std::size_t c = num_cells; c-- > 0;) {
+    std::size_t right = cells.neighbor(c, 3);
+    std::size_t up = cells.neighbor(c, 4);
+    std::size_t forward = cells.neighbor(c, 5);
+    double e = packed_precon_[c];
+    double t = packed_q_[c] + e * packed_z_[right] + e * packed_z_[up] +
+               e * packed_z_[forward];
+    packed_z_[c] = t * e;
+  }
+}
+
+template <typename T>
+void PressureSolver<T>::WriteCheckpoint(CheckpointWriter* writer) const {
+  writer->Write(has_previous_pressure_);
+  if (previous_labels_) {
+    writer->WriteArray(*previous_labels_);
+  }
+}
+
+template <typename T>
+void PressureSolver<T>::ReadCheckpoint(CheckpointReader* reader) {
+  has_previous_pressure_ = reader->Read<bool>();
+  if (previous_labels_) {
+    reader->ReadArray(previous_labels_.get());
+  }
+}
+
+template class PressureSolver<float>;
+template class PressureSolver<double>;
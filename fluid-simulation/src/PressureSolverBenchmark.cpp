@@ -0,0 +1,268 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Particle.h"
+#include "PressureSolver.h"
+#include "StaggeredGrid.h"
+#include "ThreadPool.h"
+
+namespace {
+
+// Physical width of the simulated tank along x, in meters. The grid cell width
+// shrinks as the resolution grows so every resolution simulates the same scene.
+const double kTankWidth = 0.25;
+
+// Time step size, matching inputs/fluid.json
+const double kDt = 0.001111112;
+
+const double kFlipRatio = 0.95;
+
+// Returns the particles of a dam break: a block of still fluid filling the
+// lower half of the tank in x and z (gravity acts along z) and the whole tank
+// in y, seeded with 2 x 2 x 2 particles per grid cell.
+std::vector<Particle> MakeDamBreak(std::size_t nx, std::size_t ny,
+                                   std::size_t nz, double dx) {
+  std::vector<Particle> particles;
+  const double kOffsets[] = {0.25, 0.75};
+  for (std::size_t i = 1; i < nx / 2; i++) {
+    for (std::size_t j = 1; j < ny - 1; j++) {
+      for (std::size_t k = 1; k < nz / 2; k++) {
+        for (double a : kOffsets) {
+          for (double b : kOffsets) {
+            for (double c : kOffsets) {
+              Particle particle;
+              particle.pos << (i + a) * dx, (j + b) * dx, (k + c) * dx;
+              particle.vel.setZero();
+              particles.push_back(particle);
+            }
+          }
+        }
+      }
+    }
+  }
+  return particles;
+}
+
+// Pressure solve statistics gathered over a run of time steps
+struct SolveStats {
+  std::size_t total_iterations;
+  std::size_t max_iterations;
+  double solve_seconds;
+
+  // Time spent in whole time steps, pressure solves included
+  double step_seconds;
+};
+
+// Pressures and particles at the end of a run of time steps
+struct DamBreakState {
+  std::vector<double> pressures;
+  std::vector<Particle> particles;
+};
+
+// Runs |num_steps| time steps of the dam break on an |nx| x |ny| x |nz| grid
+// storing its quantities as |T|, whose PressureSolver uses |options| and
+// |num_threads| threads. If |final_state| isn't NULL, it is set to the
+// pressures and particles after the last step.
+template <typename T = double>
+SolveStats RunDamBreak(std::size_t nx, std::size_t ny, std::size_t nz,
+                       std::size_t num_steps,
+                       const PressureSolverOptions& options,
+                       std::size_t num_threads = 1u,
+                       DamBreakState* final_state = NULL) {
+  double dx = kTankWidth / nx;
+  StaggeredGrid<T> grid(nx, ny, nz, Eigen::Vector3d::Zero(), dx, options,
+                        num_threads);
+  std::vector<Particle> particles = MakeDamBreak(nx, ny, nz, dx);
+
+  SolveStats stats = {0u, 0u, 0.0, 0.0};
+
+  grid.ParticlesToGrid(particles);
+  for (std::size_t step = 0; step < num_steps; step++) {
+    std::chrono::steady_clock::time_point step_start =
+        std::chrono::steady_clock::now();
+
+    for (std::vector<Particle>::iterator p = particles.begin();
+         p != particles.end(); p++) {
+      p->pos = grid.Advect(p->pos, kDt);
+    }
+
+    grid.ParticlesToGrid(particles);
+    grid.ApplyGravity(kDt);
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    std::size_t iterations = grid.ProjectPressure().iterations;
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    stats.total_iterations += iterations;
+    if (iterations > stats.max_iterations) {
+      stats.max_iterations = iterations;
+    }
+    stats.solve_seconds += elapsed.count();
+
+    for (std::vector<Particle>::iterator p = particles.begin();
+         p != particles.end(); p++) {
+      p->vel = grid.GridToParticle(kFlipRatio, *p);
+    }
+
+    std::chrono::duration<double> step_elapsed =
+        std::chrono::steady_clock::now() - step_start;
+    stats.step_seconds += step_elapsed.count();
+  }
+
+  if (final_state) {
+    final_state->pressures.clear();
+    for (std::size_t i = 0; i < nx; i++) {
+      for (std::size_t j = 0; j < ny; j++) {
+        for (std::size_t k = 0; k < nz; k++) {
+          final_state->pressures.push_back(grid.p()(i, j, k));
+        }
+      }
+    }
+    final_state->particles = particles;
+  }
+
+  return stats;
+}
+
+void PrintStats(const std::string& name, const SolveStats& stats,
+                std::size_t num_steps) {
+  std::cout << name << ": "
+            << static_cast<double>(stats.total_iterations) / num_steps
+            << " mean iterations, " << stats.max_iterations
+            << " max iterations, " << 1000.0 * stats.solve_seconds / num_steps
+            << " ms per solve" << std::endl;
+}
+
+// Runs the dam break with |options| on a double grid and on a float grid, and
+// prints their speed and how far apart their final pressures and particles
+// are.
+void ComparePrecisions(std::size_t nx, std::size_t ny, std::size_t nz,
+                       std::size_t num_steps,
+                       const PressureSolverOptions& options) {
+  DamBreakState double_state;
+  SolveStats double_stats = RunDamBreak<double>(nx, ny, nz, num_steps, options,
+                                                1u, &double_state);
+  DamBreakState float_state;
+  SolveStats float_stats = RunDamBreak<float>(nx, ny, nz, num_steps, options,
+                                              1u, &float_state);
+
+  std::cout << "double: " << 1000.0 * double_stats.step_seconds / num_steps
+            << " ms per step, float: "
+            << 1000.0 * float_stats.step_seconds / num_steps
+            << " ms per step ("
+            << double_stats.step_seconds / float_stats.step_seconds << "x)"
+            << std::endl;
+
+  double max_pressure = 0.0;
+  double max_pressure_difference = 0.0;
+  for (std::size_t n = 0; n < double_state.pressures.size(); n++) {
+    max_pressure = std::max(max_pressure, std::abs(double_state.pressures[n]));
+    max_pressure_difference = std::max(
+        max_pressure_difference,
+        std::abs(double_state.pressures[n] - float_state.pressures[n]));
+  }
+
+  double max_speed = 0.0;
+  double max_velocity_difference = 0.0;
+  double max_position_difference = 0.0;
+  for (std::size_t n = 0; n < double_state.particles.size(); n++) {
+    const Particle& a = double_state.particles[n];
+    const Particle& b = float_state.particles[n];
+    max_speed = std::max(max_speed, a.vel.norm());
+    max_velocity_difference =
+        std::max(max_velocity_difference, (a.vel - b.vel).norm());
+    max_position_difference =
+        std::max(max_position_difference, (a.pos - b.pos).norm());
+  }
+
+  std::cout << "Max pressure difference: "
+            << 100.0 * max_pressure_difference / max_pressure
+            << "% of max pressure" << std::endl;
+  std::cout << "Max velocity difference: "
+            << 100.0 * max_velocity_difference / max_speed
+            << "% of max speed" << std::endl;
+  std::cout << "Max position difference: "
+            << max_position_difference / (kTankWidth / nx) << " cell widths"
+            << std::endl;
+}
+
+}  // namespace
+
+// Compares pressure solver configurations on a dam break scene.
+//
+// Usage: ./PressureSolverBenchmark [nx ny nz] [num_steps]
+int main(int argc, char** argv) {
+  std::size_t nx = 25, ny = 50, nz = 25;
+  if (argc >= 4) {
+    nx = std::strtoul(argv[1], NULL, 10);
+    ny = std::strtoul(argv[2], NULL, 10);
+    nz = std::strtoul(argv[3], NULL, 10);
+  }
+  std::size_t num_steps = argc >= 5 ? std::strtoul(argv[4], NULL, 10) : 30u;
+
+  std::cout << "Dam break on a " << nx << " x " << ny << " x " << nz
+            << " grid, " << num_steps << " time steps" << std::endl;
+
+  PressureSolverOptions cg;
+  cg.preconditioner = NO_PRECONDITIONER;
+  PrintStats("CG          ", RunDamBreak(nx, ny, nz, num_steps, cg),
+             num_steps);
+
+  PressureSolverOptions cg_compact = cg;
+  cg_compact.compact_fluid_cells = true;
+  PrintStats("CG, packed  ", RunDamBreak(nx, ny, nz, num_steps, cg_compact),
+             num_steps);
+
+  std::size_t all_threads = ThreadPool(0u).num_threads();
+  std::string threaded_name = "CG, " + std::to_string(all_threads) + " threads";
+  threaded_name.resize(12, ' ');
+  PrintStats(threaded_name, RunDamBreak(nx, ny, nz, num_steps, cg, 0u),
+             num_steps);
+
+  PressureSolverOptions mic0;
+  mic0.preconditioner = MIC0;
+  PrintStats("MIC(0) PCG  ", RunDamBreak(nx, ny, nz, num_steps, mic0),
+             num_steps);
+
+  PressureSolverOptions mic0_simd = mic0;
+  mic0_simd.vectorized_stencil = true;
+  PrintStats("MIC(0), SIMD", RunDamBreak(nx, ny, nz, num_steps, mic0_simd),
+             num_steps);
+
+  PressureSolverOptions mic0_compact = mic0;
+  mic0_compact.compact_fluid_cells = true;
+  PrintStats("MIC(0), pack", RunDamBreak(nx, ny, nz, num_steps, mic0_compact),
+             num_steps);
+
+  PressureSolverOptions mic0_warm = mic0_compact;
+  mic0_warm.warm_start = true;
+  PrintStats("MIC(0), warm", RunDamBreak(nx, ny, nz, num_steps, mic0_warm),
+             num_steps);
+
+  PrintStats("MIC(0), flt ",
+             RunDamBreak<float>(nx, ny, nz, num_steps, mic0_warm), num_steps);
+
+  PressureSolverOptions mgpcg;
+  mgpcg.preconditioner = MULTIGRID;
+  PrintStats("MGPCG       ", RunDamBreak(nx, ny, nz, num_steps, mgpcg),
+             num_steps);
+
+  PressureSolverOptions multigrid;
+  multigrid.method = MULTIGRID_V_CYCLES;
+  PrintStats("V-cycles    ", RunDamBreak(nx, ny, nz, num_steps, multigrid),
+             num_steps);
+
+  std::cout << std::endl
+            << "Float vs. double storage, MIC(0), packed, warm start:"
+            << std::endl;
+  ComparePrecisions(nx, ny, nz, num_steps, mic0_warm);
+
+  return EXIT_SUCCESS;
+}
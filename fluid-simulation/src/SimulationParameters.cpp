@@ -2,17 +2,174 @@
 
 #include <cassert>
 #include <fstream>
+#include <iostream>
+#include <sstream>
 
 #include "json/json.h"
 
 // To disable assert*() calls, uncomment this line:
 // #define NDEBUG
 
+namespace {
+
+// Returns the preconditioner named |name| in a .json file.
+PreconditionerType ParsePreconditioner(const std::string& name) {
+  if (name == "none") {
+    return NO_PRECONDITIONER;
+  }
+  if (name == "mic0") {
+    return MIC0;
+  }
+  if (name == "multigrid") {
+    return MULTIGRID;
+  }
+
+  std::cout << "ERROR: unknown preconditioner \"" << name << "\"!"
+            << std::endl;
+  std::cout << "Valid preconditioners: \"none\", \"mic0\", \"multigrid\""
+            << std::endl;
+  assert(false);  // crash the program
+  return NO_PRECONDITIONER;
+}
+
+// Returns the pressure solver method named |name| in a .json file.
+PressureSolverMethod ParsePressureSolverMethod(const std::string& name) {
+  if (name == "cg") {
+    return CONJUGATE_GRADIENT;
+  }
+  if (name == "multigrid") {
+    return MULTIGRID_V_CYCLES;
+  }
+
+  std::cout << "ERROR: unknown pressure solver \"" << name << "\"!"
+            << std::endl;
+  std::cout << "Valid pressure solvers: \"cg\", \"multigrid\"" << std::endl;
+  assert(false);  // crash the program
+  return CONJUGATE_GRADIENT;
+}
+
+// Returns the scalar precision named |name| in a .json file or on the command
+// line.
+ScalarPrecision ParseScalarPrecision(const std::string& name) {
+  if (name == "double") {
+    return DOUBLE_PRECISION;
+  }
+  if (name == "float") {
+    return SINGLE_PRECISION;
+  }
+
+  std::cout << "ERROR: unknown precision \"" << name << "\"!" << std::endl;
+  std::cout << "Valid precisions: \"double\", \"float\"" << std::endl;
+  assert(false);  // crash the program
+  return DOUBLE_PRECISION;
+}
+
+// Returns the advection scheme named |name| in a .json file.
+AdvectionScheme ParseAdvectionScheme(const std::string& name) {
+  if (name == "euler") {
+    return FORWARD_EULER;
+  }
+  if (name == "rk2") {
+    return RK2;
+  }
+  if (name == "rk3") {
+    return RK3;
+  }
+
+  std::cout << "ERROR: unknown advection scheme \"" << name << "\"!"
+            << std::endl;
+  std::cout << "Valid advection schemes: \"euler\", \"rk2\", \"rk3\""
+            << std::endl;
+  assert(false);  // crash the program
+  return FORWARD_EULER;
+}
+
+// Returns the output format named |name| in a .json file.
+OutputFormat ParseOutputFormat(const std::string& name) {
+  if (name == "text") {
+    return TEXT_OUTPUT;
+  }
+  if (name == "binary") {
+    return BINARY_OUTPUT;
+  }
+
+  std::cout << "ERROR: unknown output format \"" << name << "\"!"
+            << std::endl;
+  std::cout << "Valid output formats: \"text\", \"binary\"" << std::endl;
+  assert(false);  // crash the program
+  return TEXT_OUTPUT;
+}
+
+// Returns the 3D vector held in the three-element array |json|.
+Eigen::Vector3d ParseVector(const Json::Value& json) {
+  return Eigen::Vector3d(json[0].asDouble(), json[1].asDouble(),
+                         json[2].asDouble());
+}
+
+// Returns the particle emitter described by |json|, an element of the
+// "emitters" array in a .json file, for a grid with lower corner |lc| and cells
+// |dx| wide.
+//
+// A "dam_break" emitter is a box of the given "size" in the lower corner of
+// the grid, just inside its SOLID boundary.
+ParticleEmitter ParseParticleEmitter(const Json::Value& json,
+                                     const Eigen::Vector3d& lc, double dx) {
+  ParticleEmitter emitter;
+  const std::string shape = json.get("shape", std::string("box")).asString();
+  if (shape == "box") {
+    emitter.lower = ParseVector(json["lower"]);
+    emitter.upper = ParseVector(json["upper"]);
+  } else if (shape == "sphere") {
+    emitter.shape = SPHERE_EMITTER;
+    emitter.center = ParseVector(json["center"]);
+    emitter.radius = json["radius"].asDouble();
+  } else if (shape == "dam_break") {
+    emitter.lower = lc.array() + dx;
+    emitter.upper = emitter.lower + ParseVector(json["size"]);
+  } else {
+    std::cout << "ERROR: unknown emitter shape \"" << shape << "\"!"
+              << std::endl;
+    std::cout << "Valid emitter shapes: \"box\", \"sphere\", \"dam_break\""
+              << std::endl;
+    assert(false);  // crash the program
+  }
+  if (json.isMember("velocity")) {
+    emitter.velocity = ParseVector(json["velocity"]);
+  }
+  emitter.particles_per_cell = json.get("particles_per_cell", 8).asUInt();
+  emitter.jitter = json.get("jitter", emitter.jitter).asDouble();
+
+  std::size_t side = 1;
+  while (side * side * side < emitter.particles_per_cell) {
+    side++;
+  }
+  if (side * side * side != emitter.particles_per_cell) {
+    std::cout << "ERROR: " << emitter.particles_per_cell
+              << " particles per cell isn't a cube, 1, 8, 27, ...!"
+              << std::endl;
+    assert(false);  // crash the program
+  }
+  return emitter;
+}
+
+}  // namespace
+
 SimulationParameters::SimulationParameters(
     double dt_seconds, double duration_seconds, double density,
     const Eigen::Matrix<std::size_t, 3, 1>& dimensions, double dx,
     const Eigen::Vector3d& lc, double flip_ratio, const std::string& input_file,
-    const std::string& output_file_name_pattern)
+    const std::vector<ParticleEmitter>& emitters, std::uint64_t emitter_seed,
+    const std::string& output_file_name_pattern,
+    const PressureSolverOptions& pressure_solver_options,
+    std::size_t num_threads, ScalarPrecision precision,
+    bool contiguous_grid_arrays, bool incremental_cell_labels,
+    bool active_region_sweeps,
+    const ParticleSortOptions& particle_sort_options,
+    const AdvectionOptions& advection_options,
+    const TimeStepOptions& time_step_options, OutputFormat output_format,
+    bool async_output, const CheckpointOptions& checkpoint_options,
+    const std::string& timing_file_name,
+    const std::string& solver_stats_file_name, const std::string& json_text)
     : dt_seconds_(dt_seconds),
       duration_seconds_(duration_seconds),
       density_(density),
@@ -21,7 +178,24 @@ SimulationParameters::SimulationParameters(
       lc_(lc),
       flip_ratio_(flip_ratio),
       input_file_(input_file),
-      output_file_name_pattern_(output_file_name_pattern) {}
+      emitters_(emitters),
+      emitter_seed_(emitter_seed),
+      output_file_name_pattern_(output_file_name_pattern),
+      pressure_solver_options_(pressure_solver_options),
+      num_threads_(num_threads),
+      precision_(precision),
+      contiguous_grid_arrays_(contiguous_grid_arrays),
+      incremental_cell_labels_(incremental_cell_labels),
+      active_region_sweeps_(active_region_sweeps),
+      particle_sort_options_(particle_sort_options),
+      advection_options_(advection_options),
+      time_step_options_(time_step_options),
+      output_format_(output_format),
+      async_output_(async_output),
+      checkpoint_options_(checkpoint_options),
+      timing_file_name_(timing_file_name),
+      solver_stats_file_name_(solver_stats_file_name),
+      json_text_(json_text) {}
 
 SimulationParameters::SimulationParameters(const SimulationParameters& other)
     : dt_seconds_(other.dt_seconds_),
@@ -32,18 +206,41 @@ SimulationParameters::SimulationParameters(const SimulationParameters& other)
       lc_(other.lc_),
       flip_ratio_(other.flip_ratio_),
       input_file_(other.input_file_),
-      output_file_name_pattern_(other.output_file_name_pattern_) {
+      emitters_(other.emitters_),
+      emitter_seed_(other.emitter_seed_),
+      output_file_name_pattern_(other.output_file_name_pattern_),
+      pressure_solver_options_(other.pressure_solver_options_),
+      num_threads_(other.num_threads_),
+      precision_(other.precision_),
+      contiguous_grid_arrays_(other.contiguous_grid_arrays_),
+      incremental_cell_labels_(other.incremental_cell_labels_),
+      active_region_sweeps_(other.active_region_sweeps_),
+      particle_sort_options_(other.particle_sort_options_),
+      advection_options_(other.advection_options_),
+      time_step_options_(other.time_step_options_),
+      output_format_(other.output_format_),
+      async_output_(other.async_output_),
+      checkpoint_options_(other.checkpoint_options_),
+      timing_file_name_(other.timing_file_name_),
+      solver_stats_file_name_(other.solver_stats_file_name_),
+      json_text_(other.json_text_) {
   assert(false);
 }
 
 SimulationParameters SimulationParameters::CreateFromJsonFile(
-    const std::string& input_file_path) {
+    const std::string& input_file_path, const std::string& precision_name) {
   std::ifstream in(input_file_path, std::ios::in);
+  std::stringstream json_text;
+  json_text << in.rdbuf();
+  return CreateFromJson(json_text.str(), precision_name);
+}
 
+SimulationParameters SimulationParameters::CreateFromJson(
+    const std::string& json_text, const std::string& precision_name) {
   Json::Reader json_reader;
   Json::Value json_root;
 
-  bool read_succeeded = json_reader.parse(in, json_root);
+  bool read_succeeded = json_reader.parse(json_text, json_root);
   assert(read_succeeded);
 
   double dt_seconds = json_root.get("dt", 1.0 / 300.0).asDouble();
@@ -66,12 +263,86 @@ SimulationParameters SimulationParameters::CreateFromJsonFile(
   lc << lc_x, lc_y, lc_z;
 
   std::string input_file = json_root["particles"].asString();
+  std::vector<ParticleEmitter> emitters;
+  for (const Json::Value& emitter : json_root["emitters"]) {
+    emitters.push_back(ParseParticleEmitter(emitter, lc, dx));
+  }
+  std::uint64_t emitter_seed = json_root.get("seed", 0).asUInt64();
+  if (input_file.empty() && emitters.empty()) {
+    std::cout << "ERROR: no \"particles\" file or \"emitters\" to start the "
+                 "simulation from!"
+              << std::endl;
+    assert(false);  // crash the program
+  }
   std::string output_file_name_pattern =
       json_root.get("output_fname", std::string("output.%04d.txt")).asString();
+  OutputFormat output_format = ParseOutputFormat(
+      json_root.get("output_format", std::string("text")).asString());
+  bool async_output = json_root.get("async_output", false).asBool();
+
+  PressureSolverOptions pressure_solver_options;
+  pressure_solver_options.method = ParsePressureSolverMethod(
+      json_root.get("pressure_solver", std::string("cg")).asString());
+  pressure_solver_options.preconditioner = ParsePreconditioner(
+      json_root.get("preconditioner", std::string("none")).asString());
+  pressure_solver_options.compact_fluid_cells =
+      json_root.get("compact_fluid_cells", false).asBool();
+  pressure_solver_options.warm_start =
+      json_root.get("warm_start", false).asBool();
+  pressure_solver_options.vectorized_stencil =
+      json_root.get("vectorized_stencil", false).asBool();
+
+  std::size_t num_threads = json_root.get("num_threads", 1).asUInt();
+
+  ScalarPrecision precision = ParseScalarPrecision(
+      precision_name.empty()
+          ? json_root.get("precision", std::string("double")).asString()
+          : precision_name);
+
+  bool contiguous_grid_arrays =
+      json_root.get("contiguous_grid_arrays", false).asBool();
+  bool incremental_cell_labels =
+      json_root.get("incremental_cell_labels", false).asBool();
+  bool active_region_sweeps =
+      json_root.get("active_region_sweeps", false).asBool();
 
-  return SimulationParameters(dt_seconds, duration_seconds, density, dimensions,
-                              dx, lc, flip_ratio, input_file,
-                              output_file_name_pattern);
+  ParticleSortOptions particle_sort_options;
+  particle_sort_options.interval =
+      json_root.get("particle_sort_interval", 0).asUInt();
+  particle_sort_options.disorder_threshold =
+      json_root.get("particle_sort_disorder", 0.0).asDouble();
+
+  AdvectionOptions advection_options;
+  advection_options.scheme = ParseAdvectionScheme(
+      json_root.get("advection", std::string("euler")).asString());
+  advection_options.max_cfl = json_root.get("advection_cfl", 0.0).asDouble();
+
+  TimeStepOptions time_step_options;
+  time_step_options.cfl = json_root.get("cfl", 0.0).asDouble();
+  time_step_options.min_dt = json_root.get("min_dt", 0.0).asDouble();
+  time_step_options.max_dt =
+      json_root.get("max_dt", time_step_options.max_dt).asDouble();
+
+  CheckpointOptions checkpoint_options;
+  checkpoint_options.interval =
+      json_root.get("checkpoint_interval", 0).asUInt();
+  checkpoint_options.file_name =
+      json_root.get("checkpoint_fname", checkpoint_options.file_name)
+          .asString();
+
+  std::string timing_file_name =
+      json_root.get("timing_fname", std::string()).asString();
+  std::string solver_stats_file_name =
+      json_root.get("solver_stats_fname", std::string()).asString();
+
+  return SimulationParameters(
+      dt_seconds, duration_seconds, density, dimensions, dx, lc, flip_ratio,
+      input_file, emitters, emitter_seed, output_file_name_pattern,
+      pressure_solver_options, num_threads, precision, contiguous_grid_arrays,
+      incremental_cell_labels, active_region_sweeps, particle_sort_options,
+      advection_options, time_step_options, output_format, async_output,
+      checkpoint_options, timing_file_name, solver_stats_file_name,
+      json_text);
 }
 
 SimulationParameters::~SimulationParameters() {}
@@ -79,9 +350,13 @@ SimulationParameters::~SimulationParameters() {}
 SimulationParameters ReadSimulationParameters(int argc, char** argv) {
   if (argc < 2) {
     std::cout << "ERROR: .json file argument not found!" << std::endl;
-    std::cout << "Usage: ./FluidSimulator [.json file path]" << std::endl;
+    std::cout << "Usage: ./FluidSimulator [.json file path] [double|float]"
+              << std::endl;
     assert(false);  // crash the program
   }
 
+  if (argc >= 3) {
+    return SimulationParameters::CreateFromJsonFile(argv[1], argv[2]);
+  }
   return SimulationParameters::CreateFromJsonFile(argv[1]);
 }
@@ -1,8 +1,11 @@
 #include "StaggeredGrid.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 
-#include "NeighborDirection.h"
+#include "Checkpoint.h"
+#include "NeighborMaterialInfo.h"
 
 // To disable assert*() calls, uncomment this line:
 // #define NDEBUG
@@ -24,6 +27,33 @@ const double kClampCushion = 1.0e-4;
 // particles hover over the main fluid surface for less time.
 const double kGravAccMetersPerSecond = 9.80665;
 
+// Number of cells around the FLUID cells that active region sweeps also
+// visit. Splats and interpolation reach one cell past a particle's cell, and
+// advection with a CFL number of at most 1 samples velocities up to one cell
+// further.
+const std::size_t kActiveRegionMargin = 2;
+
+// Position and velocity of particle |n| of a std::vector<Particle> or a
+// ParticleSet, for the transfers that take either
+inline const Eigen::Vector3d& ParticlePosition(
+    const std::vector<Particle>& particles, std::size_t n) {
+  return particles[n].pos;
+}
+inline const Eigen::Vector3d& ParticleVelocity(
+    const std::vector<Particle>& particles, std::size_t n) {
+  return particles[n].vel;
+}
+template <typename P>
+inline Eigen::Vector3d ParticlePosition(const ParticleSet<P>& particles,
+                                        std::size_t n) {
+  return particles.position(n);
+}
+template <typename P>
+inline Eigen::Vector3d ParticleVelocity(const ParticleSet<P>& particles,
+                                        std::size_t n) {
+  return particles.velocity(n);
+}
+
 Eigen::Vector3d HalfShiftYZ(double dx) {
   Eigen::Vector3d half_shift;
   double dx_2 = dx / 2.0;
@@ -89,12 +119,26 @@ inline Eigen::Vector3d GetWeights(const Eigen::Vector3d& p_lc_over_dx,
   return p_lc_over_dx - indices.cast<double>();
 }
 
-// Computes a velocity, via trilinear interpolation, for a particle whose
-// position has been shifted negatively in the dimensions other than the
-// dimension of the velocities to be interpolated.
-double InterpolateGridVelocities(
-    const Eigen::Vector3d& shifted_particle_position_lc,
-    const Array3D<double>& grid_vels, double dx) {
+// Grid cell containing a particle position shifted negatively in the
+// dimensions other than the dimension of the velocities to be interpolated,
+// with the barycentric weights of the shifted position inside that cell, which
+// every interpolation of that velocity component at the position shares
+struct TrilinearStencil {
+  std::size_t i;
+  std::size_t j;
+  std::size_t k;
+  double w0;
+  double om_w0;
+  double w1;
+  double om_w1;
+  double w2;
+  double om_w2;
+};
+
+// Returns the stencil of the shifted particle position
+// |shifted_particle_position_lc| in a grid with grid cell width |dx|.
+inline TrilinearStencil MakeTrilinearStencil(
+    const Eigen::Vector3d& shifted_particle_position_lc, double dx) {
   Eigen::Vector3d p_shift_lc_over_dx = shifted_particle_position_lc / dx;
 
   // Determine the grid cell containing the shifted particle position.
@@ -104,15 +148,34 @@ double InterpolateGridVelocities(
   // that grid cell.
   Eigen::Vector3d weights = GetWeights(p_shift_lc_over_dx, ijk);
 
-  double w0 = weights[0];
-  double om_w0 = 1.0 - w0;
-  double w1 = weights[1];
-  double om_w1 = 1.0 - w1;
-  double w2 = weights[2];
-  double om_w2 = 1.0 - w2;
-  std::size_t i = ijk[0];
-  std::size_t j = ijk[1];
-  std::size_t k = ijk[2];
+  TrilinearStencil stencil;
+  stencil.i = ijk[0];
+  stencil.j = ijk[1];
+  stencil.k = ijk[2];
+  stencil.w0 = weights[0];
+  stencil.om_w0 = 1.0 - stencil.w0;
+  stencil.w1 = weights[1];
+  stencil.om_w1 = 1.0 - stencil.w1;
+  stencil.w2 = weights[2];
+  stencil.om_w2 = 1.0 - stencil.w2;
+  return stencil;
+}
+
+// Computes a velocity, via trilinear interpolation of |grid_vels| over
+// |stencil|, for a particle whose position has been shifted negatively in the
+// dimensions other than the dimension of the velocities to be interpolated.
+template <typename T>
+inline double InterpolateGridVelocities(const TrilinearStencil& stencil,
+                                        const Array3D<T>& grid_vels) {
+  double w0 = stencil.w0;
+  double om_w0 = stencil.om_w0;
+  double w1 = stencil.w1;
+  double om_w1 = stencil.om_w1;
+  double w2 = stencil.w2;
+  double om_w2 = stencil.om_w2;
+  std::size_t i = stencil.i;
+  std::size_t j = stencil.j;
+  std::size_t k = stencil.k;
 
   // Trilinearly interpolate grid velocities to get a velocity for the particle.
   return om_w0 * om_w1 * om_w2 * grid_vels(i, j, k) +
@@ -125,16 +188,22 @@ double InterpolateGridVelocities(
          w0 * w1 * w2 * grid_vels(i + 1, j + 1, k + 1);
 }
 
+template <typename T>
 void Contribute(double weight, double particle_velocity,
-                Array3D<double>* grid_vels, Array3D<double>* grid_vel_weights,
+                Array3D<T>* grid_vels, Array3D<T>* grid_vel_weights,
                 std::size_t i, std::size_t j, std::size_t k) {
   (*grid_vels)(i, j, k) += weight * particle_velocity;
   (*grid_vel_weights)(i, j, k) += weight;
 }
 
+// Splats |particle_velocity| onto the eight grid velocities around a particle
+// whose position has been shifted negatively in the dimensions other than the
+// dimension of the velocities, leaving out those outside the slab
+// |i_begin| <= i < |i_end|.
+template <typename T>
 void Splat(const Eigen::Vector3d& shifted_particle_position_lc, double dx,
-           double particle_velocity, Array3D<double>* grid_vels,
-           Array3D<double>* grid_vel_weights) {
+           double particle_velocity, std::size_t i_begin, std::size_t i_end,
+           Array3D<T>* grid_vels, Array3D<T>* grid_vel_weights) {
   Eigen::Vector3d p_shift_lc_over_dx = shifted_particle_position_lc / dx;
 
   // Determine the grid cell containing the shifted particle position.
@@ -154,90 +223,109 @@ void Splat(const Eigen::Vector3d& shifted_particle_position_lc, double dx,
   std::size_t j = ijk[1];
   std::size_t k = ijk[2];
 
-  Contribute(om_w0 * om_w1 * om_w2, particle_velocity, grid_vels,
-             grid_vel_weights, i, j, k);
-  Contribute(om_w0 * om_w1 * w2, particle_velocity, grid_vels, grid_vel_weights,
-             i, j, k + 1);
-  Contribute(om_w0 * w1 * om_w2, particle_velocity, grid_vels, grid_vel_weights,
-             i, j + 1, k);
-  Contribute(om_w0 * w1 * w2, particle_velocity, grid_vels, grid_vel_weights, i,
-             j + 1, k + 1);
-  Contribute(w0 * om_w1 * om_w2, particle_velocity, grid_vels, grid_vel_weights,
-             i + 1, j, k);
-  Contribute(w0 * om_w1 * w2, particle_velocity, grid_vels, grid_vel_weights,
-             i + 1, j, k + 1);
-  Contribute(w0 * w1 * om_w2, particle_velocity, grid_vels, grid_vel_weights,
-             i + 1, j + 1, k);
-  Contribute(w0 * w1 * w2, particle_velocity, grid_vels, grid_vel_weights,
-             i + 1, j + 1, k + 1);
-}
-
-MaterialType GetNeighborMaterial(const Array3D<MaterialType>& cell_labels,
-                                 std::size_t i, std::size_t j, std::size_t k,
-                                 NeighborDirection dir) {
-  switch (dir) {
-    case LEFT:
-      return cell_labels(i - 1, j, k);
-    case DOWN:
-      return cell_labels(i, j - 1, k);
-    case BACK:
-      return cell_labels(i, j, k - 1);
-    case RIGHT:
-      return cell_labels(i + 1, j, k);
-    case UP:
-      return cell_labels(i, j + 1, k);
-    case FORWARD:
-      return cell_labels(i, j, k + 1);
-  }
-  // No default case: switch cases should cover all possibilities
-  assert(false);
-  return SOLID;  // for compiler happiness, should never get executed
-}
-
-unsigned short UpdateFromNeighbor(unsigned short nbr_info,
-                                  MaterialType nbr_material,
-                                  NeighborDirection dir) {
-  unsigned short new_nbr_info = nbr_info;
-
-  if (nbr_material != SOLID) {
-    new_nbr_info++;
-  }
-
-  if (nbr_material != FLUID) {
-    return new_nbr_info;
-  }
-
-  return new_nbr_info | dir;
-}
-
-void MakeNeighborMaterialInfo(const Array3D<MaterialType>& cell_labels,
-                              Array3D<unsigned short>* neighbors) {
-  (*neighbors) = 0u;
-
-  for (std::size_t i = 1; i < cell_labels.nx() - 1; i++) {
-    for (std::size_t j = 1; j < cell_labels.ny() - 1; j++) {
-      for (std::size_t k = 1; k < cell_labels.nz() - 1; k++) {
-        if (cell_labels(i, j, k) != FLUID) {
-          continue;
-        }
+  if (i >= i_begin && i < i_end) {
+    Contribute(om_w0 * om_w1 * om_w2, particle_velocity, grid_vels,
+               grid_vel_weights, i, j, k);
+    Contribute(om_w0 * om_w1 * w2, particle_velocity, grid_vels,
+               grid_vel_weights, i, j, k + 1);
+    Contribute(om_w0 * w1 * om_w2, particle_velocity, grid_vels,
+               grid_vel_weights, i, j + 1, k);
+    Contribute(om_w0 * w1 * w2, particle_velocity, grid_vels,
+               grid_vel_weights, i, j + 1, k + 1);
+  }
+  if (i + 1 >= i_begin && i + 1 < i_end) {
+    Contribute(w0 * om_w1 * om_w2, particle_velocity, grid_vels,
+               grid_vel_weights, i + 1, j, k);
+    Contribute(w0 * om_w1 * w2, particle_velocity, grid_vels,
+               grid_vel_weights, i + 1, j, k + 1);
+    Contribute(w0 * w1 * om_w2, particle_velocity, grid_vels,
+               grid_vel_weights, i + 1, j + 1, k);
+    Contribute(w0 * w1 * w2, particle_velocity, grid_vels, grid_vel_weights,
+               i + 1, j + 1, k + 1);
+  }
+}
 
-        unsigned short nbr_info = 0u;
-        for (NeighborDirection dir : kNeighborDirections) {
-          MaterialType nbr_material =
-              GetNeighborMaterial(cell_labels, i, j, k, dir);
-          nbr_info = UpdateFromNeighbor(nbr_info, nbr_material, dir);
-        }
+// Returns the box of every cell of an |nx| x |ny| x |nz| grid.
+CellBox WholeGridBox(std::size_t nx, std::size_t ny, std::size_t nz) {
+  CellBox box = {{0, 0, 0}, {nx, ny, nz}};
+  return box;
+}
 
-        (*neighbors)(i, j, k) = nbr_info;
+// Returns an inverted box of no cells of an |nx| x |ny| x |nz| grid, which
+// becomes a cell's box once grown to hold it.
+CellBox InvertedBox(std::size_t nx, std::size_t ny, std::size_t nz) {
+  CellBox box = {{nx, ny, nz}, {0, 0, 0}};
+  return box;
+}
+
+// Returns the box of the velocities along |axis| on the faces of the cells of
+// |cells|, which holds one more index along |axis| unless it's empty.
+CellBox FaceBox(const CellBox& cells, std::size_t axis) {
+  CellBox faces = cells;
+  if (cells.begin[axis] < cells.end[axis]) {
+    faces.end[axis]++;
+  }
+  return faces;
+}
+
+// Sets the elements of |*arr| in |box| to zero.
+template <typename T>
+void ZeroBox(const CellBox& box, Array3D<T>* arr) {
+  for (std::size_t i = box.begin[0]; i < box.end[0]; i++) {
+    for (std::size_t j = box.begin[1]; j < box.end[1]; j++) {
+      for (std::size_t k = box.begin[2]; k < box.end[2]; k++) {
+        (*arr)(i, j, k) = 0.0;
+      }
+    }
+  }
+}
+
+// Copies the elements of |from| in |box| to |*to|.
+template <typename T>
+void CopyBox(const CellBox& box, const Array3D<T>& from, Array3D<T>* to) {
+  for (std::size_t i = box.begin[0]; i < box.end[0]; i++) {
+    for (std::size_t j = box.begin[1]; j < box.end[1]; j++) {
+      for (std::size_t k = box.begin[2]; k < box.end[2]; k++) {
+        (*to)(i, j, k) = from(i, j, k);
+      }
+    }
+  }
+}
+
+// Returns the largest magnitude of the elements of |arr| in |box|.
+template <typename T>
+double MaxAbs(const Array3D<T>& arr, const CellBox& box) {
+  double max_abs = 0.0;
+  for (std::size_t i = box.begin[0]; i < box.end[0]; i++) {
+    for (std::size_t j = box.begin[1]; j < box.end[1]; j++) {
+      for (std::size_t k = box.begin[2]; k < box.end[2]; k++) {
+        max_abs = std::max(max_abs,
+                           std::fabs(static_cast<double>(arr(i, j, k))));
       }
     }
   }
+  return max_abs;
+}
+
+// Returns the width, in grid points along x, of the slabs a grid |nx| cells
+// wide splits particle splatting into on |num_threads| threads: one slab per
+// thread, and at least two grid points wide, so a particle never reaches more
+// than two slabs.
+std::size_t SplatSlabWidth(std::size_t nx, std::size_t num_threads) {
+  return std::max<std::size_t>(2u, (nx + num_threads) / num_threads);
 }
 
 }  // namespace
 
-StaggeredGrid::StaggeredGrid(std::size_t nx, std::size_t ny, std::size_t nz,
-                             const Eigen::Vector3d& lc, double dx)
+template <typename T>
+StaggeredGrid<T>::StaggeredGrid(std::size_t nx, std::size_t ny, std::size_t nz,
+                                const Eigen::Vector3d& lc, double dx,
+                                const PressureSolverOptions& solver_options,
+                                std::size_t num_threads,
+                                bool contiguous_arrays,
+                                const AdvectionOptions& advection_options,
+                                bool incremental_cell_labels,
+                                bool active_region_sweeps)
     : nx_(nx),
       ny_(ny),
       nz_(nz),
@@ -248,41 +336,159 @@ StaggeredGrid::StaggeredGrid(std::size_t nx, std::size_t ny, std::size_t nz,
       half_shift_yz_(HalfShiftYZ(dx)),
       half_shift_xz_(HalfShiftXZ(dx)),
       half_shift_xy_(HalfShiftXY(dx)),
-      p_(nx, ny, nz),
-      u_(nx + 1, ny, nz),
-      v_(nx, ny + 1, nz),
-      w_(nx, ny, nz + 1),
-      fu_(nx + 1, ny, nz),
-      fv_(nx, ny + 1, nz),
-      fw_(nx, ny, nz + 1),
-      cell_labels_(nx, ny, nz),
-      neighbors_(nx, ny, nz),
-      pressure_solver_(nx, ny, nz) {}
-
-StaggeredGrid::~StaggeredGrid() {}
-
-Eigen::Vector3d StaggeredGrid::Advect(const Eigen::Vector3d& pos,
-                                      double dt) const {
-  Eigen::Vector3d interpolated_velocity = InterpolateCurrentGridVelocities(pos);
-  return ClampToNonSolidCells(pos + dt * interpolated_velocity);
-}
-
-Eigen::Vector3d StaggeredGrid::InterpolateCurrentGridVelocities(
+      arena_(contiguous_arrays
+                 ? new Array3DArena(ArenaBytes(nx, ny, nz, solver_options))
+                 : NULL),
+      p_(nx, ny, nz, arena_.get()),
+      u_(nx + 1, ny, nz, arena_.get()),
+      v_(nx, ny + 1, nz, arena_.get()),
+      w_(nx, ny, nz + 1, arena_.get()),
+      fu_(nx + 1, ny, nz, arena_.get()),
+      fv_(nx, ny + 1, nz, arena_.get()),
+      fw_(nx, ny, nz + 1, arena_.get()),
+      cell_labels_(nx, ny, nz, arena_.get()),
+      advection_options_(advection_options),
+      thread_pool_(num_threads),
+      splat_slab_width_(SplatSlabWidth(nx, thread_pool_.num_threads())),
+      neighbors_(nx, ny, nz, arena_.get()),
+      fluid_cells_(nx, ny, nz),
+      pressure_solver_(nx, ny, nz, solver_options, &thread_pool_,
+                       arena_.get()),
+      incremental_cell_labels_(incremental_cell_labels),
+      label_pass_(0),
+      relabel_all_cells_(true),
+      active_region_sweeps_(active_region_sweeps),
+      active_region_(WholeGridBox(nx, ny, nz)),
+      phase_profiler_(NULL) {
+  // The coefficient arrays are only allocated if they will be used.
+  if (solver_options.vectorized_stencil) {
+    pressure_matrix_.reset(new PressureMatrix<T>(nx, ny, nz, arena_.get()));
+  }
+
+  // Incremental cell labels start from the labels of a grid without
+  // particles, and only ever restore those.
+  if (incremental_cell_labels_) {
+    cell_label_passes_.reset(new Array3D<std::uint32_t>(nx, ny, nz));
+    slab_new_fluid_cells_.resize(nx / splat_slab_width_ + 1);
+    ClearCellLabels();
+    ResetIncrementalCellLabels();
+  }
+
+  // The velocities start out unset, so the first sweeps visit every cell.
+  if (active_region_sweeps_) {
+    slab_fluid_boxes_.assign(nx / splat_slab_width_ + 1,
+                             InvertedBox(nx, ny, nz));
+  }
+}
+
+template <typename T>
+std::size_t StaggeredGrid<T>::ArenaBytes(
+    std::size_t nx, std::size_t ny, std::size_t nz,
+    const PressureSolverOptions& solver_options) {
+  // p_, then u_ and fu_, v_ and fv_, and w_ and fw_
+  std::size_t bytes = Array3D<T>::ArenaBytes(nx, ny, nz) +
+                      2 * Array3D<T>::ArenaBytes(nx + 1, ny, nz) +
+                      2 * Array3D<T>::ArenaBytes(nx, ny + 1, nz) +
+                      2 * Array3D<T>::ArenaBytes(nx, ny, nz + 1);
+  bytes += Array3D<MaterialType>::ArenaBytes(nx, ny, nz) +
+           Array3D<unsigned short>::ArenaBytes(nx, ny, nz);
+  if (solver_options.vectorized_stencil) {
+    bytes += PressureMatrix<T>::ArenaBytes(nx, ny, nz);
+  }
+  return bytes + PressureSolver<T>::ArenaBytes(nx, ny, nz, solver_options);
+}
+
+template <typename T>
+StaggeredGrid<T>::~StaggeredGrid() {}
+
+template <typename T>
+Eigen::Vector3d StaggeredGrid<T>::Advect(const Eigen::Vector3d& pos,
+                                         double dt) const {
+  return AdvectSubsteps(pos, InterpolateCurrentGridVelocities(pos), dt,
+                        NumAdvectionSubsteps(dt));
+}
+
+template <typename T>
+double StaggeredGrid<T>::MaxSpeed() const {
+  // Every interpolated velocity component is a convex combination of grid
+  // velocities, so no particle moves faster than this.
+  double max_u = MaxAbs(u_, FaceBox(active_region_, 0));
+  double max_v = MaxAbs(v_, FaceBox(active_region_, 1));
+  double max_w = MaxAbs(w_, FaceBox(active_region_, 2));
+  return std::sqrt(max_u * max_u + max_v * max_v + max_w * max_w);
+}
+
+template <typename T>
+std::size_t StaggeredGrid<T>::NumAdvectionSubsteps(double dt) const {
+  if (advection_options_.max_cfl <= 0.0) {
+    return 1;
+  }
+
+  double max_cells = MaxSpeed() * dt / dx_;
+  return std::max<std::size_t>(
+      1u, static_cast<std::size_t>(
+              std::ceil(max_cells / advection_options_.max_cfl)));
+}
+
+template <typename T>
+Eigen::Vector3d StaggeredGrid<T>::AdvectSubsteps(
+    const Eigen::Vector3d& pos, const Eigen::Vector3d& velocity, double dt,
+    std::size_t num_substeps) const {
+  const double h = dt / num_substeps;
+  Eigen::Vector3d advected_pos = AdvectStep(pos, velocity, h);
+  for (std::size_t substep = 1; substep < num_substeps; substep++) {
+    advected_pos = AdvectStep(
+        advected_pos, InterpolateCurrentGridVelocities(advected_pos), h);
+  }
+  return advected_pos;
+}
+
+template <typename T>
+Eigen::Vector3d StaggeredGrid<T>::AdvectStep(const Eigen::Vector3d& pos,
+                                             const Eigen::Vector3d& velocity,
+                                             double h) const {
+  switch (advection_options_.scheme) {
+    case FORWARD_EULER:
+      break;
+    case RK2: {
+      Eigen::Vector3d k2 = InterpolateCurrentGridVelocities(
+          ClampToNonSolidCells(pos + 0.5 * h * velocity));
+      return ClampToNonSolidCells(pos + h * k2);
+    }
+    case RK3: {
+      Eigen::Vector3d k2 = InterpolateCurrentGridVelocities(
+          ClampToNonSolidCells(pos + 0.5 * h * velocity));
+      Eigen::Vector3d k3 = InterpolateCurrentGridVelocities(
+          ClampToNonSolidCells(pos + 0.75 * h * k2));
+      return ClampToNonSolidCells(
+          pos + h * (2.0 / 9.0 * velocity + 3.0 / 9.0 * k2 + 4.0 / 9.0 * k3));
+    }
+  }
+  return ClampToNonSolidCells(pos + h * velocity);
+}
+
+template <typename T>
+Eigen::Vector3d StaggeredGrid<T>::InterpolateCurrentGridVelocities(
     const Eigen::Vector3d& pos) const {
   return InterpolateTheseGridVelocities(pos, u_, v_, w_);
 }
 
-Eigen::Vector3d StaggeredGrid::InterpolateTheseGridVelocities(
-    const Eigen::Vector3d& pos, const Array3D<double>& u,
-    const Array3D<double>& v, const Array3D<double>& w) const {
+template <typename T>
+Eigen::Vector3d StaggeredGrid<T>::InterpolateTheseGridVelocities(
+    const Eigen::Vector3d& pos, const Array3D<T>& u, const Array3D<T>& v,
+    const Array3D<T>& w) const {
   Eigen::Vector3d p_lc(pos - lc_);
-  double u_p = InterpolateGridVelocities(p_lc - half_shift_yz_, u, dx_);
-  double v_p = InterpolateGridVelocities(p_lc - half_shift_xz_, v, dx_);
-  double w_p = InterpolateGridVelocities(p_lc - half_shift_xy_, w, dx_);
+  double u_p = InterpolateGridVelocities(
+      MakeTrilinearStencil(p_lc - half_shift_yz_, dx_), u);
+  double v_p = InterpolateGridVelocities(
+      MakeTrilinearStencil(p_lc - half_shift_xz_, dx_), v);
+  double w_p = InterpolateGridVelocities(
+      MakeTrilinearStencil(p_lc - half_shift_xy_, dx_), w);
   return Eigen::Vector3d(u_p, v_p, w_p);
 }
 
-inline Eigen::Vector3d StaggeredGrid::ClampToNonSolidCells(
+template <typename T>
+inline Eigen::Vector3d StaggeredGrid<T>::ClampToNonSolidCells(
     const Eigen::Vector3d& pos) const {
   Eigen::Vector3d clamped_pos = pos;
   const double cell_plus_cushion = dx_ + kClampCushion;
@@ -303,18 +509,74 @@ inline Eigen::Vector3d StaggeredGrid::ClampToNonSolidCells(
   return clamped_pos;
 }
 
-void StaggeredGrid::ParticlesToGrid(const std::vector<Particle>& particles) {
+template <typename T>
+void StaggeredGrid<T>::ParticlesToGrid(
+    const std::vector<Particle>& particles) {
+  TransferParticlesToGrid(particles);
+}
+
+template <typename T>
+template <typename P>
+void StaggeredGrid<T>::ParticlesToGrid(const ParticleSet<P>& particles) {
+  TransferParticlesToGrid(particles);
+}
+
+template <typename T>
+template <typename P>
+void StaggeredGrid<T>::AdvectParticles(double dt, ParticleSet<P>* particles) {
+  const std::size_t num_substeps = NumAdvectionSubsteps(dt);
+  thread_pool_.ParallelFor(0, particles->size(), [&](std::size_t n_begin,
+                                                     std::size_t n_end) {
+    for (std::size_t n = n_begin; n < n_end; n++) {
+      Eigen::Vector3d pos = particles->position(n);
+      particles->set_position(
+          n, AdvectSubsteps(pos, InterpolateCurrentGridVelocities(pos), dt,
+                            num_substeps));
+    }
+  });
+}
+
+template <typename T>
+template <typename Particles>
+void StaggeredGrid<T>::TransferParticlesToGrid(const Particles& particles) {
   ZeroOutVelocities();
-  ClearCellLabels();
+  if (incremental_cell_labels_) {
+    label_pass_++;
+  } else {
+    ClearCellLabels();
+  }
 
-  for (std::vector<Particle>::const_iterator p = particles.begin();
-       p != particles.end(); p++) {
-    Eigen::Vector3d p_lc(p->pos - lc_);
-    SetParticlesCellToFluid(p_lc);
+  if (thread_pool_.num_threads() == 1) {
+    for (std::size_t n = 0; n < particles.size(); n++) {
+      SplatParticle(ParticlePosition(particles, n),
+                    ParticleVelocity(particles, n), 0, nx_ + 1);
+    }
+  } else {
+    // Each thread splats onto its own slabs of grid points, visiting the
+    // particles that reach them in their original order, so every grid
+    // velocity sums the same contributions in the same order as on one
+    // thread.
+    std::size_t num_slabs = BinParticlesBySlab(particles);
+    thread_pool_.ParallelFor(0, num_slabs, [&](std::size_t slab_begin,
+                                               std::size_t slab_end) {
+      for (std::size_t slab = slab_begin; slab < slab_end; slab++) {
+        std::size_t i_begin = slab * splat_slab_width_;
+        std::size_t i_end = std::min(i_begin + splat_slab_width_, nx_ + 1);
+        for (std::size_t n = slab_starts_[slab]; n < slab_starts_[slab + 1];
+             n++) {
+          std::size_t particle = slab_particles_[n];
+          SplatParticle(ParticlePosition(particles, particle),
+                        ParticleVelocity(particles, particle), i_begin, i_end);
+        }
+      }
+    });
+  }
 
-    Splat(p_lc - half_shift_yz_, dx_, p->vel[0], &u_, &fu_);
-    Splat(p_lc - half_shift_xz_, dx_, p->vel[1], &v_, &fv_);
-    Splat(p_lc - half_shift_xy_, dx_, p->vel[2], &w_, &fw_);
+  if (incremental_cell_labels_) {
+    UpdateFluidCellList();
+  }
+  if (active_region_sweeps_) {
+    UpdateActiveRegion();
   }
 
   NormalizeHorizontalVelocities();
@@ -326,21 +588,127 @@ void StaggeredGrid::ParticlesToGrid(const std::vector<Particle>& particles) {
   SetBoundaryVelocities();
 }
 
-void StaggeredGrid::ZeroOutVelocities() {
-  u_ = 0.0;
-  fu_ = 0.0;
-  v_ = 0.0;
-  fv_ = 0.0;
-  w_ = 0.0;
-  fw_ = 0.0;
+template <typename T>
+void StaggeredGrid<T>::SplatParticle(const Eigen::Vector3d& pos,
+                                     const Eigen::Vector3d& vel,
+                                     std::size_t i_begin, std::size_t i_end) {
+  Eigen::Vector3d p_lc(pos - lc_);
+  SetParticlesCellToFluid(p_lc, i_begin, i_end);
+
+  Splat(p_lc - half_shift_yz_, dx_, vel[0], i_begin, i_end, &u_, &fu_);
+  Splat(p_lc - half_shift_xz_, dx_, vel[1], i_begin, i_end, &v_, &fv_);
+  Splat(p_lc - half_shift_xy_, dx_, vel[2], i_begin, i_end, &w_, &fw_);
+}
+
+template <typename T>
+void StaggeredGrid<T>::GetSplatSlabs(const Eigen::Vector3d& pos,
+                                     std::size_t* first_slab,
+                                     std::size_t* last_slab) const {
+  // The v and w splats start half a cell lower along x than the u splat, which
+  // reaches one grid point past the particle's cell. These are computed
+  // exactly as Splat computes them.
+  Eigen::Vector3d p_lc(pos - lc_);
+  std::size_t i_first = floor(p_lc - half_shift_xz_, dx_)[0];
+  std::size_t i_last = floor(p_lc, dx_)[0] + 1;
+  *first_slab = i_first / splat_slab_width_;
+  *last_slab = i_last / splat_slab_width_;
+}
+
+template <typename T>
+template <typename Particles>
+std::size_t StaggeredGrid<T>::BinParticlesBySlab(const Particles& particles) {
+  const std::size_t num_slabs = nx_ / splat_slab_width_ + 1;
+  const std::size_t num_chunks = thread_pool_.num_threads();
+  const std::size_t num_particles = particles.size();
+  chunk_slab_counts_.assign(num_chunks * num_slabs, 0u);
+
+  // Count the particles of each chunk reaching each slab, one chunk of
+  // consecutive particles per thread.
+  thread_pool_.ParallelFor(0, num_chunks, [&](std::size_t chunk_begin,
+                                              std::size_t chunk_end) {
+    for (std::size_t chunk = chunk_begin; chunk < chunk_end; chunk++) {
+      std::size_t* counts = &chunk_slab_counts_[chunk * num_slabs];
+      std::size_t n_end = (chunk + 1) * num_particles / num_chunks;
+      for (std::size_t n = chunk * num_particles / num_chunks; n < n_end;
+           n++) {
+        std::size_t first_slab, last_slab;
+        GetSplatSlabs(ParticlePosition(particles, n), &first_slab, &last_slab);
+        counts[first_slab]++;
+        if (last_slab != first_slab) {
+          counts[last_slab]++;
+        }
+      }
+    }
+  });
+
+  // Turn the counts into the position of each chunk's first particle within
+  // each slab's list, with the lists of the slabs one after another.
+  slab_starts_.resize(num_slabs + 1);
+  std::size_t num_entries = 0;
+  for (std::size_t slab = 0; slab < num_slabs; slab++) {
+    slab_starts_[slab] = num_entries;
+    for (std::size_t chunk = 0; chunk < num_chunks; chunk++) {
+      std::size_t count = chunk_slab_counts_[chunk * num_slabs + slab];
+      chunk_slab_counts_[chunk * num_slabs + slab] = num_entries;
+      num_entries += count;
+    }
+  }
+  slab_starts_[num_slabs] = num_entries;
+  slab_particles_.resize(num_entries);
+
+  // Fill in the lists, which keeps each one in increasing particle order.
+  thread_pool_.ParallelFor(0, num_chunks, [&](std::size_t chunk_begin,
+                                              std::size_t chunk_end) {
+    for (std::size_t chunk = chunk_begin; chunk < chunk_end; chunk++) {
+      std::size_t* next = &chunk_slab_counts_[chunk * num_slabs];
+      std::size_t n_end = (chunk + 1) * num_particles / num_chunks;
+      for (std::size_t n = chunk * num_particles / num_chunks; n < n_end;
+           n++) {
+        std::size_t first_slab, last_slab;
+        GetSplatSlabs(ParticlePosition(particles, n), &first_slab, &last_slab);
+        slab_particles_[next[first_slab]++] = n;
+        if (last_slab != first_slab) {
+          slab_particles_[next[last_slab]++] = n;
+        }
+      }
+    }
+  });
+
+  return num_slabs;
+}
+
+template <typename T>
+void StaggeredGrid<T>::ZeroOutVelocities() {
+  if (!active_region_sweeps_) {
+    u_ = 0.0;
+    fu_ = 0.0;
+    v_ = 0.0;
+    fv_ = 0.0;
+    w_ = 0.0;
+    fw_ = 0.0;
+    return;
+  }
+
+  // Only the previous active region holds velocities that aren't zero.
+  const CellBox u_faces = FaceBox(active_region_, 0);
+  const CellBox v_faces = FaceBox(active_region_, 1);
+  const CellBox w_faces = FaceBox(active_region_, 2);
+  ZeroBox(u_faces, &u_);
+  ZeroBox(u_faces, &fu_);
+  ZeroBox(v_faces, &v_);
+  ZeroBox(v_faces, &fv_);
+  ZeroBox(w_faces, &w_);
+  ZeroBox(w_faces, &fw_);
 }
 
-void StaggeredGrid::ClearCellLabels() {
+template <typename T>
+void StaggeredGrid<T>::ClearCellLabels() {
   SetOuterCellLabelsToSolid();
   SetInnerCellLabelsToEmpty();
 }
 
-void StaggeredGrid::SetOuterCellLabelsToSolid() {
+template <typename T>
+void StaggeredGrid<T>::SetOuterCellLabelsToSolid() {
   // There's some duplicate assignment of grid cells that are on the
   // corners of the grid. Plus, these solid settings could be set once on
   // construction of |this| StaggeredGrid, but just in case something gets
@@ -372,7 +740,8 @@ void StaggeredGrid::SetOuterCellLabelsToSolid() {
   }
 }
 
-void StaggeredGrid::SetInnerCellLabelsToEmpty() {
+template <typename T>
+void StaggeredGrid<T>::SetInnerCellLabelsToEmpty() {
   for (std::size_t i = 1; i < nx_ - 1; i++) {
     for (std::size_t j = 1; j < ny_ - 1; j++) {
       for (std::size_t k = 1; k < nz_ - 1; k++) {
@@ -382,15 +751,133 @@ void StaggeredGrid::SetInnerCellLabelsToEmpty() {
   }
 }
 
-void StaggeredGrid::SetParticlesCellToFluid(const Eigen::Vector3d& p_lc) {
+template <typename T>
+void StaggeredGrid<T>::SetParticlesCellToFluid(const Eigen::Vector3d& p_lc,
+                                               std::size_t i_begin,
+                                               std::size_t i_end) {
   GridIndices ijk = floor(p_lc, dx_);
-  cell_labels_(ijk[0], ijk[1], ijk[2]) = MaterialType::FLUID;
+  if (ijk[0] >= i_begin && ijk[0] < i_end) {
+    cell_labels_(ijk[0], ijk[1], ijk[2]) = MaterialType::FLUID;
+
+    // The first particle to reach a cell in this call lists it as new FLUID,
+    // unless a particle reached it in the previous call too.
+    if (active_region_sweeps_) {
+      CellBox& box = slab_fluid_boxes_[i_begin / splat_slab_width_];
+      for (std::size_t a = 0; a < 3; a++) {
+        box.begin[a] = std::min(box.begin[a], ijk[a]);
+        box.end[a] = std::max(box.end[a], ijk[a] + 1);
+      }
+    }
+
+    if (incremental_cell_labels_) {
+      std::uint32_t& pass = (*cell_label_passes_)(ijk[0], ijk[1], ijk[2]);
+      if (pass != label_pass_) {
+        if (pass + 1 != label_pass_) {
+          slab_new_fluid_cells_[i_begin / splat_slab_width_].push_back(
+              ijk[0] * ny_nz_ + ijk[1] * nz_ + ijk[2]);
+        }
+        pass = label_pass_;
+      }
+    }
+  }
 }
 
-void StaggeredGrid::NormalizeHorizontalVelocities() {
+template <typename T>
+MaterialType StaggeredGrid<T>::StaticCellLabel(std::size_t i, std::size_t j,
+                                               std::size_t k) const {
+  if (i == 0 || i == nx_ - 1 || j == 0 || j == ny_ - 1 || k == 0 ||
+      k == nz_ - 1) {
+    return MaterialType::SOLID;
+  }
+  return MaterialType::EMPTY;
+}
+
+template <typename T>
+void StaggeredGrid<T>::UpdateFluidCellList() {
+  // FLUID cells of the previous call that no particle reached get their
+  // labels back.
+  std::size_t num_kept = 0;
+  for (std::size_t cell : fluid_cell_list_) {
+    std::size_t i = cell / ny_nz_, j = cell % ny_nz_ / nz_, k = cell % nz_;
+    if ((*cell_label_passes_)(i, j, k) == label_pass_) {
+      fluid_cell_list_[num_kept++] = cell;
+    } else {
+      cell_labels_(i, j, k) = StaticCellLabel(i, j, k);
+      relabeled_cells_.push_back(cell);
+    }
+  }
+  fluid_cell_list_.resize(num_kept);
+
+  for (std::vector<std::size_t>& new_cells : slab_new_fluid_cells_) {
+    fluid_cell_list_.insert(fluid_cell_list_.end(), new_cells.begin(),
+                            new_cells.end());
+    relabeled_cells_.insert(relabeled_cells_.end(), new_cells.begin(),
+                            new_cells.end());
+    new_cells.clear();
+  }
+}
+
+template <typename T>
+void StaggeredGrid<T>::ResetIncrementalCellLabels() {
+  if (!incremental_cell_labels_) {
+    return;
+  }
+  // Cells not reached in the latest call are left at pass 0, which is never
+  // the previous one.
+  label_pass_ = 1;
+  (*cell_label_passes_) = 0u;
+  fluid_cell_list_.clear();
+  for (std::size_t i = 0; i < nx_; i++) {
+    for (std::size_t j = 0; j < ny_; j++) {
+      for (std::size_t k = 0; k < nz_; k++) {
+        if (cell_labels_(i, j, k) == MaterialType::FLUID) {
+          (*cell_label_passes_)(i, j, k) = label_pass_;
+          fluid_cell_list_.push_back(i * ny_nz_ + j * nz_ + k);
+        }
+      }
+    }
+  }
+  relabeled_cells_.clear();
+  relabel_all_cells_ = true;
+}
+
+template <typename T>
+void StaggeredGrid<T>::UpdateActiveRegion() {
+  CellBox fluid_box = InvertedBox(nx_, ny_, nz_);
+  for (CellBox& box : slab_fluid_boxes_) {
+    for (std::size_t a = 0; a < 3; a++) {
+      fluid_box.begin[a] = std::min(fluid_box.begin[a], box.begin[a]);
+      fluid_box.end[a] = std::max(fluid_box.end[a], box.end[a]);
+    }
+    box = InvertedBox(nx_, ny_, nz_);
+  }
+  if (fluid_box.begin[0] >= fluid_box.end[0]) {
+    active_region_ = CellBox();
+    return;
+  }
+
+  const std::size_t n[3] = {nx_, ny_, nz_};
+  for (std::size_t a = 0; a < 3; a++) {
+    std::size_t begin = fluid_box.begin[a] > kActiveRegionMargin
+                            ? fluid_box.begin[a] - kActiveRegionMargin
+                            : 0;
+    std::size_t end = std::min(n[a], fluid_box.end[a] + kActiveRegionMargin);
+
+    // SetBoundaryVelocities() copies the velocities of the cells next to the
+    // outer faces of the grid onto those faces, so a region reaching them
+    // covers the faces too.
+    active_region_.begin[a] = begin <= 1 ? 0 : begin;
+    active_region_.end[a] = end + 1 >= n[a] ? n[a] : end;
+  }
+}
+
+template <typename T>
+void StaggeredGrid<T>::NormalizeHorizontalVelocities() {
+  const CellBox faces = FaceBox(active_region_, 0);
+
   // Set boundary velocities to zero.
-  for (std::size_t j = 0; j < ny_; j++) {
-    for (std::size_t k = 0; k < nz_; k++) {
+  for (std::size_t j = faces.begin[1]; j < faces.end[1]; j++) {
+    for (std::size_t k = faces.begin[2]; k < faces.end[2]; k++) {
       u_(0, j, k) = 0.0;
       u_(1, j, k) = 0.0;
       u_(nx_ - 1, j, k) = 0.0;
@@ -400,9 +887,10 @@ void StaggeredGrid::NormalizeHorizontalVelocities() {
 
   // Normalize the non-boundary velocities unless the corresponding
   // velocity-weight is small.
-  for (std::size_t i = 2; i < nx_ - 1; i++) {
-    for (std::size_t j = 0; j < ny_; j++) {
-      for (std::size_t k = 0; k < nz_; k++) {
+  for (std::size_t i = std::max<std::size_t>(2u, faces.begin[0]);
+       i < std::min(nx_ - 1, faces.end[0]); i++) {
+    for (std::size_t j = faces.begin[1]; j < faces.end[1]; j++) {
+      for (std::size_t k = faces.begin[2]; k < faces.end[2]; k++) {
         if (fu_(i, j, k) < kFloatZero) {
           u_(i, j, k) = 0.0;
           continue;
@@ -413,10 +901,13 @@ void StaggeredGrid::NormalizeHorizontalVelocities() {
   }
 }
 
-void StaggeredGrid::NormalizeVerticalVelocities() {
+template <typename T>
+void StaggeredGrid<T>::NormalizeVerticalVelocities() {
+  const CellBox faces = FaceBox(active_region_, 1);
+
   // Set boundary velocities to zero.
-  for (std::size_t i = 0; i < nx_; i++) {
-    for (std::size_t k = 0; k < nz_; k++) {
+  for (std::size_t i = faces.begin[0]; i < faces.end[0]; i++) {
+    for (std::size_t k = faces.begin[2]; k < faces.end[2]; k++) {
       v_(i, 0, k) = 0.0;
       v_(i, 1, k) = 0.0;
       v_(i, ny_ - 1, k) = 0.0;
@@ -426,9 +917,10 @@ void StaggeredGrid::NormalizeVerticalVelocities() {
 
   // Normalize the non-boundary velocities unless the corresponding
   // velocity-weight is small.
-  for (std::size_t i = 0; i < nx_; i++) {
-    for (std::size_t j = 2; j < ny_ - 1; j++) {
-      for (std::size_t k = 0; k < nz_; k++) {
+  for (std::size_t i = faces.begin[0]; i < faces.end[0]; i++) {
+    for (std::size_t j = std::max<std::size_t>(2u, faces.begin[1]);
+         j < std::min(ny_ - 1, faces.end[1]); j++) {
+      for (std::size_t k = faces.begin[2]; k < faces.end[2]; k++) {
         if (fv_(i, j, k) < kFloatZero) {
           v_(i, j, k) = 0.0;
           continue;
@@ -439,10 +931,13 @@ void StaggeredGrid::NormalizeVerticalVelocities() {
   }
 }
 
-void StaggeredGrid::NormalizeDepthVelocities() {
+template <typename T>
+void StaggeredGrid<T>::NormalizeDepthVelocities() {
+  const CellBox faces = FaceBox(active_region_, 2);
+
   // Set boundary velocities to zero.
-  for (std::size_t i = 0; i < nx_; i++) {
-    for (std::size_t j = 0; j < ny_; j++) {
+  for (std::size_t i = faces.begin[0]; i < faces.end[0]; i++) {
+    for (std::size_t j = faces.begin[1]; j < faces.end[1]; j++) {
       w_(i, j, 0) = 0.0;
       w_(i, j, 1) = 0.0;
       w_(i, j, nz_ - 1) = 0.0;
@@ -452,9 +947,10 @@ void StaggeredGrid::NormalizeDepthVelocities() {
 
   // Normalize the non-boundary velocities unless the corresponding
   // velocity-weight is small.
-  for (std::size_t i = 0; i < nx_; i++) {
-    for (std::size_t j = 0; j < ny_; j++) {
-      for (std::size_t k = 2; k < nz_ - 1; k++) {
+  for (std::size_t i = faces.begin[0]; i < faces.end[0]; i++) {
+    for (std::size_t j = faces.begin[1]; j < faces.end[1]; j++) {
+      for (std::size_t k = std::max<std::size_t>(2u, faces.begin[2]);
+           k < std::min(nz_ - 1, faces.end[2]); k++) {
         if (fw_(i, j, k) < kFloatZero) {
           w_(i, j, k) = 0.0;
           continue;
@@ -465,19 +961,29 @@ void StaggeredGrid::NormalizeDepthVelocities() {
   }
 }
 
-void StaggeredGrid::StoreNormalizedVelocities() {
+template <typename T>
+void StaggeredGrid<T>::StoreNormalizedVelocities() {
   // Store the normalized grid velocities so they can be used for mapping
   // velocities from particles back to the grid before this time step ends.
-  fu_.SetEqualTo(u_);
-  fv_.SetEqualTo(v_);
-  fw_.SetEqualTo(w_);
+  if (!active_region_sweeps_) {
+    fu_.SetEqualTo(u_);
+    fv_.SetEqualTo(v_);
+    fw_.SetEqualTo(w_);
+    return;
+  }
+  CopyBox(FaceBox(active_region_, 0), u_, &fu_);
+  CopyBox(FaceBox(active_region_, 1), v_, &fv_);
+  CopyBox(FaceBox(active_region_, 2), w_, &fw_);
 }
 
-void StaggeredGrid::SetBoundaryVelocities() {
+template <typename T>
+void StaggeredGrid<T>::SetBoundaryVelocities() {
   // These are the "boundary conditions."
+  const std::size_t* begin = active_region_.begin;
+  const std::size_t* end = active_region_.end;
 
-  for (std::size_t j = 0; j < ny_; j++) {
-    for (std::size_t k = 0; k < nz_; k++) {
+  for (std::size_t j = begin[1]; j < end[1]; j++) {
+    for (std::size_t k = begin[2]; k < end[2]; k++) {
       // Zero out horizontal velocities on either side of each grid cell on the
       // left and right boundary walls of the grid.
       u_(0, j, k) = 0.0;
@@ -495,8 +1001,8 @@ void StaggeredGrid::SetBoundaryVelocities() {
     }
   }
 
-  for (std::size_t i = 0; i < nx_; i++) {
-    for (std::size_t k = 0; k < nz_; k++) {
+  for (std::size_t i = begin[0]; i < end[0]; i++) {
+    for (std::size_t k = begin[2]; k < end[2]; k++) {
       // Zero out vertical velocities on either side of each grid cell on the
       // bottom and top boundary walls of the grid.
       v_(i, 0, k) = 0.0;
@@ -514,8 +1020,8 @@ void StaggeredGrid::SetBoundaryVelocities() {
     }
   }
 
-  for (std::size_t i = 0; i < nx_; i++) {
-    for (std::size_t j = 0; j < ny_; j++) {
+  for (std::size_t i = begin[0]; i < end[0]; i++) {
+    for (std::size_t j = begin[1]; j < end[1]; j++) {
       // Zero out depth velocities on either side of each grid cell on the back
       // and front boundary walls of the grid.
       w_(i, j, 0) = 0.0;
@@ -534,7 +1040,8 @@ void StaggeredGrid::SetBoundaryVelocities() {
   }
 }
 
-void StaggeredGrid::ApplyGravity(double dt) {
+template <typename T>
+void StaggeredGrid<T>::ApplyGravity(double dt) {
   double vertical_velocity_change = -dt * kGravAccMetersPerSecond;
   /*for (std::size_t i = 0; i < nx_; i++) {
     for (std::size_t j = 0; j < ny_ + 1; j++) {
@@ -545,9 +1052,10 @@ void StaggeredGrid::ApplyGravity(double dt) {
   }*/
   // Shifting gravity to act along z-axis for consistency with Bargteil and
   // Shinar's code
-  for (std::size_t i = 0; i < nx_; i++) {
-    for (std::size_t j = 0; j < ny_; j++) {
-      for (std::size_t k = 0; k < nz_ + 1; k++) {
+  const CellBox faces = FaceBox(active_region_, 2);
+  for (std::size_t i = faces.begin[0]; i < faces.end[0]; i++) {
+    for (std::size_t j = faces.begin[1]; j < faces.end[1]; j++) {
+      for (std::size_t k = faces.begin[2]; k < faces.end[2]; k++) {
         w_(i, j, k) += vertical_velocity_change;
       }
     }
@@ -557,22 +1065,72 @@ void StaggeredGrid::ApplyGravity(double dt) {
   SetBoundaryVelocities();
 }
 
-void StaggeredGrid::ProjectPressure() {
+template <typename T>
+PressureSolveStats StaggeredGrid<T>::ProjectPressure() {
   // Cache which neighbors are non-SOLID and which ones are FLUID.
-  MakeNeighborMaterialInfo(cell_labels_, &neighbors_);
+  {
+    ScopedPhaseTimer timer(NEIGHBOR_INFO_PHASE, phase_profiler_);
+    if (!incremental_cell_labels_ || relabel_all_cells_) {
+      if (pressure_matrix_) {
+        MakeNeighborMaterialInfo(cell_labels_, &neighbors_,
+                                 pressure_matrix_.get());
+      } else {
+        MakeNeighborMaterialInfo(cell_labels_, &neighbors_);
+      }
+      relabel_all_cells_ = false;
+    } else {
+      // A cell's neighbors info only depends on its own label and those of
+      // its six neighbors.
+      for (std::size_t cell : relabeled_cells_) {
+        std::size_t i = cell / ny_nz_, j = cell % ny_nz_ / nz_, k = cell % nz_;
+        UpdateNeighborMaterialInfo(cell_labels_, i, j, k, &neighbors_,
+                                   pressure_matrix_.get());
+        const std::size_t neighbor_cells[6][3] = {
+            {i - 1, j, k}, {i + 1, j, k}, {i, j - 1, k},
+            {i, j + 1, k}, {i, j, k - 1}, {i, j, k + 1}};
+        for (const std::size_t* n : neighbor_cells) {
+          // Indices below zero wrap around past the end.
+          if (n[0] < nx_ && n[1] < ny_ && n[2] < nz_) {
+            UpdateNeighborMaterialInfo(cell_labels_, n[0], n[1], n[2],
+                                       &neighbors_, pressure_matrix_.get());
+          }
+        }
+      }
+    }
+    relabeled_cells_.clear();
+    if (pressure_solver_.options().compact_fluid_cells) {
+      fluid_cells_.Build(cell_labels_, neighbors_);
+    }
+  }
 
   // Determine fluid pressures that make fluid velocity as divergence-free as
   // we reasonably can.
-  pressure_solver_.ProjectPressure(cell_labels_, neighbors_, u_, v_, w_, &p_);
+  PressureSolveStats stats;
+  {
+    ScopedPhaseTimer timer(PRESSURE_SOLVE_PHASE, phase_profiler_);
+    stats = pressure_solver_.ProjectPressure(
+        cell_labels_, neighbors_, fluid_cells_, pressure_matrix_.get(), u_, v_,
+        w_, &p_);
+  }
 
   // Update grid fluid velocity values based on the fluid pressure gradient.
+  ScopedPhaseTimer timer(PRESSURE_GRADIENT_PHASE, phase_profiler_);
   SubtractPressureGradientFromVelocity();
+
+  return stats;
 }
 
-void StaggeredGrid::SubtractPressureGradientFromVelocity() {
-  for (std::size_t i = 1; i < nx_ - 1; i++) {
-    for (std::size_t j = 1; j < ny_ - 1; j++) {
-      for (std::size_t k = 1; k < nz_ - 1; k++) {
+template <typename T>
+void StaggeredGrid<T>::SubtractPressureGradientFromVelocity() {
+  // Outside the active region, no cell is FLUID, so every pressure is zero.
+  const std::size_t* begin = active_region_.begin;
+  const std::size_t* end = active_region_.end;
+  for (std::size_t i = std::max<std::size_t>(1u, begin[0]);
+       i < std::min(nx_ - 1, end[0]); i++) {
+    for (std::size_t j = std::max<std::size_t>(1u, begin[1]);
+         j < std::min(ny_ - 1, end[1]); j++) {
+      for (std::size_t k = std::max<std::size_t>(1u, begin[2]);
+           k < std::min(nz_ - 1, end[2]); k++) {
         if (cell_labels_(i, j, k) == SOLID) {
           continue;
         }
@@ -591,8 +1149,9 @@ void StaggeredGrid::SubtractPressureGradientFromVelocity() {
   }
 }
 
-Eigen::Vector3d StaggeredGrid::GridToParticle(double flip_ratio,
-                                              const Particle& particle) const {
+template <typename T>
+Eigen::Vector3d StaggeredGrid<T>::GridToParticle(
+    double flip_ratio, const Particle& particle) const {
   Eigen::Vector3d old_velocity = InterpolateOldGridVelocities(particle.pos);
   Eigen::Vector3d new_velocity = InterpolateCurrentGridVelocities(particle.pos);
 
@@ -625,7 +1184,109 @@ Eigen::Vector3d StaggeredGrid::GridToParticle(double flip_ratio,
   return flip_ratio * (particle.vel - old_velocity) + new_velocity;
 }
 
-Eigen::Vector3d StaggeredGrid::InterpolateOldGridVelocities(
+template <typename T>
+template <typename P>
+void StaggeredGrid<T>::GridToParticles(double flip_ratio,
+                                       ParticleSet<P>* particles) {
+  thread_pool_.ParallelFor(0, particles->size(), [&](std::size_t n_begin,
+                                                     std::size_t n_end) {
+    for (std::size_t n = n_begin; n < n_end; n++) {
+      particles->set_velocity(
+          n, GridToParticle(flip_ratio, particles->Get(n)));
+    }
+  });
+}
+
+template <typename T>
+template <typename P>
+void StaggeredGrid<T>::GridToParticlesAndAdvect(double flip_ratio, double dt,
+                                                ParticleSet<P>* particles) {
+  const std::size_t num_substeps = NumAdvectionSubsteps(dt);
+  thread_pool_.ParallelFor(0, particles->size(), [&](std::size_t n_begin,
+                                                     std::size_t n_end) {
+    for (std::size_t n = n_begin; n < n_end; n++) {
+      Eigen::Vector3d pos = particles->position(n);
+      Eigen::Vector3d p_lc(pos - lc_);
+
+      // Each staggered component's cell and weights serve both the old and
+      // the current grid velocities.
+      TrilinearStencil u_stencil =
+          MakeTrilinearStencil(p_lc - half_shift_yz_, dx_);
+      TrilinearStencil v_stencil =
+          MakeTrilinearStencil(p_lc - half_shift_xz_, dx_);
+      TrilinearStencil w_stencil =
+          MakeTrilinearStencil(p_lc - half_shift_xy_, dx_);
+      Eigen::Vector3d old_velocity(
+          InterpolateGridVelocities(u_stencil, fu_),
+          InterpolateGridVelocities(v_stencil, fv_),
+          InterpolateGridVelocities(w_stencil, fw_));
+      Eigen::Vector3d new_velocity(InterpolateGridVelocities(u_stencil, u_),
+                                   InterpolateGridVelocities(v_stencil, v_),
+                                   InterpolateGridVelocities(w_stencil, w_));
+
+      // Blend PIC and FLIP as GridToParticle(..) does, then advect through the
+      // current grid velocities as Advect(..) does, starting from the
+      // velocity just interpolated.
+      particles->set_velocity(
+          n, flip_ratio * (particles->velocity(n) - old_velocity) +
+                 new_velocity);
+      particles->set_position(
+          n, AdvectSubsteps(pos, new_velocity, dt, num_substeps));
+    }
+  });
+}
+
+template <typename T>
+Eigen::Vector3d StaggeredGrid<T>::InterpolateOldGridVelocities(
     const Eigen::Vector3d& pos) const {
   return InterpolateTheseGridVelocities(pos, fu_, fv_, fw_);
 }
+
+template <typename T>
+void StaggeredGrid<T>::WriteCheckpoint(CheckpointWriter* writer) const {
+  writer->WriteArray(p_);
+  writer->WriteArray(u_);
+  writer->WriteArray(v_);
+  writer->WriteArray(w_);
+  writer->WriteArray(fu_);
+  writer->WriteArray(fv_);
+  writer->WriteArray(fw_);
+  writer->WriteArray(cell_labels_);
+  pressure_solver_.WriteCheckpoint(writer);
+}
+
+template <typename T>
+void StaggeredGrid<T>::ReadCheckpoint(CheckpointReader* reader) {
+  reader->ReadArray(&p_);
+  reader->ReadArray(&u_);
+  reader->ReadArray(&v_);
+  reader->ReadArray(&w_);
+  reader->ReadArray(&fu_);
+  reader->ReadArray(&fv_);
+  reader->ReadArray(&fw_);
+  reader->ReadArray(&cell_labels_);
+  ResetIncrementalCellLabels();
+
+  // The velocities read may be nonzero anywhere until the next
+  // ParticlesToGrid(..) call zeroes them.
+  active_region_ = WholeGridBox(nx_, ny_, nz_);
+  pressure_solver_.ReadCheckpoint(reader);
+}
+
+template class StaggeredGrid<float>;
+template class StaggeredGrid<double>;
+
+#define INSTANTIATE_PARTICLE_SET_TRANSFERS(T, P)                               \
+  template void StaggeredGrid<T>::ParticlesToGrid(                             \
+      const ParticleSet<P>& particles);                                        \
+  template void StaggeredGrid<T>::AdvectParticles(double dt,                   \
+                                                  ParticleSet<P>* particles);  \
+  template void StaggeredGrid<T>::GridToParticles(double flip_ratio,           \
+                                                  ParticleSet<P>* particles);  \
+  template void StaggeredGrid<T>::GridToParticlesAndAdvect(                    \
+      double flip_ratio, double dt, ParticleSet<P>* particles);
+
+INSTANTIATE_PARTICLE_SET_TRANSFERS(float, float)
+INSTANTIATE_PARTICLE_SET_TRANSFERS(float, double)
+INSTANTIATE_PARTICLE_SET_TRANSFERS(double, float)
+INSTANTIATE_PARTICLE_SET_TRANSFERS(double, double)
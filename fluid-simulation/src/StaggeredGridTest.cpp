@@ -1,10 +1,29 @@
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <string>
 #include <vector>
 
+#include "Checkpoint.h"
+#include "FrameWriter.h"
+#include "NeighborMaterialInfo.h"
 #include "Particle.h"
+#include "ParticleEmitter.h"
+#include "ParticleFrame.h"
+#include "ParticleSet.h"
+#include "ParticleSorter.h"
+#include "PhaseProfiler.h"
+#include "PressureKernels.h"
+#include "PressureSolveLog.h"
 #include "SimulationParameters.h"
 #include "StaggeredGrid.h"
+#include "ThreadPool.h"
+#include "TimeStepper.h"
 
 namespace {
 
@@ -48,7 +67,7 @@ bool IsEmpty(MaterialType label) { return label == MaterialType::EMPTY; }
 
 bool IsFluid(MaterialType label) { return label == MaterialType::FLUID; }
 
-void CheckOuterCellsAreSolid(const StaggeredGrid& grid, std::size_t nx,
+void CheckOuterCellsAreSolid(const StaggeredGrid<double>& grid, std::size_t nx,
                              std::size_t ny, std::size_t nz) {
   // Outer cell labels should be |SOLID|.
   for (std::size_t j = 0; j < ny; j++) {
@@ -71,7 +90,7 @@ void CheckOuterCellsAreSolid(const StaggeredGrid& grid, std::size_t nx,
   }
 }
 
-void CheckEmptyParticleSplat(const StaggeredGrid& grid, std::size_t nx,
+void CheckEmptyParticleSplat(const StaggeredGrid<double>& grid, std::size_t nx,
                              std::size_t ny, std::size_t nz) {
   // Check grid's arrays' sizes against size we used to initialize grid.
   assert(grid.u().nx() == nx + 1);
@@ -103,7 +122,7 @@ void CheckEmptyParticleSplat(const StaggeredGrid& grid, std::size_t nx,
   }
 }
 
-void CheckOneParticleSplat(const StaggeredGrid& grid, std::size_t nx,
+void CheckOneParticleSplat(const StaggeredGrid<double>& grid, std::size_t nx,
                            std::size_t ny, std::size_t nz) {
   // Particle is at (2.75, 3.25, 2.5).
   //
@@ -218,7 +237,7 @@ void CheckOneParticleSplat(const StaggeredGrid& grid, std::size_t nx,
   }
 }
 
-void CheckOneParticlePostSplatMaterial(const StaggeredGrid& grid,
+void CheckOneParticlePostSplatMaterial(const StaggeredGrid<double>& grid,
                                        std::size_t nx, std::size_t ny,
                                        std::size_t nz) {
   CheckOuterCellsAreSolid(grid, nx, ny, nz);
@@ -237,7 +256,7 @@ void CheckOneParticlePostSplatMaterial(const StaggeredGrid& grid,
   }
 }
 
-void CheckTwoParticlesSplat(const StaggeredGrid& grid, std::size_t nx,
+void CheckTwoParticlesSplat(const StaggeredGrid<double>& grid, std::size_t nx,
                             std::size_t ny, std::size_t nz) {
   // Particle 2 is at (3.125, 3.125, 2.5).
   //
@@ -433,7 +452,7 @@ void CheckTwoParticlesSplat(const StaggeredGrid& grid, std::size_t nx,
   }
 }
 
-void CheckTwoParticlePostSplatMaterial(const StaggeredGrid& grid,
+void CheckTwoParticlePostSplatMaterial(const StaggeredGrid<double>& grid,
                                        std::size_t nx, std::size_t ny,
                                        std::size_t nz) {
   CheckOuterCellsAreSolid(grid, nx, ny, nz);
@@ -626,7 +645,7 @@ void CheckAdvection(const std::vector<Particle>& particles) {
 
 // Verify that having applied gravity subtracts dt times 9.80665 m/s^2 from all
 // vertical velocities while leaving all other values unchanged.
-void CheckEffectOfGravity(const StaggeredGrid& grid, std::size_t nx,
+void CheckEffectOfGravity(const StaggeredGrid<double>& grid, std::size_t nx,
                           std::size_t ny, std::size_t nz) {
   // Horizontal velocities should all remain unchanged.
   assert(FuzzyEquals(grid.u()(3, 2, 2),
@@ -736,7 +755,7 @@ void TestGridSplatAdvectGravity(int argc, char** argv) {
   std::size_t nx = 9, ny = 7, nz = 5;
   Eigen::Vector3d lower_corner(0.0, 0.0, 0.0);
   double dx = 1.0;
-  StaggeredGrid grid(nx, ny, nz, lower_corner, dx);
+  StaggeredGrid<double> grid(nx, ny, nz, lower_corner, dx);
 
   // Ensure the grid's arrays have the correct dimensions.
   assert(grid.p().nx() == nx);
@@ -860,7 +879,7 @@ void TestPressureProjection(int argc, char** argv) {
   std::size_t nx = 9, ny = 7, nz = 5;
   Eigen::Vector3d lower_corner(0.0, 0.0, 0.0);
   double dx = 1.0;
-  StaggeredGrid grid(nx, ny, nz, lower_corner, dx);
+  StaggeredGrid<double> grid(nx, ny, nz, lower_corner, dx);
 
   std::vector<Particle> particles;
 
@@ -882,13 +901,1334 @@ void TestPressureProjection(int argc, char** argv) {
   assert(IsZero(&grid.p()));*/
 }
 
+// Returns pressures computed on a grid storing its quantities as |T|, whose
+// PressureSolver uses |options| and |num_threads| threads, for a block of fluid
+// particles falling under gravity. |contiguous_arrays| is passed on to the
+// grid.
+template <typename T = double>
+std::vector<double> ProjectFallingBlock(const PressureSolverOptions& options,
+                                        double dt,
+                                        std::size_t num_threads = 1u,
+                                        bool contiguous_arrays = false) {
+  std::size_t nx = 9, ny = 7, nz = 8;
+  Eigen::Vector3d lower_corner(0.0, 0.0, 0.0);
+  double dx = 1.0;
+  StaggeredGrid<T> grid(nx, ny, nz, lower_corner, dx, options, num_threads,
+                        contiguous_arrays);
+
+  std::vector<Particle> particles;
+  for (double x = 1.25; x < 6.0; x += 0.5) {
+    for (double y = 1.25; y < 6.0; y += 0.5) {
+      for (double z = 1.25; z < 4.0; z += 0.5) {
+        particles.push_back(MakeParticle(x, y, z, x - 3.0, 0.0, 1.0));
+      }
+    }
+  }
+
+  grid.ParticlesToGrid(particles);
+  grid.ApplyGravity(dt);
+  assert(grid.ProjectPressure().iterations > 0u);
+
+  std::vector<double> pressures;
+  for (std::size_t i = 0; i < nx; i++) {
+    for (std::size_t j = 0; j < ny; j++) {
+      for (std::size_t k = 0; k < nz; k++) {
+        pressures.push_back(grid.p()(i, j, k));
+      }
+    }
+  }
+  return pressures;
+}
+
+void TestPreconditionedPressureProjection(int argc, char** argv) {
+  SimulationParameters params = ReadSimulationParameters(argc, argv);
+
+  PressureSolverOptions cg;
+  cg.preconditioner = NO_PRECONDITIONER;
+  std::vector<double> cg_pressures =
+      ProjectFallingBlock(cg, params.dt_seconds());
+
+  PressureSolverOptions mic0;
+  mic0.preconditioner = MIC0;
+  std::vector<double> mic0_pressures =
+      ProjectFallingBlock(mic0, params.dt_seconds());
+
+  PressureSolverOptions mgpcg;
+  mgpcg.preconditioner = MULTIGRID;
+  std::vector<double> mgpcg_pressures =
+      ProjectFallingBlock(mgpcg, params.dt_seconds());
+
+  PressureSolverOptions multigrid;
+  multigrid.method = MULTIGRID_V_CYCLES;
+  std::vector<double> multigrid_pressures =
+      ProjectFallingBlock(multigrid, params.dt_seconds());
+
+  // All solvers stop at the same relative residual tolerance, so they should
+  // agree on the pressures to within a small fraction of the largest pressure.
+  double max_pressure = 0.0;
+  for (std::size_t n = 0; n < cg_pressures.size(); n++) {
+    max_pressure = std::max(max_pressure, std::abs(cg_pressures[n]));
+  }
+  assert(max_pressure > kFloatZero);
+  for (std::size_t n = 0; n < cg_pressures.size(); n++) {
+    assert(std::abs(cg_pressures[n] - mic0_pressures[n]) <
+           1.0e-2 * max_pressure);
+    assert(std::abs(cg_pressures[n] - mgpcg_pressures[n]) <
+           1.0e-2 * max_pressure);
+    assert(std::abs(cg_pressures[n] - multigrid_pressures[n]) <
+           1.0e-2 * max_pressure);
+  }
+}
+
+void TestMultithreadedPressureProjection(int argc, char** argv) {
+  SimulationParameters params = ReadSimulationParameters(argc, argv);
+
+  PressureSolverOptions cg;
+  std::vector<double> one_thread_pressures =
+      ProjectFallingBlock(cg, params.dt_seconds(), 1u);
+
+  // Results must match bit-for-bit regardless of the number of threads.
+  for (std::size_t num_threads = 2; num_threads <= 4; num_threads++) {
+    std::vector<double> pressures =
+        ProjectFallingBlock(cg, params.dt_seconds(), num_threads);
+    assert(pressures == one_thread_pressures);
+  }
+}
+
+// Returns whether |a1| and |a2| have the same dimensions and exactly the same
+// elements.
+template <typename T>
+bool ExactlyEqual(const Array3D<T>& a1, const Array3D<T>& a2) {
+  if (a1.nx() != a2.nx() || a1.ny() != a2.ny() || a1.nz() != a2.nz()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < a1.nx(); i++) {
+    for (std::size_t j = 0; j < a1.ny(); j++) {
+      for (std::size_t k = 0; k < a1.nz(); k++) {
+        if (!(a1(i, j, k) == a2(i, j, k))) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+void TestMultithreadedParticlesToGrid() {
+  std::size_t nx = 11, ny = 6, nz = 7;
+  Eigen::Vector3d lower_corner(-1.0, 2.0, 0.5);
+  double dx = 0.5;
+
+  // Randomly placed particles, in random order, so that the slabs each thread
+  // splats onto share many grid points with their neighbors.
+  std::mt19937 generator(7u);
+  std::uniform_real_distribution<double> x(1.0, nx - 1.0);
+  std::uniform_real_distribution<double> y(1.0, ny - 1.0);
+  std::uniform_real_distribution<double> z(1.0, nz - 1.0);
+  std::uniform_real_distribution<double> velocity(-1.0, 1.0);
+  std::vector<Particle> particles;
+  for (std::size_t n = 0; n < 2000; n++) {
+    Eigen::Vector3d pos = lower_corner + dx * Make3d(x(generator),
+                                                     y(generator),
+                                                     z(generator));
+    particles.push_back(MakeParticle(pos[0], pos[1], pos[2],
+                                     velocity(generator), velocity(generator),
+                                     velocity(generator)));
+  }
+
+  StaggeredGrid<double> one_thread_grid(nx, ny, nz, lower_corner, dx);
+  one_thread_grid.ParticlesToGrid(particles);
+
+  // Grid velocities and labels must match bit-for-bit regardless of the number
+  // of threads, including more threads than the slabs can be split among.
+  for (std::size_t num_threads = 2; num_threads <= 8; num_threads++) {
+    StaggeredGrid<double> grid(nx, ny, nz, lower_corner, dx,
+                               PressureSolverOptions(), num_threads);
+    grid.ParticlesToGrid(particles);
+    assert(ExactlyEqual(grid.u(), one_thread_grid.u()));
+    assert(ExactlyEqual(grid.v(), one_thread_grid.v()));
+    assert(ExactlyEqual(grid.w(), one_thread_grid.w()));
+    assert(ExactlyEqual(grid.cell_labels(), one_thread_grid.cell_labels()));
+  }
+}
+
+void TestParticleSorter() {
+  std::size_t nx = 5, ny = 4, nz = 3;
+  Eigen::Vector3d lower_corner(1.0, -2.0, 0.0);
+  double dx = 0.25;
+  ParticleSorter sorter(nx, ny, nz, lower_corner, dx);
+
+  // Random particles in the non-SOLID cells, numbered by their x velocity to
+  // check the sort is stable.
+  std::mt19937 generator(3u);
+  std::uniform_real_distribution<double> x(dx, (nx - 1) * dx);
+  std::uniform_real_distribution<double> y(dx, (ny - 1) * dx);
+  std::uniform_real_distribution<double> z(dx, (nz - 1) * dx);
+  std::vector<Particle> unsorted;
+  for (std::size_t n = 0; n < 500; n++) {
+    Eigen::Vector3d pos = lower_corner + Make3d(x(generator), y(generator),
+                                                z(generator));
+    unsorted.push_back(MakeParticle(pos[0], pos[1], pos[2], n, 0.0, 0.0));
+  }
+  ParticleSet<double> particles(unsorted);
+  assert(sorter.Disorder(particles) > 0.25);
+
+  StaggeredGrid<double> unsorted_grid(nx, ny, nz, lower_corner, dx);
+  unsorted_grid.ParticlesToGrid(unsorted);
+
+  sorter.Sort(&particles);
+  assert(particles.size() == unsorted.size());
+  assert(sorter.Disorder(particles) == 0.0);
+
+  // Every cell's particles are where the cell start table says, in their
+  // original order.
+  std::size_t num_cells = nx * ny * nz;
+  assert(sorter.cell_start(0) == 0u);
+  assert(sorter.cell_start(num_cells) == particles.size());
+  for (std::size_t cell = 0; cell < num_cells; cell++) {
+    for (std::size_t n = sorter.cell_start(cell);
+         n < sorter.cell_start(cell + 1); n++) {
+      assert(sorter.CellIndex(particles.position(n)) == cell);
+      if (n > sorter.cell_start(cell)) {
+        assert(particles.vx()[n - 1] < particles.vx()[n]);
+      }
+    }
+  }
+
+  // Sorting only changes the order in which grid velocities are summed.
+  StaggeredGrid<double> grid(nx, ny, nz, lower_corner, dx);
+  grid.ParticlesToGrid(particles);
+  assert(ExactlyEqual(grid.cell_labels(), unsorted_grid.cell_labels()));
+  for (std::size_t i = 0; i <= nx; i++) {
+    for (std::size_t j = 0; j < ny; j++) {
+      for (std::size_t k = 0; k < nz; k++) {
+        assert(std::abs(grid.u()(i, j, k) - unsorted_grid.u()(i, j, k)) <
+               1.0e-9 * particles.size());
+      }
+    }
+  }
+
+  // A schedule sorts on every |interval|-th step; a disorder threshold sorts
+  // once the particles have mixed.
+  ParticleSortOptions every_third;
+  every_third.interval = 3;
+  assert(sorter.ShouldSort(every_third, 0u, particles));
+  assert(!sorter.ShouldSort(every_third, 4u, particles));
+  assert(sorter.ShouldSort(every_third, 6u, particles));
+  ParticleSortOptions disordered;
+  disordered.disorder_threshold = 0.1;
+  assert(!sorter.ShouldSort(disordered, 1u, particles));
+  assert(sorter.ShouldSort(disordered, 1u, ParticleSet<double>(unsorted)));
+  assert(!sorter.ShouldSort(ParticleSortOptions(), 0u,
+                            ParticleSet<double>(unsorted)));
+}
+
+// Checks that the batched particle transfers of grids with |num_threads|
+// threads and |advection_options|, on a ParticleSet of |P|, separate or fused,
+// match the transfers of one particle at a time, to within the precision of
+// |P|.
+template <typename P>
+void CheckParticleSetTransfers(std::size_t num_threads, double tolerance,
+                               const AdvectionOptions& advection_options =
+                                   AdvectionOptions()) {
+  std::size_t nx = 8, ny = 6, nz = 7;
+  Eigen::Vector3d lower_corner(0.5, 0.0, -1.0);
+  double dx = 0.5;
+  double dt = 0.05;
+  double flip_ratio = 0.95;
+
+  std::mt19937 generator(11u);
+  std::uniform_real_distribution<double> x(1.0, nx - 1.0);
+  std::uniform_real_distribution<double> y(1.0, ny - 1.0);
+  std::uniform_real_distribution<double> z(1.0, nz - 1.0);
+  std::uniform_real_distribution<double> velocity(-1.0, 1.0);
+  std::vector<Particle> particles;
+  for (std::size_t n = 0; n < 300; n++) {
+    Eigen::Vector3d pos = lower_corner + dx * Make3d(x(generator),
+                                                     y(generator),
+                                                     z(generator));
+    particles.push_back(MakeParticle(pos[0], pos[1], pos[2],
+                                     velocity(generator), velocity(generator),
+                                     velocity(generator)));
+  }
+  ParticleSet<P> particle_set(particles);
+  ParticleSet<P> fused_set(particles);
+
+  // One particle at a time, as the simulator used to step
+  StaggeredGrid<double> grid(nx, ny, nz, lower_corner, dx,
+                             PressureSolverOptions(), 1u, false,
+                             advection_options);
+  grid.ParticlesToGrid(particles);
+  grid.ApplyGravity(dt);
+  grid.ProjectPressure();
+  for (Particle& particle : particles) {
+    particle.vel = grid.GridToParticle(flip_ratio, particle);
+  }
+  for (Particle& particle : particles) {
+    particle.pos = grid.Advect(particle.pos, dt);
+  }
+
+  // The whole set at once
+  StaggeredGrid<double> batch_grid(nx, ny, nz, lower_corner, dx,
+                                   PressureSolverOptions(), num_threads, false,
+                                   advection_options);
+  batch_grid.ParticlesToGrid(particle_set);
+  batch_grid.ApplyGravity(dt);
+  batch_grid.ProjectPressure();
+  batch_grid.GridToParticles(flip_ratio, &particle_set);
+  batch_grid.AdvectParticles(dt, &particle_set);
+  batch_grid.GridToParticlesAndAdvect(flip_ratio, dt, &fused_set);
+
+  assert(particle_set.size() == particles.size());
+  assert(fused_set.size() == particles.size());
+  for (std::size_t n = 0; n < particles.size(); n++) {
+    Particle particle = particle_set.Get(n);
+    assert((particle.pos - particles[n].pos).norm() <= tolerance);
+    assert((particle.vel - particles[n].vel).norm() <= tolerance);
+    Particle fused = fused_set.Get(n);
+    assert((fused.pos - particles[n].pos).norm() <= tolerance);
+    assert((fused.vel - particles[n].vel).norm() <= tolerance);
+  }
+}
+
+void TestParticleSetTransfers() {
+  // Double coordinates give the same results as single particles, bit for bit,
+  // on any number of threads.
+  CheckParticleSetTransfers<double>(1u, 0.0);
+  CheckParticleSetTransfers<double>(3u, 0.0);
+
+  // Float coordinates round every position and velocity.
+  CheckParticleSetTransfers<float>(1u, 1.0e-5);
+  CheckParticleSetTransfers<float>(3u, 1.0e-5);
+
+  // So do higher-order schemes with substeps.
+  AdvectionOptions substepped_rk3;
+  substepped_rk3.scheme = RK3;
+  substepped_rk3.max_cfl = 0.05;
+  CheckParticleSetTransfers<double>(3u, 0.0, substepped_rk3);
+}
+
+// Returns a grid of |n| x |n| x |n| unit cells, with advection options
+// |advection_options|, whose velocities rotate about the line x = y = n / 2 at
+// one radian per second. The particles splatted onto it are spaced half a cell
+// apart, symmetrically about every grid velocity, so away from the walls the
+// grid velocities match the rotation to rounding.
+std::unique_ptr<StaggeredGrid<double>> MakeRotatingGrid(
+    std::size_t n, const AdvectionOptions& advection_options) {
+  const double center = 0.5 * n;
+  std::vector<Particle> particles;
+  for (std::size_t a = 1; a < 2 * n; a++) {
+    for (std::size_t b = 1; b < 2 * n; b++) {
+      for (std::size_t c = 1; c < 2 * n; c++) {
+        double x = 0.5 * a, y = 0.5 * b, z = 0.5 * c;
+        particles.push_back(
+            MakeParticle(x, y, z, center - y, x - center, 0.0));
+      }
+    }
+  }
+
+  std::unique_ptr<StaggeredGrid<double>> grid(new StaggeredGrid<double>(
+      n, n, n, Eigen::Vector3d::Zero(), 1.0, PressureSolverOptions(), 1u,
+      false, advection_options));
+  grid->ParticlesToGrid(particles);
+  return grid;
+}
+
+// Returns the largest magnitude of the elements of |arr|.
+double MaxAbs(const Array3D<double>& arr) {
+  double max_abs = 0.0;
+  for (std::size_t i = 0; i < arr.nx(); i++) {
+    for (std::size_t j = 0; j < arr.ny(); j++) {
+      for (std::size_t k = 0; k < arr.nz(); k++) {
+        max_abs = std::max(max_abs, std::fabs(arr(i, j, k)));
+      }
+    }
+  }
+  return max_abs;
+}
+
+void TestAdvectionSchemes() {
+  const std::size_t n = 10;
+  const double kPi = std::acos(-1.0);
+
+  // A quarter turn in eight steps takes a particle two cells from the axis
+  // along x to two cells from it along y. Each scheme's order lowers the
+  // error.
+  const AdvectionScheme kSchemes[] = {FORWARD_EULER, RK2, RK3};
+  const Eigen::Vector3d start = Make3d(7.0, 5.0, 5.25);
+  const Eigen::Vector3d end = Make3d(5.0, 7.0, 5.25);
+  double errors[3];
+  for (std::size_t s = 0; s < 3; s++) {
+    AdvectionOptions options;
+    options.scheme = kSchemes[s];
+    std::unique_ptr<StaggeredGrid<double>> grid = MakeRotatingGrid(n, options);
+    ParticleSet<double> particles;
+    particles.resize(1);
+    particles.set_position(0, start);
+    particles.set_velocity(0, Eigen::Vector3d::Zero());
+    for (std::size_t step = 0; step < 8; step++) {
+      grid->AdvectParticles(kPi / 16.0, &particles);
+    }
+    errors[s] = (particles.position(0) - end).norm();
+  }
+  assert(errors[0] > 0.1);
+  assert(errors[1] < 0.1 * errors[0]);
+  assert(errors[2] < 0.1 * errors[1]);
+
+  // A CFL limit splits one long step into equal substeps, as many as keep the
+  // fastest grid velocity within |max_cfl| cells of each.
+  AdvectionOptions substepped;
+  substepped.max_cfl = 0.5;
+  std::unique_ptr<StaggeredGrid<double>> grid =
+      MakeRotatingGrid(n, substepped);
+  std::unique_ptr<StaggeredGrid<double>> one_step_grid =
+      MakeRotatingGrid(n, AdvectionOptions());
+  const double dt = kPi / 2.0;
+  double max_u = MaxAbs(grid->u()), max_v = MaxAbs(grid->v()),
+         max_w = MaxAbs(grid->w());
+  double max_speed = std::sqrt(max_u * max_u + max_v * max_v + max_w * max_w);
+  std::size_t num_substeps =
+      static_cast<std::size_t>(std::ceil(max_speed * dt / 0.5));
+  assert(num_substeps > 1);
+
+  ParticleSet<double> particles;
+  particles.resize(1);
+  particles.set_position(0, start);
+  particles.set_velocity(0, Eigen::Vector3d::Zero());
+  grid->AdvectParticles(dt, &particles);
+  Eigen::Vector3d substepped_pos = start;
+  for (std::size_t substep = 0; substep < num_substeps; substep++) {
+    substepped_pos = one_step_grid->Advect(substepped_pos, dt / num_substeps);
+  }
+  assert(particles.position(0) == substepped_pos);
+  assert((substepped_pos - end).norm() <
+         (one_step_grid->Advect(start, dt) - end).norm());
+}
+
+void TestTimeStepper() {
+  const double kFrameSeconds = 1.0 / 30.0;
+  const double dx = 0.01;
+
+  // A fixed time step writes frames exactly when the simulator's original
+  // countdown did.
+  TimeStepper fixed(0.0011, 0.2, dx, TimeStepOptions(), kFrameSeconds);
+  std::size_t steps = 0;
+  for (double time = 0.0, frame_time = -1.0; time < 0.2;
+       time += 0.0011, frame_time -= 0.0011, steps++) {
+    assert(!fixed.Done());
+    assert(fixed.time() == time);
+    assert(fixed.FrameDue() == (frame_time < 0.0));
+    if (frame_time < 0.0) {
+      fixed.FrameWritten();
+      frame_time = kFrameSeconds - 0.0001;
+    }
+    fixed.ChooseStep(1000.0);
+    assert(fixed.dt() == 0.0011);
+    fixed.Advance();
+  }
+  assert(fixed.Done());
+  assert(fixed.step() == steps);
+
+  // Adaptive time steps keep the grid's top speed within |cfl| cells per step,
+  // between |min_dt| and |max_dt|, then shorten to fit a whole number of them
+  // in the frame.
+  TimeStepOptions options;
+  options.cfl = 1.0;
+  options.min_dt = 0.001;
+  options.max_dt = 0.02;
+  TimeStepper adaptive(0.0011, 1.0, dx, options, kFrameSeconds);
+  adaptive.FrameWritten();
+  adaptive.ChooseStep(0.0);
+  assert(adaptive.dt() == kFrameSeconds / 2.0);
+  adaptive.ChooseStep(100.0);
+  assert(adaptive.dt() == kFrameSeconds / 34.0);
+
+  // At 0.8 m/s, steps of 1/80 s would overshoot a frame in the third step, so
+  // each frame takes three even steps, the last landing exactly on the frame
+  // boundary.
+  std::size_t frames = 1;
+  while (!adaptive.Done()) {
+    if (adaptive.FrameDue()) {
+      assert(adaptive.time() == frames * kFrameSeconds);
+      adaptive.FrameWritten();
+      frames++;
+    }
+    adaptive.ChooseStep(0.8);
+    assert(adaptive.dt() <= 1.0 / 80.0);
+    adaptive.Advance();
+  }
+  assert(adaptive.time() == 1.0);
+  assert(adaptive.steps_per_frame().size() == 1);
+  assert(adaptive.steps_per_frame().at(3) == frames - 1);
+  assert(frames == 30);
+}
+
+// Checks that a binary particle frame of |particles| storing coordinates as
+// |T| reads back exactly, with its header filled in.
+template <typename T>
+void CheckBinaryParticleFrame(const std::vector<Particle>& particles) {
+  const std::string kFileName = "outputs/binary_frame_test.part";
+  ParticleSet<T> written(particles);
+  WriteBinaryParticleFrame(kFileName, written, 0.25);
+  assert(IsBinaryParticleFrame(kFileName));
+
+  ParticleFrameHeader header;
+  ParticleSet<T> read;
+  ReadBinaryParticleFrame(kFileName, &header, &read);
+  std::remove(kFileName.c_str());
+  assert(header.version == kParticleFrameVersion);
+  assert(header.scalar_bytes == sizeof(T));
+  assert(header.num_particles == particles.size());
+  assert(header.time == 0.25);
+  assert(read.size() == written.size());
+  for (std::size_t n = 0; n < read.size(); n++) {
+    assert(read.position(n) == written.position(n));
+    assert(read.velocity(n) == written.velocity(n));
+    for (std::size_t d = 0; d < 3; d++) {
+      assert(header.lower[d] <= read.position(n)[d]);
+      assert(read.position(n)[d] <= header.upper[d]);
+    }
+  }
+}
+
+void TestParticleFrames() {
+  std::mt19937 generator(5u);
+  std::uniform_real_distribution<double> coordinate(-2.0, 2.0);
+  std::vector<Particle> particles;
+  for (std::size_t n = 0; n < 100; n++) {
+    particles.push_back(MakeParticle(
+        coordinate(generator), coordinate(generator), coordinate(generator),
+        coordinate(generator), coordinate(generator), coordinate(generator)));
+  }
+
+  // Binary frames hold the coordinates exactly, as float or double.
+  CheckBinaryParticleFrame<double>(particles);
+  CheckBinaryParticleFrame<float>(particles);
+
+  // Text frames round them to six significant digits, and read back with
+  // ReadParticles.
+  const std::string kFileName = "outputs/text_frame_test.part";
+  WriteTextParticleFrame(kFileName, ParticleSet<double>(particles));
+  assert(!IsBinaryParticleFrame(kFileName));
+  std::vector<Particle> read = ReadParticles(kFileName);
+  std::remove(kFileName.c_str());
+  assert(read.size() == particles.size());
+  for (std::size_t n = 0; n < read.size(); n++) {
+    assert((read[n].pos - particles[n].pos).norm() <= 1.0e-5);
+    assert((read[n].vel - particles[n].vel).norm() <= 1.0e-5);
+  }
+
+  // ReadParticles parses numbers exactly as a stream does, whatever their
+  // layout, and ReadParticleFrame(..) reads either format.
+  std::ofstream out(kFileName.c_str(), std::ios::out);
+  out << "2\n1 2 3 4 5 6\n0.1 -2e-3 +7.25\t8 9\n  1e3\n";
+  out.close();
+  read = ReadParticles(kFileName);
+  assert(read.size() == 2);
+  assert(read[0].pos == Eigen::Vector3d(1.0, 2.0, 3.0));
+  assert(read[0].vel == Eigen::Vector3d(4.0, 5.0, 6.0));
+  assert(read[1].pos == Eigen::Vector3d(0.1, -2e-3, 7.25));
+  assert(read[1].vel == Eigen::Vector3d(8.0, 9.0, 1e3));
+  ParticleSet<float> text_set;
+  ReadParticleFrame(kFileName, &text_set);
+  WriteBinaryParticleFrame(kFileName, ParticleSet<double>(read), 0.0);
+  ParticleSet<float> binary_set;
+  ReadParticleFrame(kFileName, &binary_set);
+  std::remove(kFileName.c_str());
+  assert(text_set.size() == 2 && binary_set.size() == 2);
+  for (std::size_t n = 0; n < text_set.size(); n++) {
+    assert(text_set.position(n) == binary_set.position(n));
+    assert(text_set.velocity(n) == binary_set.velocity(n));
+  }
+}
+
+void TestParticleEmitters() {
+  const std::size_t nx = 10, ny = 8, nz = 8;
+  const Eigen::Vector3d lower_corner(-1.0, 0.0, 0.5);
+  const double dx = 0.5;
+  ThreadPool one_thread(1u), three_threads(3u);
+
+  // Without jitter, a box gets a particle at the center of each subcell of the
+  // cells it covers, clipped to the cells inside the SOLID boundary.
+  ParticleEmitter box;
+  box.lower = lower_corner;
+  box.upper = lower_corner + Eigen::Vector3d(2.0, 1.0, 100.0);
+  box.velocity = Eigen::Vector3d(1.0, -2.0, 3.0);
+  box.jitter = 0.0;
+  ParticleSet<double> particles;
+  particles.resize(1);
+  particles.set_position(0, Eigen::Vector3d(7.0, 7.0, 7.0));
+  EmitParticles(std::vector<ParticleEmitter>(1, box), 0u, nx, ny, nz,
+                lower_corner, dx, &one_thread, &particles);
+  // Cells 1 to 3 along x, 1 along y, and 1 to 6 along z
+  assert(particles.size() == 1 + 3 * 1 * 6 * 8);
+  assert(particles.position(0) == Eigen::Vector3d(7.0, 7.0, 7.0));
+  assert(particles.position(1) ==
+         lower_corner + Eigen::Vector3d(0.625, 0.625, 0.625));
+  assert(particles.position(2) ==
+         lower_corner + Eigen::Vector3d(0.625, 0.625, 0.875));
+  for (std::size_t n = 1; n < particles.size(); n++) {
+    assert(particles.velocity(n) == box.velocity);
+  }
+
+  // With jitter, the particles depend only on the seed, whatever the number
+  // of threads, and each stays in its subcell.
+  ParticleEmitter sphere;
+  sphere.shape = SPHERE_EMITTER;
+  sphere.center = lower_corner + Eigen::Vector3d(2.5, 2.2, 2.0);
+  sphere.radius = 1.2;
+  sphere.particles_per_cell = 27;
+  std::vector<ParticleEmitter> emitters(1, sphere);
+  emitters.push_back(box);
+  emitters.back().jitter = 1.0;
+  ParticleSet<double> jittered, threaded, reseeded;
+  EmitParticles(emitters, 7u, nx, ny, nz, lower_corner, dx, &one_thread,
+                &jittered);
+  EmitParticles(emitters, 7u, nx, ny, nz, lower_corner, dx, &three_threads,
+                &threaded);
+  EmitParticles(emitters, 8u, nx, ny, nz, lower_corner, dx, &one_thread,
+                &reseeded);
+  assert(jittered.size() == threaded.size());
+  bool reseeding_moved_particles = jittered.size() != reseeded.size();
+  for (std::size_t n = 0; n < jittered.size(); n++) {
+    assert(jittered.position(n) == threaded.position(n));
+    if (n < reseeded.size() && jittered.position(n) != reseeded.position(n)) {
+      reseeding_moved_particles = true;
+    }
+  }
+  assert(reseeding_moved_particles);
+
+  // The sphere gets about 27 particles per cell of its volume.
+  std::size_t num_sphere_particles = 0;
+  for (std::size_t n = 0; n < jittered.size(); n++) {
+    if ((jittered.position(n) - sphere.center).norm() < sphere.radius) {
+      num_sphere_particles++;
+    }
+  }
+  const double kSphereCells = 4.0 / 3.0 * M_PI * std::pow(1.2 / dx, 3);
+  assert(std::abs(num_sphere_particles - 27.0 * kSphereCells) <
+         0.05 * 27.0 * kSphereCells);
+  assert(jittered.size() - num_sphere_particles == 3 * 1 * 6 * 8);
+}
+
+void TestFrameWriter() {
+  std::mt19937 generator(6u);
+  std::uniform_real_distribution<double> coordinate(-2.0, 2.0);
+  std::vector<Particle> particles;
+  for (std::size_t n = 0; n < 1000; n++) {
+    particles.push_back(MakeParticle(
+        coordinate(generator), coordinate(generator), coordinate(generator),
+        coordinate(generator), coordinate(generator), coordinate(generator)));
+  }
+
+  // More frames than buffers, each changed right after it is passed to the
+  // writer, are written as they were when passed.
+  const std::size_t kNumFrames = 5;
+  std::vector<ParticleSet<double>> frames;
+  ParticleSet<double> particle_set(particles);
+  FrameWriter<double> writer(BINARY_OUTPUT, true, 2u);
+  for (std::size_t frame = 0; frame < kNumFrames; frame++) {
+    frames.push_back(particle_set);
+    writer.Write("outputs/frame_writer_test." + std::to_string(frame) +
+                     ".part",
+                 particle_set, 0.1 * frame);
+    for (std::size_t n = 0; n < particle_set.size(); n++) {
+      particle_set.set_position(n, particle_set.position(n) * 0.5);
+    }
+  }
+  writer.Finish();
+  assert(writer.num_frames() == kNumFrames);
+
+  for (std::size_t frame = 0; frame < kNumFrames; frame++) {
+    const std::string file_name =
+        "outputs/frame_writer_test." + std::to_string(frame) + ".part";
+    ParticleFrameHeader header;
+    ParticleSet<double> read;
+    ReadBinaryParticleFrame(file_name, &header, &read);
+    std::remove(file_name.c_str());
+    assert(header.time == 0.1 * frame);
+    assert(read.size() == frames[frame].size());
+    for (std::size_t n = 0; n < read.size(); n++) {
+      assert(read.position(n) == frames[frame].position(n));
+      assert(read.velocity(n) == frames[frame].velocity(n));
+    }
+  }
+}
+
+void TestCompactPressureProjection(int argc, char** argv) {
+  SimulationParameters params = ReadSimulationParameters(argc, argv);
+
+  const PreconditionerType kPreconditioners[] = {NO_PRECONDITIONER, MIC0,
+                                                 MULTIGRID};
+  for (PreconditionerType preconditioner : kPreconditioners) {
+    PressureSolverOptions dense;
+    dense.preconditioner = preconditioner;
+    std::vector<double> dense_pressures =
+        ProjectFallingBlock(dense, params.dt_seconds());
+
+    PressureSolverOptions compact = dense;
+    compact.compact_fluid_cells = true;
+    std::vector<double> compact_pressures =
+        ProjectFallingBlock(compact, params.dt_seconds());
+
+    // Packing only changes the order in which dot products are summed.
+    double max_pressure = 0.0;
+    for (std::size_t n = 0; n < dense_pressures.size(); n++) {
+      max_pressure = std::max(max_pressure, std::abs(dense_pressures[n]));
+    }
+    for (std::size_t n = 0; n < dense_pressures.size(); n++) {
+      assert(std::abs(dense_pressures[n] - compact_pressures[n]) <
+             1.0e-9 * max_pressure);
+    }
+
+    // Packed results must not depend on the number of threads either.
+    assert(ProjectFallingBlock(compact, params.dt_seconds(), 3u) ==
+           compact_pressures);
+  }
+}
+
+// Checks that carving a grid's arrays from one arena doesn't change its
+// results, for every solver configuration that allocates arrays of its own.
+void TestContiguousGridArrays(int argc, char** argv) {
+  SimulationParameters params = ReadSimulationParameters(argc, argv);
+
+  PressureSolverOptions mic0;
+  mic0.preconditioner = MIC0;
+  PressureSolverOptions warm = mic0;
+  warm.warm_start = true;
+  PressureSolverOptions vectorized = mic0;
+  vectorized.vectorized_stencil = true;
+  const PressureSolverOptions kOptions[] = {mic0, warm, vectorized};
+
+  for (const PressureSolverOptions& options : kOptions) {
+    assert(ProjectFallingBlock(options, params.dt_seconds(), 1u, true) ==
+           ProjectFallingBlock(options, params.dt_seconds(), 1u, false));
+    assert(ProjectFallingBlock<float>(options, params.dt_seconds(), 1u,
+                                      true) ==
+           ProjectFallingBlock<float>(options, params.dt_seconds(), 1u, false));
+  }
+}
+
+void TestSinglePrecisionPressureProjection(int argc, char** argv) {
+  SimulationParameters params = ReadSimulationParameters(argc, argv);
+
+  const PreconditionerType kPreconditioners[] = {NO_PRECONDITIONER, MIC0,
+                                                 MULTIGRID};
+  for (PreconditionerType preconditioner : kPreconditioners) {
+    for (bool compact : {false, true}) {
+      PressureSolverOptions options;
+      options.preconditioner = preconditioner;
+      options.compact_fluid_cells = compact;
+      std::vector<double> double_pressures =
+          ProjectFallingBlock<double>(options, params.dt_seconds());
+      std::vector<double> float_pressures =
+          ProjectFallingBlock<float>(options, params.dt_seconds());
+
+      // Float storage rounds every stored value, but the dot products are
+      // still accumulated in double, so the solve converges to the same
+      // tolerance.
+      double max_pressure = 0.0;
+      for (std::size_t n = 0; n < double_pressures.size(); n++) {
+        max_pressure = std::max(max_pressure, std::abs(double_pressures[n]));
+      }
+      assert(max_pressure > kFloatZero);
+      for (std::size_t n = 0; n < double_pressures.size(); n++) {
+        assert(std::abs(double_pressures[n] - float_pressures[n]) <
+               1.0e-2 * max_pressure);
+      }
+    }
+  }
+}
+
+// Returns the total number of pressure solve iterations over |num_steps| time
+// steps of a block of particles falling in a grid whose PressureSolver uses
+// |options|, and sets |*pressures| to the pressures of the last step.
+std::size_t ProjectFallingBlockSteps(const PressureSolverOptions& options,
+                                     double dt, std::size_t num_steps,
+                                     std::vector<double>* pressures) {
+  std::size_t nx = 9, ny = 7, nz = 8;
+  Eigen::Vector3d lower_corner(0.0, 0.0, 0.0);
+  StaggeredGrid<double> grid(nx, ny, nz, lower_corner, 1.0, options);
+
+  std::vector<Particle> particles;
+  for (double x = 1.25; x < 6.0; x += 0.5) {
+    for (double y = 1.25; y < 6.0; y += 0.5) {
+      for (double z = 1.25; z < 4.0; z += 0.5) {
+        particles.push_back(MakeParticle(x, y, z, x - 3.0, 0.0, 1.0));
+      }
+    }
+  }
+
+  std::size_t total_iterations = 0;
+  grid.ParticlesToGrid(particles);
+  for (std::size_t step = 0; step < num_steps; step++) {
+    for (Particle& particle : particles) {
+      particle.pos = grid.Advect(particle.pos, dt);
+    }
+    grid.ParticlesToGrid(particles);
+    grid.ApplyGravity(dt);
+    total_iterations += grid.ProjectPressure().iterations;
+    for (Particle& particle : particles) {
+      particle.vel = grid.GridToParticle(0.95, particle);
+    }
+  }
+
+  pressures->clear();
+  for (std::size_t i = 0; i < nx; i++) {
+    for (std::size_t j = 0; j < ny; j++) {
+      for (std::size_t k = 0; k < nz; k++) {
+        pressures->push_back(grid.p()(i, j, k));
+      }
+    }
+  }
+  return total_iterations;
+}
+
+void TestWarmStartedPressureProjection(int argc, char** argv) {
+  SimulationParameters params = ReadSimulationParameters(argc, argv);
+  const std::size_t kNumSteps = 10;
+
+  for (bool compact : {false, true}) {
+    PressureSolverOptions cold;
+    cold.preconditioner = MIC0;
+    cold.compact_fluid_cells = compact;
+    std::vector<double> cold_pressures;
+    std::size_t cold_iterations = ProjectFallingBlockSteps(
+        cold, params.dt_seconds(), kNumSteps, &cold_pressures);
+
+    PressureSolverOptions warm = cold;
+    warm.warm_start = true;
+    std::vector<double> warm_pressures;
+    std::size_t warm_iterations = ProjectFallingBlockSteps(
+        warm, params.dt_seconds(), kNumSteps, &warm_pressures);
+
+    // A warm start converges to the same tolerance in fewer iterations.
+    assert(warm_iterations < cold_iterations);
+    double max_pressure = 0.0;
+    for (std::size_t n = 0; n < cold_pressures.size(); n++) {
+      max_pressure = std::max(max_pressure, std::abs(cold_pressures[n]));
+    }
+    assert(max_pressure > kFloatZero);
+    for (std::size_t n = 0; n < cold_pressures.size(); n++) {
+      assert(std::abs(cold_pressures[n] - warm_pressures[n]) <
+             1.0e-2 * max_pressure);
+    }
+  }
+}
+
+void TestPressureSolveStats(int argc, char** argv) {
+  SimulationParameters params = ReadSimulationParameters(argc, argv);
+  std::size_t nx = 9, ny = 7, nz = 8;
+  Eigen::Vector3d lower_corner(0.0, 0.0, 0.0);
+
+  std::vector<Particle> particles;
+  for (double x = 1.25; x < 6.0; x += 0.5) {
+    for (double y = 1.25; y < 6.0; y += 0.5) {
+      for (double z = 1.25; z < 4.0; z += 0.5) {
+        particles.push_back(MakeParticle(x, y, z, x - 3.0, 0.0, 1.0));
+      }
+    }
+  }
+
+  // Whichever way the equation is solved, the stats describe the same
+  // converged solve of the same cells.
+  PressureSolverOptions cg, compact, multigrid;
+  compact.preconditioner = MIC0;
+  compact.compact_fluid_cells = true;
+  multigrid.method = MULTIGRID_V_CYCLES;
+  for (const PressureSolverOptions& options : {cg, compact, multigrid}) {
+    StaggeredGrid<double> grid(nx, ny, nz, lower_corner, 1.0, options);
+    grid.ParticlesToGrid(particles);
+    grid.ApplyGravity(params.dt_seconds());
+    PressureSolveStats stats = grid.ProjectPressure();
+
+    std::size_t num_fluid_cells = 0;
+    for (std::size_t i = 0; i < nx; i++) {
+      for (std::size_t j = 0; j < ny; j++) {
+        for (std::size_t k = 0; k < nz; k++) {
+          num_fluid_cells += grid.cell_labels()(i, j, k) == FLUID ? 1 : 0;
+        }
+      }
+    }
+    assert(stats.num_fluid_cells == num_fluid_cells);
+    assert(stats.iterations > 0u);
+    assert(stats.converged);
+    assert(stats.rhs_norm > 0.0);
+    assert(stats.initial_residual_norm == stats.rhs_norm);
+    assert(std::abs(stats.tolerance - 1.0e-6 * stats.rhs_norm) <
+           1.0e-12 * stats.rhs_norm);
+    assert(stats.final_residual_norm <= stats.tolerance);
+    assert(stats.seconds >= 0.0);
+  }
+
+  // The log file has a line of column names, then a line per solve, written
+  // as soon as the solve is added.
+  const std::string kFileName = "outputs/solver_stats_test.csv";
+  PressureSolveStats stats;
+  stats.iterations = 12;
+  stats.rhs_norm = 4.0;
+  stats.initial_residual_norm = 4.0;
+  stats.final_residual_norm = 2.0e-6;
+  stats.tolerance = 4.0e-6;
+  stats.num_fluid_cells = 30;
+  PressureSolveStats unconverged = stats;
+  unconverged.iterations = 1000;
+  unconverged.converged = false;
+  unconverged.final_residual_norm = 1.0e-3;
+  std::vector<std::string> lines;
+  {
+    PressureSolveLog log(kFileName, false);
+    log.Add(0, 0.0, stats);
+    log.Add(1, 0.125, unconverged);
+    assert(log.num_solves() == 2);
+    assert(log.num_unconverged() == 1);
+
+    std::ifstream in(kFileName.c_str(), std::ios::in);
+    for (std::string line; std::getline(in, line);) {
+      lines.push_back(line);
+    }
+  }
+  {
+    // A resumed simulation adds to the lines already there.
+    PressureSolveLog log(kFileName, true);
+    log.Add(2, 0.25, stats);
+  }
+  std::ifstream in(kFileName.c_str(), std::ios::in);
+  std::size_t num_lines = 0;
+  for (std::string line; std::getline(in, line);) {
+    num_lines++;
+  }
+  in.close();
+  std::remove(kFileName.c_str());
+  assert(lines.size() == 3);
+  assert(lines[0].compare(0, 26, "step,time,iterations,conve") == 0);
+  assert(lines[1] == "0,0,12,1,4,4,2e-06,5e-07,1e-06,30,0");
+  assert(lines[2].compare(0, 17, "1,0.125,1000,0,4,") == 0);
+  assert(num_lines == 4);
+}
+
+void TestPhaseProfiler() {
+  PhaseProfiler profiler;
+  profiler.Add(ADVECTION_PHASE, 0.25);
+  profiler.Add(ADVECTION_PHASE, 0.5);
+  profiler.Add(CHECKPOINT_PHASE, 2.0);
+  profiler.EndStep(0.0);
+  {
+    ScopedPhaseTimer timer(PRESSURE_SOLVE_PHASE, &profiler);
+    ScopedPhaseTimer untimed(PRESSURE_SOLVE_PHASE, NULL);
+  }
+  profiler.EndStep(0.125);
+  if (!kPhaseTimersEnabled) {
+    assert(profiler.num_steps() == 0);
+    return;
+  }
+
+  // Each step's phase times add up within the step and across steps.
+  assert(profiler.num_steps() == 2);
+  assert(profiler.TotalSeconds(ADVECTION_PHASE) == 0.75);
+  assert(profiler.TotalSeconds(CHECKPOINT_PHASE) == 2.0);
+  assert(profiler.TotalSeconds(PRESSURE_SOLVE_PHASE) >= 0.0);
+  assert(profiler.TotalSeconds(PRESSURE_SOLVE_PHASE) < 1.0);
+  assert(profiler.TotalSeconds(GRAVITY_PHASE) == 0.0);
+
+  // The CSV file has a line of column names, then a line per step.
+  const std::string kFileName = "outputs/phase_profiler_test.csv";
+  assert(profiler.WriteCsv(kFileName));
+  std::ifstream in(kFileName.c_str(), std::ios::in);
+  std::vector<std::string> lines;
+  for (std::string line; std::getline(in, line);) {
+    lines.push_back(line);
+  }
+  in.close();
+  std::remove(kFileName.c_str());
+  assert(lines.size() == 3);
+  assert(lines[0].compare(0, 20, "step,time,Advection,") == 0);
+  assert(lines[1].compare(0, 15, "0,0,0.75,0,0,0,") == 0);
+  assert(lines[2].compare(0, 8, "1,0.125,") == 0);
+}
+
+// Runs |num_steps| time steps of |dt| of the simulator's loop on |*grid| and
+// |*particles|.
+void StepSimulation(double dt, std::size_t num_steps,
+                    StaggeredGrid<double>* grid,
+                    ParticleSet<double>* particles) {
+  for (std::size_t step = 0; step < num_steps; step++) {
+    grid->AdvectParticles(dt, particles);
+    grid->ParticlesToGrid(*particles);
+    grid->ApplyGravity(dt);
+    grid->ProjectPressure();
+    grid->GridToParticles(0.95, particles);
+  }
+}
+
+void TestCheckpoints(int argc, char** argv) {
+  SimulationParameters params = ReadSimulationParameters(argc, argv);
+  const std::string kFileName = "outputs/checkpoint_test.bin";
+  const std::size_t kNumSteps = 5;
+  std::size_t nx = 9, ny = 7, nz = 8;
+  Eigen::Vector3d lower_corner(0.0, 0.0, 0.0);
+  PressureSolverOptions options;
+  options.preconditioner = MIC0;
+  options.warm_start = true;
+
+  std::vector<Particle> block;
+  for (double x = 1.25; x < 6.0; x += 0.5) {
+    for (double y = 1.25; y < 6.0; y += 0.5) {
+      for (double z = 1.25; z < 4.0; z += 0.5) {
+        block.push_back(MakeParticle(x, y, z, x - 3.0, 0.0, 1.0));
+      }
+    }
+  }
+  StaggeredGrid<double> grid(nx, ny, nz, lower_corner, 1.0, options);
+  ParticleSet<double> particles(block);
+  grid.ParticlesToGrid(particles);
+  StepSimulation(params.dt_seconds(), kNumSteps, &grid, &particles);
+
+  TimeStepper stepper(0.01, 1.0, 1.0, TimeStepOptions(), 1.0 / 30.0);
+  for (std::size_t step = 0; step < 10; step++) {
+    if (stepper.FrameDue()) {
+      stepper.FrameWritten();
+    }
+    stepper.ChooseStep(1.0);
+    stepper.Advance();
+  }
+
+  CheckpointWriter writer;
+  writer.WriteString(params.json_text());
+  stepper.WriteCheckpoint(&writer);
+  grid.WriteCheckpoint(&writer);
+  writer.WriteParticles(particles);
+  assert(writer.Save(kFileName));
+
+  // Restored state continues exactly as the original does.
+  CheckpointReader reader(kFileName);
+  assert(reader.ReadString() == params.json_text());
+  TimeStepper restored_stepper(0.01, 1.0, 1.0, TimeStepOptions(),
+                               1.0 / 30.0);
+  restored_stepper.ReadCheckpoint(&reader);
+  StaggeredGrid<double> restored_grid(nx, ny, nz, lower_corner, 1.0, options);
+  restored_grid.ReadCheckpoint(&reader);
+  ParticleSet<double> restored_particles;
+  reader.ReadParticles(&restored_particles);
+  reader.Finish();
+  std::remove(kFileName.c_str());
+
+  assert(restored_stepper.time() == stepper.time());
+  assert(restored_stepper.dt() == stepper.dt());
+  assert(restored_stepper.step() == stepper.step());
+  assert(restored_stepper.frame() == stepper.frame());
+  assert(restored_stepper.FrameDue() == stepper.FrameDue());
+  assert(restored_stepper.steps_per_frame() == stepper.steps_per_frame());
+
+  StepSimulation(params.dt_seconds(), kNumSteps, &grid, &particles);
+  StepSimulation(params.dt_seconds(), kNumSteps, &restored_grid,
+                 &restored_particles);
+  assert(ExactlyEqual(restored_grid.p(), grid.p()));
+  assert(ExactlyEqual(restored_grid.u(), grid.u()));
+  assert(ExactlyEqual(restored_grid.v(), grid.v()));
+  assert(ExactlyEqual(restored_grid.w(), grid.w()));
+  assert(restored_grid.pressure_solver().warm_start_residual_ratio() ==
+         grid.pressure_solver().warm_start_residual_ratio());
+  assert(restored_particles.size() == particles.size());
+  for (std::size_t n = 0; n < particles.size(); n++) {
+    assert(restored_particles.position(n) == particles.position(n));
+    assert(restored_particles.velocity(n) == particles.velocity(n));
+  }
+}
+
+// Sets |*labels| to FLUID cells mixed with a few interior SOLID and EMPTY
+// cells, inside a layer of SOLID cells.
+void MakeMixedLabels(Array3D<MaterialType>* labels) {
+  const std::size_t nx = labels->nx(), ny = labels->ny(), nz = labels->nz();
+  for (std::size_t i = 0; i < nx; i++) {
+    for (std::size_t j = 0; j < ny; j++) {
+      for (std::size_t k = 0; k < nz; k++) {
+        if (i == 0 || j == 0 || k == 0 || i == nx - 1 || j == ny - 1 ||
+            k == nz - 1 || (i + 2 * j + k) % 9 == 0) {
+          (*labels)(i, j, k) = SOLID;
+        } else {
+          (*labels)(i, j, k) = (i + j + 3 * k) % 7 == 0 ? EMPTY : FLUID;
+        }
+      }
+    }
+  }
+}
+
+// Sets the interior cells of |*d| to a pattern of direction vector values, and
+// its outer cells to zero.
+template <typename T>
+void MakeDirection(Array3D<T>* d) {
+  (*d) = 0;
+  for (std::size_t i = 1; i < d->nx() - 1; i++) {
+    for (std::size_t j = 1; j < d->ny() - 1; j++) {
+      for (std::size_t k = 1; k < d->nz() - 1; k++) {
+        (*d)(i, j, k) = 0.25 * ((i * 5 + j * 3 + k) % 13) - 1.5;
+      }
+    }
+  }
+}
+
+// Checks that relabeling only the cells particles entered or left, as a block
+// of fluid splashes, gives the same labels and pressures as relabeling every
+// cell, also across a checkpoint.
+void TestIncrementalCellLabels() {
+  const std::string kFileName = "outputs/incremental_labels_test.bin";
+  const std::size_t kNumSteps = 12;
+  const double kDt = 0.1;
+  std::size_t nx = 9, ny = 7, nz = 8;
+  Eigen::Vector3d lower_corner(0.0, 0.0, 0.0);
+
+  std::vector<Particle> block;
+  for (double x = 1.25; x < 6.0; x += 0.5) {
+    for (double y = 1.25; y < 6.0; y += 0.5) {
+      for (double z = 1.25; z < 4.0; z += 0.5) {
+        block.push_back(MakeParticle(x, y, z, 3.0 * (x - 3.0), 0.0, 1.0));
+      }
+    }
+  }
+
+  // As the block splashes, relabeling only the cells it enters and leaves
+  // gives the same labels and pressures as relabeling every cell, with the
+  // stencil in the neighbors bitmask, a PressureMatrix, or packed vectors.
+  PressureSolverOptions bitmask, matrix, compact;
+  matrix.vectorized_stencil = true;
+  compact.preconditioner = MIC0;
+  compact.compact_fluid_cells = true;
+  for (const PressureSolverOptions& options : {bitmask, matrix, compact}) {
+    for (std::size_t num_threads : {1u, 3u}) {
+      StaggeredGrid<double> grid(nx, ny, nz, lower_corner, 1.0, options,
+                                 num_threads);
+      std::unique_ptr<StaggeredGrid<double>> incremental_grid(
+          new StaggeredGrid<double>(nx, ny, nz, lower_corner, 1.0, options,
+                                    num_threads, false, AdvectionOptions(),
+                                    true));
+      ParticleSet<double> particles(block), incremental_particles(block);
+      grid.ParticlesToGrid(particles);
+      incremental_grid->ParticlesToGrid(incremental_particles);
+      for (std::size_t step = 0; step < kNumSteps; step++) {
+        StepSimulation(kDt, 1, &grid, &particles);
+        StepSimulation(kDt, 1, incremental_grid.get(), &incremental_particles);
+        assert(ExactlyEqual(incremental_grid->cell_labels(),
+                            grid.cell_labels()));
+        assert(ExactlyEqual(incremental_grid->p(), grid.p()));
+
+        // A grid restored from a checkpoint carries on from its labels.
+        if (step == kNumSteps / 2) {
+          CheckpointWriter writer;
+          incremental_grid->WriteCheckpoint(&writer);
+          assert(writer.Save(kFileName));
+          incremental_grid.reset(new StaggeredGrid<double>(
+              nx, ny, nz, lower_corner, 1.0, options, num_threads, false,
+              AdvectionOptions(), true));
+          CheckpointReader reader(kFileName);
+          incremental_grid->ReadCheckpoint(&reader);
+          reader.Finish();
+          std::remove(kFileName.c_str());
+        }
+      }
+      for (std::size_t n = 0; n < particles.size(); n++) {
+        assert(incremental_particles.position(n) == particles.position(n));
+      }
+    }
+  }
+}
+
+// Checks that sweeping only the grid velocities around the FLUID cells, as a
+// block of fluid splashes, moves the particles exactly as sweeping every grid
+// velocity does, and only leaves out gravity far from the fluid.
+void TestActiveRegionSweeps() {
+  const std::size_t kNumSteps = 12;
+  const double kDt = 0.02;
+  std::size_t nx = 12, ny = 7, nz = 10;
+  Eigen::Vector3d lower_corner(0.0, 0.0, 0.0);
+
+  std::vector<Particle> block;
+  for (double x = 1.25; x < 5.0; x += 0.5) {
+    for (double y = 1.25; y < 4.0; y += 0.5) {
+      for (double z = 1.25; z < 4.0; z += 0.5) {
+        block.push_back(MakeParticle(x, y, z, 3.0 * (x - 3.0), 0.0, 1.0));
+      }
+    }
+  }
+
+  PressureSolverOptions options;
+  options.preconditioner = MIC0;
+  for (std::size_t num_threads : {1u, 3u}) {
+    for (bool incremental_cell_labels : {false, true}) {
+      StaggeredGrid<double> grid(nx, ny, nz, lower_corner, 1.0, options,
+                                 num_threads);
+      StaggeredGrid<double> active_grid(nx, ny, nz, lower_corner, 1.0,
+                                        options, num_threads, false,
+                                        AdvectionOptions(),
+                                        incremental_cell_labels, true);
+      ParticleSet<double> particles(block), active_particles(block);
+      grid.ParticlesToGrid(particles);
+      active_grid.ParticlesToGrid(active_particles);
+      for (std::size_t step = 0; step < kNumSteps; step++) {
+        StepSimulation(kDt, 1, &grid, &particles);
+        StepSimulation(kDt, 1, &active_grid, &active_particles);
+        assert(ExactlyEqual(active_grid.u(), grid.u()));
+        assert(ExactlyEqual(active_grid.v(), grid.v()));
+        assert(ExactlyEqual(active_grid.p(), grid.p()));
+        const Array3D<MaterialType>& labels = grid.cell_labels();
+        for (std::size_t i = 0; i < nx; i++) {
+          for (std::size_t j = 0; j < ny; j++) {
+            for (std::size_t k = 0; k < nz + 1; k++) {
+              if (active_grid.w()(i, j, k) != grid.w()(i, j, k)) {
+                assert(active_grid.w()(i, j, k) == 0.0);
+                assert(labels(i, j, k - 1) != FLUID);
+                assert(labels(i, j, k) != FLUID);
+              }
+            }
+          }
+        }
+      }
+      for (std::size_t n = 0; n < particles.size(); n++) {
+        assert(active_particles.position(n) == particles.position(n));
+        assert(active_particles.velocity(n) == particles.velocity(n));
+      }
+    }
+  }
+}
+
+// Checks that each fused Conjugate Gradient kernel gives the same arrays as the
+// separate sweeps it replaces, and the same dot product up to rounding.
+void TestFusedPressureKernels() {
+  const std::size_t nx = 7, ny = 6, nz = 8;
+  ThreadPool pool(3u);
+
+  Array3D<MaterialType> labels(nx, ny, nz);
+  MakeMixedLabels(&labels);
+  Array3D<unsigned short> neighbors(nx, ny, nz);
+  MakeNeighborMaterialInfo(labels, &neighbors);
+
+  Array3D<double> d(nx, ny, nz), p(nx, ny, nz), r(nx, ny, nz);
+  MakeDirection(&d);
+  p = 0.0;
+  r = 0.0;
+  for (std::size_t i = 1; i < nx - 1; i++) {
+    for (std::size_t j = 1; j < ny - 1; j++) {
+      for (std::size_t k = 1; k < nz - 1; k++) {
+        p(i, j, k) = 0.5 * ((i + j * 7 + k * 2) % 5);
+        r(i, j, k) = 0.125 * ((i * 3 + j + k * 11) % 17) - 1.0;
+      }
+    }
+  }
+
+  Array3D<double> q(nx, ny, nz), fused_q(nx, ny, nz);
+  q = 0.0;
+  fused_q = 0.0;
+  ATimes(d, neighbors, &pool, &q);
+  double d_dot_q = ATimesAndDot(d, neighbors, &pool, &fused_q);
+  for (std::size_t i = 0; i < nx; i++) {
+    for (std::size_t j = 0; j < ny; j++) {
+      for (std::size_t k = 0; k < nz; k++) {
+        assert(fused_q(i, j, k) == q(i, j, k));
+      }
+    }
+  }
+  assert(FuzzyEquals(d_dot_q, Dot(d, q)));
+
+  const double alpha = 0.375;
+  Array3D<double> fused_p(nx, ny, nz), fused_r(nx, ny, nz);
+  fused_p.SetEqualTo(p);
+  fused_r.SetEqualTo(r);
+  p.PlusEquals(alpha, d);
+  r.PlusEquals(-alpha, q);
+  double r_dot_r =
+      UpdatePressureAndResidual(alpha, d, q, &pool, &fused_p, &fused_r);
+  for (std::size_t i = 0; i < nx; i++) {
+    for (std::size_t j = 0; j < ny; j++) {
+      for (std::size_t k = 0; k < nz; k++) {
+        assert(fused_p(i, j, k) == p(i, j, k));
+        assert(fused_r(i, j, k) == r(i, j, k));
+      }
+    }
+  }
+  assert(FuzzyEquals(r_dot_r, Dot(r, r)));
+}
+
+// Checks that multiplying by the coefficient arrays of a PressureMatrix, with
+// every instruction set the CPU supports, gives the same A * d as decoding the
+// neighbors bitmask, for direction vectors stored as |T|.
+template <typename T>
+void CheckVectorizedStencil() {
+  // Rows of 19 interior cells exercise both the vector loops and their
+  // scalar remainders.
+  const std::size_t nx = 6, ny = 5, nz = 21;
+  ThreadPool pool(2u);
+
+  Array3D<MaterialType> labels(nx, ny, nz);
+  MakeMixedLabels(&labels);
+  Array3D<unsigned short> neighbors(nx, ny, nz);
+  PressureMatrix<T> matrix(nx, ny, nz);
+  MakeNeighborMaterialInfo(labels, &neighbors, &matrix);
+
+  Array3D<T> d(nx, ny, nz);
+  MakeDirection(&d);
+  Array3D<T> q(nx, ny, nz);
+  q = 0;
+  double d_dot_q = ATimesAndDot(d, neighbors, &pool, &q);
+
+  const SimdInstructionSet kInstructionSets[] = {NO_SIMD, SSE2_SIMD,
+                                                 AVX2_SIMD};
+  for (SimdInstructionSet simd : kInstructionSets) {
+    if (simd > BestSimdInstructionSet()) {
+      continue;
+    }
+
+    Array3D<T> matrix_q(nx, ny, nz);
+    matrix_q = 0;
+    double matrix_d_dot_q = ATimesAndDot(matrix, d, simd, &pool, &matrix_q);
+
+    // The values of |d| are small multiples of 0.25, so every term is exact.
+    for (std::size_t i = 0; i < nx; i++) {
+      for (std::size_t j = 0; j < ny; j++) {
+        for (std::size_t k = 0; k < nz; k++) {
+          assert(matrix_q(i, j, k) == q(i, j, k));
+        }
+      }
+    }
+    assert(FuzzyEquals(matrix_d_dot_q, d_dot_q));
+  }
+}
+
+void TestVectorizedStencil(int argc, char** argv) {
+  CheckVectorizedStencil<double>();
+  CheckVectorizedStencil<float>();
+
+  SimulationParameters params = ReadSimulationParameters(argc, argv);
+  for (bool warm_start : {false, true}) {
+    PressureSolverOptions bitmask;
+    bitmask.preconditioner = MIC0;
+    bitmask.warm_start = warm_start;
+    std::vector<double> bitmask_pressures =
+        ProjectFallingBlock(bitmask, params.dt_seconds());
+
+    PressureSolverOptions vectorized = bitmask;
+    vectorized.vectorized_stencil = true;
+    std::vector<double> vectorized_pressures =
+        ProjectFallingBlock(vectorized, params.dt_seconds());
+
+    // Only the order in which dot products are summed may differ.
+    double max_pressure = 0.0;
+    for (std::size_t n = 0; n < bitmask_pressures.size(); n++) {
+      max_pressure = std::max(max_pressure, std::abs(bitmask_pressures[n]));
+    }
+    for (std::size_t n = 0; n < bitmask_pressures.size(); n++) {
+      assert(std::abs(bitmask_pressures[n] - vectorized_pressures[n]) <
+             1.0e-9 * max_pressure);
+    }
+  }
+}
+
 std::vector<Particle> GridToParticle(int argc, char** argv, double flip_ratio) {
   SimulationParameters params = ReadSimulationParameters(argc, argv);
 
   std::size_t nx = 9, ny = 7, nz = 5;
   Eigen::Vector3d lower_corner(0.0, 0.0, 0.0);
   double dx = 1.0;
-  StaggeredGrid grid(nx, ny, nz, lower_corner, dx);
+  StaggeredGrid<double> grid(nx, ny, nz, lower_corner, dx);
 
   std::vector<Particle> particles;
 
@@ -1170,6 +2510,82 @@ int main(int argc, char** argv) {
   // On a separate grid, test pressure projection.
   TestPressureProjection(argc, argv);
 
+  // On separate grids, test that preconditioning doesn't change pressures.
+  TestPreconditionedPressureProjection(argc, argv);
+
+  // On separate grids, test that threading doesn't change pressures at all.
+  TestMultithreadedPressureProjection(argc, argv);
+
+  // On separate grids, test that threading doesn't change particle-to-grid
+  // transfers at all.
+  TestMultithreadedParticlesToGrid();
+
+  // Test that sorting particles by grid cell is stable and only reorders them.
+  TestParticleSorter();
+
+  // Test that the batched transfers of a ParticleSet match the transfers of
+  // single particles.
+  TestParticleSetTransfers();
+
+  // Test that particle frames read back as they were written, in either
+  // format.
+  TestParticleFrames();
+
+  // Test that emitters fill their regions with the same particles on any
+  // number of threads.
+  TestParticleEmitters();
+
+  // Test that the background frame writer writes every frame as it was when
+  // passed to it.
+  TestFrameWriter();
+
+  // Test that fixed time steps write frames as they always have, and that
+  // adaptive ones land on frame boundaries.
+  TestTimeStepper();
+
+  // Test that higher-order advection schemes are more accurate, and that
+  // substeps split a time step evenly.
+  TestAdvectionSchemes();
+
+  // On separate grids, test that packing the solver vectors over the FLUID
+  // cells doesn't change pressures.
+  TestCompactPressureProjection(argc, argv);
+
+  // On separate grids, test that warm starts save iterations without changing
+  // pressures.
+  TestWarmStartedPressureProjection(argc, argv);
+
+  // On separate grids, test that each pressure solve reports its convergence,
+  // and that the solver stats log records it.
+  TestPressureSolveStats(argc, argv);
+
+  // Test that phase times add up per phase and per step.
+  TestPhaseProfiler();
+
+  // Test that a simulation restored from a checkpoint continues exactly as
+  // the original does.
+  TestCheckpoints(argc, argv);
+
+  // On separate grids, test that relabeling only the cells whose occupancy
+  // changed matches relabeling every cell.
+  TestIncrementalCellLabels();
+
+  // On separate grids, test that sweeping only the grid velocities around the
+  // fluid moves particles exactly as sweeping every grid velocity does.
+  TestActiveRegionSweeps();
+
+  // On separate grids, test that storing grid quantities as float changes
+  // pressures only slightly.
+  TestSinglePrecisionPressureProjection(argc, argv);
+
+  // Test that the fused pressure solver kernels match the separate sweeps.
+  TestFusedPressureKernels();
+
+  // Test that the vectorized coefficient array stencil matches the bitmask
+  // one, on its own and in pressure projection.
+  TestVectorizedStencil(argc, argv);
+  TestContiguousGridArrays(argc, argv);
+
   // On a separate grid, test grid-to-particle velocity transfer.
   // TestGridToParticlePurePic(argc, argv);  // need to change gravity to z
   TestGridToParticlePureFlip(argc, argv);
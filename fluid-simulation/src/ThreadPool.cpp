@@ -0,0 +1,101 @@
+#include "ThreadPool.h"
+
+namespace {
+
+// Returns |num_threads|, or the number of hardware threads if it's zero.
+std::size_t ResolveNumThreads(std::size_t num_threads) {
+  if (num_threads > 0) {
+    return num_threads;
+  }
+  std::size_t hardware_threads = std::thread::hardware_concurrency();
+  return hardware_threads > 0 ? hardware_threads : 1u;
+}
+
+}  // namespace
+
+ThreadPool::ThreadPool(std::size_t num_threads)
+    : num_threads_(ResolveNumThreads(num_threads)),
+      fn_(NULL),
+      begin_(0),
+      end_(0),
+      generation_(0),
+      num_busy_workers_(0),
+      stopping_(false) {
+  for (std::size_t thread_index = 1; thread_index < num_threads_;
+       thread_index++) {
+    workers_.push_back(
+        std::thread(&ThreadPool::WorkerLoop, this, thread_index));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  loop_posted_.notify_all();
+
+  for (std::size_t n = 0; n < workers_.size(); n++) {
+    workers_[n].join();
+  }
+}
+
+void ThreadPool::ParallelFor(
+    std::size_t begin, std::size_t end,
+    const std::function<void(std::size_t, std::size_t)>& fn) {
+  if (workers_.empty()) {
+    fn(begin, end);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fn_ = &fn;
+    begin_ = begin;
+    end_ = end;
+    generation_++;
+    num_busy_workers_ = workers_.size();
+  }
+  loop_posted_.notify_all();
+
+  RunSlab(0);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  loop_finished_.wait(lock, [this] { return num_busy_workers_ == 0; });
+  fn_ = NULL;
+}
+
+void ThreadPool::WorkerLoop(std::size_t thread_index) {
+  std::size_t last_generation = 0;
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      loop_posted_.wait(lock, [this, last_generation] {
+        return stopping_ || generation_ != last_generation;
+      });
+      if (stopping_) {
+        return;
+      }
+      last_generation = generation_;
+    }
+
+    RunSlab(thread_index);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    num_busy_workers_--;
+    if (num_busy_workers_ == 0) {
+      loop_finished_.notify_one();
+    }
+  }
+}
+
+void ThreadPool::RunSlab(std::size_t thread_index) {
+  // |fn_|, |begin_|, and |end_| don't change until every slab is done.
+  std::size_t length = end_ - begin_;
+  std::size_t slab_begin = begin_ + length * thread_index / num_threads_;
+  std::size_t slab_end = begin_ + length * (thread_index + 1) / num_threads_;
+  if (slab_begin < slab_end) {
+    (*fn_)(slab_begin, slab_end);
+  }
+}
@@ -0,0 +1,136 @@
+#include "TimeStepper.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+
+#include "Checkpoint.h"
+
+// To disable assert*() calls, uncomment this line:
+// #define NDEBUG
+
+namespace {
+
+// Fraction of a time step by which the time left in a frame may exceed a whole
+// number of steps and still take that many
+const double kStepTolerance = 1.0e-6;
+
+}  // namespace
+
+TimeStepper::TimeStepper(double fixed_dt, double duration, double dx,
+                         const TimeStepOptions& options, double frame_seconds)
+    : fixed_dt_(fixed_dt),
+      duration_(duration),
+      dx_(dx),
+      options_(options),
+      frame_seconds_(frame_seconds),
+      time_(0.0),
+      dt_(fixed_dt),
+      step_(0),
+      frame_(0),
+      frame_time_(-1.0),
+      next_frame_(1),
+      lands_on_frame_(false),
+      frame_due_(true),
+      frame_start_step_(0) {
+  assert(fixed_dt > 0.0);
+  assert(!adaptive() || (0.0 <= options.min_dt &&
+                         options.min_dt <= options.max_dt &&
+                         options.max_dt > 0.0));
+}
+
+TimeStepper::~TimeStepper() {}
+
+bool TimeStepper::FrameDue() const {
+  if (adaptive()) {
+    return frame_due_;
+  }
+  return frame_time_ < 0.0;
+}
+
+void TimeStepper::FrameWritten() {
+  if (frame_ > 0) {
+    steps_per_frame_[step_ - frame_start_step_]++;
+  }
+  frame_start_step_ = step_;
+  frame_++;
+
+  // Legacy frame spacing, a hair short of a frame so that accumulated round
+  // off never skips one
+  frame_time_ = frame_seconds_ - 0.0001;
+  frame_due_ = false;
+}
+
+void TimeStepper::ChooseStep(double max_speed) {
+  if (!adaptive()) {
+    dt_ = fixed_dt_;
+    return;
+  }
+
+  double dt = options_.max_dt;
+  if (max_speed > 0.0) {
+    dt = std::min(dt, options_.cfl * dx_ / max_speed);
+  }
+  dt = std::max(dt, options_.min_dt);
+
+  // Spread the rest of the frame evenly over as few steps as fit, so the last
+  // one lands exactly on the next frame boundary instead of leaving a sliver
+  // of a step before it. Rounding in the remaining time mustn't add a step.
+  double remaining = next_frame_ * frame_seconds_ - time_;
+  double num_steps = std::max(1.0, std::ceil(remaining / dt - kStepTolerance));
+  lands_on_frame_ = num_steps == 1.0;
+  dt_ = remaining / num_steps;
+}
+
+void TimeStepper::Advance() {
+  frame_time_ -= dt_;
+  step_++;
+  if (!adaptive() || !lands_on_frame_) {
+    time_ += dt_;
+    return;
+  }
+
+  // Frame boundaries are computed from their index, not accumulated, so frame
+  // times don't drift.
+  time_ = next_frame_ * frame_seconds_;
+  next_frame_++;
+  lands_on_frame_ = false;
+  frame_due_ = true;
+}
+
+void TimeStepper::WriteCheckpoint(CheckpointWriter* writer) const {
+  writer->Write(time_);
+  writer->Write(dt_);
+  writer->Write<std::uint64_t>(step_);
+  writer->Write<std::uint64_t>(frame_);
+  writer->Write(frame_time_);
+  writer->Write<std::uint64_t>(next_frame_);
+  writer->Write(lands_on_frame_);
+  writer->Write(frame_due_);
+  writer->Write<std::uint64_t>(frame_start_step_);
+  writer->Write<std::uint64_t>(steps_per_frame_.size());
+  for (const std::pair<const std::size_t, std::size_t>& bin :
+       steps_per_frame_) {
+    writer->Write<std::uint64_t>(bin.first);
+    writer->Write<std::uint64_t>(bin.second);
+  }
+}
+
+void TimeStepper::ReadCheckpoint(CheckpointReader* reader) {
+  time_ = reader->Read<double>();
+  dt_ = reader->Read<double>();
+  step_ = reader->Read<std::uint64_t>();
+  frame_ = reader->Read<std::uint64_t>();
+  frame_time_ = reader->Read<double>();
+  next_frame_ = reader->Read<std::uint64_t>();
+  lands_on_frame_ = reader->Read<bool>();
+  frame_due_ = reader->Read<bool>();
+  frame_start_step_ = reader->Read<std::uint64_t>();
+  steps_per_frame_.clear();
+  std::uint64_t num_bins = reader->Read<std::uint64_t>();
+  for (std::uint64_t bin = 0; bin < num_bins; bin++) {
+    std::size_t num_steps = reader->Read<std::uint64_t>();
+    steps_per_frame_[num_steps] = reader->Read<std::uint64_t>();
+  }
+}